@@ -0,0 +1,135 @@
+// Copyright Alan (AJ) Pryor, Jr. 2017
+// Transcribed from MATLAB code by Colin Ophus
+// Prismatic is distributed under the GNU General Public License (GPL)
+// If you use Prismatic, we kindly ask that you cite the following papers:
+
+// 1. Ophus, C.: A fast image simulation algorithm for scanning
+//    transmission electron microscopy. Advanced Structural and
+//    Chemical Imaging 3(1), 13 (2017)
+
+// 2. Pryor, Jr., A., Ophus, C., and Miao, J.: A Streaming Multi-GPU
+//    Implementation of Image Simulation Algorithms for Scanning
+//	  Transmission Electron Microscopy. arXiv:1706.08563 (2017)
+
+
+#ifndef PRISM_CHECKPOINT_H
+#define PRISM_CHECKPOINT_H
+#include "params.h"
+#include "defines.h"
+#include <string>
+#include <vector>
+#include <set>
+#include <fstream>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+
+namespace Prismatic {
+    // Keeps the progress of a run in files next to the output so that a run restarted with --resume continues from
+    // its last checkpoint. A checkpoint holds the summed outputs of the completed frozen phonons, the potential of
+    // the running one, the compact S-matrix beams and output probes it has finished, and a journal of the 4D blocks it
+    // has stored. Workers only report finished units; a thread of the checkpoint copies them out every
+    // checkpointInterval seconds and then replaces the state file that refers to them, so a run stopped at any
+    // point resumes from the last state file.
+    class Checkpoint {
+    public:
+        enum class Stage { Beams, Probes };
+
+        // reads the state file of an interrupted run if meta.resume is set and the file matches the settings
+        Checkpoint(const Parameters<PRISMATIC_FLOAT_PRECISION> &pars);
+
+        ~Checkpoint();
+
+        // whether the run continues in the output file of the interrupted run instead of recreating it
+        bool continuesOutput() const;
+
+        size_t getCompletedFP() const { return completedFP; };
+
+        // sums of the completed frozen phonons
+        void restoreNet(Parameters<PRISMATIC_FLOAT_PRECISION> &pars);
+
+        // called before the potential of frozen phonon fpNum is computed; an interrupted one gets its potential back
+        void beginFP(Parameters<PRISMATIC_FLOAT_PRECISION> &pars, const size_t fpNum);
+
+        // called once the potential of the running frozen phonon is ready
+        void recordPotential(const Parameters<PRISMATIC_FLOAT_PRECISION> &pars);
+
+        // called once the sums include frozen phonon fpNum and its 4D output is stored
+        void finishFP(const Parameters<PRISMATIC_FLOAT_PRECISION> &pars, const size_t fpNum);
+
+        // units of stage the running frozen phonon already completed; their data is restored into pars
+        std::vector<bool> beginStage(const Stage stage, Parameters<PRISMATIC_FLOAT_PRECISION> &pars);
+
+        // units start to stop of the running stage are done; called by the workers
+        void complete(const size_t start, const size_t stop);
+
+        // write out the units completed since the last checkpoint and detach from the arrays of the stage
+        void endStage();
+
+        // the run is complete
+        void remove();
+
+    private:
+        typedef std::vector<std::pair<size_t, size_t> > rangeList;
+
+        struct stageState
+        {
+            size_t units;
+            size_t unitFloats;
+            rangeList done;
+        };
+
+        std::string getKey(const Parameters<PRISMATIC_FLOAT_PRECISION> &pars) const;
+        std::string getStageFile(const Stage stage) const;
+        bool readState();
+        void writeState();
+        void writeUnits(const rangeList &ranges);
+        void commit();
+        void journalBlock(const std::string &name,
+                          const size_t index,
+                          const hsize_t *offset,
+                          const hsize_t *dims,
+                          const std::vector<PRISMATIC_FLOAT_PRECISION> &data);
+        void replayJournal(Parameters<PRISMATIC_FLOAT_PRECISION> &pars);
+        void run();
+
+        std::string prefix;
+        std::string key;
+        size_t interval;
+
+        // what the state file records
+        size_t completedFP;
+        size_t netSlot;
+        size_t fp;
+        bool potentialSaved;
+        size_t potDims[3];
+        size_t numPlanes;
+        size_t numSlices;
+        PRISMATIC_FLOAT_PRECISION dzPot;
+        size_t netDims[4];
+        size_t dpcDims[4];
+        stageState stages[2];
+        bool resuming;
+
+        // the running stage
+        Stage stage;
+        Parameters<PRISMATIC_FLOAT_PRECISION> *source;
+        rangeList pending;
+        size_t framesPerProbe;
+        std::vector<size_t> frameCount;
+        size_t numXprobes;
+
+        // 4D blocks stored by the running frozen phonon
+        std::ofstream journal;
+        std::set<std::pair<std::string, size_t> > journaled;
+
+        // lock order is writeLock, journalLock, stateLock
+        std::mutex stateLock;
+        std::mutex writeLock;
+        std::mutex journalLock;
+        std::condition_variable wake;
+        bool stopping;
+        std::thread worker;
+    };
+} // namespace Prismatic
+#endif //PRISM_CHECKPOINT_H
@@ -0,0 +1,56 @@
+// Copyright Alan (AJ) Pryor, Jr. 2017
+// Transcribed from MATLAB code by Colin Ophus
+// Prismatic is distributed under the GNU General Public License (GPL)
+// If you use Prismatic, we kindly ask that you cite the following papers:
+
+// 1. Ophus, C.: A fast image simulation algorithm for scanning
+//    transmission electron microscopy. Advanced Structural and
+//    Chemical Imaging 3(1), 13 (2017)
+
+// 2. Pryor, Jr., A., Ophus, C., and Miao, J.: A Streaming Multi-GPU
+//    Implementation of Image Simulation Algorithms for Scanning
+//	  Transmission Electron Microscopy. arXiv:1706.08563 (2017)
+
+#ifndef PRISM_COUNTEDDATACUBE_H
+#define PRISM_COUNTEDDATACUBE_H
+#include "defines.h"
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <utility>
+
+namespace Prismatic {
+    // An electron counted 4D datacube. Each frame handed in is sampled into Poisson counts and kept as a sorted list of
+    // (pixel index, count) events of its probe. Frozen phonons sample their share of the dose and merge into the same
+    // list, which gives the counts of the averaged pattern. Probes own their lists, so threads add frames without locking.
+    class CountedDatacube {
+    public:
+        CountedDatacube(const std::string &_groupPath,
+                        const size_t _numX,
+                        const size_t _numY);
+
+        // frame holds the intensity of each pixel, expected counts are intensity * electrons
+        void addFrame(const size_t ax,
+                      const size_t ay,
+                      const PRISMATIC_FLOAT_PRECISION *frame,
+                      const size_t frameSize,
+                      const PRISMATIC_FLOAT_PRECISION electrons,
+                      const unsigned int seed);
+
+        // events of all probes in scan order (ax slowest), with offsets[p] to offsets[p+1] the events of probe p
+        void getEvents(std::vector<uint64_t> &offsets,
+                       std::vector<uint32_t> &indices,
+                       std::vector<uint32_t> &counts) const;
+
+        const std::string &getGroupPath() const { return groupPath; };
+
+    private:
+        typedef std::vector<std::pair<uint32_t, uint32_t> > eventList;
+
+        std::string groupPath;
+        size_t numX;
+        size_t numY;
+        std::vector<eventList> events;
+    };
+} // namespace Prismatic
+#endif //PRISM_COUNTEDDATACUBE_H
@@ -0,0 +1,132 @@
+// Copyright Alan (AJ) Pryor, Jr. 2017
+// Transcribed from MATLAB code by Colin Ophus
+// Prismatic is distributed under the GNU General Public License (GPL)
+// If you use Prismatic, we kindly ask that you cite the following papers:
+
+// 1. Ophus, C.: A fast image simulation algorithm for scanning
+//    transmission electron microscopy. Advanced Structural and
+//    Chemical Imaging 3(1), 13 (2017)
+
+// 2. Pryor, Jr., A., Ophus, C., and Miao, J.: A Streaming Multi-GPU
+//    Implementation of Image Simulation Algorithms for Scanning
+//	  Transmission Electron Microscopy. arXiv:1706.08563 (2017)
+
+#ifndef PRISM_DATACUBEWRITER_H
+#define PRISM_DATACUBEWRITER_H
+#include "H5Cpp.h"
+#include "defines.h"
+#include "FrameQuantizer.h"
+#include <string>
+#include <vector>
+#include <map>
+#include <set>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <thread>
+#include <exception>
+#include <condition_variable>
+
+namespace Prismatic {
+    // Collects the 4D-STEM frames of one pass over the probes into staging blocks of whole scan rows and writes each
+    // block with a single hyperslab once all of its frames have arrived. Worker threads copy their frames straight
+    // into the staging memory; only a dedicated writer thread touches the file, and the file is flushed once in finish().
+    // When addToFile is set (later frozen phonons) each block is read once and added to the stored sums.
+    // With a shard prefix every block goes to its own shard file instead, which the datacube in the main file
+    // references as a virtual dataset (see setup4DOutput). With a quantizer the blocks are stored as integer levels.
+    // A journal, when set, receives every block as it will be stored, before the file is written (see Checkpoint).
+    class DatacubeWriter {
+    public:
+        // name, block index, offset and dims of a block and its stored values
+        typedef std::function<void(const std::string &, const size_t, const hsize_t *, const hsize_t *,
+                                   const std::vector<PRISMATIC_FLOAT_PRECISION> &)> blockJournal;
+
+        DatacubeWriter(H5::H5File _file,
+                       const size_t _numX,
+                       const size_t _numY,
+                       const bool _addToFile,
+                       const std::string _shardPrefix = "",
+                       const H5::DSetCreatPropList _shardProps = H5::DSetCreatPropList::DEFAULT,
+                       const std::shared_ptr<const FrameQuantizer> _quantizer = nullptr);
+
+        ~DatacubeWriter();
+
+        // frame is mdims[2] x mdims[3] elements of valuesPerElement floats, for the probe at offset[0], offset[1]
+        void push(const std::string &name,
+                  const PRISMATIC_FLOAT_PRECISION *frame,
+                  const hsize_t *mdims,
+                  const hsize_t *offset,
+                  const size_t valuesPerElement,
+                  const PRISMATIC_FLOAT_PRECISION numFP);
+
+        void finish();
+
+        // set before the first frame is pushed
+        void setJournal(const blockJournal &_journal);
+
+        // frames of these (name, block index) pairs are dropped; their blocks are already stored
+        void skipBlocks(const std::set<std::pair<std::string, size_t> > &_skipped);
+
+        // bytes of one stored element: valuesPerElement floats, or one integer level with a quantizer
+        static size_t getElementBytes(const size_t valuesPerElement,
+                                      const FrameQuantizer *quantizer);
+
+        // probes per block along x and y for frames of frameBytes, shared with the virtual dataset layout
+        static void getBlockShape(const size_t numX,
+                                  const size_t numY,
+                                  const size_t frameBytes,
+                                  size_t &blockX,
+                                  size_t &blockY);
+
+        static std::string getShardName(const std::string &shardPrefix,
+                                         const std::string &name,
+                                         const size_t blockIndex);
+
+        // target size of one block as stored; a block always holds at least one frame
+        static size_t targetBlockBytes;
+
+        // serializes the file access of writers that run at the same time, e.g. for concurrent frozen phonons
+        static std::mutex fileLock;
+
+    private:
+        struct stagingBlock {
+            std::string name;
+            size_t index;
+            hsize_t offset[4];
+            hsize_t dims[4];
+            std::vector<PRISMATIC_FLOAT_PRECISION> data;
+            std::atomic<size_t> remaining;
+        };
+
+        std::shared_ptr<stagingBlock> getBlock(const std::string &name,
+                                               const size_t ax,
+                                               const size_t ay,
+                                               const hsize_t *mdims,
+                                               const size_t frameSize);
+        void writeBlock(stagingBlock &block);
+        void run();
+
+        H5::H5File file;
+        size_t numX, numY;
+        size_t blockX, blockY;
+        bool addToFile;
+        bool finished;
+        std::string shardPrefix;
+        H5::DSetCreatPropList shardProps;
+        std::shared_ptr<const FrameQuantizer> quantizer;
+        blockJournal journal;
+        std::set<std::pair<std::string, size_t> > skipped;
+
+        std::mutex blockLock;
+        std::map<std::pair<std::string, size_t>, std::shared_ptr<stagingBlock> > blocks;
+
+        std::mutex queueLock;
+        std::condition_variable queueReady;
+        std::deque<std::shared_ptr<stagingBlock> > ready;
+        std::exception_ptr writerError;
+        std::thread writer;
+    };
+}
+#endif //PRISM_DATACUBEWRITER_H
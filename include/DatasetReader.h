@@ -0,0 +1,75 @@
+// Copyright Alan (AJ) Pryor, Jr. 2017
+// Transcribed from MATLAB code by Colin Ophus
+// Prismatic is distributed under the GNU General Public License (GPL)
+// If you use Prismatic, we kindly ask that you cite the following papers:
+
+// 1. Ophus, C.: A fast image simulation algorithm for scanning
+//    transmission electron microscopy. Advanced Structural and
+//    Chemical Imaging 3(1), 13 (2017)
+
+// 2. Pryor, Jr., A., Ophus, C., and Miao, J.: A Streaming Multi-GPU
+//    Implementation of Image Simulation Algorithms for Scanning
+//	  Transmission Electron Microscopy. arXiv:1706.08563 (2017)
+
+#ifndef PRISM_DATASETREADER_H
+#define PRISM_DATASETREADER_H
+#include "H5Cpp.h"
+#include "defines.h"
+#include <string>
+#include <vector>
+#include <map>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <future>
+#include <complex>
+
+namespace Prismatic {
+    // Opens one dataset of an HDF5 file and hands out parts of it instead of the whole array. read() returns any
+    // hyperslab, e.g. a tile of probes or a window of detector pixels. getSlab() returns a run of entries along the
+    // outermost axis (potential slices, S-matrix beams, scan rows) through a cache of recent slabs, which prefetch()
+    // fills from a background thread. Blocks are laid out in dataset order, like the *_inOrder readers in fileIO.
+    // T is PRISMATIC_FLOAT_PRECISION or std::complex<PRISMATIC_FLOAT_PRECISION>.
+    template <class T>
+    class DatasetReader {
+    public:
+        DatasetReader(const std::string &filename,
+                      const std::string &dataPath,
+                      const size_t _cacheBytes = 256 * 1024 * 1024);
+
+        ~DatasetReader();
+
+        const std::vector<hsize_t> &getDims() const { return dims; };
+
+        // number of outermost entries in a slab that keeps a few slabs within the cache
+        size_t getSlabLength() const;
+
+        void read(const hsize_t *offset, const hsize_t *count, T *buffer);
+
+        std::shared_ptr<const std::vector<T> > getSlab(const size_t first, const size_t num);
+
+        void prefetch(const size_t first, const size_t num);
+
+    private:
+        typedef std::pair<size_t, size_t> slabKey;
+
+        std::shared_ptr<const std::vector<T> > readSlab(const size_t first, const size_t num);
+
+        void cacheSlab(const slabKey &key, std::shared_ptr<const std::vector<T> > slab);
+
+        H5::H5File file;
+        H5::DataSet dataset;
+        H5::DataType memType;
+        std::vector<hsize_t> dims;
+        size_t entrySize;
+        size_t cacheBytes;
+        size_t cachedBytes;
+
+        std::mutex h5Lock; // the serial HDF5 library is not thread safe
+        std::mutex cacheLock;
+        std::map<slabKey, std::shared_ptr<const std::vector<T> > > cache;
+        std::deque<slabKey> cacheOrder;
+        std::map<slabKey, std::shared_future<std::shared_ptr<const std::vector<T> > > > pending;
+    };
+} // namespace Prismatic
+#endif //PRISM_DATASETREADER_H
@@ -0,0 +1,53 @@
+// Copyright Alan (AJ) Pryor, Jr. 2017
+// Transcribed from MATLAB code by Colin Ophus
+// Prismatic is distributed under the GNU General Public License (GPL)
+// If you use Prismatic, we kindly ask that you cite the following papers:
+
+// 1. Ophus, C.: A fast image simulation algorithm for scanning
+//    transmission electron microscopy. Advanced Structural and
+//    Chemical Imaging 3(1), 13 (2017)
+
+// 2. Pryor, Jr., A., Ophus, C., and Miao, J.: A Streaming Multi-GPU
+//    Implementation of Image Simulation Algorithms for Scanning
+//	  Transmission Electron Microscopy. arXiv:1706.08563 (2017)
+
+
+#ifndef PRISM_FPCONVERGENCE_H
+#define PRISM_FPCONVERGENCE_H
+#include "params.h"
+#include "defines.h"
+#include <vector>
+
+namespace Prismatic {
+    // Tracks the running mean and variance of one output over the frozen phonon configurations computed so far and
+    // decides when the standard error of their average is small enough to stop. The error is relative to the mean
+    // over all elements of the output, so dark pixels do not hold the calculation back.
+    class FPConvergence {
+    public:
+        FPConvergence(const Metadata<PRISMATIC_FLOAT_PRECISION> &meta);
+
+        // fold the output of the frozen phonon just computed into the running statistics
+        void add(const Parameters<PRISMATIC_FLOAT_PRECISION> &pars);
+
+        // relative standard error of the mean, infinite until two configurations were added
+        PRISMATIC_FLOAT_PRECISION getError() const;
+
+        size_t getCount() const { return count; };
+
+        bool converged() const;
+
+        // record the number of configurations actually computed in pars and rescale the 4D output written for numFP
+        void finish(Parameters<PRISMATIC_FLOAT_PRECISION> &pars) const;
+
+    private:
+        void sample(const Parameters<PRISMATIC_FLOAT_PRECISION> &pars, std::vector<double> &values) const;
+
+        PRISMATIC_FLOAT_PRECISION target;
+        size_t minFP;
+        ConvergenceOutput output;
+        size_t count;
+        std::vector<double> mean;
+        std::vector<double> m2;
+    };
+} // namespace Prismatic
+#endif //PRISM_FPCONVERGENCE_H
@@ -0,0 +1,72 @@
+// Copyright Alan (AJ) Pryor, Jr. 2017
+// Transcribed from MATLAB code by Colin Ophus
+// Prismatic is distributed under the GNU General Public License (GPL)
+// If you use Prismatic, we kindly ask that you cite the following papers:
+
+// 1. Ophus, C.: A fast image simulation algorithm for scanning
+//    transmission electron microscopy. Advanced Structural and
+//    Chemical Imaging 3(1), 13 (2017)
+
+// 2. Pryor, Jr., A., Ophus, C., and Miao, J.: A Streaming Multi-GPU
+//    Implementation of Image Simulation Algorithms for Scanning
+//	  Transmission Electron Microscopy. arXiv:1706.08563 (2017)
+
+#ifndef PRISM_FRAMEQUANTIZER_H
+#define PRISM_FRAMEQUANTIZER_H
+#include "H5Cpp.h"
+#include "defines.h"
+#include <vector>
+#include <cstdint>
+
+namespace Prismatic {
+    // Stores 4D intensities as 8 or 16 bit levels q with a scale and offset per diffraction pattern, kept in the
+    // (Rx, Ry) datasets "scale" and "offset" next to the datacube.
+    //   linear: I = offset + scale * q, with offset the pattern minimum and scale = (max - min) / L
+    //           |error| <= scale / 2 = (max - min) / (2 L)
+    //   log:    I = exp(offset + scale * q) - floor, with scale = ln((max + floor) / (min + floor)) / L
+    //           |error| <= (exp(scale / 2) - 1) * (I + floor), i.e. a relative error of about scale / 2
+    // where L = 2^bits - 1. Frozen phonons decode the stored levels, add their share and encode again, so the
+    // error of the final pattern is at most numFP times the bound above.
+    class FrameQuantizer {
+    public:
+        FrameQuantizer(const int _bits, const bool _logScale);
+
+        // absolute intensity floor of the log encoding
+        static const PRISMATIC_FLOAT_PRECISION logFloor;
+
+        const H5::PredType &getFileType() const;
+
+        bool isLogScale() const { return logScale; };
+
+        // offset of an all zero pattern, the fill value of the offset dataset
+        PRISMATIC_FLOAT_PRECISION getZeroOffset() const;
+
+        void encode(const PRISMATIC_FLOAT_PRECISION *frame,
+                    const size_t frameSize,
+                    uint16_t *levels,
+                    PRISMATIC_FLOAT_PRECISION &scale,
+                    PRISMATIC_FLOAT_PRECISION &offset) const;
+
+        void decode(const uint16_t *levels,
+                    const size_t frameSize,
+                    const PRISMATIC_FLOAT_PRECISION scale,
+                    const PRISMATIC_FLOAT_PRECISION offset,
+                    PRISMATIC_FLOAT_PRECISION *frame) const;
+
+        // add a block of dims[0] x dims[1] frames to the datacube; dataset and fspace select the block in the file
+        // holding the levels, group holds the scale and offset datasets, indexed by the probe offset of the block
+        void writeFrames(H5::Group &group,
+                         H5::DataSet &dataset,
+                         H5::DataSpace &fspace,
+                         const hsize_t *dims,
+                         const hsize_t *offset,
+                         std::vector<PRISMATIC_FLOAT_PRECISION> &frames,
+                         const bool addToStored) const;
+
+    private:
+        int bits;
+        bool logScale;
+        PRISMATIC_FLOAT_PRECISION maxLevel;
+    };
+} // namespace Prismatic
+#endif //PRISM_FRAMEQUANTIZER_H
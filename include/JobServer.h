@@ -0,0 +1,51 @@
+// Copyright Alan (AJ) Pryor, Jr. 2017
+// Transcribed from MATLAB code by Colin Ophus
+// Prismatic is distributed under the GNU General Public License (GPL)
+// If you use Prismatic, we kindly ask that you cite the following papers:
+
+// 1. Ophus, C.: A fast image simulation algorithm for scanning
+//    transmission electron microscopy. Advanced Structural and
+//    Chemical Imaging 3(1), 13 (2017)
+
+// 2. Pryor, Jr., A., Ophus, C., and Miao, J.: A Streaming Multi-GPU
+//    Implementation of Image Simulation Algorithms for Scanning
+//	  Transmission Electron Microscopy. arXiv:1706.08563 (2017)
+
+#ifndef PRISM_JOBSERVER_H
+#define PRISM_JOBSERVER_H
+#include "params.h"
+#include "defines.h"
+#include <string>
+#include <vector>
+#include <functional>
+
+namespace Prismatic {
+    // Runs simulation jobs back to back in one long-lived process, so the state kept between simulations (the
+    // simulation plan, FFTW wisdom, the Kirkland tables and the last atoms file read) stays warm across jobs. Jobs are
+    // read one per line from stdin or from the clients of a UNIX socket, and every job is answered with one line:
+    // "ok <job> <output file> <seconds>" or "error <job> <message>".
+    class JobServer {
+    public:
+        // the options of defaults apply to every job before its own
+        JobServer(const Metadata<PRISMATIC_FLOAT_PRECISION> &_defaults);
+
+        void run();
+
+    private:
+        // answer the jobs of one client until it closes; false once it asks the server to stop
+        bool serve(const std::function<bool(std::string &)> &readLine,
+                   const std::function<void(const std::string &)> &reply);
+
+        std::string runJob(const std::string &line);
+
+        // settings of a job given as a parameter file, a JSON object of options or command line options
+        bool parseJob(const std::string &line, Metadata<PRISMATIC_FLOAT_PRECISION> &meta, std::string &error);
+
+        void listen(const std::string &socketPath);
+
+        Metadata<PRISMATIC_FLOAT_PRECISION> defaults;
+        std::string source;
+        size_t numJobs;
+    };
+} // namespace Prismatic
+#endif //PRISM_JOBSERVER_H
@@ -0,0 +1,43 @@
+// Copyright Alan (AJ) Pryor, Jr. 2017
+// Transcribed from MATLAB code by Colin Ophus
+// Prismatic is distributed under the GNU General Public License (GPL)
+// If you use Prismatic, we kindly ask that you cite the following papers:
+
+// 1. Ophus, C.: A fast image simulation algorithm for scanning
+//    transmission electron microscopy. Advanced Structural and
+//    Chemical Imaging 3(1), 13 (2017)
+
+// 2. Pryor, Jr., A., Ophus, C., and Miao, J.: A Streaming Multi-GPU
+//    Implementation of Image Simulation Algorithms for Scanning
+//	  Transmission Electron Microscopy. arXiv:1706.08563 (2017)
+
+#ifndef PRISM_MPICOMM_H
+#define PRISM_MPICOMM_H
+#include "params.h"
+#include "defines.h"
+
+#ifdef PRISMATIC_ENABLE_MPI
+namespace Prismatic {
+    // Helpers of MPI builds. Ranks share the work of one simulation: rank 0 computes the potential, the S-matrix
+    // beams are split among all ranks and gathered, and the probe scan is split into one tile per rank.
+    int getMPIRank();
+
+    int getMPISize();
+
+    // copy the potential computed on rank 0 to every other rank
+    void broadcastPotential(Parameters<PRISMATIC_FLOAT_PRECISION> &pars);
+
+    // range of S-matrix beams this rank computes
+    std::pair<size_t, size_t> getRankBeams(const Parameters<PRISMATIC_FLOAT_PRECISION> &pars);
+
+    // collect the beams every rank computed into Scompact on all ranks
+    void gatherBeams(Parameters<PRISMATIC_FLOAT_PRECISION> &pars);
+
+    // wait for all ranks
+    void barrier();
+
+    // stop all ranks after an error on one of them, which would otherwise leave the rest waiting in a collective call
+    void abortRanks(const std::string &message);
+} // namespace Prismatic
+#endif //PRISMATIC_ENABLE_MPI
+#endif //PRISM_MPICOMM_H
@@ -42,17 +42,15 @@ void createStack(Parameters<PRISMATIC_FLOAT_PRECISION> &pars);
 
 void formatOutput_CPU_integrate(Parameters<PRISMATIC_FLOAT_PRECISION> &pars,
 								Array2D<complex<PRISMATIC_FLOAT_PRECISION>> &psi,
-								const Array2D<PRISMATIC_FLOAT_PRECISION> &alphaInd,
 								const size_t currentSlice,
 								const size_t ay,
 								const size_t ax);
 
 void formatOutput_CPU_integrate_batch(Parameters<PRISMATIC_FLOAT_PRECISION> &pars,
 									  Array1D<complex<PRISMATIC_FLOAT_PRECISION>> &psi_stack,
-									  const Array2D<PRISMATIC_FLOAT_PRECISION> &alphaInd,
-									  const size_t currentSlice,
-									  const size_t ay,
-									  const size_t ax);
+									  size_t Nstart,
+									  const size_t Nstop,
+									  const size_t currentSlice);
 
 std::pair<Prismatic::Array2D<std::complex<PRISMATIC_FLOAT_PRECISION>>, Prismatic::Array2D<std::complex<PRISMATIC_FLOAT_PRECISION>>>
 getSingleMultisliceProbe_CPU(Parameters<PRISMATIC_FLOAT_PRECISION> &pars, const PRISMATIC_FLOAT_PRECISION xp, const PRISMATIC_FLOAT_PRECISION yp);
@@ -52,5 +52,7 @@ namespace Prismatic {
 
 	void apply_aberrations(Parameters<PRISMATIC_FLOAT_PRECISION> &pars);
 
+	void compressSMatrix(Parameters<PRISMATIC_FLOAT_PRECISION> &pars);
+
 }
 #endif //PRISMATIC_PRISM02_H
@@ -20,6 +20,7 @@
 #include <thread>
 #include <mutex>
 #include <numeric>
+#include <vector>
 #include "fftw3.h"
 #include "utility.h"
 
@@ -36,6 +37,39 @@ void createStack_integrate(Parameters<PRISMATIC_FLOAT_PRECISION> &pars);
 void setupFourierCoordinates(Parameters<PRISMATIC_FLOAT_PRECISION> &pars);
 void transformIndices(Parameters<PRISMATIC_FLOAT_PRECISION> &pars);
 void initializeProbes(Parameters<PRISMATIC_FLOAT_PRECISION> &pars);
+void getProbeWindow(Parameters<PRISMATIC_FLOAT_PRECISION> &pars,
+					const PRISMATIC_FLOAT_PRECISION xp,
+					const PRISMATIC_FLOAT_PRECISION yp,
+					Array1D<PRISMATIC_FLOAT_PRECISION> &x,
+					Array1D<PRISMATIC_FLOAT_PRECISION> &y);
+size_t getNumSMatrixPlanes(Parameters<PRISMATIC_FLOAT_PRECISION> &pars);
+void getProbeWeights_CPU(Parameters<PRISMATIC_FLOAT_PRECISION> &pars,
+						 const PRISMATIC_FLOAT_PRECISION xp,
+						 const PRISMATIC_FLOAT_PRECISION yp,
+						 std::complex<PRISMATIC_FLOAT_PRECISION> *weights);
+void getProbeWeights_CPU(Parameters<PRISMATIC_FLOAT_PRECISION> &pars,
+						 const Array2D<std::complex<PRISMATIC_FLOAT_PRECISION>> &psiProbeInit,
+						 const PRISMATIC_FLOAT_PRECISION xTiltShift,
+						 const PRISMATIC_FLOAT_PRECISION yTiltShift,
+						 const PRISMATIC_FLOAT_PRECISION xp,
+						 const PRISMATIC_FLOAT_PRECISION yp,
+						 std::complex<PRISMATIC_FLOAT_PRECISION> *weights);
+void synthesizeProbe_CPU(Parameters<PRISMATIC_FLOAT_PRECISION> &pars,
+						 const std::complex<PRISMATIC_FLOAT_PRECISION> *weights,
+						 const Array1D<PRISMATIC_FLOAT_PRECISION> &x,
+						 const Array1D<PRISMATIC_FLOAT_PRECISION> &y,
+						 std::complex<PRISMATIC_FLOAT_PRECISION> *psi);
+std::complex<PRISMATIC_FLOAT_PRECISION> complexDot_CPU(const std::complex<PRISMATIC_FLOAT_PRECISION> *a,
+													   const std::complex<PRISMATIC_FLOAT_PRECISION> *b,
+													   const size_t N);
+void complexGemm_CPU(const std::complex<PRISMATIC_FLOAT_PRECISION> *A,
+					 const std::complex<PRISMATIC_FLOAT_PRECISION> *B,
+					 std::complex<PRISMATIC_FLOAT_PRECISION> *C,
+					 const size_t M, const size_t N, const size_t K);
+void setSMatrixLayout_CPU(Parameters<PRISMATIC_FLOAT_PRECISION> &pars, const bool pixelMajor);
+bool preferPixelMajor_CPU(const size_t numPlanes, const size_t activePlanes, const size_t windowPixels);
+void chooseSMatrixLayout_CPU(Parameters<PRISMATIC_FLOAT_PRECISION> &pars);
+void setSMatrixHalo_CPU(Parameters<PRISMATIC_FLOAT_PRECISION> &pars, const bool halo);
 std::pair<Prismatic::Array2D<std::complex<PRISMATIC_FLOAT_PRECISION>>, Prismatic::Array2D<std::complex<PRISMATIC_FLOAT_PRECISION>>>
 getSinglePRISMProbe_CPU(Parameters<PRISMATIC_FLOAT_PRECISION> &pars, const PRISMATIC_FLOAT_PRECISION xp, const PRISMATIC_FLOAT_PRECISION yp);
 void buildSignal_CPU(Parameters<PRISMATIC_FLOAT_PRECISION> &pars,
@@ -43,9 +77,43 @@ void buildSignal_CPU(Parameters<PRISMATIC_FLOAT_PRECISION> &pars,
 					 const size_t &ax,
 					 PRISMATIC_FFTW_PLAN &plan,
 					 Array2D<std::complex<PRISMATIC_FLOAT_PRECISION>> &psi);
+void buildSignal_CPU_batch(Parameters<PRISMATIC_FLOAT_PRECISION> &pars,
+						   const std::vector<size_t> &probes,
+						   PRISMATIC_FFTW_PLAN &plan,
+						   Array1D<std::complex<PRISMATIC_FLOAT_PRECISION>> &psi_stack);
+void buildSeriesSignal_CPU_batch(Parameters<PRISMATIC_FLOAT_PRECISION> &pars,
+								 const std::vector<size_t> &probes,
+								 PRISMATIC_FFTW_PLAN &plan,
+								 Array1D<std::complex<PRISMATIC_FLOAT_PRECISION>> &psi_stack);
+std::pair<long, long> getProbeWindowKey(Parameters<PRISMATIC_FLOAT_PRECISION> &pars, const size_t n);
+void synthesizeProbeGroup_CPU(Parameters<PRISMATIC_FLOAT_PRECISION> &pars,
+							  const std::vector<size_t> &probes,
+							  std::complex<PRISMATIC_FLOAT_PRECISION> *psi_group);
+void synthesizeWindow_CPU(Parameters<PRISMATIC_FLOAT_PRECISION> &pars,
+						  const std::complex<PRISMATIC_FLOAT_PRECISION> *weights,
+						  const size_t numWaves,
+						  const Array1D<PRISMATIC_FLOAT_PRECISION> &x,
+						  const Array1D<PRISMATIC_FLOAT_PRECISION> &y,
+						  std::complex<PRISMATIC_FLOAT_PRECISION> *psi_group);
+void formatPRISMOutput_CPU(Parameters<PRISMATIC_FLOAT_PRECISION> &pars,
+						   const size_t &ay,
+						   const size_t &ax,
+						   const std::complex<PRISMATIC_FLOAT_PRECISION> *psi);
+void formatPRISMOutput_CPU(Parameters<PRISMATIC_FLOAT_PRECISION> &pars,
+						   const size_t &ay,
+						   const size_t &ax,
+						   const std::complex<PRISMATIC_FLOAT_PRECISION> *psi,
+						   const detectorMap &detMap,
+						   Array4D<PRISMATIC_FLOAT_PRECISION> &output,
+						   Array4D<PRISMATIC_FLOAT_PRECISION> &DPC_CoM,
+						   const std::string &tag);
 
 void buildPRISMOutput_CPUOnly(Parameters<PRISMATIC_FLOAT_PRECISION> &pars);
 
+void setupPRISMOutput(Parameters<PRISMATIC_FLOAT_PRECISION> &pars);
+
 void PRISM03_calcOutput(Parameters<PRISMATIC_FLOAT_PRECISION> &pars);
+
+void PRISM03_calcSeries(Parameters<PRISMATIC_FLOAT_PRECISION> &pars);
 } // namespace Prismatic
 #endif //PRISMATIC_PRISM03_H
@@ -0,0 +1,47 @@
+// Copyright Alan (AJ) Pryor, Jr. 2017
+// Transcribed from MATLAB code by Colin Ophus
+// Prismatic is distributed under the GNU General Public License (GPL)
+// If you use Prismatic, we kindly ask that you cite the following papers:
+
+// 1. Ophus, C.: A fast image simulation algorithm for scanning
+//    transmission electron microscopy. Advanced Structural and
+//    Chemical Imaging 3(1), 13 (2017)
+
+// 2. Pryor, Jr., A., Ophus, C., and Miao, J.: A Streaming Multi-GPU
+//    Implementation of Image Simulation Algorithms for Scanning
+//	  Transmission Electron Microscopy. arXiv:1706.08563 (2017)
+
+#ifndef PRISM_POTENTIALPIPELINE_H
+#define PRISM_POTENTIALPIPELINE_H
+#include "params.h"
+#include "defines.h"
+#include <thread>
+#include <exception>
+
+namespace Prismatic {
+    // Computes the projected potential of the next frozen phonon on a few threads of its own while the S-matrix and
+    // output stages of the current one run. Only one potential is staged at a time, so together with the potential
+    // in use at most two are held in memory.
+    class PotentialPipeline {
+    public:
+        PotentialPipeline(const size_t _numThreads);
+
+        ~PotentialPipeline();
+
+        size_t getNumThreads() const { return numThreads; };
+
+        // start the potential of frozen phonon fpNum from the atoms and grid of pars, with a fresh random seed
+        void start(const Parameters<PRISMATIC_FLOAT_PRECISION> &pars, const size_t fpNum);
+
+        // wait for the potential of frozen phonon fpNum and hand it to pars; false if it was not started
+        bool finish(Parameters<PRISMATIC_FLOAT_PRECISION> &pars, const size_t fpNum);
+
+    private:
+        size_t numThreads;
+        size_t stagedFP;
+        Parameters<PRISMATIC_FLOAT_PRECISION> stage;
+        std::exception_ptr error;
+        std::thread worker;
+    };
+} // namespace Prismatic
+#endif //PRISM_POTENTIALPIPELINE_H
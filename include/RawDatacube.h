@@ -0,0 +1,62 @@
+// Copyright Alan (AJ) Pryor, Jr. 2017
+// Transcribed from MATLAB code by Colin Ophus
+// Prismatic is distributed under the GNU General Public License (GPL)
+// If you use Prismatic, we kindly ask that you cite the following papers:
+
+// 1. Ophus, C.: A fast image simulation algorithm for scanning
+//    transmission electron microscopy. Advanced Structural and
+//    Chemical Imaging 3(1), 13 (2017)
+
+// 2. Pryor, Jr., A., Ophus, C., and Miao, J.: A Streaming Multi-GPU
+//    Implementation of Image Simulation Algorithms for Scanning
+//	  Transmission Electron Microscopy. arXiv:1706.08563 (2017)
+
+#ifndef PRISM_RAWDATACUBE_H
+#define PRISM_RAWDATACUBE_H
+#include "defines.h"
+#include <string>
+#include <vector>
+
+namespace Prismatic {
+    // A 4D datacube kept in a memory-mapped .npy file (format version 1.0, C order, little endian) instead of an
+    // HDF5 dataset. The file is created zero filled, and the frame of each probe is a fixed region of the mapping,
+    // so threads add their frames straight into it without any locking.
+    class RawDatacube {
+    public:
+        RawDatacube(const std::string &_filename,
+                    const std::vector<size_t> &_shape,
+                    const bool _complex);
+
+        ~RawDatacube();
+
+        // first value of the frame of probe (ax, ay); complex frames interleave real and imaginary parts
+        PRISMATIC_FLOAT_PRECISION *getFrame(const size_t ax, const size_t ay);
+
+        const std::string &getFilename() const { return filename; };
+
+        const std::vector<size_t> &getShape() const { return shape; };
+
+        // numpy type string of the elements, e.g. <f4 or <c8
+        std::string getDescr() const;
+
+        void flush();
+
+    private:
+        RawDatacube(const RawDatacube &);
+        RawDatacube &operator=(const RawDatacube &);
+
+        std::string filename;
+        std::vector<size_t> shape;
+        bool complex;
+        size_t headerBytes;
+        size_t fileBytes;
+        char *mapping;
+#ifdef _WIN32
+        void *fileHandle;
+        void *mapHandle;
+#else
+        int fileDescriptor;
+#endif //_WIN32
+    };
+} // namespace Prismatic
+#endif //PRISM_RAWDATACUBE_H
@@ -0,0 +1,68 @@
+// Copyright Alan (AJ) Pryor, Jr. 2017
+// Transcribed from MATLAB code by Colin Ophus
+// Prismatic is distributed under the GNU General Public License (GPL)
+// If you use Prismatic, we kindly ask that you cite the following papers:
+
+// 1. Ophus, C.: A fast image simulation algorithm for scanning
+//    transmission electron microscopy. Advanced Structural and
+//    Chemical Imaging 3(1), 13 (2017)
+
+// 2. Pryor, Jr., A., Ophus, C., and Miao, J.: A Streaming Multi-GPU
+//    Implementation of Image Simulation Algorithms for Scanning
+//	  Transmission Electron Microscopy. arXiv:1706.08563 (2017)
+
+
+#ifndef PRISM_SCANTILER_H
+#define PRISM_SCANTILER_H
+#include "params.h"
+#include "defines.h"
+#include "H5Cpp.h"
+#include <string>
+#include <vector>
+
+namespace Prismatic {
+    // Splits the probe scan into bands of scan rows (ranges of the probe list for arbitrary probes) and computes each
+    // band in a local worker process of its own. The potential, or for PRISM the compact S-matrix, of every frozen
+    // phonon is computed once by the launcher into a shared file that the workers import. Once all workers are done,
+    // their outputs are merged into one output file laid out as if the whole scan ran in one process. In MPI builds
+    // the tiles can be the ranks of an MPI run instead: rank 0 computes the potentials, the S-matrix beams are split
+    // among all ranks, every rank computes one tile and rank 0 merges them.
+    class ScanTiler {
+    public:
+        ScanTiler(const Metadata<PRISMATIC_FLOAT_PRECISION> &_meta, const bool _mpiRanks = false);
+
+        void run();
+
+    private:
+        // compute the potentials or S-matrices the workers import
+        void writeSharedFile();
+
+        // fork one worker per tile and wait for all of them
+        void runWorkers();
+
+        // settings of the worker computing tile
+        Metadata<PRISMATIC_FLOAT_PRECISION> getTileMeta(const size_t tile) const;
+
+        void merge();
+
+        void removeTemporaryFiles();
+
+        std::string getTileFile(const size_t tile) const;
+
+        // concatenate the scan dependent data of a group of the tile files along the tiled axis
+        void mergeGroup(std::vector<H5::H5File> &tiles, H5::Group &target, const std::string &path);
+
+        // concatenate dataset name of the group at path of every tile file along axis into target
+        void concatenate(std::vector<H5::H5File> &tiles, H5::Group &target, const std::string &path,
+                         const std::string &name, const int axis);
+
+        Metadata<PRISMATIC_FLOAT_PRECISION> meta;
+        size_t numTiles;
+        size_t numFP;
+        std::string sharedFile;
+        bool useSharedFile;
+        bool mpiRanks;
+        int rank;
+    };
+} // namespace Prismatic
+#endif //PRISM_SCANTILER_H
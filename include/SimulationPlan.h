@@ -0,0 +1,96 @@
+// Copyright Alan (AJ) Pryor, Jr. 2017
+// Transcribed from MATLAB code by Colin Ophus
+// Prismatic is distributed under the GNU General Public License (GPL)
+// If you use Prismatic, we kindly ask that you cite the following papers:
+
+// 1. Ophus, C.: A fast image simulation algorithm for scanning
+//    transmission electron microscopy. Advanced Structural and
+//    Chemical Imaging 3(1), 13 (2017)
+
+// 2. Pryor, Jr., A., Ophus, C., and Miao, J.: A Streaming Multi-GPU
+//    Implementation of Image Simulation Algorithms for Scanning
+//	  Transmission Electron Microscopy. arXiv:1706.08563 (2017)
+
+#ifndef PRISM_SIMULATIONPLAN_H
+#define PRISM_SIMULATIONPLAN_H
+#include "params.h"
+#include "defines.h"
+#include <string>
+#include <sstream>
+#include <vector>
+#include <map>
+#include <mutex>
+#include <cstdint>
+
+namespace Prismatic {
+    // Keeps the geometry derived state of the setup stages (probe positions, Fourier coordinates, masks, propagators,
+    // detector maps and initial probes) together with a key of everything the stage read to derive it. A stage whose
+    // key matches copies its state from the plan instead of recomputing it, so frozen phonons, series steps and
+    // repeated calls in one process pay for each setup once. The plan is process wide and keeps one entry per stage.
+    class SimulationPlan {
+    public:
+        // builds a stage key from settings and array contents; arrays enter through a hash of their bytes
+        class Key {
+        public:
+            Key();
+
+            template <class T>
+            Key &operator<<(const T &val)
+            {
+                key << val << ' ';
+                return *this;
+            };
+
+            template <class T>
+            Key &operator<<(const std::vector<T> &vals)
+            {
+                key << vals.size() << '[';
+                for (auto &v : vals)
+                    *this << v;
+                key << "] ";
+                return *this;
+            };
+
+            template <size_t N, class T>
+            Key &operator<<(const ArrayND<N, T> &arr)
+            {
+                for (auto d : arr.get_dimarr())
+                    key << d << 'x';
+                if (arr.size() > 0)
+                    addHash(&*arr.begin(), arr.size() * sizeof(*arr.begin()));
+                key << ' ';
+                return *this;
+            };
+
+            Key &operator<<(const aberration &ab);
+
+            Key &operator<<(const detector &det);
+
+            std::string str() const { return key.str(); };
+
+        private:
+            void addHash(const void *data, const size_t bytes);
+
+            std::stringstream key;
+        };
+
+        typedef void (*stateCopy)(const Parameters<PRISMATIC_FLOAT_PRECISION> &from, Parameters<PRISMATIC_FLOAT_PRECISION> &to);
+
+        static SimulationPlan &getPlan();
+
+        // copy the planned state of stage into pars if it was stored with the same key
+        bool restore(const std::string &stage, const std::string &key, stateCopy copy, Parameters<PRISMATIC_FLOAT_PRECISION> &pars);
+
+        // keep the state of stage computed in pars, replacing what the stage held before
+        void store(const std::string &stage, const std::string &key, stateCopy copy, const Parameters<PRISMATIC_FLOAT_PRECISION> &pars);
+
+        void clear();
+
+    private:
+        SimulationPlan(){};
+
+        std::mutex planLock;
+        std::map<std::string, std::pair<std::string, Parameters<PRISMATIC_FLOAT_PRECISION> > > stages;
+    };
+} // namespace Prismatic
+#endif //PRISM_SIMULATIONPLAN_H
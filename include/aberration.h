@@ -17,6 +17,9 @@
 #include <vector>
 #include <array>
 #include <iostream>
+#include <list>
+#include <map>
+#include <mutex>
 #include "ArrayND.h"
 #include "defines.h"
 
@@ -49,6 +52,52 @@ using Array2D = Prismatic::ArrayND<2, std::vector<T> >;
 
 std::vector<aberration> readAberrations(const std::string &filename);
 
+// Evaluates the aberration function chi on a grid from per-pixel bases (lambda*q)^m, cos(n*theta) and sin(n*theta)
+// that are built once per grid with recurrences. The last chi of each grid is kept with the coefficients it was
+// built from, so a call that changes only a few coefficients, such as a defocus step of a series, adds the change of
+// those terms instead of summing every term again. The engine is process wide; it keeps the most recent grids within
+// a memory budget, and go() clears it when a run ends.
+class ChiEngine
+{
+public:
+    static ChiEngine &getEngine();
+
+    Array2D<std::complex<PRISMATIC_FLOAT_PRECISION>> getChi(const Array2D<PRISMATIC_FLOAT_PRECISION> &q,
+                                                            const Array2D<PRISMATIC_FLOAT_PRECISION> &qTheta,
+                                                            const PRISMATIC_FLOAT_PRECISION lambda,
+                                                            const std::vector<aberration> &ab);
+
+    void clear();
+
+private:
+    // coefficients of cos(n*theta) and sin(n*theta) for the term (m, n)
+    typedef std::map<std::pair<int, int>, std::pair<PRISMATIC_FLOAT_PRECISION, PRISMATIC_FLOAT_PRECISION> > termMap;
+
+    struct gridState
+    {
+        std::string key;
+        PRISMATIC_FLOAT_PRECISION lambda;
+        std::vector<PRISMATIC_FLOAT_PRECISION> lambdaQ;
+        std::vector<PRISMATIC_FLOAT_PRECISION> theta;
+        std::vector<std::vector<PRISMATIC_FLOAT_PRECISION> > radial;
+        std::vector<std::vector<PRISMATIC_FLOAT_PRECISION> > cosine;
+        std::vector<std::vector<PRISMATIC_FLOAT_PRECISION> > sine;
+        std::vector<PRISMATIC_FLOAT_PRECISION> chi;
+        termMap terms;
+    };
+
+    ChiEngine(){};
+
+    static termMap getTerms(const std::vector<aberration> &ab);
+
+    static size_t getBytes(const gridState &grid);
+
+    static void addTerm(gridState &grid, const int m, const int n, const PRISMATIC_FLOAT_PRECISION cx, const PRISMATIC_FLOAT_PRECISION cy);
+
+    std::mutex engineLock;
+    std::list<gridState> grids;
+};
+
 Array2D<std::complex<PRISMATIC_FLOAT_PRECISION>> getChi(Array2D<PRISMATIC_FLOAT_PRECISION> &q,
                                                         Array2D<PRISMATIC_FLOAT_PRECISION> &qTheta,
                                                         PRISMATIC_FLOAT_PRECISION &lambda, 
@@ -41,7 +41,6 @@ namespace Prismatic {
 
 	using format_output_func = void (*)( Parameters<PRISMATIC_FLOAT_PRECISION>&,
 	                                     Array2D< std::complex<PRISMATIC_FLOAT_PRECISION> >&,
-	                                     const Array2D<PRISMATIC_FLOAT_PRECISION>&,
 										 const size_t,
 	                                     const size_t,
 	                                     const size_t);
@@ -0,0 +1,90 @@
+// Copyright Alan (AJ) Pryor, Jr. 2017
+// Transcribed from MATLAB code by Colin Ophus
+// Prismatic is distributed under the GNU General Public License (GPL)
+// If you use Prismatic, we kindly ask that you cite the following papers:
+
+// 1. Ophus, C.: A fast image simulation algorithm for scanning
+//    transmission electron microscopy. Advanced Structural and
+//    Chemical Imaging 3(1), 13 (2017)
+
+// 2. Pryor, Jr., A., Ophus, C., and Miao, J.: A Streaming Multi-GPU
+//    Implementation of Image Simulation Algorithms for Scanning
+//	  Transmission Electron Microscopy. arXiv:1706.08563 (2017)
+
+#ifndef PRISM_DETECTOR_H
+#define PRISM_DETECTOR_H
+#include <string>
+#include <vector>
+#include <complex>
+#include <iostream>
+#include "ArrayND.h"
+#include "defines.h"
+
+// user-defined virtual detector: an annulus between two scattering angles, optionally restricted to an
+// azimuthal segment. Angles are stored in radians; a full annulus has minPhi = 0 and maxPhi = 2 pi
+struct detector
+{
+    PRISMATIC_FLOAT_PRECISION innerAngle;
+    PRISMATIC_FLOAT_PRECISION outerAngle;
+    PRISMATIC_FLOAT_PRECISION minPhi;
+    PRISMATIC_FLOAT_PRECISION maxPhi;
+    void to_string() const
+    {
+        std::cout << "innerAngle = " << innerAngle * 1000 << " mrad" << std::endl;
+        std::cout << "outerAngle = " << outerAngle * 1000 << " mrad" << std::endl;
+        std::cout << "minPhi = " << minPhi << std::endl;
+        std::cout << "maxPhi = " << maxPhi << std::endl;
+    };
+
+    bool operator==(const detector &d) const
+    {
+        return (innerAngle == d.innerAngle) && (outerAngle == d.outerAngle) && (minPhi == d.minPhi) && (maxPhi == d.maxPhi);
+    };
+};
+
+namespace Prismatic
+{
+
+template <class T>
+using Array2D = Prismatic::ArrayND<2, std::vector<T> >;
+
+// Every integrated output of a probe (annular bins, user detectors, and the DPC centre of mass sums) compiled into
+// one sparse pixel -> bin map in compressed-row form. Pixel pixels[p] adds weights[e] * |psi|^2 to bins[e] for
+// e in [rowStart[p], rowStart[p+1]). Bins are ordered [annular | user detectors | DPC qx, qy, total]
+struct detectorMap
+{
+    std::vector<size_t> pixels;
+    std::vector<size_t> rowStart;
+    std::vector<size_t> bins;
+    std::vector<PRISMATIC_FLOAT_PRECISION> weights;
+    size_t numAnnular = 0;
+    size_t numCustom = 0;
+    bool DPC = false;
+
+    size_t numBins() const { return numAnnular + numCustom + (DPC ? 3 : 0); };
+    size_t numStored() const { return numAnnular + numCustom; }; // bins that are written to the output stack
+};
+
+std::vector<detector> readDetectors(const std::string &filename);
+
+detectorMap buildDetectorMap(const Array2D<PRISMATIC_FLOAT_PRECISION> &alphaInd,
+                             const size_t Ndet,
+                             const Array2D<PRISMATIC_FLOAT_PRECISION> &alpha,
+                             const Array2D<PRISMATIC_FLOAT_PRECISION> &phi,
+                             const Array2D<PRISMATIC_FLOAT_PRECISION> &qx,
+                             const Array2D<PRISMATIC_FLOAT_PRECISION> &qy,
+                             const std::vector<detector> &detectors,
+                             const bool DPC);
+
+void integrateDetectors(const detectorMap &map,
+                        const std::complex<PRISMATIC_FLOAT_PRECISION> *psi,
+                        const PRISMATIC_FLOAT_PRECISION scale,
+                        PRISMATIC_FLOAT_PRECISION *binValues);
+
+void storeDetectorBins(const detectorMap &map,
+                       const PRISMATIC_FLOAT_PRECISION *binValues,
+                       PRISMATIC_FLOAT_PRECISION *output,
+                       PRISMATIC_FLOAT_PRECISION *DPC_CoM);
+
+} // namespace Prismatic
+#endif //PRISM_DETECTOR_H
@@ -29,6 +29,8 @@ void setup4DOutput(Parameters<PRISMATIC_FLOAT_PRECISION> &pars);
 
 void setupVDOutput(Parameters<PRISMATIC_FLOAT_PRECISION> &pars);
 
+void setupCustomDetectorOutput(Parameters<PRISMATIC_FLOAT_PRECISION> &pars);
+
 void setup2DOutput(Parameters<PRISMATIC_FLOAT_PRECISION> &pars);
 
 void setupDPCOutput(Parameters<PRISMATIC_FLOAT_PRECISION> &pars);
@@ -43,6 +45,14 @@ void sortHRTEMbeams(Parameters<PRISMATIC_FLOAT_PRECISION> &pars);
 
 void setupProbeOutput(Parameters<PRISMATIC_FLOAT_PRECISION> &pars);
 
+std::shared_ptr<FrameQuantizer> getQuantizer(Parameters<PRISMATIC_FLOAT_PRECISION> &pars);
+
+H5::DSetCreatPropList getOutputPropList(Parameters<PRISMATIC_FLOAT_PRECISION> &pars,
+                                        const int rank,
+                                        const hsize_t *dims,
+                                        const size_t elementBytes,
+                                        const hsize_t *chunkDims = NULL);
+
 void writeRealSlice(H5::DataSet dataset, const PRISMATIC_FLOAT_PRECISION *buffer, const hsize_t *mdims);
 
 void writeDatacube3D(H5::DataSet dataset, const PRISMATIC_FLOAT_PRECISION *buffer, const hsize_t *mdims);
@@ -55,8 +65,13 @@ void savePotentialSlices(Parameters<PRISMATIC_FLOAT_PRECISION> &pars);
 
 void saveHRTEM(Parameters<PRISMATIC_FLOAT_PRECISION> &pars, Array3D<PRISMATIC_FLOAT_PRECISION> &net_output);
 
+void saveCounted4D(Parameters<PRISMATIC_FLOAT_PRECISION> &pars);
+
 void saveSTEM(Parameters<PRISMATIC_FLOAT_PRECISION> &pars);
 
+// multiply the accumulated 4D datacubes of the output file by factor
+void rescale4DOutput(Parameters<PRISMATIC_FLOAT_PRECISION> &pars, const PRISMATIC_FLOAT_PRECISION factor);
+
 void save_qArr(Parameters<PRISMATIC_FLOAT_PRECISION> &pars);
 
 void saveProbe(Parameters<PRISMATIC_FLOAT_PRECISION> &pars);
@@ -106,7 +121,8 @@ void writeRealDataSet_inOrder(H5::Group group,
                         const std::string &dsetname,
                         const PRISMATIC_FLOAT_PRECISION *buffer,
                         const hsize_t *mdims,
-                        const size_t &rank);
+                        const size_t &rank,
+                        const H5::DSetCreatPropList &plist = H5::DSetCreatPropList::DEFAULT);
 
 void writeComplexDataSet_inOrder(H5::Group group,
                         const std::string &dsetname,
@@ -276,9 +292,72 @@ void readRealDataSet_inOrder(ArrayND<N, std::vector<PRISMATIC_FLOAT_PRECISION>>
 
 
 // void writeDatacube4D(Parameters<PRISMATIC_FLOAT_PRECISION> &pars, PRISMATIC_FLOAT_PRECISION *buffer, const hsize_t *mdims, const hsize_t *offset, const PRISMATIC_FLOAT_PRECISION numFP, const std::string nameString);
+template<class T>
+void reduceFrames(Parameters<PRISMATIC_FLOAT_PRECISION> &pars, const T *frames, const hsize_t *mdims, std::vector<T> &reduced)
+{
+	//window and bin each pattern, summing the pixels of a bin
+	const size_t numX = pars.frame4DDims[0];
+	const size_t numY = pars.frame4DDims[1];
+	reduced.assign(mdims[0] * mdims[1] * numX * numY, T(0));
+	for (auto f = 0; f < mdims[0] * mdims[1]; f++)
+	{
+		const T *frame = frames + f * mdims[2] * mdims[3];
+		T *out = &reduced[f * numX * numY];
+		for (auto i = 0; i < numX * pars.frame4DBin[0]; i++)
+		{
+			const T *row = frame + (pars.frame4DStart[0] + i) * mdims[3] + pars.frame4DStart[1];
+			T *outRow = out + (i / pars.frame4DBin[0]) * numY;
+			for (auto j = 0; j < numY * pars.frame4DBin[1]; j++)
+				outRow[j / pars.frame4DBin[1]] += row[j];
+		}
+	}
+};
+
 template<class T>
 void writeDatacube4D(Parameters<PRISMATIC_FLOAT_PRECISION> &pars, T *buffer, T *readBuffer, const hsize_t *mdims, const hsize_t *offset, const PRISMATIC_FLOAT_PRECISION numFP, const std::string nameString)
 {
+	//patterns reach the datacube with its detector sampling
+	std::vector<T> reduced;
+	hsize_t reducedDims[4];
+	if(pars.reduce4D)
+	{
+		reduceFrames(pars, buffer, mdims, reduced);
+		reducedDims[0] = mdims[0];
+		reducedDims[1] = mdims[1];
+		reducedDims[2] = pars.frame4DDims[0];
+		reducedDims[3] = pars.frame4DDims[1];
+		buffer = &reduced[0];
+		mdims = reducedDims;
+	}
+
+	//counted datacubes sample the frame into the event list of its probe, no lock needed
+	auto counted = pars.countedDatacubes.find(nameString);
+	if(counted != pars.countedDatacubes.end())
+	{
+		counted->second->addFrame(offset[0], offset[1], reinterpret_cast<const PRISMATIC_FLOAT_PRECISION*>(buffer), mdims[2] * mdims[3],
+								  pars.meta.countedElectrons / numFP, (unsigned int) pars.meta.randomSeed);
+		return;
+	}
+
+	//raw datacubes take the frame straight into its own slot of the mapping, no lock needed
+	auto raw = pars.rawDatacubes.find(nameString);
+	if(raw != pars.rawDatacubes.end())
+	{
+		const PRISMATIC_FLOAT_PRECISION *frame = reinterpret_cast<const PRISMATIC_FLOAT_PRECISION*>(buffer);
+		PRISMATIC_FLOAT_PRECISION *dst = raw->second->getFrame(offset[0], offset[1]);
+		for (auto i = 0; i < mdims[2] * mdims[3] * sizeof(T) / sizeof(PRISMATIC_FLOAT_PRECISION); i++)
+			dst[i] += frame[i]/numFP;
+		return;
+	}
+
+	//hand the frame to the staging writer if one is running for this pass
+	if(pars.cbedWriter)
+	{
+		pars.cbedWriter->push(nameString, reinterpret_cast<const PRISMATIC_FLOAT_PRECISION*>(buffer), mdims, offset,
+							  sizeof(T) / sizeof(PRISMATIC_FLOAT_PRECISION), numFP);
+		return;
+	}
+
 	//for 4D writes, need to first read the data set and then add; this way, FP are accounted for
 	//lock the whole file access/writing procedure in only one location
 	std::unique_lock<std::mutex> writeGatekeeper(write4D_lock);
@@ -293,11 +372,23 @@ void writeDatacube4D(Parameters<PRISMATIC_FLOAT_PRECISION> &pars, T *buffer, T *
     //read old frozen phonon set
     fspace.selectHyperslab(H5S_SELECT_SET, mdims, offset);
 
-    dataset.read(&readBuffer[0], dataset.getDataType(), mspace, fspace);
-    for (auto i = 0; i < mdims[0] * mdims[1] * mdims[2] * mdims[3]; i++)
-        readBuffer[i] += buffer[i]/numFP;
-        
-    dataset.write(&readBuffer[0], dataset.getDataType(), mspace, fspace);
+    std::shared_ptr<FrameQuantizer> quantizer = getQuantizer(pars);
+    if(quantizer)
+    {
+        std::vector<PRISMATIC_FLOAT_PRECISION> frames(mdims[0] * mdims[1] * mdims[2] * mdims[3]);
+        const PRISMATIC_FLOAT_PRECISION *frame = reinterpret_cast<const PRISMATIC_FLOAT_PRECISION*>(buffer);
+        for (auto i = 0; i < frames.size(); i++)
+            frames[i] = frame[i]/numFP;
+        quantizer->writeFrames(dataGroup, dataset, fspace, mdims, offset, frames, true);
+    }
+    else
+    {
+        dataset.read(&readBuffer[0], dataset.getDataType(), mspace, fspace);
+        for (auto i = 0; i < mdims[0] * mdims[1] * mdims[2] * mdims[3]; i++)
+            readBuffer[i] += buffer[i]/numFP;
+
+        dataset.write(&readBuffer[0], dataset.getDataType(), mspace, fspace);
+    }
 
     fspace.close();
     mspace.close();
@@ -310,12 +401,26 @@ void writeDatacube4D(Parameters<PRISMATIC_FLOAT_PRECISION> &pars, T *buffer, T *
 	writeGatekeeper.unlock();
 };
 
+std::string getShardPrefix(Parameters<PRISMATIC_FLOAT_PRECISION> &pars);
+
+void writeRawSidecar(Parameters<PRISMATIC_FLOAT_PRECISION> &pars);
+
+void startDatacubeWriter(Parameters<PRISMATIC_FLOAT_PRECISION> &pars);
+
+void finishDatacubeWriter(Parameters<PRISMATIC_FLOAT_PRECISION> &pars);
+
 void createScratchFile(Parameters<PRISMATIC_FLOAT_PRECISION> &pars);
 
 void removeScratchFile(Parameters<PRISMATIC_FLOAT_PRECISION> &pars);
 
+std::array<hsize_t, 4> getScratchChunk(const hsize_t *dims);
+
+void updateScratchDataSet(H5::DataSet &dataset, Array4D<PRISMATIC_FLOAT_PRECISION> &data, const bool addToStored);
+
 void updateScratchData(Parameters<PRISMATIC_FLOAT_PRECISION> &pars);
 
+void readScratchData(Parameters<PRISMATIC_FLOAT_PRECISION> &pars);
+
 } //namespace Prismatic
 
 #endif //PRISMATIC_FILEIO_H
\ No newline at end of file
@@ -20,11 +20,16 @@
 #include "defines.h"
 #include <time.h>
 #include "aberration.h"
+#include "detector.h"
 
 namespace Prismatic{
 
     enum class StreamingMode{Stream, SingleXfer, Auto};
     enum class TiltSelection{Rectangular, Radial};
+    enum class SMatrixLayout{BeamMajor, PixelMajor, Auto};
+    enum class OutputFilter{None, Deflate, LZ4, Zstd};
+    enum class OutputPrecision{Float, UInt16, UInt8};
+    enum class ConvergenceOutput{Stack3D, Annular2D, DPC_CoM};
 
     template <class T>
     class Metadata{
@@ -42,6 +47,17 @@ namespace Prismatic{
             realspacePixelSize[1] = 0.1;
             potBound              = 3.0;
             numFP                 = 1;
+            concurrentFP          = 1;
+            pipelineThreads       = 0;
+            reusePlan             = true;
+            targetFPError         = 0.0;
+            minFP                 = 2;
+            convergenceOutput     = ConvergenceOutput::Stack3D;
+            checkpointInterval    = 0;
+            resume                = false;
+            scanTiles             = 1;
+            scanTile              = -1;
+            serveSource           = "";
             fpNum                 = 1;
             sliceThickness        = 2.0;
             zSampling             = 16;
@@ -71,6 +87,7 @@ namespace Prismatic{
             C3                    = (T) nan(""); //
             C5                    = (T) nan(""); //
             aberrations           = {}; //
+            detectors             = {}; //
             probeSemiangle        = 20.0 / 1000; //
             detectorAngleStep     = 1.0 / 1000; //
             probeXtilt            = 0; //
@@ -108,6 +125,18 @@ namespace Prismatic{
             save3DOutput          = true; //
             save4DOutput          = false; //
             crop4DOutput          = false; //
+            shard4DOutput         = false; //
+            raw4DOutput           = false; //
+            countedElectrons      = 0.0; //
+            precision4D           = OutputPrecision::Float; //
+            logQuantize4D         = false; //
+            chunk4D               = std::vector<size_t>{1, 1, 0, 0}; //
+            bin4D                 = std::vector<size_t>{1, 1}; //
+            window4DOutput        = false; //
+            window4D              = std::vector<T>{0, 0, 0, 0}; //
+            outputFilter          = OutputFilter::None; //
+            outputFilterLevel     = 4; //
+            outputShuffle         = true; //
             saveDPC_CoM           = false; //
             savePotentialSlices   = false; //
             saveSMatrix           = false; //
@@ -130,10 +159,18 @@ namespace Prismatic{
             seriesKeys            = {};
             seriesTags            = {};
             maxFileSize           = 2e9;
+            seriesMemory          = 4e9;
+            scratchDirectory      = "";
+            seriesSinglePass      = true;
             matrixRefocus         = false;
+            compressSMatrix       = false;
+            sMatrixRankTol        = 1e-4;
+            sMatrixLayout         = SMatrixLayout::Auto;
+            sMatrixHalo           = false;
             arbitraryAberrations  = false;
             importFile            = "";
             importPath            = "";
+            importCache           = 256e6;
         }
         size_t interpolationFactorY; // PRISM f_y parameter
         size_t interpolationFactorX; // PRISM f_x parameter
@@ -142,9 +179,21 @@ namespace Prismatic{
         std::string outputFolder; // folder of output images
         std::string importFile; //HDF5 file from where potential or S-matrix is imported
         std::string importPath; //path to dataset in HDF5 file
+        unsigned long long int importCache; //bytes of imported datasets cached while they are streamed in
         T realspacePixelSize[2]; // pixel size
         T potBound; // bounding integration radius for potential calculation
         size_t numFP; // number of frozen phonon configurations to compute
+        size_t concurrentFP; // number of frozen phonon configurations computed at once, each on its share of the threads
+        size_t pipelineThreads; // threads computing the potential of the next frozen phonon while the current one runs, 0 for none
+        bool reusePlan; // whether setup stages reuse the geometry derived state of earlier frozen phonons, series steps and calls
+        T targetFPError; // relative standard error of the averaged output at which frozen phonons stop, 0 to always run numFP
+        size_t minFP; // frozen phonon configurations computed before the error target can stop the run
+        ConvergenceOutput convergenceOutput; // output whose standard error is compared to targetFPError
+        size_t checkpointInterval; // seconds between checkpoints of the running frozen phonon, 0 for none
+        bool resume; // whether to continue from the checkpoint of an interrupted run
+        size_t scanTiles; // local worker processes the scan is split among, 1 to run in this process
+        int scanTile; // tile of the scan a worker process computes, -1 for the whole scan
+        std::string serveSource; // "stdin" or a UNIX socket path to read simulation jobs from, empty to run one simulation
         size_t fpNum; // current frozen phonon number
         T sliceThickness; // thickness of slice in Z
         size_t zSampling; //oversampling of potential in Z direction
@@ -170,6 +219,7 @@ namespace Prismatic{
         T C3;
         T C5;
         std::vector<aberration> aberrations;
+        std::vector<detector> detectors; // user-defined annular/segment detectors integrated alongside the regular bins
         T probeSemiangle;
         T probeXtilt;
         T probeYtilt;
@@ -209,6 +259,18 @@ namespace Prismatic{
         bool save3DOutput;
         bool save4DOutput;
         bool crop4DOutput;
+        bool shard4DOutput; // write each block of 4D frames to its own file, stitched together by a virtual dataset
+        bool raw4DOutput; // write the 4D datacubes to memory-mapped .npy files with a JSON sidecar instead of the HDF5 file
+        T countedElectrons; // electrons per probe for electron counted 4D output; 0 keeps the dense intensities
+        OutputPrecision precision4D; // element type of the 4D intensities; integer types get a scale and offset per pattern
+        bool logQuantize4D; // quantize the logarithm of the 4D intensities instead of the intensities
+        std::vector<size_t> chunk4D; // chunk shape of the 4D datacubes as Rx, Ry, Qx, Qy; 0 spans the whole axis
+        std::vector<size_t> bin4D; // binning factors of the 4D detector pixels along Qx, Qy
+        bool window4DOutput; // keep only a rectangular window of the 4D detector pixels
+        std::vector<T> window4D; // window limits as Qx min, Qx max, Qy min, Qy max in radians
+        OutputFilter outputFilter; // compression filter applied to the datasets of the output file
+        int outputFilterLevel; // compression level passed to the deflate or zstd filter
+        bool outputShuffle; // byte shuffle ahead of the compression filter
         bool saveDPC_CoM;
         bool savePotentialSlices;
         bool saveSMatrix;
@@ -228,7 +290,14 @@ namespace Prismatic{
         std::vector<std::string> seriesKeys;
         std::vector<std::string> seriesTags;
         unsigned long long int maxFileSize; 
+        unsigned long long int seriesMemory; // bytes of series outputs accumulated in memory before they spill to a scratch file
+        std::string scratchDirectory; // directory of the series scratch file, the working directory if empty
+        bool seriesSinglePass; // whether PRISM computes all series members in one pass over the S-matrix
         bool matrixRefocus; //whether or not to refocus the comapct s-matrix in a PRISM sim
+        bool compressSMatrix; //whether or not to replace the compact s-matrix with a low-rank basis before PRISM03
+        T sMatrixRankTol; //relative residual at which the low-rank basis of the compact s-matrix is truncated
+        SMatrixLayout sMatrixLayout; //memory order of the compact s-matrix while CPU workers build the PRISM output
+        bool sMatrixHalo; //whether or not to pad the compact s-matrix periodically so that every probe window is a contiguous block
         bool arbitraryAberrations;
         StreamingMode transferMode;
         TiltSelection tiltMode;
@@ -261,6 +330,23 @@ namespace Prismatic{
         std::cout << "realspacePixelSize[1] = " << realspacePixelSize[1] << std::endl;
         std::cout << "potBound = " << potBound << std::endl;
         std::cout << "numFP = " << numFP << std::endl;
+        std::cout << "concurrentFP = " << concurrentFP << std::endl;
+        std::cout << "pipelineThreads = " << pipelineThreads << std::endl;
+        std::cout << "reusePlan = " << reusePlan << std::endl;
+        std::cout << "targetFPError = " << targetFPError << std::endl;
+        std::cout << "minFP = " << minFP << std::endl;
+        if (convergenceOutput == Prismatic::ConvergenceOutput::Annular2D){
+            std::cout << "convergenceOutput : 2D" << std::endl;
+        } else if (convergenceOutput == Prismatic::ConvergenceOutput::DPC_CoM){
+            std::cout << "convergenceOutput : DPC" << std::endl;
+        } else {
+            std::cout << "convergenceOutput : 3D" << std::endl;
+        }
+        std::cout << "checkpointInterval = " << checkpointInterval << std::endl;
+        std::cout << "resume = " << resume << std::endl;
+        std::cout << "scanTiles = " << scanTiles << std::endl;
+        if(scanTile >= 0) std::cout << "scanTile = " << scanTile << std::endl;
+        if(!serveSource.empty()) std::cout << "serveSource = " << serveSource << std::endl;
         std::cout << "sliceThickness = " << sliceThickness<< std::endl;
         std::cout << "zSampling = " << zSampling << std::endl;
         std::cout << "numSlices = " << numSlices << std::endl;
@@ -332,6 +418,34 @@ namespace Prismatic{
         std::cout << "save3DOutput = " << save3DOutput << std::endl;
         std::cout << "save4DOutput = " << save4DOutput << std::endl;
         std::cout << "crop4DOutput = " << crop4DOutput << std::endl;
+        std::cout << "shard4DOutput = " << shard4DOutput << std::endl;
+        std::cout << "raw4DOutput = " << raw4DOutput << std::endl;
+        std::cout << "countedElectrons = " << countedElectrons << std::endl;
+        if (precision4D == Prismatic::OutputPrecision::UInt16){
+            std::cout << "4D precision : uint16" << std::endl;
+        } else if (precision4D == Prismatic::OutputPrecision::UInt8){
+            std::cout << "4D precision : uint8" << std::endl;
+        } else {
+            std::cout << "4D precision : float" << std::endl;
+        }
+        std::cout << "logQuantize4D = " << logQuantize4D << std::endl;
+        std::cout << "chunk4D = " << chunk4D[0] << " " << chunk4D[1] << " " << chunk4D[2] << " " << chunk4D[3] << std::endl;
+        std::cout << "bin4D = " << bin4D[0] << " " << bin4D[1] << std::endl;
+        std::cout << "window4DOutput = " << window4DOutput << std::endl;
+        if (window4DOutput) std::cout << "window4D = " << window4D[0] << " " << window4D[1] << " " << window4D[2] << " " << window4D[3] << std::endl;
+        if (outputFilter == Prismatic::OutputFilter::Deflate){
+            std::cout << "Output filter : Deflate" << std::endl;
+        } else if (outputFilter == Prismatic::OutputFilter::LZ4){
+            std::cout << "Output filter : LZ4" << std::endl;
+        } else if (outputFilter == Prismatic::OutputFilter::Zstd){
+            std::cout << "Output filter : Zstd" << std::endl;
+        } else {
+            std::cout << "Output filter : None" << std::endl;
+        }
+        if (outputFilter != Prismatic::OutputFilter::None){
+            std::cout << "outputFilterLevel = " << outputFilterLevel << std::endl;
+            std::cout << "outputShuffle = " << outputShuffle << std::endl;
+        }
         std::cout << "saveDPC_CoM = " << saveDPC_CoM << std::endl;
         std::cout << "savePotentialSlices = " << savePotentialSlices << std::endl;
         std::cout << "saveSMatrix = " << saveSMatrix << std::endl;
@@ -345,6 +459,7 @@ namespace Prismatic{
         {
             std::cout << "importFile = " << importFile << std::endl;
             std::cout << "importPath = " << importPath << std::endl;
+            std::cout << "importCache = " << importCache << std::endl;
         }
         std::cout << "userSpecifiedNumFP = " << userSpecifiedNumFP << std::endl;
         std::cout << "saveComplexOutputWave = " << saveComplexOutputWave << std::endl;
@@ -352,7 +467,24 @@ namespace Prismatic{
         std::cout << "saveProbe = " << saveProbe << std::endl;
         std::cout << "saveProbeComplex = " << saveProbeComplex << std::endl;
         std::cout << "simSeries = " << simSeries << std::endl;
+        if(simSeries)
+        {
+            std::cout << "seriesMemory = " << seriesMemory << std::endl;
+            std::cout << "scratchDirectory = " << scratchDirectory << std::endl;
+            std::cout << "seriesSinglePass = " << seriesSinglePass << std::endl;
+        }
         std::cout << "matrixRefocus = " << matrixRefocus << std::endl;
+        std::cout << "compressSMatrix = " << compressSMatrix << std::endl;
+        if(compressSMatrix) std::cout << "sMatrixRankTol = " << sMatrixRankTol << std::endl;
+        if (sMatrixLayout == Prismatic::SMatrixLayout::Auto){
+            std::cout << "S-matrix layout : Auto" << std::endl;
+        } else if (sMatrixLayout == Prismatic::SMatrixLayout::PixelMajor){
+            std::cout << "S-matrix layout : Pixel-major" << std::endl;
+        } else {
+            std::cout << "S-matrix layout : Beam-major" << std::endl;
+        }
+        std::cout << "sMatrixHalo = " << sMatrixHalo << std::endl;
+        std::cout << "number of custom detectors = " << detectors.size() << std::endl;
         std::cout << std::noboolalpha << std::endl;
 
     #ifdef PRISMATIC_ENABLE_GPU
@@ -382,6 +514,17 @@ namespace Prismatic{
         if(realspacePixelSize[1] != other.realspacePixelSize[1])return false;
         if(potBound != other.potBound)return false;
         if(numFP != other.numFP)return false;
+        if(concurrentFP != other.concurrentFP)return false;
+        if(pipelineThreads != other.pipelineThreads)return false;
+        if(reusePlan != other.reusePlan)return false;
+        if(targetFPError != other.targetFPError)return false;
+        if(minFP != other.minFP)return false;
+        if(convergenceOutput != other.convergenceOutput)return false;
+        if(checkpointInterval != other.checkpointInterval)return false;
+        if(resume != other.resume)return false;
+        if(scanTiles != other.scanTiles)return false;
+        if(scanTile != other.scanTile)return false;
+        if(serveSource != other.serveSource)return false;
         if(fpNum != other.fpNum)return false;
         if(sliceThickness != other.sliceThickness)return false;
         if(zSampling != other.zSampling)return false;
@@ -436,6 +579,18 @@ namespace Prismatic{
         if(save3DOutput != other.save3DOutput)return false;
         if(save4DOutput != other.save4DOutput)return false;
         if(crop4DOutput != other.crop4DOutput)return false;
+        if(shard4DOutput != other.shard4DOutput)return false;
+        if(raw4DOutput != other.raw4DOutput)return false;
+        if(countedElectrons != other.countedElectrons)return false;
+        if(precision4D != other.precision4D)return false;
+        if(logQuantize4D != other.logQuantize4D)return false;
+        if(chunk4D != other.chunk4D)return false;
+        if(bin4D != other.bin4D)return false;
+        if(window4DOutput != other.window4DOutput)return false;
+        if(window4D != other.window4D)return false;
+        if(outputFilter != other.outputFilter)return false;
+        if(outputFilterLevel != other.outputFilterLevel)return false;
+        if(outputShuffle != other.outputShuffle)return false;
         if(saveDPC_CoM != other.saveDPC_CoM)return false;
         if(savePotentialSlices != other.savePotentialSlices)return false;
         if(saveSMatrix != other.saveSMatrix)return false;
@@ -451,7 +606,16 @@ namespace Prismatic{
         if(saveProbe != other.saveProbe)return false;
         if(saveProbeComplex != other.saveProbeComplex)return false;
         if(simSeries != other.simSeries)return false;
+        if(importCache != other.importCache)return false;
+        if(seriesMemory != other.seriesMemory)return false;
+        if(scratchDirectory != other.scratchDirectory)return false;
+        if(seriesSinglePass != other.seriesSinglePass)return false;
         if(matrixRefocus != other.matrixRefocus)return false;
+        if(compressSMatrix != other.compressSMatrix)return false;
+        if(sMatrixRankTol != other.sMatrixRankTol)return false;
+        if(sMatrixLayout != other.sMatrixLayout)return false;
+        if(sMatrixHalo != other.sMatrixHalo)return false;
+        if(detectors != other.detectors)return false;
         return true;
     }
 
@@ -14,6 +14,7 @@
 #ifndef PRISM_PARAMS_H
 #define PRISM_PARAMS_H
 #include <vector>
+#include <map>
 #include <string>
 #include <algorithm>
 #include <mutex>
@@ -23,6 +24,10 @@
 #include "meta.h"
 #include "H5Cpp.h"
 #include "aberration.h"
+#include "detector.h"
+#include "DatacubeWriter.h"
+#include "RawDatacube.h"
+#include "CountedDatacube.h"
 
 #ifdef PRISMATIC_BUILDING_GUI
 class prism_progressbar;
@@ -42,6 +47,22 @@ namespace Prismatic{
 
 	// for monitoring memory consumption on GPU
 	static std::mutex memLock;
+
+	class PotentialPipeline;
+	class Checkpoint;
+
+	// probe side state and outputs of one member of a simulation series that PRISM03 computes in the same pass as the others
+	template <class T>
+	struct seriesMember
+	{
+		std::string tag;
+		Array2D<std::complex<T> > psiProbeInit;
+		detectorMap detMap;
+		T xTiltShift;
+		T yTiltShift;
+		Array4D<T> output;
+		Array4D<T> DPC_CoM;
+	};
 	
     template <class T>
     class Parameters {
@@ -52,6 +73,9 @@ namespace Prismatic{
 		void calculateFileSize();
 	    Metadata<T> meta;
 	    Array3D< std::complex<T>  > Scompact;
+	    Array2D< std::complex<T>  > ScompactCoeffs; // [beam][basis] weights when Scompact holds a low-rank basis
+	    size_t ScompactPlanes; // number of planes in Scompact; the beam axis is padded when it is stored innermost
+	    std::array<size_t, 2> ScompactHalo; // {y, x} width of the periodic halo appended to Scompact, zero when there is none
 	    Array4D<T> output;
 	    Array4D<T> net_output;
 		Array4D<T> DPC_CoM;
@@ -90,6 +114,7 @@ namespace Prismatic{
 	    Array2D<T> q2;
 	    Array2D<T> q1;
 		Array2D<T> qTheta;
+		detectorMap detMap; // sparse pixel -> bin map for the annular, custom and DPC integrations
         Array1D<T> xp;
         Array1D<T> yp;
 		Array1D<T> qx;
@@ -135,10 +160,27 @@ namespace Prismatic{
 		std::vector<T> depths;
 	    size_t numberBeams;
 		H5::H5File outputFile;
+		std::shared_ptr<DatacubeWriter> cbedWriter; // collects 4D output frames while a pass over the probes is running
+		std::shared_ptr<PotentialPipeline> potentialPipeline; // computes the potential of the next frozen phonon while the current one runs
+		std::shared_ptr<Checkpoint> checkpoint; // records the progress of the run so that it can be resumed
+		H5::DSetCreatPropList shardProps; // chunking and filters of the 4D shard files, set up with the sharded datacubes
+		std::map<std::string, std::shared_ptr<RawDatacube> > rawDatacubes; // memory-mapped 4D outputs, keyed by datacube group path
+		std::map<std::string, std::shared_ptr<CountedDatacube> > countedDatacubes; // electron counted 4D outputs, keyed by datacube group path
+		bool reduce4D; // whether 4D patterns are windowed or binned before they are written
+		std::array<size_t, 2> frame4DStart; // first detector pixel of the 4D window along Qx, Qy
+		std::array<size_t, 2> frame4DBin; // binning factors of the 4D patterns along Qx, Qy
+		std::array<size_t, 2> frame4DDims; // size of the written 4D patterns along Qx, Qy
 		H5::H5File scratchFile;
+		std::string scratchFilename; // scratch file of series outputs that did not fit the series memory budget
+		bool seriesInMemory; // whether the series outputs are accumulated in seriesOutput instead of the scratch file
+		std::map<std::string, Array4D<T> > seriesOutput; // frozen phonon sums of each series output, keyed by dataset name
+		std::vector<seriesMember<T> > seriesMembers; // series members computed together in one PRISM03 pass, empty otherwise
 		size_t fpFlag; //flag to prevent creation of new HDF5 files
 		std::string currentTag;
 		bool potentialReady;
+		bool sMatrixCompressed;
+		bool sMatrixPixelMajor;
+		bool distributeBeams; // whether the S-matrix beams are split among the MPI ranks and gathered after PRISM02
 
 		#ifdef PRISMATIC_ENABLE_GPU
 				cudaDeviceProp deviceProperties;
@@ -232,8 +274,28 @@ namespace Prismatic{
 			zStartPlane = (size_t) std::ceil(meta.zStart / meta.sliceThickness);
 			
 			potentialReady = false;
-
-            meta.alphaBeamMax = meta.probeSemiangle + 2.5 / 1000.0;
+			sMatrixCompressed = false;
+			sMatrixPixelMajor = false;
+			distributeBeams = false;
+			seriesInMemory = false;
+			reduce4D = false;
+			ScompactPlanes = 0;
+			ScompactHalo = {0, 0};
+
+			//the beams cover the widest probe aperture of any series member, shifted by its largest tilt
+			T maxSemiangle = meta.probeSemiangle;
+			T maxXtilt = std::abs(meta.probeXtilt);
+			T maxYtilt = std::abs(meta.probeYtilt);
+			for(auto i = 0; i < meta.seriesKeys.size(); i++)
+			{
+				for(auto val : meta.seriesVals[i])
+				{
+					if(meta.seriesKeys[i] == "probeSemiangle") maxSemiangle = std::max(maxSemiangle, val);
+					else if(meta.seriesKeys[i] == "probeXtilt") maxXtilt = std::max(maxXtilt, std::abs(val));
+					else if(meta.seriesKeys[i] == "probeYtilt") maxYtilt = std::max(maxYtilt, std::abs(val));
+				}
+			}
+            meta.alphaBeamMax = maxSemiangle + std::sqrt(maxXtilt*maxXtilt + maxYtilt*maxYtilt) + 2.5 / 1000.0;
 
 			//set tilt properties to prevent out of bound access
 			if(meta.algorithm == Algorithm::HRTEM)
@@ -309,6 +371,23 @@ namespace Prismatic{
 				meta.seriesVals.push_back(defocii);
 			}
 
+			//series over other probe parameters are tagged here; defocus series keep the _df tags of the CC supergroup
+			if(meta.seriesVals.size() > 0 and meta.seriesTags.size() != meta.seriesVals[0].size())
+			{
+				for(auto i = 1; i < meta.seriesVals.size(); i++)
+				{
+					if(meta.seriesVals[i].size() != meta.seriesVals[0].size())
+					{
+						std::cout << "Series over " << meta.seriesKeys[0] << " and " << meta.seriesKeys[i] << " have different numbers of values" << std::endl;
+						throw std::runtime_error("Mismatched simulation series");
+					}
+				}
+				std::string prefix = (meta.seriesKeys[0] == "probeDefocus") ? "_df" : "_sr";
+				meta.seriesTags.clear();
+				for(auto i = 0; i < meta.seriesVals[0].size(); i++)
+					meta.seriesTags.push_back(prefix+digitString(i));
+			}
+
 			
 			//check filesize
 			try
@@ -404,6 +483,7 @@ namespace Prismatic{
 		unsigned long long int numElems = 0;
 		if(meta.save2DOutput) numElems += numProbes;
 		if(meta.save3DOutput) numElems += numProbes*Ndet_tmp;
+		numElems += numProbes*meta.detectors.size();
 		if(meta.saveDPC_CoM) numElems += 2*numProbes; 
 
 		if(meta.algorithm == Algorithm::Multislice)
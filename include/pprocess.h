@@ -102,8 +102,7 @@ Array2D<std::complex<PRISMATIC_FLOAT_PRECISION>> gaussian2D_k(const PRISMATIC_FL
     Array2D<std::complex<PRISMATIC_FLOAT_PRECISION>> output = zeros_ND<2, std::complex<PRISMATIC_FLOAT_PRECISION>>({{samples_x.get_dimj(), samples_x.get_dimi()}});
 
 	//create FFT plans 
-	PRISMATIC_FFTW_INIT_THREADS();
-	PRISMATIC_FFTW_PLAN_WITH_NTHREADS(1);
+	initFFTWThreads(1);
 	
 	std::unique_lock<std::mutex> gatekeeper(fftw_plan_lock);
 	PRISMATIC_FFTW_PLAN plan_forward = PRISMATIC_FFTW_PLAN_DFT_2D(output.get_dimj(), output.get_dimi(),
@@ -451,8 +450,7 @@ Array2D<PRISMATIC_FLOAT_PRECISION> fourierDownsample(Array2D<PRISMATIC_FLOAT_PRE
     Array2D<PRISMATIC_FLOAT_PRECISION> result = zeros_ND<2, PRISMATIC_FLOAT_PRECISION>({{Nj, Ni}});
 
 	//create FFT plans 
-	PRISMATIC_FFTW_INIT_THREADS();
-	PRISMATIC_FFTW_PLAN_WITH_NTHREADS(1);
+	initFFTWThreads(1);
 	
 	std::unique_lock<std::mutex> gatekeeper(fftw_plan_lock);
 	PRISMATIC_FFTW_PLAN plan_forward = PRISMATIC_FFTW_PLAN_DFT_2D(fstore.get_dimj(), fstore.get_dimi(),
@@ -543,8 +541,7 @@ void convolve2D(Array2D<PRISMATIC_FLOAT_PRECISION> &arr, Array2D<PRISMATIC_FLOAT
 	Array2D<std::complex<PRISMATIC_FLOAT_PRECISION>> kkern = zeros_ND<2,std::complex<PRISMATIC_FLOAT_PRECISION>>({{kernel.get_dimj(),kernel.get_dimi()}});
 
 	//create FFT plans 
-	PRISMATIC_FFTW_INIT_THREADS();
-	PRISMATIC_FFTW_PLAN_WITH_NTHREADS(1);
+	initFFTWThreads(1);
 	
 	std::unique_lock<std::mutex> gatekeeper(fftw_plan_lock);
 	PRISMATIC_FFTW_PLAN plan_forward_arr = PRISMATIC_FFTW_PLAN_DFT_2D(karr.get_dimj(), karr.get_dimi(),
@@ -600,8 +597,7 @@ void convolve2D(Array2D<PRISMATIC_FLOAT_PRECISION> &arr, Array2D<std::complex<PR
     Array2D<std::complex<PRISMATIC_FLOAT_PRECISION>> karr = zeros_ND<2,std::complex<PRISMATIC_FLOAT_PRECISION>>({{arr.get_dimj(), arr.get_dimi()}});
 
 	//create FFT plans 
-	PRISMATIC_FFTW_INIT_THREADS();
-	PRISMATIC_FFTW_PLAN_WITH_NTHREADS(1);
+	initFFTWThreads(1);
 	
 	std::unique_lock<std::mutex> gatekeeper(fftw_plan_lock);
 	PRISMATIC_FFTW_PLAN plan_forward_arr = PRISMATIC_FFTW_PLAN_DFT_2D(karr.get_dimj(), karr.get_dimi(),
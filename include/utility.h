@@ -20,6 +20,7 @@
 #include <complex>
 #include <ctime>
 #include <iomanip>
+#include <functional>
 #include "defines.h"
 #include "fftw3.h"
 #include "configure.h"
@@ -255,7 +256,13 @@ PRISMATIC_FLOAT_PRECISION computePearsonCorrelation(Prismatic::Array2D<std::comp
 PRISMATIC_FLOAT_PRECISION computeRfactor(Prismatic::Array2D<std::complex<PRISMATIC_FLOAT_PRECISION>> left,
 										 Prismatic::Array2D<std::complex<PRISMATIC_FLOAT_PRECISION>> right);
 
-int nyquistProbes(Prismatic::Parameters<PRISMATIC_FLOAT_PRECISION> pars, size_t dim);
+int nyquistProbes(const Prismatic::Parameters<PRISMATIC_FLOAT_PRECISION> &pars, size_t dim);
+
+std::pair<size_t, size_t> getScanTileRange(const size_t numPositions, const size_t numTiles, const size_t tile);
+
+void getProbePositions(const Prismatic::Parameters<PRISMATIC_FLOAT_PRECISION> &pars,
+					   std::vector<PRISMATIC_FLOAT_PRECISION> &xp_d,
+					   std::vector<PRISMATIC_FLOAT_PRECISION> &yp_d);
 
 std::string remove_extension(const std::string &filename);
 
@@ -276,6 +283,31 @@ std::vector<T> getUnique(std::vector<T> input)
 
 void updateSeriesParams(Parameters<PRISMATIC_FLOAT_PRECISION> &pars, size_t iter);
 
+bool useSeriesPass(Parameters<PRISMATIC_FLOAT_PRECISION> &pars);
+
+// set up FFTW threads once per process and set the threads of the plans made next; 0 leaves the thread count as is
+void initFFTWThreads(const size_t numThreads = 0);
+
+size_t getConcurrentFP(Parameters<PRISMATIC_FLOAT_PRECISION> &pars);
+
+size_t getPipelineThreads(Parameters<PRISMATIC_FLOAT_PRECISION> &pars);
+
+bool useTargetFPError(Parameters<PRISMATIC_FLOAT_PRECISION> &pars);
+
+bool useCheckpoint(Parameters<PRISMATIC_FLOAT_PRECISION> &pars);
+
+std::string getScanTileFallback(Metadata<PRISMATIC_FLOAT_PRECISION> &meta);
+
+bool useScanTiles(Metadata<PRISMATIC_FLOAT_PRECISION> &meta);
+
+#ifdef PRISMATIC_ENABLE_MPI
+bool useMPIRanks(Metadata<PRISMATIC_FLOAT_PRECISION> &meta);
+#endif //PRISMATIC_ENABLE_MPI
+
+void runConcurrentFP(Parameters<PRISMATIC_FLOAT_PRECISION> &pars,
+					 const size_t numGroups,
+					 const std::function<void(Parameters<PRISMATIC_FLOAT_PRECISION> &)> &calcFP);
+
 } // namespace Prismatic
 
 #endif //PRISMATIC_UTILITY_H
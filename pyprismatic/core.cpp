@@ -288,7 +288,15 @@ static PyObject *pyprismatic_core_go(PyObject *self, PyObject *args)
 	Prismatic::Metadata<PRISMATIC_FLOAT_PRECISION> tmp_meta;
 	if(Prismatic::parseParamFile(tmp_meta,"scratch_param.txt"))
 	{
-		Prismatic::go(meta);
+		try
+		{
+			Prismatic::go(meta);
+		}
+		catch (std::exception &e)
+		{
+			PyErr_SetString(PyExc_RuntimeError, e.what());
+			return NULL;
+		}
 	}else{
 		std::cout << "Invalid parameters detected. Cancelling calculation, please check inputs." << std::endl;
 	}
@@ -62,3 +62,113 @@ def readMRC(filename: str, dtype: type = float, order: str = "C"):
             .reshape((dimx, dimy, dimz), order=order)
             .astype(dtype)
         )
+
+
+def convertRaw4D(sidecar: str, remove: bool = False):
+    """
+    * convertRaw4D *
+
+    Move the raw 4D output of a simulation run with --4D-raw into its HDF5 output file, giving
+    the usual 4DSTEM_simulation/data/datacubes/CBED_array_depthNNNN/data layout.
+
+    :param sidecar: Filename of the .json sidecar written next to the output file
+    :param remove: Delete the .npy files once they are converted
+    :return: Filename of the HDF5 output file
+
+    """
+    import json
+    import os
+    import h5py
+    import numpy as np
+
+    folder = os.path.dirname(os.path.abspath(sidecar))
+    with open(sidecar, "r") as fid:
+        description = json.load(fid)
+
+    output = os.path.join(folder, description["output_file"])
+    with h5py.File(output, "a") as f:
+        for cube in description["datacubes"]:
+            raw = os.path.join(folder, cube["file"])
+            data = np.load(raw, mmap_mode="r")
+            group = f[cube["group"]]
+            # one scan row of diffraction patterns per chunk and per copy, so the datacube is never loaded whole
+            dset = group.create_dataset(
+                "data", shape=data.shape, dtype=data.dtype, chunks=(1,) + data.shape[1:]
+            )
+            for ax in range(data.shape[0]):
+                dset[ax] = data[ax]
+            del group.attrs["raw_file"]
+            del data
+            if remove:
+                os.remove(raw)
+
+    return output
+
+
+def readCounted4D(filename: str, group: str = "CBED_array_depth0000", dense: bool = True):
+    """
+    * readCounted4D *
+
+    Read an electron counted datacube written with --4D-counted.
+
+    :param filename: Filename of the HDF5 output file
+    :param group: Name of the datacube in 4DSTEM_simulation/data/counted_datacubes
+    :param dense: Return the counts as a dense (Rx, Ry, Qx, Qy) array; otherwise return an (Rx, Ry) object
+        array holding the (qx, qy) detector coordinate of each electron, as in a py4DSTEM counted datacube
+    :return: NumPy array of counts or electron coordinates
+
+    """
+    import h5py
+    import numpy as np
+
+    with h5py.File(filename, "r") as f:
+        g = f["4DSTEM_simulation/data/counted_datacubes"][group]
+        shape = (g["dim1"].shape[0], g["dim2"].shape[0], g["dim3"].shape[0], g["dim4"].shape[0])
+        offsets = g["frame_offsets"][...]
+        indices = g["pixel_index"][...]
+        counts = g["counts"][...]
+
+    probe = np.repeat(np.arange(shape[0] * shape[1]), np.diff(offsets))
+    if dense:
+        output = np.zeros((shape[0] * shape[1], shape[2] * shape[3]), dtype=np.uint32)
+        output[probe, indices] = counts
+        return output.reshape(shape)
+
+    output = np.empty((shape[0], shape[1]), dtype=object)
+    for p in range(shape[0] * shape[1]):
+        events = slice(offsets[p], offsets[p + 1])
+        pixels = np.repeat(indices[events], counts[events])
+        output[p // shape[1], p % shape[1]] = np.stack(np.unravel_index(pixels, shape[2:]), axis=1)
+    return output
+
+
+def readQuantized4D(filename: str, group: str = "CBED_array_depth0000"):
+    """
+    * readQuantized4D *
+
+    Read a 4D datacube written with an integer --4D-precision and restore its intensities from the
+    per-pattern scale and offset datasets.
+
+    :param filename: Filename of the HDF5 output file
+    :param group: Name of the datacube in 4DSTEM_simulation/data/datacubes
+    :return: NumPy array of intensities with shape (Rx, Ry, Qx, Qy)
+
+    """
+    import h5py
+    import numpy as np
+
+    with h5py.File(filename, "r") as f:
+        g = f["4DSTEM_simulation/data/datacubes"][group]
+        levels = g["data"][...]
+        scale = g["scale"][...][:, :, None, None]
+        offset = g["offset"][...][:, :, None, None]
+        mode = g.attrs["quantization"]
+        if isinstance(mode, bytes):
+            mode = mode.decode()
+        mode = mode.strip("\x00")
+        floor = g.attrs["log_floor"] if "log_floor" in g.attrs else 0
+
+    output = offset + scale * levels.astype(scale.dtype)
+    if mode == "log":
+        output = np.maximum(np.exp(output) - floor, 0)
+    return output
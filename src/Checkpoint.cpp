@@ -0,0 +1,663 @@
+// Copyright Alan (AJ) Pryor, Jr. 2017
+// Transcribed from MATLAB code by Colin Ophus
+// Prismatic is distributed under the GNU General Public License (GPL)
+// If you use Prismatic, we kindly ask that you cite the following papers:
+
+// 1. Ophus, C.: A fast image simulation algorithm for scanning
+//    transmission electron microscopy. Advanced Structural and
+//    Chemical Imaging 3(1), 13 (2017)
+
+// 2. Pryor, Jr., A., Ophus, C., and Miao, J.: A Streaming Multi-GPU
+//    Implementation of Image Simulation Algorithms for Scanning
+//	  Transmission Electron Microscopy. arXiv:1706.08563 (2017)
+
+
+#include "Checkpoint.h"
+#include "SimulationPlan.h"
+#include "DatacubeWriter.h"
+#include "fileIO.h"
+#include <iostream>
+#include <sstream>
+#include <cstdio>
+#include <cstdint>
+#include <chrono>
+#include <stdexcept>
+#include <algorithm>
+#include <limits>
+
+namespace Prismatic
+{
+// marks the start of every journal entry, so that a torn entry at the end of the journal is not replayed
+static const uint64_t journalMagic = 0x50524953434b5054ULL;
+
+Checkpoint::Checkpoint(const Parameters<PRISMATIC_FLOAT_PRECISION> &pars) : prefix(pars.meta.filenameOutput + ".checkpoint"),
+																		   key(getKey(pars)),
+																		   interval(pars.meta.checkpointInterval),
+																		   completedFP(0),
+																		   netSlot(0),
+																		   fp(0),
+																		   potentialSaved(false),
+																		   numPlanes(0),
+																		   numSlices(0),
+																		   dzPot(0),
+																		   resuming(false),
+																		   stage(Stage::Beams),
+																		   source(nullptr),
+																		   framesPerProbe(0),
+																		   numXprobes(0),
+																		   stopping(false)
+{
+	for (auto &s : stages)
+		s = stageState{0, 0, rangeList()};
+	for (auto &d : potDims)
+		d = 0;
+	for (auto &d : netDims)
+		d = 0;
+	for (auto &d : dpcDims)
+		d = 0;
+
+	if (pars.meta.resume)
+	{
+		resuming = readState();
+		if (resuming)
+			std::cout << "Resuming from checkpoint " << prefix << " with " << completedFP << " completed frozen phonons" << std::endl;
+		else
+			std::cout << "No checkpoint of these settings at " << prefix << ", starting from the beginning" << std::endl;
+	}
+	worker = std::thread(&Checkpoint::run, this);
+};
+
+Checkpoint::~Checkpoint()
+{
+	{
+		std::lock_guard<std::mutex> gatekeeper(stateLock);
+		stopping = true;
+	}
+	wake.notify_one();
+	if (worker.joinable())
+		worker.join();
+};
+
+std::string Checkpoint::getKey(const Parameters<PRISMATIC_FLOAT_PRECISION> &pars) const
+{
+	// the settings that decide the arrays and values of a frozen phonon; threads and batch sizes may change on resume
+	const Metadata<PRISMATIC_FLOAT_PRECISION> &m = pars.meta;
+	SimulationPlan::Key k;
+	k << m.filenameAtoms << (int)m.algorithm << m.numFP << m.E0 << m.realspacePixelSize[0] << m.realspacePixelSize[1]
+	  << m.potBound << m.tileX << m.tileY << m.tileZ << m.sliceThickness << m.zSampling << m.numSlices << m.zStart
+	  << m.interpolationFactorX << m.interpolationFactorY << m.probeStepX << m.probeStepY
+	  << m.scanWindowXMin << m.scanWindowXMax << m.scanWindowYMin << m.scanWindowYMax << m.probes_x << m.probes_y
+	  << m.alphaBeamMax << m.probeSemiangle << m.probeDefocus << m.C3 << m.C5 << m.aberrations
+	  << m.probeXtilt << m.probeYtilt << m.detectorAngleStep << m.detectors
+	  << m.includeThermalEffects << m.includeOccupancy << m.potential3D
+	  << m.save2DOutput << m.save3DOutput << m.save4DOutput << m.saveDPC_CoM << m.crop4DOutput << m.bin4D << m.window4D;
+	return k.str();
+};
+
+std::string Checkpoint::getStageFile(const Stage s) const
+{
+	return prefix + ((s == Stage::Beams) ? ".beams" : ".probes");
+};
+
+bool Checkpoint::readState()
+{
+	std::ifstream f(prefix);
+	if (!f)
+		return false;
+
+	std::string line, word, storedKey;
+	std::getline(f, line);
+	if (line != "prismatic checkpoint")
+		return false;
+	f >> word;
+	std::getline(f, storedKey);
+	if (word != "key" || storedKey.substr(std::min((size_t)1, storedKey.size())) != key)
+		return false;
+
+	f >> word >> completedFP >> netSlot >> fp;
+	f >> word >> potentialSaved >> numPlanes >> numSlices >> dzPot;
+	for (auto &d : potDims)
+		f >> d;
+	f >> word;
+	for (auto &d : netDims)
+		f >> d;
+	for (auto &d : dpcDims)
+		f >> d;
+	for (auto &s : stages)
+	{
+		size_t numRanges;
+		f >> word >> s.units >> s.unitFloats >> numRanges;
+		s.done.resize(numRanges);
+		for (auto &r : s.done)
+			f >> r.first >> r.second;
+	}
+	if (!f)
+	{
+		std::cout << "The checkpoint " << prefix << " could not be read" << std::endl;
+		return false;
+	}
+	return true;
+};
+
+void Checkpoint::writeState()
+{
+	// the state file is replaced in one step, so it refers either to the old or to the new data, never to parts of both
+	std::stringstream state;
+	state.precision(std::numeric_limits<PRISMATIC_FLOAT_PRECISION>::max_digits10);
+	{
+		std::lock_guard<std::mutex> gatekeeper(stateLock);
+		state << "prismatic checkpoint\n";
+		state << "key " << key << '\n';
+		state << "fp " << completedFP << ' ' << netSlot << ' ' << fp << '\n';
+		state << "potential " << potentialSaved << ' ' << numPlanes << ' ' << numSlices << ' ' << dzPot;
+		for (auto d : potDims)
+			state << ' ' << d;
+		state << '\n';
+		state << "net";
+		for (auto d : netDims)
+			state << ' ' << d;
+		for (auto d : dpcDims)
+			state << ' ' << d;
+		state << '\n';
+		for (auto &s : stages)
+		{
+			state << "stage " << s.units << ' ' << s.unitFloats << ' ' << s.done.size();
+			for (auto &r : s.done)
+				state << ' ' << r.first << ' ' << r.second;
+			state << '\n';
+		}
+	}
+
+	std::string tmpName = prefix + ".tmp";
+	{
+		std::ofstream f(tmpName, std::ios::trunc);
+		f << state.str();
+		f.flush();
+		if (!f)
+			throw std::runtime_error("Unable to write " + tmpName);
+	}
+	if (std::rename(tmpName.c_str(), prefix.c_str()) != 0)
+	{
+		// rename does not replace an existing file everywhere
+		std::remove(prefix.c_str());
+		if (std::rename(tmpName.c_str(), prefix.c_str()) != 0)
+			throw std::runtime_error("Unable to replace " + prefix);
+	}
+};
+
+bool Checkpoint::continuesOutput() const
+{
+	// the output file of the first frozen phonon is set up while it runs, so an interrupted first one starts it over
+	return resuming && completedFP > 0;
+};
+
+void Checkpoint::restoreNet(Parameters<PRISMATIC_FLOAT_PRECISION> &pars)
+{
+	if (!resuming || completedFP == 0)
+		return;
+
+	std::ifstream f(prefix + ".net" + std::to_string(netSlot), std::ios::binary);
+	pars.net_output = zeros_ND<4, PRISMATIC_FLOAT_PRECISION>({{netDims[0], netDims[1], netDims[2], netDims[3]}});
+	f.read(reinterpret_cast<char *>(&pars.net_output[0]), pars.net_output.size() * sizeof(PRISMATIC_FLOAT_PRECISION));
+	if (pars.meta.saveDPC_CoM)
+	{
+		pars.net_DPC_CoM = zeros_ND<4, PRISMATIC_FLOAT_PRECISION>({{dpcDims[0], dpcDims[1], dpcDims[2], dpcDims[3]}});
+		f.read(reinterpret_cast<char *>(&pars.net_DPC_CoM[0]), pars.net_DPC_CoM.size() * sizeof(PRISMATIC_FLOAT_PRECISION));
+	}
+	if (!f)
+		throw std::runtime_error("Unable to read the frozen phonon sums of checkpoint " + prefix);
+};
+
+void Checkpoint::beginFP(Parameters<PRISMATIC_FLOAT_PRECISION> &pars, const size_t fpNum)
+{
+	std::lock_guard<std::mutex> writeGatekeeper(writeLock);
+	if (resuming && potentialSaved && fp == fpNum)
+	{
+		// the thermal displacements are not reproducible from the seed, so the checkpointed beams and probes
+		// continue with the potential they were computed with
+		std::ifstream f(prefix + ".pot", std::ios::binary);
+		pars.pot = zeros_ND<3, PRISMATIC_FLOAT_PRECISION>({{potDims[0], potDims[1], potDims[2]}});
+		if (pars.pot.size() > 0)
+			f.read(reinterpret_cast<char *>(&pars.pot[0]), pars.pot.size() * sizeof(PRISMATIC_FLOAT_PRECISION));
+		if (!f)
+			throw std::runtime_error("Unable to read the potential of checkpoint " + prefix);
+		pars.numPlanes = numPlanes;
+		pars.numSlices = numSlices;
+		pars.dzPot = dzPot;
+		pars.potentialReady = true;
+		std::cout << "Frozen phonon #" << fpNum << " continues from the checkpoint" << std::endl;
+		return;
+	}
+
+	{
+		std::lock_guard<std::mutex> gatekeeper(stateLock);
+		resuming = false;
+		fp = fpNum;
+		potentialSaved = false;
+		for (auto &s : stages)
+			s.done.clear();
+		journaled.clear();
+	}
+	{
+		std::lock_guard<std::mutex> journalGatekeeper(journalLock);
+		if (journal.is_open())
+			journal.close();
+		journal.open(prefix + ".journal", std::ios::binary | std::ios::trunc);
+	}
+	writeState();
+};
+
+void Checkpoint::recordPotential(const Parameters<PRISMATIC_FLOAT_PRECISION> &pars)
+{
+	std::lock_guard<std::mutex> writeGatekeeper(writeLock);
+	if (resuming)
+		return;
+
+	{
+		std::ofstream f(prefix + ".pot", std::ios::binary | std::ios::trunc);
+		if (pars.pot.size() > 0)
+			f.write(reinterpret_cast<const char *>(&*pars.pot.begin()), pars.pot.size() * sizeof(PRISMATIC_FLOAT_PRECISION));
+		f.flush();
+		if (!f)
+			throw std::runtime_error("Unable to write the potential of checkpoint " + prefix);
+	}
+	{
+		std::lock_guard<std::mutex> gatekeeper(stateLock);
+		potentialSaved = true;
+		potDims[0] = pars.pot.get_dimk();
+		potDims[1] = pars.pot.get_dimj();
+		potDims[2] = pars.pot.get_dimi();
+		numPlanes = pars.numPlanes;
+		numSlices = pars.numSlices;
+		dzPot = pars.dzPot;
+	}
+	writeState();
+};
+
+void Checkpoint::finishFP(const Parameters<PRISMATIC_FLOAT_PRECISION> &pars, const size_t fpNum)
+{
+	std::lock_guard<std::mutex> writeGatekeeper(writeLock);
+
+	// the sums go to the slot the state file does not refer to
+	size_t slot = 1 - netSlot;
+	{
+		std::ofstream f(prefix + ".net" + std::to_string(slot), std::ios::binary | std::ios::trunc);
+		f.write(reinterpret_cast<const char *>(&*pars.net_output.begin()), pars.net_output.size() * sizeof(PRISMATIC_FLOAT_PRECISION));
+		if (pars.meta.saveDPC_CoM)
+			f.write(reinterpret_cast<const char *>(&*pars.net_DPC_CoM.begin()), pars.net_DPC_CoM.size() * sizeof(PRISMATIC_FLOAT_PRECISION));
+		f.flush();
+		if (!f)
+			throw std::runtime_error("Unable to write the frozen phonon sums of checkpoint " + prefix);
+	}
+
+	{
+		std::lock_guard<std::mutex> gatekeeper(stateLock);
+		completedFP = fpNum + 1;
+		netSlot = slot;
+		netDims[0] = pars.net_output.get_diml();
+		netDims[1] = pars.net_output.get_dimk();
+		netDims[2] = pars.net_output.get_dimj();
+		netDims[3] = pars.net_output.get_dimi();
+		if (pars.meta.saveDPC_CoM)
+		{
+			dpcDims[0] = pars.net_DPC_CoM.get_diml();
+			dpcDims[1] = pars.net_DPC_CoM.get_dimk();
+			dpcDims[2] = pars.net_DPC_CoM.get_dimj();
+			dpcDims[3] = pars.net_DPC_CoM.get_dimi();
+		}
+		fp = completedFP;
+		potentialSaved = false;
+		resuming = false;
+		for (auto &s : stages)
+			s.done.clear();
+		journaled.clear();
+	}
+	writeState();
+
+	// the 4D blocks of this frozen phonon are in the output file now
+	std::lock_guard<std::mutex> journalGatekeeper(journalLock);
+	if (journal.is_open())
+		journal.close();
+	journal.open(prefix + ".journal", std::ios::binary | std::ios::trunc);
+};
+
+std::vector<bool> Checkpoint::beginStage(const Stage _stage, Parameters<PRISMATIC_FLOAT_PRECISION> &pars)
+{
+	std::lock_guard<std::mutex> writeGatekeeper(writeLock);
+	bool restoring = resuming && potentialSaved && fp == pars.meta.fpNum;
+
+	size_t units, unitFloats;
+	if (_stage == Stage::Beams)
+	{
+		units = pars.Scompact.get_dimk();
+		unitFloats = 2 * pars.Scompact.get_dimj() * pars.Scompact.get_dimi();
+	}
+	else
+	{
+		// every probe owns one slot of each layer of the outputs
+		units = pars.numProbes;
+		if (pars.output.get_dimk() * pars.output.get_dimj() != units)
+			throw std::runtime_error("Checkpoints need one output slot per probe");
+		unitFloats = pars.output.get_diml() * pars.output.get_dimi();
+		if (pars.meta.saveDPC_CoM)
+			unitFloats += pars.DPC_CoM.get_diml() * pars.DPC_CoM.get_dimi();
+	}
+
+	stageState &s = stages[(int)_stage];
+	if (restoring && !s.done.empty() && (s.units != units || s.unitFloats != unitFloats))
+		throw std::runtime_error("The checkpoint " + prefix + " does not match this simulation");
+
+	std::vector<bool> done(units, false);
+	if (!restoring)
+		s.done.clear();
+	s.units = units;
+	s.unitFloats = unitFloats;
+
+	{
+		std::lock_guard<std::mutex> gatekeeper(stateLock);
+		stage = _stage;
+		source = &pars;
+		pending.clear();
+	}
+
+	// the workers have not started, and the checkpoint thread waits for writeLock
+	if (!s.done.empty())
+	{
+		std::ifstream f(getStageFile(_stage), std::ios::binary);
+		std::vector<PRISMATIC_FLOAT_PRECISION> buffer;
+		size_t numDone = 0;
+		for (auto &r : s.done)
+		{
+			buffer.resize((r.second - r.first) * unitFloats);
+			f.seekg(r.first * unitFloats * sizeof(PRISMATIC_FLOAT_PRECISION));
+			f.read(reinterpret_cast<char *>(&buffer[0]), buffer.size() * sizeof(PRISMATIC_FLOAT_PRECISION));
+			if (!f)
+				throw std::runtime_error("Unable to read " + getStageFile(_stage));
+			for (auto n = r.first; n < r.second; ++n)
+			{
+				const PRISMATIC_FLOAT_PRECISION *unit = &buffer[(n - r.first) * unitFloats];
+				if (_stage == Stage::Beams)
+				{
+					std::copy(unit, unit + unitFloats, reinterpret_cast<PRISMATIC_FLOAT_PRECISION *>(&pars.Scompact[n * unitFloats / 2]));
+				}
+				else
+				{
+					const size_t bins = pars.output.get_dimi();
+					for (auto l = 0; l < pars.output.get_diml(); ++l, unit += bins)
+						std::copy(unit, unit + bins, &pars.output[(l * units + n) * bins]);
+					if (pars.meta.saveDPC_CoM)
+					{
+						for (auto l = 0; l < pars.DPC_CoM.get_diml(); ++l, unit += 2)
+							std::copy(unit, unit + 2, &pars.DPC_CoM[(l * units + n) * 2]);
+					}
+				}
+				done[n] = true;
+			}
+			numDone += r.second - r.first;
+		}
+		std::cout << "Restored " << numDone << " of " << units << ((_stage == Stage::Beams) ? " beams" : " probes") << " from the checkpoint" << std::endl;
+	}
+
+	if (_stage == Stage::Probes)
+	{
+		// a probe counts as done once every 4D block holding one of its frames is in the journal
+		framesPerProbe = pars.meta.save4DOutput ? pars.output.get_diml() : 0;
+		numXprobes = pars.numXprobes;
+		frameCount.assign(units, 0);
+		if (pars.cbedWriter)
+		{
+			if (restoring)
+				replayJournal(pars);
+			pars.cbedWriter->skipBlocks(journaled);
+			pars.cbedWriter->setJournal([this](const std::string &name, const size_t index, const hsize_t *offset,
+											   const hsize_t *dims, const std::vector<PRISMATIC_FLOAT_PRECISION> &data) {
+				journalBlock(name, index, offset, dims, data);
+			});
+		}
+	}
+	return done;
+};
+
+void Checkpoint::complete(const size_t start, const size_t stop)
+{
+	std::lock_guard<std::mutex> gatekeeper(stateLock);
+	pending.push_back(std::make_pair(start, stop));
+};
+
+void Checkpoint::endStage()
+{
+	commit();
+	std::lock_guard<std::mutex> writeGatekeeper(writeLock);
+	std::lock_guard<std::mutex> gatekeeper(stateLock);
+	source = nullptr;
+	pending.clear();
+};
+
+void Checkpoint::remove()
+{
+	{
+		std::lock_guard<std::mutex> journalGatekeeper(journalLock);
+		if (journal.is_open())
+			journal.close();
+	}
+	std::string suffixes[] = {"", ".tmp", ".pot", ".beams", ".probes", ".net0", ".net1", ".journal"};
+	for (auto &suffix : suffixes)
+		std::remove((prefix + suffix).c_str());
+};
+
+void Checkpoint::commit()
+{
+	std::lock_guard<std::mutex> writeGatekeeper(writeLock);
+
+	// take the pending units whose data is complete; probes wait for the journal to hold their 4D blocks
+	rangeList ready;
+	{
+		std::lock_guard<std::mutex> gatekeeper(stateLock);
+		if (!source)
+			return;
+		rangeList waiting;
+		for (auto &r : pending)
+		{
+			if (stage == Stage::Beams || framesPerProbe == 0)
+			{
+				ready.push_back(r);
+				continue;
+			}
+			for (auto n = r.first; n < r.second; ++n)
+			{
+				rangeList &to = (frameCount[n] >= framesPerProbe) ? ready : waiting;
+				if (!to.empty() && to.back().second == n)
+					++to.back().second;
+				else
+					to.push_back(std::make_pair(n, n + 1));
+			}
+		}
+		pending.swap(waiting);
+	}
+	if (ready.empty())
+		return;
+
+	// units are written where the state file does not yet refer to them
+	writeUnits(ready);
+
+	{
+		std::lock_guard<std::mutex> gatekeeper(stateLock);
+		rangeList &done = stages[(int)stage].done;
+		done.insert(done.end(), ready.begin(), ready.end());
+		std::sort(done.begin(), done.end());
+		rangeList merged;
+		for (auto &r : done)
+		{
+			if (!merged.empty() && r.first <= merged.back().second)
+				merged.back().second = std::max(merged.back().second, r.second);
+			else
+				merged.push_back(r);
+		}
+		done.swap(merged);
+	}
+	writeState();
+};
+
+void Checkpoint::writeUnits(const rangeList &ranges)
+{
+	// completed units are no longer written by the workers, so they are read without stopping them
+	const Parameters<PRISMATIC_FLOAT_PRECISION> &pars = *source;
+	const size_t unitFloats = stages[(int)stage].unitFloats;
+	const size_t units = stages[(int)stage].units;
+	std::string fileName = getStageFile(stage);
+	{
+		std::ofstream create(fileName, std::ios::binary | std::ios::app);
+	}
+	std::fstream f(fileName, std::ios::binary | std::ios::in | std::ios::out);
+
+	std::vector<PRISMATIC_FLOAT_PRECISION> buffer;
+	for (auto &r : ranges)
+	{
+		buffer.resize((r.second - r.first) * unitFloats);
+		for (auto n = r.first; n < r.second; ++n)
+		{
+			PRISMATIC_FLOAT_PRECISION *unit = &buffer[(n - r.first) * unitFloats];
+			if (stage == Stage::Beams)
+			{
+				const PRISMATIC_FLOAT_PRECISION *beam = reinterpret_cast<const PRISMATIC_FLOAT_PRECISION *>(&*pars.Scompact.begin() + n * unitFloats / 2);
+				std::copy(beam, beam + unitFloats, unit);
+			}
+			else
+			{
+				const size_t bins = pars.output.get_dimi();
+				for (auto l = 0; l < pars.output.get_diml(); ++l, unit += bins)
+				{
+					const PRISMATIC_FLOAT_PRECISION *values = &*pars.output.begin() + (l * units + n) * bins;
+					std::copy(values, values + bins, unit);
+				}
+				if (pars.meta.saveDPC_CoM)
+				{
+					for (auto l = 0; l < pars.DPC_CoM.get_diml(); ++l, unit += 2)
+					{
+						const PRISMATIC_FLOAT_PRECISION *values = &*pars.DPC_CoM.begin() + (l * units + n) * 2;
+						std::copy(values, values + 2, unit);
+					}
+				}
+			}
+		}
+		f.seekp(r.first * unitFloats * sizeof(PRISMATIC_FLOAT_PRECISION));
+		f.write(reinterpret_cast<const char *>(&buffer[0]), buffer.size() * sizeof(PRISMATIC_FLOAT_PRECISION));
+	}
+	f.flush();
+	if (!f)
+		throw std::runtime_error("Unable to write " + fileName);
+};
+
+void Checkpoint::journalBlock(const std::string &name,
+							  const size_t index,
+							  const hsize_t *offset,
+							  const hsize_t *dims,
+							  const std::vector<PRISMATIC_FLOAT_PRECISION> &data)
+{
+	{
+		std::lock_guard<std::mutex> journalGatekeeper(journalLock);
+		uint64_t header[11] = {journalMagic, name.size(), index, offset[0], offset[1], offset[2], offset[3], dims[0], dims[1], dims[2], dims[3]};
+		uint64_t count = data.size();
+		journal.write(reinterpret_cast<const char *>(header), sizeof(header));
+		journal.write(name.c_str(), name.size());
+		journal.write(reinterpret_cast<const char *>(&count), sizeof(count));
+		journal.write(reinterpret_cast<const char *>(&data[0]), count * sizeof(PRISMATIC_FLOAT_PRECISION));
+		journal.flush();
+		if (!journal)
+			throw std::runtime_error("Unable to write the 4D journal of checkpoint " + prefix);
+	}
+
+	std::lock_guard<std::mutex> gatekeeper(stateLock);
+	journaled.insert(std::make_pair(name, index));
+	for (auto y = offset[1]; y < offset[1] + dims[1]; ++y)
+	{
+		for (auto x = offset[0]; x < offset[0] + dims[0]; ++x)
+		{
+			if (y * numXprobes + x < frameCount.size())
+				++frameCount[y * numXprobes + x];
+		}
+	}
+};
+
+void Checkpoint::replayJournal(Parameters<PRISMATIC_FLOAT_PRECISION> &pars)
+{
+	// the journaled blocks hold the values the output file is meant to store, so writing them again is safe
+	std::string fileName = prefix + ".journal";
+	std::ifstream f(fileName, std::ios::binary);
+	std::streamoff valid = 0;
+	size_t numBlocks = 0;
+	std::vector<PRISMATIC_FLOAT_PRECISION> data;
+	while (f)
+	{
+		uint64_t header[11];
+		uint64_t count;
+		if (!f.read(reinterpret_cast<char *>(header), sizeof(header)) || header[0] != journalMagic || header[1] > 1024)
+			break;
+		std::string name(header[1], ' ');
+		if (!f.read(&name[0], header[1]) || !f.read(reinterpret_cast<char *>(&count), sizeof(count)))
+			break;
+		hsize_t offset[4] = {header[3], header[4], header[5], header[6]};
+		hsize_t dims[4] = {header[7], header[8], header[9], header[10]};
+		if (count == 0 || count % (dims[0] * dims[1] * dims[2] * dims[3]) != 0)
+			break;
+		data.resize(count);
+		if (!f.read(reinterpret_cast<char *>(&data[0]), count * sizeof(PRISMATIC_FLOAT_PRECISION)))
+			break;
+		valid = f.tellg();
+
+		{
+			std::lock_guard<std::mutex> fileGatekeeper(DatacubeWriter::fileLock);
+			H5::DataSet dataset = pars.outputFile.openGroup(name).openDataSet("data");
+			H5::DataSpace mspace(4, dims);
+			H5::DataSpace fspace = dataset.getSpace();
+			fspace.selectHyperslab(H5S_SELECT_SET, dims, offset);
+			dataset.write(&data[0], dataset.getDataType(), mspace, fspace);
+		}
+
+		journaled.insert(std::make_pair(name, (size_t)header[2]));
+		for (auto y = offset[1]; y < offset[1] + dims[1]; ++y)
+		{
+			for (auto x = offset[0]; x < offset[0] + dims[0]; ++x)
+			{
+				if (y * numXprobes + x < frameCount.size())
+					++frameCount[y * numXprobes + x];
+			}
+		}
+		++numBlocks;
+	}
+	f.close();
+	std::cout << "Restored " << numBlocks << " 4D blocks from the checkpoint" << std::endl;
+
+	// new entries overwrite a torn entry at the end
+	std::lock_guard<std::mutex> journalGatekeeper(journalLock);
+	if (journal.is_open())
+		journal.close();
+	{
+		std::ofstream create(fileName, std::ios::binary | std::ios::app);
+	}
+	journal.open(fileName, std::ios::binary | std::ios::in | std::ios::out);
+	journal.seekp(valid);
+};
+
+void Checkpoint::run()
+{
+	std::unique_lock<std::mutex> gatekeeper(stateLock);
+	while (!stopping)
+	{
+		wake.wait_for(gatekeeper, std::chrono::seconds(interval), [this] { return stopping; });
+		if (stopping)
+			break;
+		gatekeeper.unlock();
+		try
+		{
+			commit();
+		}
+		catch (std::exception &e)
+		{
+			// a failed checkpoint only costs progress on resume, so the run goes on
+			std::cout << "Writing checkpoint " << prefix << " failed: " << e.what() << std::endl;
+		}
+		gatekeeper.lock();
+	}
+};
+} // namespace Prismatic
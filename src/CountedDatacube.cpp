@@ -0,0 +1,91 @@
+// Copyright Alan (AJ) Pryor, Jr. 2017
+// Transcribed from MATLAB code by Colin Ophus
+// Prismatic is distributed under the GNU General Public License (GPL)
+// If you use Prismatic, we kindly ask that you cite the following papers:
+
+// 1. Ophus, C.: A fast image simulation algorithm for scanning
+//    transmission electron microscopy. Advanced Structural and
+//    Chemical Imaging 3(1), 13 (2017)
+
+// 2. Pryor, Jr., A., Ophus, C., and Miao, J.: A Streaming Multi-GPU
+//    Implementation of Image Simulation Algorithms for Scanning
+//	  Transmission Electron Microscopy. arXiv:1706.08563 (2017)
+
+#include "CountedDatacube.h"
+#include <random>
+
+namespace Prismatic
+{
+CountedDatacube::CountedDatacube(const std::string &_groupPath,
+								 const size_t _numX,
+								 const size_t _numY) : groupPath(_groupPath),
+													   numX(_numX),
+													   numY(_numY),
+													   events(_numX * _numY){};
+
+void CountedDatacube::addFrame(const size_t ax,
+							   const size_t ay,
+							   const PRISMATIC_FLOAT_PRECISION *frame,
+							   const size_t frameSize,
+							   const PRISMATIC_FLOAT_PRECISION electrons,
+							   const unsigned int seed)
+{
+	// seeding by probe keeps the counts independent of which thread handles the probe
+	std::seed_seq seq{seed, (unsigned int)ax, (unsigned int)ay};
+	std::mt19937 rng(seq);
+
+	eventList sampled;
+	for (auto i = 0; i < frameSize; ++i)
+	{
+		double lambda = frame[i] * electrons;
+		if (lambda <= 0)
+			continue;
+		std::poisson_distribution<uint32_t> pd(lambda);
+		uint32_t count = pd(rng);
+		if (count > 0)
+			sampled.push_back(std::make_pair((uint32_t)i, count));
+	}
+
+	// merge with the counts of earlier frozen phonons, both lists are sorted by pixel
+	eventList &probe = events[ax * numY + ay];
+	eventList merged;
+	merged.reserve(probe.size() + sampled.size());
+	auto a = probe.begin();
+	auto b = sampled.begin();
+	while (a != probe.end() || b != sampled.end())
+	{
+		if (b == sampled.end() || (a != probe.end() && a->first < b->first))
+			merged.push_back(*a++);
+		else if (a == probe.end() || b->first < a->first)
+			merged.push_back(*b++);
+		else
+		{
+			merged.push_back(std::make_pair(a->first, a->second + b->second));
+			++a;
+			++b;
+		}
+	}
+	probe.swap(merged);
+};
+
+void CountedDatacube::getEvents(std::vector<uint64_t> &offsets,
+								std::vector<uint32_t> &indices,
+								std::vector<uint32_t> &counts) const
+{
+	offsets.resize(events.size() + 1);
+	offsets[0] = 0;
+	for (auto p = 0; p < events.size(); ++p)
+		offsets[p + 1] = offsets[p] + events[p].size();
+
+	indices.resize(offsets.back());
+	counts.resize(offsets.back());
+	for (auto p = 0; p < events.size(); ++p)
+	{
+		for (auto e = 0; e < events[p].size(); ++e)
+		{
+			indices[offsets[p] + e] = events[p][e].first;
+			counts[offsets[p] + e] = events[p][e].second;
+		}
+	}
+};
+} // namespace Prismatic
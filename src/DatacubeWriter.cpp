@@ -0,0 +1,275 @@
+// Copyright Alan (AJ) Pryor, Jr. 2017
+// Transcribed from MATLAB code by Colin Ophus
+// Prismatic is distributed under the GNU General Public License (GPL)
+// If you use Prismatic, we kindly ask that you cite the following papers:
+
+// 1. Ophus, C.: A fast image simulation algorithm for scanning
+//    transmission electron microscopy. Advanced Structural and
+//    Chemical Imaging 3(1), 13 (2017)
+
+// 2. Pryor, Jr., A., Ophus, C., and Miao, J.: A Streaming Multi-GPU
+//    Implementation of Image Simulation Algorithms for Scanning
+//	  Transmission Electron Microscopy. arXiv:1706.08563 (2017)
+
+#include "DatacubeWriter.h"
+#include <algorithm>
+#include <cstdio>
+
+namespace Prismatic
+{
+size_t DatacubeWriter::targetBlockBytes = 64 * 1024 * 1024;
+
+std::mutex DatacubeWriter::fileLock;
+
+DatacubeWriter::DatacubeWriter(H5::H5File _file,
+							   const size_t _numX,
+							   const size_t _numY,
+							   const bool _addToFile,
+							   const std::string _shardPrefix,
+							   const H5::DSetCreatPropList _shardProps,
+							   const std::shared_ptr<const FrameQuantizer> _quantizer) : file(_file),
+																		  numX(_numX),
+																		  numY(_numY),
+																		  blockX(0),
+																		  blockY(0),
+																		  addToFile(_addToFile),
+																		  finished(false),
+																		  shardPrefix(_shardPrefix),
+																		  shardProps(_shardProps),
+																		  quantizer(_quantizer)
+{
+	writer = std::thread(&DatacubeWriter::run, this);
+};
+
+DatacubeWriter::~DatacubeWriter()
+{
+	if (writer.joinable())
+	{
+		{
+			std::lock_guard<std::mutex> gatekeeper(queueLock);
+			finished = true;
+		}
+		queueReady.notify_one();
+		writer.join();
+	}
+};
+
+std::shared_ptr<DatacubeWriter::stagingBlock> DatacubeWriter::getBlock(const std::string &name,
+																		 const size_t ax,
+																		 const size_t ay,
+																		 const hsize_t *mdims,
+																		 const size_t frameSize)
+{
+	std::lock_guard<std::mutex> gatekeeper(blockLock);
+	if (blockX == 0)
+	{
+		// sized by the stored elements, so that shard blocks match the virtual dataset laid out by setup4DOutput
+		const size_t frameElements = mdims[2] * mdims[3];
+		getBlockShape(numX, numY, frameElements * getElementBytes(frameSize / frameElements, quantizer.get()), blockX, blockY);
+	}
+
+	size_t blockIndex = (ay / blockY) * ((numX + blockX - 1) / blockX) + ax / blockX;
+	if (skipped.count(std::make_pair(name, blockIndex)))
+		return nullptr;
+	std::shared_ptr<stagingBlock> &block = blocks[std::make_pair(name, blockIndex)];
+	if (!block)
+	{
+		block = std::make_shared<stagingBlock>();
+		block->name = name;
+		block->index = blockIndex;
+		block->offset[0] = (ax / blockX) * blockX;
+		block->offset[1] = (ay / blockY) * blockY;
+		block->offset[2] = block->offset[3] = 0;
+		block->dims[0] = std::min(blockX, numX - (size_t)block->offset[0]);
+		block->dims[1] = std::min(blockY, numY - (size_t)block->offset[1]);
+		block->dims[2] = mdims[2];
+		block->dims[3] = mdims[3];
+		block->data = std::vector<PRISMATIC_FLOAT_PRECISION>(block->dims[0] * block->dims[1] * frameSize, 0);
+		block->remaining = block->dims[0] * block->dims[1];
+	}
+	return block;
+};
+
+void DatacubeWriter::push(const std::string &name,
+						  const PRISMATIC_FLOAT_PRECISION *frame,
+						  const hsize_t *mdims,
+						  const hsize_t *offset,
+						  const size_t valuesPerElement,
+						  const PRISMATIC_FLOAT_PRECISION numFP)
+{
+	const size_t frameSize = mdims[2] * mdims[3] * valuesPerElement;
+	std::shared_ptr<stagingBlock> block = getBlock(name, offset[0], offset[1], mdims, frameSize);
+	if (!block)
+		return;
+
+	// frames own disjoint slots of the block, so the copy needs no lock
+	size_t slot = (offset[0] - block->offset[0]) * block->dims[1] + (offset[1] - block->offset[1]);
+	PRISMATIC_FLOAT_PRECISION *dst = &block->data[slot * frameSize];
+	for (auto i = 0; i < frameSize; ++i)
+		dst[i] = frame[i] / numFP;
+
+	if (--block->remaining == 0)
+	{
+		{
+			std::lock_guard<std::mutex> gatekeeper(blockLock);
+			blocks.erase(std::make_pair(name, block->index));
+		}
+		{
+			std::lock_guard<std::mutex> gatekeeper(queueLock);
+			ready.push_back(block);
+		}
+		queueReady.notify_one();
+	}
+};
+
+void DatacubeWriter::setJournal(const blockJournal &_journal)
+{
+	journal = _journal;
+};
+
+void DatacubeWriter::skipBlocks(const std::set<std::pair<std::string, size_t> > &_skipped)
+{
+	std::lock_guard<std::mutex> gatekeeper(blockLock);
+	skipped = _skipped;
+};
+
+size_t DatacubeWriter::getElementBytes(const size_t valuesPerElement,
+									   const FrameQuantizer *quantizer)
+{
+	return quantizer ? quantizer->getFileType().getSize() : valuesPerElement * sizeof(PRISMATIC_FLOAT_PRECISION);
+};
+
+void DatacubeWriter::getBlockShape(const size_t numX,
+								   const size_t numY,
+								   const size_t frameBytes,
+								   size_t &blockX,
+								   size_t &blockY)
+{
+	// bands of whole scan rows when a row fits in the target size, otherwise runs of probes within a row
+	blockY = std::max((size_t)1, std::min(numY, targetBlockBytes / (frameBytes * numX)));
+	blockX = (blockY > 1) ? numX : std::max((size_t)1, std::min(numX, targetBlockBytes / frameBytes));
+};
+
+std::string DatacubeWriter::getShardName(const std::string &shardPrefix,
+										 const std::string &name,
+										 const size_t blockIndex)
+{
+	char buffer[20];
+	sprintf(buffer, "%06d", (int)blockIndex);
+	return shardPrefix + "_" + name.substr(name.find_last_of('/') + 1) + "_shard" + buffer + ".h5";
+};
+
+void DatacubeWriter::writeBlock(stagingBlock &block)
+{
+	std::lock_guard<std::mutex> fileGatekeeper(fileLock);
+	H5::Group dataGroup = file.openGroup(block.name);
+	H5::DataSet dataset = dataGroup.openDataSet("data");
+	H5::DataSpace mspace(4, block.dims);
+	H5::DataSpace fspace;
+	H5::H5File shard;
+	if (shardPrefix.empty())
+	{
+		fspace = dataset.getSpace();
+		fspace.selectHyperslab(H5S_SELECT_SET, block.dims, block.offset);
+	}
+	else
+	{
+		// the block is the whole shard; the first pass creates it with the datacube's element type
+		std::string shardName = getShardName(shardPrefix, block.name, block.index);
+		fspace = H5::DataSpace(4, block.dims);
+		if (addToFile)
+		{
+			shard = H5::H5File(shardName.c_str(), H5F_ACC_RDWR);
+			dataset = shard.openDataSet("data");
+		}
+		else
+		{
+			// shards keep the filters of the output but their chunks can not outgrow the block
+			H5::DSetCreatPropList plist;
+			plist.copy(shardProps);
+			if (plist.getLayout() == H5D_CHUNKED)
+			{
+				hsize_t chunkDims[4];
+				plist.getChunk(4, chunkDims);
+				for (auto i = 0; i < 4; ++i)
+					chunkDims[i] = std::min(chunkDims[i], block.dims[i]);
+				plist.setChunk(4, chunkDims);
+			}
+			H5::DataType dataType = dataset.getDataType();
+			shard = H5::H5File(shardName.c_str(), H5F_ACC_TRUNC);
+			dataset = shard.createDataSet("data", dataType, fspace, plist);
+		}
+	}
+
+	if (quantizer)
+	{
+		// scale and offset of the patterns stay in the main file, also for shards
+		quantizer->writeFrames(dataGroup, dataset, fspace, block.dims, block.offset, block.data, addToFile);
+	}
+	else
+	{
+		if (addToFile)
+		{
+			std::vector<PRISMATIC_FLOAT_PRECISION> stored(block.data.size());
+			dataset.read(&stored[0], dataset.getDataType(), mspace, fspace);
+			for (auto i = 0; i < stored.size(); ++i)
+				block.data[i] += stored[i];
+		}
+		if (journal)
+			journal(block.name, block.index, block.offset, block.dims, block.data);
+		dataset.write(&block.data[0], dataset.getDataType(), mspace, fspace);
+	}
+
+	fspace.close();
+	mspace.close();
+	dataset.close();
+	dataGroup.close();
+	if (!shardPrefix.empty())
+		shard.close();
+	std::vector<PRISMATIC_FLOAT_PRECISION>().swap(block.data);
+};
+
+void DatacubeWriter::run()
+{
+	while (true)
+	{
+		std::unique_lock<std::mutex> gatekeeper(queueLock);
+		queueReady.wait(gatekeeper, [this] { return finished || !ready.empty(); });
+		if (ready.empty())
+			return;
+		std::shared_ptr<stagingBlock> block = ready.front();
+		ready.pop_front();
+		gatekeeper.unlock();
+
+		if (writerError)
+			continue; // keep draining so workers never wait on a failed writer
+		try
+		{
+			writeBlock(*block);
+		}
+		catch (...)
+		{
+			writerError = std::current_exception();
+		}
+	}
+};
+
+void DatacubeWriter::finish()
+{
+	// drain the queue, write any block that did not receive all of its frames, and flush once
+	{
+		std::lock_guard<std::mutex> gatekeeper(queueLock);
+		finished = true;
+	}
+	queueReady.notify_one();
+	writer.join();
+	if (writerError)
+		std::rethrow_exception(writerError);
+
+	for (auto &b : blocks)
+		writeBlock(*b.second);
+	blocks.clear();
+	std::lock_guard<std::mutex> fileGatekeeper(fileLock);
+	file.flush(H5F_SCOPE_LOCAL);
+};
+} // namespace Prismatic
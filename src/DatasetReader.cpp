@@ -0,0 +1,146 @@
+// Copyright Alan (AJ) Pryor, Jr. 2017
+// Transcribed from MATLAB code by Colin Ophus
+// Prismatic is distributed under the GNU General Public License (GPL)
+// If you use Prismatic, we kindly ask that you cite the following papers:
+
+// 1. Ophus, C.: A fast image simulation algorithm for scanning
+//    transmission electron microscopy. Advanced Structural and
+//    Chemical Imaging 3(1), 13 (2017)
+
+// 2. Pryor, Jr., A., Ophus, C., and Miao, J.: A Streaming Multi-GPU
+//    Implementation of Image Simulation Algorithms for Scanning
+//	  Transmission Electron Microscopy. arXiv:1706.08563 (2017)
+
+#include "DatasetReader.h"
+#include <algorithm>
+#include <stdexcept>
+
+namespace Prismatic
+{
+template <class T>
+DatasetReader<T>::DatasetReader(const std::string &filename,
+								const std::string &dataPath,
+								const size_t _cacheBytes) : cacheBytes(_cacheBytes),
+															cachedBytes(0)
+{
+	file = H5::H5File(filename.c_str(), H5F_ACC_RDONLY);
+
+	// the HDF5 chunk cache gets the same budget, so partial reads of compressed chunks do not decompress them twice
+	H5::DSetAccPropList aplist;
+	aplist.setChunkCache(12421, std::max(cacheBytes, (size_t)1024 * 1024), 0.75);
+	dataset = file.openDataSet(dataPath.c_str(), aplist);
+
+	H5::DataSpace fspace = dataset.getSpace();
+	dims.resize(fspace.getSimpleExtentNdims());
+	fspace.getSimpleExtentDims(&dims[0], NULL);
+	fspace.close();
+
+	// complex datasets are read with their own compound type, as readComplexDataSet_inOrder does
+	memType = (sizeof(T) == sizeof(PRISMATIC_FLOAT_PRECISION)) ? H5::DataType(PFP_TYPE) : dataset.getDataType();
+	if (sizeof(T) != sizeof(PRISMATIC_FLOAT_PRECISION) && dataset.getDataType().getSize() != sizeof(T))
+		throw std::runtime_error("Dataset " + dataPath + " does not match the element type of the reader.\n");
+
+	entrySize = 1;
+	for (auto i = 1; i < dims.size(); ++i)
+		entrySize *= dims[i];
+};
+
+template <class T>
+DatasetReader<T>::~DatasetReader()
+{
+	// prefetches still hold the dataset
+	for (auto &p : pending)
+		p.second.wait();
+	dataset.close();
+	file.close();
+};
+
+template <class T>
+size_t DatasetReader<T>::getSlabLength() const
+{
+	return std::max((size_t)1, std::min((size_t)dims[0], cacheBytes / (4 * entrySize * sizeof(T))));
+};
+
+template <class T>
+void DatasetReader<T>::read(const hsize_t *offset, const hsize_t *count, T *buffer)
+{
+	std::lock_guard<std::mutex> gatekeeper(h5Lock);
+	H5::DataSpace fspace = dataset.getSpace();
+	H5::DataSpace mspace(dims.size(), count);
+	fspace.selectHyperslab(H5S_SELECT_SET, count, offset);
+	dataset.read(buffer, memType, mspace, fspace);
+	mspace.close();
+	fspace.close();
+};
+
+template <class T>
+std::shared_ptr<const std::vector<T> > DatasetReader<T>::readSlab(const size_t first, const size_t num)
+{
+	std::vector<hsize_t> offset(dims.size(), 0);
+	std::vector<hsize_t> count(dims);
+	offset[0] = first;
+	count[0] = num;
+	std::shared_ptr<std::vector<T> > slab = std::make_shared<std::vector<T> >(num * entrySize);
+	read(&offset[0], &count[0], &(*slab)[0]);
+	return slab;
+};
+
+template <class T>
+void DatasetReader<T>::cacheSlab(const slabKey &key, std::shared_ptr<const std::vector<T> > slab)
+{
+	// called with cacheLock held; the oldest slabs go first, callers keep theirs alive through the shared pointer
+	if (cache.count(key))
+		return;
+	cache[key] = slab;
+	cacheOrder.push_back(key);
+	cachedBytes += slab->size() * sizeof(T);
+	while (cachedBytes > cacheBytes && cacheOrder.size() > 1)
+	{
+		cachedBytes -= cache[cacheOrder.front()]->size() * sizeof(T);
+		cache.erase(cacheOrder.front());
+		cacheOrder.pop_front();
+	}
+};
+
+template <class T>
+std::shared_ptr<const std::vector<T> > DatasetReader<T>::getSlab(const size_t first, const size_t num)
+{
+	if (first + num > dims[0])
+		throw std::out_of_range("Requested slab exceeds the outer dimension of the dataset.\n");
+
+	slabKey key = std::make_pair(first, num);
+	std::shared_future<std::shared_ptr<const std::vector<T> > > request;
+	{
+		std::lock_guard<std::mutex> gatekeeper(cacheLock);
+		auto cached = cache.find(key);
+		if (cached != cache.end())
+			return cached->second;
+		auto fetching = pending.find(key);
+		if (fetching != pending.end())
+		{
+			request = fetching->second;
+			pending.erase(fetching);
+		}
+	}
+
+	std::shared_ptr<const std::vector<T> > slab = request.valid() ? request.get() : readSlab(first, num);
+	std::lock_guard<std::mutex> gatekeeper(cacheLock);
+	cacheSlab(key, slab);
+	return slab;
+};
+
+template <class T>
+void DatasetReader<T>::prefetch(const size_t first, const size_t num)
+{
+	if (num == 0 || first + num > dims[0])
+		return;
+	slabKey key = std::make_pair(first, num);
+	std::lock_guard<std::mutex> gatekeeper(cacheLock);
+	if (cache.count(key) || pending.count(key))
+		return;
+	pending[key] = std::async(std::launch::async, &DatasetReader<T>::readSlab, this, first, num).share();
+};
+
+template class DatasetReader<PRISMATIC_FLOAT_PRECISION>;
+template class DatasetReader<std::complex<PRISMATIC_FLOAT_PRECISION> >;
+} // namespace Prismatic
@@ -0,0 +1,119 @@
+// Copyright Alan (AJ) Pryor, Jr. 2017
+// Transcribed from MATLAB code by Colin Ophus
+// Prismatic is distributed under the GNU General Public License (GPL)
+// If you use Prismatic, we kindly ask that you cite the following papers:
+
+// 1. Ophus, C.: A fast image simulation algorithm for scanning
+//    transmission electron microscopy. Advanced Structural and
+//    Chemical Imaging 3(1), 13 (2017)
+
+// 2. Pryor, Jr., A., Ophus, C., and Miao, J.: A Streaming Multi-GPU
+//    Implementation of Image Simulation Algorithms for Scanning
+//	  Transmission Electron Microscopy. arXiv:1706.08563 (2017)
+
+
+#include "FPConvergence.h"
+#include "fileIO.h"
+#include <iostream>
+#include <algorithm>
+#include <limits>
+#include <cmath>
+
+namespace Prismatic
+{
+FPConvergence::FPConvergence(const Metadata<PRISMATIC_FLOAT_PRECISION> &meta) : target(meta.targetFPError),
+																				 minFP(std::max((size_t)2, meta.minFP)),
+																				 output(meta.convergenceOutput),
+																				 count(0){};
+
+void FPConvergence::sample(const Parameters<PRISMATIC_FLOAT_PRECISION> &pars, std::vector<double> &values) const
+{
+	if (output == ConvergenceOutput::DPC_CoM)
+	{
+		values.assign(pars.DPC_CoM.begin(), pars.DPC_CoM.end());
+	}
+	else if (output == ConvergenceOutput::Annular2D)
+	{
+		// the annular image of saveSTEM, one per output depth
+		size_t lower = std::max((size_t)0, (size_t)(pars.meta.integrationAngleMin / pars.meta.detectorAngleStep));
+		size_t upper = std::min(pars.detectorAngles.size(), (size_t)(pars.meta.integrationAngleMax / pars.meta.detectorAngleStep));
+		values.assign(pars.output.get_dimk() * pars.output.get_dimj() * pars.output.get_diml(), 0);
+		auto v = values.begin();
+		for (auto j = 0; j < pars.output.get_diml(); ++j)
+		{
+			for (auto y = 0; y < pars.output.get_dimk(); ++y)
+			{
+				for (auto x = 0; x < pars.output.get_dimj(); ++x, ++v)
+				{
+					for (auto b = lower; b < upper; ++b)
+						*v += pars.output.at(j, y, x, b);
+				}
+			}
+		}
+	}
+	else
+	{
+		values.assign(pars.output.begin(), pars.output.end());
+	}
+};
+
+void FPConvergence::add(const Parameters<PRISMATIC_FLOAT_PRECISION> &pars)
+{
+	std::vector<double> values;
+	sample(pars, values);
+	++count;
+	if (count == 1)
+	{
+		mean = values;
+		m2.assign(values.size(), 0);
+	}
+	else
+	{
+		// Welford's update keeps the variance accurate when the configurations differ little
+		for (auto i = 0; i < values.size(); ++i)
+		{
+			double delta = values[i] - mean[i];
+			mean[i] += delta / count;
+			m2[i] += delta * (values[i] - mean[i]);
+		}
+	}
+	std::cout << "Relative standard error after " << count << " frozen phonons: " << getError()
+			  << " (target " << target << ")" << std::endl;
+};
+
+PRISMATIC_FLOAT_PRECISION FPConvergence::getError() const
+{
+	if (count < 2)
+		return std::numeric_limits<PRISMATIC_FLOAT_PRECISION>::infinity();
+
+	// the variance of the mean is the sample variance over the number of configurations
+	double variance = 0;
+	double norm = 0;
+	for (auto i = 0; i < mean.size(); ++i)
+	{
+		variance += m2[i] / (count - 1) / count;
+		norm += mean[i] * mean[i];
+	}
+	if (norm == 0)
+		return (variance == 0) ? 0 : std::numeric_limits<PRISMATIC_FLOAT_PRECISION>::infinity();
+	return std::sqrt(variance / norm);
+};
+
+bool FPConvergence::converged() const
+{
+	return count >= minFP && getError() <= target;
+};
+
+void FPConvergence::finish(Parameters<PRISMATIC_FLOAT_PRECISION> &pars) const
+{
+	if (count == 0 || count >= pars.meta.numFP)
+		return;
+
+	std::cout << "Target error reached after " << count << " of at most " << pars.meta.numFP << " frozen phonons" << std::endl;
+
+	// 4D frames were written with a weight of 1/numFP as they were computed
+	if (pars.meta.save4DOutput)
+		rescale4DOutput(pars, (PRISMATIC_FLOAT_PRECISION)pars.meta.numFP / count);
+	pars.meta.numFP = count;
+};
+} // namespace Prismatic
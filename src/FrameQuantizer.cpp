@@ -0,0 +1,124 @@
+// Copyright Alan (AJ) Pryor, Jr. 2017
+// Transcribed from MATLAB code by Colin Ophus
+// Prismatic is distributed under the GNU General Public License (GPL)
+// If you use Prismatic, we kindly ask that you cite the following papers:
+
+// 1. Ophus, C.: A fast image simulation algorithm for scanning
+//    transmission electron microscopy. Advanced Structural and
+//    Chemical Imaging 3(1), 13 (2017)
+
+// 2. Pryor, Jr., A., Ophus, C., and Miao, J.: A Streaming Multi-GPU
+//    Implementation of Image Simulation Algorithms for Scanning
+//	  Transmission Electron Microscopy. arXiv:1706.08563 (2017)
+
+#include "FrameQuantizer.h"
+#include <algorithm>
+#include <cmath>
+
+namespace Prismatic
+{
+const PRISMATIC_FLOAT_PRECISION FrameQuantizer::logFloor = 1e-10;
+
+FrameQuantizer::FrameQuantizer(const int _bits, const bool _logScale) : bits(_bits),
+																		logScale(_logScale),
+																		maxLevel((PRISMATIC_FLOAT_PRECISION)((1 << _bits) - 1)){};
+
+const H5::PredType &FrameQuantizer::getFileType() const
+{
+	return (bits == 8) ? H5::PredType::STD_U8LE : H5::PredType::STD_U16LE;
+};
+
+PRISMATIC_FLOAT_PRECISION FrameQuantizer::getZeroOffset() const
+{
+	return logScale ? std::log(logFloor) : 0;
+};
+
+void FrameQuantizer::encode(const PRISMATIC_FLOAT_PRECISION *frame,
+							const size_t frameSize,
+							uint16_t *levels,
+							PRISMATIC_FLOAT_PRECISION &scale,
+							PRISMATIC_FLOAT_PRECISION &offset) const
+{
+	// intensities are not negative, small negative values from round off are clamped
+	PRISMATIC_FLOAT_PRECISION minVal = std::max(*std::min_element(frame, frame + frameSize), (PRISMATIC_FLOAT_PRECISION)0);
+	PRISMATIC_FLOAT_PRECISION maxVal = std::max(*std::max_element(frame, frame + frameSize), (PRISMATIC_FLOAT_PRECISION)0);
+	if (logScale)
+	{
+		minVal = std::log(minVal + logFloor);
+		maxVal = std::log(maxVal + logFloor);
+	}
+	offset = minVal;
+	scale = (maxVal - minVal) / maxLevel;
+
+	for (auto i = 0; i < frameSize; ++i)
+	{
+		PRISMATIC_FLOAT_PRECISION val = std::max(frame[i], (PRISMATIC_FLOAT_PRECISION)0);
+		if (logScale)
+			val = std::log(val + logFloor);
+		PRISMATIC_FLOAT_PRECISION level = (scale > 0) ? std::round((val - offset) / scale) : 0;
+		levels[i] = (uint16_t)std::min(std::max(level, (PRISMATIC_FLOAT_PRECISION)0), maxLevel);
+	}
+};
+
+void FrameQuantizer::decode(const uint16_t *levels,
+							const size_t frameSize,
+							const PRISMATIC_FLOAT_PRECISION scale,
+							const PRISMATIC_FLOAT_PRECISION offset,
+							PRISMATIC_FLOAT_PRECISION *frame) const
+{
+	for (auto i = 0; i < frameSize; ++i)
+	{
+		frame[i] = offset + scale * levels[i];
+		if (logScale)
+			frame[i] = std::max(std::exp(frame[i]) - logFloor, (PRISMATIC_FLOAT_PRECISION)0);
+	}
+};
+
+void FrameQuantizer::writeFrames(H5::Group &group,
+								 H5::DataSet &dataset,
+								 H5::DataSpace &fspace,
+								 const hsize_t *dims,
+								 const hsize_t *offset,
+								 std::vector<PRISMATIC_FLOAT_PRECISION> &frames,
+								 const bool addToStored) const
+{
+	const size_t numFrames = dims[0] * dims[1];
+	const size_t frameSize = dims[2] * dims[3];
+	H5::DataSet scaleData = group.openDataSet("scale");
+	H5::DataSet offsetData = group.openDataSet("offset");
+	H5::DataSpace mspace(4, dims);
+	H5::DataSpace pspace(2, dims);
+	H5::DataSpace pfspace = scaleData.getSpace();
+	pfspace.selectHyperslab(H5S_SELECT_SET, dims, offset);
+
+	std::vector<uint16_t> levels(frames.size());
+	std::vector<PRISMATIC_FLOAT_PRECISION> scales(numFrames);
+	std::vector<PRISMATIC_FLOAT_PRECISION> offsets(numFrames);
+	if (addToStored)
+	{
+		dataset.read(&levels[0], H5::PredType::NATIVE_UINT16, mspace, fspace);
+		scaleData.read(&scales[0], PFP_TYPE, pspace, pfspace);
+		offsetData.read(&offsets[0], PFP_TYPE, pspace, pfspace);
+		std::vector<PRISMATIC_FLOAT_PRECISION> stored(frameSize);
+		for (auto f = 0; f < numFrames; ++f)
+		{
+			decode(&levels[f * frameSize], frameSize, scales[f], offsets[f], &stored[0]);
+			for (auto i = 0; i < frameSize; ++i)
+				frames[f * frameSize + i] += stored[i];
+		}
+	}
+
+	for (auto f = 0; f < numFrames; ++f)
+		encode(&frames[f * frameSize], frameSize, &levels[f * frameSize], scales[f], offsets[f]);
+
+	dataset.write(&levels[0], H5::PredType::NATIVE_UINT16, mspace, fspace);
+	scaleData.write(&scales[0], PFP_TYPE, pspace, pfspace);
+	offsetData.write(&offsets[0], PFP_TYPE, pspace, pfspace);
+
+	pfspace.close();
+	pspace.close();
+	mspace.close();
+	offsetData.close();
+	scaleData.close();
+};
+} // namespace Prismatic
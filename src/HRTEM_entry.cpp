@@ -29,16 +29,8 @@ namespace Prismatic
 void HRTEM_entry(Metadata<PRISMATIC_FLOAT_PRECISION> &meta)
 {
 
-	Parameters<PRISMATIC_FLOAT_PRECISION> pars;
-    try
-    { // read atomic coordinates
-        pars = Parameters<PRISMATIC_FLOAT_PRECISION>(meta);
-    }
-    catch (...)
-    {
-        std::cout << "Terminating" << std::endl;
-        exit(1);
-    }
+	// read atomic coordinates; a failure reaches the caller, which ends the program or only the job it serves
+	Parameters<PRISMATIC_FLOAT_PRECISION> pars(meta);
 
 	HRTEM_entry_pars(pars);
 }
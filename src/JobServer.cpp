@@ -0,0 +1,359 @@
+// Copyright Alan (AJ) Pryor, Jr. 2017
+// Transcribed from MATLAB code by Colin Ophus
+// Prismatic is distributed under the GNU General Public License (GPL)
+// If you use Prismatic, we kindly ask that you cite the following papers:
+
+// 1. Ophus, C.: A fast image simulation algorithm for scanning
+//    transmission electron microscopy. Advanced Structural and
+//    Chemical Imaging 3(1), 13 (2017)
+
+// 2. Pryor, Jr., A., Ophus, C., and Miao, J.: A Streaming Multi-GPU
+//    Implementation of Image Simulation Algorithms for Scanning
+//	  Transmission Electron Microscopy. arXiv:1706.08563 (2017)
+
+#include "JobServer.h"
+#include "go.h"
+#include "parseInput.h"
+#include "MPIComm.h"
+#include <iostream>
+#include <sstream>
+#include <chrono>
+#include <cctype>
+#include <cstring>
+#include <algorithm>
+#include <stdexcept>
+#ifndef _WIN32
+#include <csignal>
+#include <cerrno>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#endif //_WIN32
+
+namespace Prismatic
+{
+namespace
+{
+std::string trimJob(const std::string &line)
+{
+	size_t start = line.find_first_not_of(" \t\r\n");
+	if (start == std::string::npos) return "";
+	size_t stop = line.find_last_not_of(" \t\r\n");
+	return line.substr(start, stop - start + 1);
+};
+
+// turn a one line JSON object such as {"num-threads": 8, "probe-step": [0.2, 0.2]} into command line options
+bool parseJSONOptions(const std::string &json, std::vector<std::string> &tokens, std::string &error)
+{
+	size_t pos = 0;
+	auto skip = [&]() {
+		while (pos < json.size() && std::isspace((unsigned char)json[pos]))
+			++pos;
+	};
+	auto expect = [&](const char c) {
+		skip();
+		if (pos < json.size() && json[pos] == c)
+		{
+			++pos;
+			return true;
+		}
+		return false;
+	};
+	auto readString = [&](std::string &out) {
+		skip();
+		if (pos >= json.size() || json[pos] != '"') return false;
+		out.clear();
+		for (++pos; pos < json.size(); ++pos)
+		{
+			char c = json[pos];
+			if (c == '"')
+			{
+				++pos;
+				return true;
+			}
+			if (c == '\\' && pos + 1 < json.size())
+			{
+				c = json[++pos];
+				if (c == 'n') c = '\n';
+				else if (c == 't') c = '\t';
+			}
+			out += c;
+		}
+		return false;
+	};
+	// numbers and booleans are passed on as the words the options expect
+	auto readValue = [&](std::string &out) {
+		skip();
+		if (pos < json.size() && json[pos] == '"') return readString(out);
+		size_t start = pos;
+		while (pos < json.size() && !std::isspace((unsigned char)json[pos]) && json[pos] != ',' && json[pos] != '}' && json[pos] != ']')
+			++pos;
+		out = json.substr(start, pos - start);
+		if (out == "true") out = "1";
+		else if (out == "false") out = "0";
+		return !out.empty();
+	};
+
+	if (!expect('{'))
+	{
+		error = "a JSON job must be an object";
+		return false;
+	}
+	if (!expect('}'))
+	{
+		do
+		{
+			std::string key, value;
+			if (!readString(key) || !expect(':'))
+			{
+				error = "expected \"option\": value in the JSON job";
+				return false;
+			}
+			tokens.push_back(key.compare(0, 1, "-") == 0 ? key : "--" + key);
+			if (expect('['))
+			{
+				if (!expect(']'))
+				{
+					do
+					{
+						if (!readValue(value))
+						{
+							error = "bad value of " + key + " in the JSON job";
+							return false;
+						}
+						tokens.push_back(value);
+					} while (expect(','));
+					if (!expect(']'))
+					{
+						error = "unterminated array of " + key + " in the JSON job";
+						return false;
+					}
+				}
+			}
+			else
+			{
+				if (!readValue(value))
+				{
+					error = "bad value of " + key + " in the JSON job";
+					return false;
+				}
+				tokens.push_back(value);
+			}
+		} while (expect(','));
+		if (!expect('}'))
+		{
+			error = "unterminated JSON job";
+			return false;
+		}
+	}
+	skip();
+	if (pos != json.size())
+	{
+		error = "trailing characters after the JSON job";
+		return false;
+	}
+	return true;
+};
+} // namespace
+
+JobServer::JobServer(const Metadata<PRISMATIC_FLOAT_PRECISION> &_defaults) : defaults(_defaults),
+																			  numJobs(0)
+{
+	//jobs do not start servers of their own
+	defaults.serveSource = "";
+	source = _defaults.serveSource;
+};
+
+void JobServer::run()
+{
+#ifdef PRISMATIC_ENABLE_MPI
+	if (getMPISize() > 1)
+		throw std::runtime_error("The job server runs in a single MPI rank");
+#endif //PRISMATIC_ENABLE_MPI
+
+	if (source == "stdin")
+	{
+		//stdout carries only the replies while serving, so the simulations log to stderr
+		std::ostream replies(std::cout.rdbuf());
+		std::streambuf *log = std::cout.rdbuf(std::cerr.rdbuf());
+		std::cout << "Serving simulation jobs from stdin" << std::endl;
+		try
+		{
+			serve([](std::string &line) { return (bool)std::getline(std::cin, line); },
+				  [&replies](const std::string &text) { replies << text << std::endl; });
+		}
+		catch (...)
+		{
+			std::cout.rdbuf(log);
+			throw;
+		}
+		std::cout << "Served " << numJobs << " simulation jobs" << std::endl;
+		std::cout.rdbuf(log);
+	}
+	else
+	{
+		listen(source);
+		std::cout << "Served " << numJobs << " simulation jobs" << std::endl;
+	}
+};
+
+bool JobServer::serve(const std::function<bool(std::string &)> &readLine,
+					  const std::function<void(const std::string &)> &reply)
+{
+	std::string line;
+	while (readLine(line))
+	{
+		std::string job = trimJob(line);
+		if (job.empty() || job[0] == '#') continue;
+		if (job == "quit")
+		{
+			reply("bye");
+			return false;
+		}
+		reply(runJob(job));
+	}
+	return true;
+};
+
+std::string JobServer::runJob(const std::string &line)
+{
+	const size_t job = numJobs++;
+	std::stringstream reply;
+	try
+	{
+		Metadata<PRISMATIC_FLOAT_PRECISION> meta = defaults;
+		std::string error;
+		if (!parseJob(line, meta, error))
+		{
+			reply << "error " << job << " " << error;
+		}
+		else
+		{
+			meta.serveSource = "";
+			std::cout << "Starting simulation job " << job << std::endl;
+			std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+			go(meta);
+			std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+			reply << "ok " << job << " " << meta.filenameOutput << " " << elapsed.count();
+		}
+	}
+	catch (std::exception &e)
+	{
+		reply << "error " << job << " " << e.what();
+	}
+
+	//every reply is one line
+	std::string text = reply.str();
+	std::replace(text.begin(), text.end(), '\n', ' ');
+	return trimJob(text);
+};
+
+bool JobServer::parseJob(const std::string &line, Metadata<PRISMATIC_FLOAT_PRECISION> &meta, std::string &error)
+{
+	std::vector<std::string> tokens;
+	if (line[0] == '{')
+	{
+		if (!parseJSONOptions(line, tokens, error)) return false;
+	}
+	else
+	{
+		std::istringstream words(line);
+		std::string word;
+		while (words >> word)
+			tokens.push_back(word);
+		//a single word that is not an option names a parameter file
+		if (tokens.size() == 1 && tokens[0][0] != '-')
+			tokens.insert(tokens.begin(), "--param-file");
+	}
+
+	std::vector<const char *> args(1, "prismatic");
+	for (auto &t : tokens)
+		args.push_back(t.c_str());
+	int argc = args.size();
+	const char **argv = &args[0];
+	if (!parseInputs(meta, argc, &argv))
+	{
+		error = "invalid options in job \"" + line + "\"";
+		return false;
+	}
+	return true;
+};
+
+void JobServer::listen(const std::string &socketPath)
+{
+#ifndef _WIN32
+	sockaddr_un address;
+	memset(&address, 0, sizeof(address));
+	address.sun_family = AF_UNIX;
+	if (socketPath.size() >= sizeof(address.sun_path))
+		throw std::runtime_error("The socket path " + socketPath + " is too long");
+	strncpy(address.sun_path, socketPath.c_str(), sizeof(address.sun_path) - 1);
+
+	int server = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (server < 0)
+		throw std::runtime_error("Unable to create a UNIX socket");
+
+	//a socket file left behind by an earlier server would fail the bind
+	unlink(socketPath.c_str());
+	if (bind(server, (sockaddr *)&address, sizeof(address)) < 0 || ::listen(server, 16) < 0)
+	{
+		close(server);
+		throw std::runtime_error("Unable to listen on " + socketPath);
+	}
+
+	//a client that leaves before its reply must not stop the server
+	signal(SIGPIPE, SIG_IGN);
+	std::cout << "Serving simulation jobs on " << socketPath << std::endl;
+
+	bool serving = true;
+	while (serving)
+	{
+		int client = accept(server, nullptr, nullptr);
+		if (client < 0)
+		{
+			if (errno == EINTR) continue;
+			break;
+		}
+
+		std::string buffer;
+		auto readLine = [client, &buffer](std::string &line) {
+			size_t end;
+			while ((end = buffer.find('\n')) == std::string::npos)
+			{
+				char chunk[4096];
+				ssize_t received = recv(client, chunk, sizeof(chunk), 0);
+				if (received < 0 && errno == EINTR) continue;
+				if (received <= 0)
+				{
+					//a last job without a newline still runs
+					if (buffer.empty()) return false;
+					line = buffer;
+					buffer.clear();
+					return true;
+				}
+				buffer.append(chunk, received);
+			}
+			line = buffer.substr(0, end);
+			buffer.erase(0, end + 1);
+			return true;
+		};
+		auto reply = [client](const std::string &text) {
+			std::string message = text + "\n";
+			for (size_t sent = 0; sent < message.size();)
+			{
+				ssize_t written = send(client, message.data() + sent, message.size() - sent, 0);
+				if (written < 0 && errno == EINTR) continue;
+				if (written <= 0) return;
+				sent += written;
+			}
+		};
+		serving = serve(readLine, reply);
+		close(client);
+	}
+	close(server);
+	unlink(socketPath.c_str());
+#else
+	throw std::runtime_error("UNIX sockets are not supported on Windows, serve jobs from stdin instead");
+#endif //_WIN32
+};
+} // namespace Prismatic
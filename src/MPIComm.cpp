@@ -0,0 +1,104 @@
+// Copyright Alan (AJ) Pryor, Jr. 2017
+// Transcribed from MATLAB code by Colin Ophus
+// Prismatic is distributed under the GNU General Public License (GPL)
+// If you use Prismatic, we kindly ask that you cite the following papers:
+
+// 1. Ophus, C.: A fast image simulation algorithm for scanning
+//    transmission electron microscopy. Advanced Structural and
+//    Chemical Imaging 3(1), 13 (2017)
+
+// 2. Pryor, Jr., A., Ophus, C., and Miao, J.: A Streaming Multi-GPU
+//    Implementation of Image Simulation Algorithms for Scanning
+//	  Transmission Electron Microscopy. arXiv:1706.08563 (2017)
+
+#include "MPIComm.h"
+
+#ifdef PRISMATIC_ENABLE_MPI
+#include "utility.h"
+#include <mpi.h>
+#include <algorithm>
+#include <iostream>
+#include <vector>
+
+namespace Prismatic
+{
+namespace
+{
+#ifdef PRISMATIC_ENABLE_DOUBLE_PRECISION
+const MPI_Datatype PFP_MPI_TYPE = MPI_DOUBLE;
+#else
+const MPI_Datatype PFP_MPI_TYPE = MPI_FLOAT;
+#endif //PRISMATIC_ENABLE_DOUBLE_PRECISION
+
+//MPI counts are ints, so large arrays are sent in pieces of at most this many values
+const size_t maxMessageLength = 1 << 30;
+} // namespace
+
+int getMPIRank()
+{
+	int rank = 0;
+	MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+	return rank;
+};
+
+int getMPISize()
+{
+	int size = 1;
+	MPI_Comm_size(MPI_COMM_WORLD, &size);
+	return size;
+};
+
+void broadcastPotential(Parameters<PRISMATIC_FLOAT_PRECISION> &pars)
+{
+	unsigned long long dims[5] = {pars.pot.get_dimk(), pars.pot.get_dimj(), pars.pot.get_dimi(), pars.numPlanes, pars.numSlices};
+	MPI_Bcast(dims, 5, MPI_UNSIGNED_LONG_LONG, 0, MPI_COMM_WORLD);
+	if (getMPIRank() != 0)
+	{
+		pars.pot = zeros_ND<3, PRISMATIC_FLOAT_PRECISION>({{(size_t)dims[0], (size_t)dims[1], (size_t)dims[2]}});
+		pars.numPlanes = dims[3];
+		pars.numSlices = dims[4];
+	}
+	for (size_t offset = 0; offset < pars.pot.size(); offset += maxMessageLength)
+	{
+		int count = (int)std::min(maxMessageLength, pars.pot.size() - offset);
+		MPI_Bcast(&pars.pot[offset], count, PFP_MPI_TYPE, 0, MPI_COMM_WORLD);
+	}
+};
+
+std::pair<size_t, size_t> getRankBeams(const Parameters<PRISMATIC_FLOAT_PRECISION> &pars)
+{
+	return getScanTileRange(pars.numberBeams, getMPISize(), getMPIRank());
+};
+
+void gatherBeams(Parameters<PRISMATIC_FLOAT_PRECISION> &pars)
+{
+	//beams are the slowest axis of Scompact, so the range of every rank is one contiguous block
+	const int size = getMPISize();
+	const size_t beamLength = pars.Scompact.get_dimj() * pars.Scompact.get_dimi();
+	MPI_Datatype beamType;
+	MPI_Type_contiguous((int)(2 * beamLength), PFP_MPI_TYPE, &beamType);
+	MPI_Type_commit(&beamType);
+
+	std::vector<int> counts(size), displacements(size);
+	for (auto r = 0; r < size; r++)
+	{
+		std::pair<size_t, size_t> beams = getScanTileRange(pars.numberBeams, size, r);
+		counts[r] = (int)(beams.second - beams.first);
+		displacements[r] = (int)beams.first;
+	}
+	MPI_Allgatherv(MPI_IN_PLACE, 0, MPI_DATATYPE_NULL, &pars.Scompact[0], &counts[0], &displacements[0], beamType, MPI_COMM_WORLD);
+	MPI_Type_free(&beamType);
+};
+
+void barrier()
+{
+	MPI_Barrier(MPI_COMM_WORLD);
+};
+
+void abortRanks(const std::string &message)
+{
+	std::cout << "Rank " << getMPIRank() << " failed: " << message << std::endl;
+	MPI_Abort(MPI_COMM_WORLD, 1);
+};
+} // namespace Prismatic
+#endif //PRISMATIC_ENABLE_MPI
@@ -25,6 +25,8 @@
 #include "fftw3.h"
 #include "WorkDispatcher.h"
 #include "Multislice_calcOutput.h"
+#include "SimulationPlan.h"
+#include "Checkpoint.h"
 #include "fileIO.h"
 
 namespace Prismatic{
@@ -39,42 +41,11 @@ namespace Prismatic{
 		// setup coordinates and build propagators
 		std::vector<PRISMATIC_FLOAT_PRECISION> xp_d;
 		std::vector<PRISMATIC_FLOAT_PRECISION> yp_d;
-		if(pars.meta.arbitraryProbes)
-		{
-			xp_d = pars.meta.probes_x;
-			yp_d = pars.meta.probes_y;
-			pars.numXprobes = xp_d.size();
-			pars.numYprobes = 1;
-			pars.numProbes = xp_d.size();
-		}
-		else
-		{
-			Array1D<PRISMATIC_FLOAT_PRECISION> xR = zeros_ND<1, PRISMATIC_FLOAT_PRECISION>({{2}});
-			xR[0] = pars.scanWindowXMin * pars.tiledCellDim[2];
-			xR[1] = pars.scanWindowXMax * pars.tiledCellDim[2];
-			Array1D<PRISMATIC_FLOAT_PRECISION> yR = zeros_ND<1, PRISMATIC_FLOAT_PRECISION>({{2}});
-			yR[0] = pars.scanWindowYMin * pars.tiledCellDim[1];
-			yR[1] = pars.scanWindowYMax * pars.tiledCellDim[1];
-
-			PRISMATIC_FLOAT_PRECISION probeStepX;
-			PRISMATIC_FLOAT_PRECISION probeStepY;
-			if(pars.meta.nyquistSampling){
-				int numX = nyquistProbes(pars,2); //x is dim 2
-				int numY = nyquistProbes(pars,1); //y is dim 1
-				probeStepX = pars.tiledCellDim[2]/numX;
-				probeStepY = pars.tiledCellDim[1]/numY;
-			}else{
-				probeStepX = pars.meta.probeStepX;
-				probeStepY = pars.meta.probeStepY;
-			}
-			
-			xp_d = vecFromRange(xR[0], probeStepX, xR[1]);
-			yp_d = vecFromRange(yR[0], probeStepY, yR[1]);
-		
-			pars.numXprobes = xp_d.size();
-			pars.numYprobes = yp_d.size();
-			pars.numProbes = xp_d.size()*yp_d.size();
-		}
+		getProbePositions(pars, xp_d, yp_d);
+
+		pars.numXprobes = xp_d.size();
+		pars.numYprobes = pars.meta.arbitraryProbes ? 1 : yp_d.size();
+		pars.numProbes = pars.numXprobes * pars.numYprobes;
 
 		Array1D<PRISMATIC_FLOAT_PRECISION> xp(xp_d, {{xp_d.size()}});
 		Array1D<PRISMATIC_FLOAT_PRECISION> yp(yp_d, {{yp_d.size()}});
@@ -161,6 +132,11 @@ namespace Prismatic{
 		pars.alphaInd = (alpha + pars.meta.detectorAngleStep/2) / pars.meta.detectorAngleStep;
 		for (auto& q : pars.alphaInd) q = std::round(q);
 		pars.dq = (pars.qxa.at(0, 1) + pars.qya.at(1, 0)) / 2;
+		pars.qTheta = pars.q1;
+		std::transform(pars.qxa.begin(), pars.qxa.end(),
+					   pars.qya.begin(), pars.qTheta.begin(), [](const PRISMATIC_FLOAT_PRECISION&a, const PRISMATIC_FLOAT_PRECISION& b){
+						   return atan2(b,a);
+					   });
 	}
 
 	void setupProbes_multislice(Parameters<PRISMATIC_FLOAT_PRECISION>& pars){
@@ -195,12 +171,6 @@ namespace Prismatic{
 		pars.psiProbeInit.at(0,0).real(1.0);
 
 		//apply aberrations
-		pars.qTheta = pars.q1;
-		std::transform(pars.qxa.begin(), pars.qxa.end(),
-					   pars.qya.begin(), pars.qTheta.begin(), [](const PRISMATIC_FLOAT_PRECISION&a, const PRISMATIC_FLOAT_PRECISION& b){
-						   return atan2(b,a);
-					   });
-		
 		Array2D<std::complex<PRISMATIC_FLOAT_PRECISION>> chi = getChi(pars.q1, pars.qTheta, pars.lambda, pars.meta.aberrations);
 
 		transform(pars.psiProbeInit.begin(), pars.psiProbeInit.end(),
@@ -253,7 +223,7 @@ namespace Prismatic{
 		pars.depths = depths;
 		pars.numLayers = numLayers;
 		
-		pars.output = zeros_ND<4, PRISMATIC_FLOAT_PRECISION>({{numLayers, pars.numYprobes, pars.numXprobes, pars.Ndet}});
+		pars.output = zeros_ND<4, PRISMATIC_FLOAT_PRECISION>({{numLayers, pars.numYprobes, pars.numXprobes, pars.Ndet + pars.meta.detectors.size()}});
 
 		if(pars.meta.saveDPC_CoM) pars.DPC_CoM = zeros_ND<4, PRISMATIC_FLOAT_PRECISION>({{numLayers,pars.numYprobes, pars.numXprobes,2}});
 		if(pars.meta.save4DOutput)
@@ -276,42 +246,14 @@ namespace Prismatic{
 
 	void formatOutput_CPU_integrate(Parameters<PRISMATIC_FLOAT_PRECISION>& pars,
 	                                       Array2D< complex<PRISMATIC_FLOAT_PRECISION> >& psi,
-	                                       const Array2D<PRISMATIC_FLOAT_PRECISION> &alphaInd,
 										   const size_t currentSlice,
 	                                       const size_t ay,
 	                                       const size_t ax){
-		Array2D<PRISMATIC_FLOAT_PRECISION> intOutput = zeros_ND<2, PRISMATIC_FLOAT_PRECISION>({{psi.get_dimj(), psi.get_dimi()}});
-		
-		auto psi_ptr = psi.begin();
-
-		for (auto& j:intOutput) j = pow(abs(*psi_ptr++),2);
-
-
-		if (pars.meta.saveDPC_CoM){
-			//calculate center of mass; qxa, qya are the fourier coordinates, should have 0 components at boundaries
-			for (long y = 0; y < psi.get_dimj(); ++y){
-				for (long x = 0; x < psi.get_dimi(); ++x){
-					pars.DPC_CoM.at(currentSlice,ay,ax,0) += pars.qxa.at(y,x) * intOutput.at(y,x);
-					pars.DPC_CoM.at(currentSlice,ay,ax,1) += pars.qya.at(y,x) * intOutput.at(y,x);
-				}
-			}
-			//divide by sum of intensity
-			PRISMATIC_FLOAT_PRECISION intensitySum = 0;
-			for (auto iter = intOutput.begin(); iter != intOutput.end(); ++iter){
-				intensitySum += *iter;
-			}
-			pars.DPC_CoM.at(currentSlice,ay,ax,0) /= intensitySum;
-			pars.DPC_CoM.at(currentSlice,ay,ax,1) /= intensitySum;
-		}
-
-		//update stack -- ax,ay are unique per thread so this write is thread-safe without a lock
-		auto idx = alphaInd.begin();
-		for (auto counts = intOutput.begin(); counts != intOutput.end(); ++counts){
-			if (*idx <= pars.Ndet){
-				pars.output.at(currentSlice,ay,ax,(*idx)-1) += *counts;
-			}
-			++idx;
-		};
+		//update stack and DPC in one pass over the sparse detector map -- ax,ay are unique per thread so this write is thread-safe without a lock
+		std::vector<PRISMATIC_FLOAT_PRECISION> binValues(pars.detMap.numBins());
+		integrateDetectors(pars.detMap, &psi[0], 1, &binValues[0]);
+		storeDetectorBins(pars.detMap, &binValues[0], &pars.output.at(currentSlice,ay,ax,0),
+						  pars.meta.saveDPC_CoM ? &pars.DPC_CoM.at(currentSlice,ay,ax,0) : nullptr);
 
 		//save 4D output if applicable
 		if (pars.meta.save4DOutput)
@@ -358,6 +300,9 @@ namespace Prismatic{
 			}
 			else
 			{
+				Array2D<PRISMATIC_FLOAT_PRECISION> intOutput = zeros_ND<2, PRISMATIC_FLOAT_PRECISION>({{psi.get_dimj(), psi.get_dimi()}});
+				auto psi_ptr = psi.begin();
+				for (auto& j:intOutput) j = pow(abs(*psi_ptr++),2);
 
 				Array2D<PRISMATIC_FLOAT_PRECISION> intOutput_small;
 				
@@ -392,58 +337,36 @@ namespace Prismatic{
 	
 	void formatOutput_CPU_integrate_batch(Parameters<PRISMATIC_FLOAT_PRECISION>& pars,
 	                                      Array1D< complex<PRISMATIC_FLOAT_PRECISION> >& psi_stack,
-	                                      const Array2D<PRISMATIC_FLOAT_PRECISION> &alphaInd,
 	                                      size_t Nstart,
 	                                      const size_t Nstop,
 										  const size_t currentSlice){
 		int probe_idx = 0;
+		std::vector<PRISMATIC_FLOAT_PRECISION> binValues(pars.detMap.numBins());
 		while (Nstart < Nstop) {
 			//since constant must use ternary operator
 			//ay and ax aren't used to calculate, just for IO and data copies
 			const size_t ay = (pars.meta.arbitraryProbes) ? 0 : Nstart / pars.numXprobes;
 			const size_t ax = (pars.meta.arbitraryProbes) ? Nstart : Nstart % pars.numXprobes;
 
-			//can't just use PSI like in single integrate for complex output
-			Array2D<PRISMATIC_FLOAT_PRECISION> intOutput = zeros_ND<2, PRISMATIC_FLOAT_PRECISION>({{pars.psiProbeInit.get_dimj(), pars.psiProbeInit.get_dimi()}});
+			//can't just use PSI like in single integrate for complex output; intensities are only needed for the 4D output
+			Array2D<PRISMATIC_FLOAT_PRECISION> intOutput;
 			Array2D<std::complex<PRISMATIC_FLOAT_PRECISION>> intOutput_c;
-			if(pars.meta.saveComplexOutputWave)
-				intOutput_c = zeros_ND<2, std::complex<PRISMATIC_FLOAT_PRECISION>>({{pars.psiProbeInit.get_dimj(), pars.psiProbeInit.get_dimi()}});
-			
 			auto psi_ptr = &psi_stack[probe_idx*pars.psiProbeInit.size()];
-			for (auto& j:intOutput) j = pow(abs(*psi_ptr++),2);
-			if(pars.meta.saveComplexOutputWave)
+			if(pars.meta.save4DOutput && pars.meta.saveComplexOutputWave)
 			{
-				//reset pointer
-				psi_ptr = &psi_stack[probe_idx*pars.psiProbeInit.size()];
+				intOutput_c = zeros_ND<2, std::complex<PRISMATIC_FLOAT_PRECISION>>({{pars.psiProbeInit.get_dimj(), pars.psiProbeInit.get_dimi()}});
 				for (auto& j:intOutput_c) j = *psi_ptr++;
 			}
-
-			if (pars.meta.saveDPC_CoM){
-				//calculate center of mass; qxa, qya are the fourier coordinates, should have 0 components at boundaries
-				for (long y = 0; y < pars.psiProbeInit.get_dimj(); ++y){
-					for (long x = 0; x < pars.psiProbeInit.get_dimi(); ++x){
-						pars.DPC_CoM.at(currentSlice,ay,ax,0) += pars.qxa.at(y,x) * intOutput.at(y,x);
-						pars.DPC_CoM.at(currentSlice,ay,ax,1) += pars.qya.at(y,x) * intOutput.at(y,x);
-					}
-				}
-
-				//divide by sum of intensity
-				PRISMATIC_FLOAT_PRECISION intensitySum = 0;
-				for (auto iter = intOutput.begin(); iter != intOutput.end(); ++iter){
-					intensitySum += *iter;
-				}
-				pars.DPC_CoM.at(currentSlice,ay,ax,0) /= intensitySum;
-				pars.DPC_CoM.at(currentSlice,ay,ax,1) /= intensitySum;
+			else if(pars.meta.save4DOutput)
+			{
+				intOutput = zeros_ND<2, PRISMATIC_FLOAT_PRECISION>({{pars.psiProbeInit.get_dimj(), pars.psiProbeInit.get_dimi()}});
+				for (auto& j:intOutput) j = pow(abs(*psi_ptr++),2);
 			}
 
-			//update stack -- ax,ay are unique per thread so this write is thread-safe without a lock
-			auto idx = alphaInd.begin();
-			for (auto counts = intOutput.begin(); counts != intOutput.end(); ++counts) {
-				if (*idx <= pars.Ndet) {
-					pars.output.at(currentSlice, ay, ax, (*idx) - 1) += *counts;
-				}
-				++idx;
-			};
+			//update stack and DPC in one pass over the sparse detector map -- ax,ay are unique per thread so this write is thread-safe without a lock
+			integrateDetectors(pars.detMap, &psi_stack[probe_idx*pars.psiProbeInit.size()], 1, &binValues[0]);
+			storeDetectorBins(pars.detMap, &binValues[0], &pars.output.at(currentSlice,ay,ax,0),
+							  pars.meta.saveDPC_CoM ? &pars.DPC_CoM.at(currentSlice,ay,ax,0) : nullptr);
 
 			if (pars.meta.save4DOutput)
 			{
@@ -529,8 +452,7 @@ namespace Prismatic{
 
 		Array2D< std::complex<PRISMATIC_FLOAT_PRECISION> > realspace_probe;
 		Array2D< std::complex<PRISMATIC_FLOAT_PRECISION> > kspace_probe;
-		PRISMATIC_FFTW_INIT_THREADS();
-		PRISMATIC_FFTW_PLAN_WITH_NTHREADS(pars.meta.numThreads);
+		initFFTWThreads(pars.meta.numThreads);
 		Array2D<complex<PRISMATIC_FLOAT_PRECISION> > psi(pars.psiProbeInit);
 		unique_lock<mutex> gatekeeper(fftw_plan_lock);
 		PRISMATIC_FFTW_PLAN plan_forward = PRISMATIC_FFTW_PLAN_DFT_2D(psi.get_dimj(), psi.get_dimi(),
@@ -591,7 +513,6 @@ namespace Prismatic{
 		PRISMATIC_FFTW_DESTROY_PLAN(plan_forward);
 		PRISMATIC_FFTW_DESTROY_PLAN(plan_inverse);
 		PRISMATIC_FFTW_DESTROY_PLAN(plan_inverse_small);
-		PRISMATIC_FFTW_CLEANUP_THREADS();
 		return std::make_pair(realspace_probe, kspace_probe);
 	};
 
@@ -655,7 +576,7 @@ namespace Prismatic{
 				}
 
 				if  ( ( (((a2+1) % pars.numSlices) == 0) && ((a2+1) >= pars.zStartPlane) ) || ((a2+1) == pars.numPlanes) ){
-					formatOutput_CPU_integrate_batch(pars, psi_stack, pars.alphaInd, Nstart, Nstop, currentSlice);
+					formatOutput_CPU_integrate_batch(pars, psi_stack, Nstart, Nstop, currentSlice);
 					currentSlice++;
 				}
 			}
@@ -704,7 +625,7 @@ namespace Prismatic{
 				for (auto& p:psi)p *= (*p_ptr++); // propagate
 
 				if ( ( (((a2+1) % pars.numSlices) == 0) && ((a2+1) >= pars.zStartPlane) ) || ((a2+1) == pars.numPlanes) ){
-					formatOutput_CPU(pars, psi, pars.alphaInd, currentSlice, ay, ax);
+					formatOutput_CPU(pars, psi, currentSlice, ay, ax);
 					currentSlice++;
 				}
 			}
@@ -718,17 +639,20 @@ namespace Prismatic{
 
 		vector<thread> workers;
 		workers.reserve(pars.meta.numThreads); // prevents multiple reallocations
-		PRISMATIC_FFTW_INIT_THREADS();
-		PRISMATIC_FFTW_PLAN_WITH_NTHREADS(pars.meta.numThreads);
+		initFFTWThreads(pars.meta.numThreads);
 		const size_t PRISMATIC_PRINT_FREQUENCY_PROBES = max((size_t)1, pars.numProbes/ 10); // for printing status
 		WorkDispatcher dispatcher(0, pars.numProbes);
 
 		// If the batch size is too big, the work won't be spread over the threads, which will usually hurt more than the benefit
 		// of batch FFT
 		pars.meta.batchSizeCPU = min(pars.meta.batchSizeTargetCPU, max((size_t)1, pars.numProbes / pars.meta.numThreads));
+
+		// probes of an interrupted run are restored from its checkpoint
+		std::vector<bool> probesDone(pars.numProbes, false);
+		if (pars.checkpoint) probesDone = pars.checkpoint->beginStage(Checkpoint::Stage::Probes, pars);
 		for (auto t = 0; t < pars.meta.numThreads; ++t){
 			cout << "Launching CPU worker #" << t << endl;
-			workers.push_back(thread([&pars, &dispatcher, t, &PRISMATIC_PRINT_FREQUENCY_PROBES]() {
+			workers.push_back(thread([&pars, &dispatcher, t, &PRISMATIC_PRINT_FREQUENCY_PROBES, &probesDone]() {
 				size_t Nstart, Nstop;
                 Nstart=Nstop=0;
 				if (dispatcher.getWork(Nstart, Nstop, pars.meta.batchSizeCPU)){ // synchronously get work assignment
@@ -776,14 +700,21 @@ namespace Prismatic{
 					// main work loop
                     do {
 						while (Nstart < Nstop) {
-							if (Nstart % PRISMATIC_PRINT_FREQUENCY_PROBES < pars.meta.batchSizeCPU | Nstart == 100){
-								cout << "Computing Probe Position #" << Nstart << "/" << pars.numProbes << endl;
-							}
-							getMultisliceProbe_CPU_batch(pars, Nstart, Nstop, plan_forward, plan_inverse, psi_stack);
+							// propagate the runs of probes the checkpoint does not hold yet
+							size_t workStop = Nstart;
+							while (workStop < Nstop && !probesDone[workStop]) ++workStop;
+							if (workStop > Nstart){
+								if (Nstart % PRISMATIC_PRINT_FREQUENCY_PROBES < pars.meta.batchSizeCPU | Nstart == 100){
+									cout << "Computing Probe Position #" << Nstart << "/" << pars.numProbes << endl;
+								}
+								getMultisliceProbe_CPU_batch(pars, Nstart, workStop, plan_forward, plan_inverse, psi_stack);
 #ifdef PRISMATIC_BUILDING_GUI
-                            pars.progressbar->signalOutputUpdate(Nstart, pars.numProbes);
+								pars.progressbar->signalOutputUpdate(Nstart, pars.numProbes);
 #endif
-							Nstart=Nstop;
+								if (pars.checkpoint) pars.checkpoint->complete(Nstart, workStop);
+							}
+							Nstart=workStop;
+							while (Nstart < Nstop && probesDone[Nstart]) ++Nstart;
 						}
 					} while(dispatcher.getWork(Nstart, Nstop, pars.meta.batchSizeCPU));
 					gatekeeper.lock();
@@ -795,20 +726,86 @@ namespace Prismatic{
 			}));
 		}
 		for (auto& t:workers)t.join();
-		PRISMATIC_FFTW_CLEANUP_THREADS();
 	};
 
 
+	std::string geometryKey_multislice(const Parameters<PRISMATIC_FLOAT_PRECISION>& pars){
+		// everything the coordinate and detector setup read
+		SimulationPlan::Key key;
+		key << pars.meta.arbitraryProbes << pars.meta.probes_x << pars.meta.probes_y
+			<< pars.scanWindowXMin << pars.scanWindowXMax << pars.scanWindowYMin << pars.scanWindowYMax
+			<< pars.tiledCellDim << pars.meta.nyquistSampling << pars.meta.probeSemiangle << pars.meta.probeStepX << pars.meta.probeStepY
+			<< pars.pot.get_dimj() << pars.pot.get_dimi() << pars.pixelSize
+			<< pars.meta.realspacePixelSize[0] << pars.meta.realspacePixelSize[1] << pars.lambda << pars.meta.sliceThickness
+			<< pars.meta.probeXtilt << pars.meta.probeYtilt << pars.meta.detectorAngleStep
+			<< pars.meta.detectors << pars.meta.saveDPC_CoM << pars.meta.scanTiles << pars.meta.scanTile;
+		return key.str();
+	}
+
+	void copyGeometry_multislice(const Parameters<PRISMATIC_FLOAT_PRECISION>& from, Parameters<PRISMATIC_FLOAT_PRECISION>& to){
+		to.numXprobes = from.numXprobes;
+		to.numYprobes = from.numYprobes;
+		to.numProbes = from.numProbes;
+		to.xp = from.xp;
+		to.yp = from.yp;
+		to.imageSize = from.imageSize;
+		to.qx = from.qx;
+		to.qy = from.qy;
+		to.qxa = from.qxa;
+		to.qya = from.qya;
+		to.q1 = from.q1;
+		to.q2 = from.q2;
+		to.qMax = from.qMax;
+		to.qMask = from.qMask;
+		to.prop = from.prop;
+		to.propBack = from.propBack;
+		to.alphaMax = from.alphaMax;
+		to.detectorAngles = from.detectorAngles;
+		to.Ndet = from.Ndet;
+		to.alphaInd = from.alphaInd;
+		to.dq = from.dq;
+		to.qTheta = from.qTheta;
+		to.detMap = from.detMap;
+	}
+
+	void copyProbe_multislice(const Parameters<PRISMATIC_FLOAT_PRECISION>& from, Parameters<PRISMATIC_FLOAT_PRECISION>& to){
+		to.psiProbeInit = from.psiProbeInit;
+	}
+
 	void Multislice_calcOutput(Parameters<PRISMATIC_FLOAT_PRECISION>& pars){
 
-		// setup coordinates and build propagators
-		setupCoordinates_multislice(pars);
+		// take the coordinates, propagators, detector and probe from the plan when their settings did not change
+		SimulationPlan &plan = SimulationPlan::getPlan();
+		std::string geometryKey = geometryKey_multislice(pars);
+		if(!pars.meta.reusePlan or !plan.restore("Multislice geometry", geometryKey, copyGeometry_multislice, pars))
+		{
+			// setup coordinates and build propagators
+			setupCoordinates_multislice(pars);
+
+			// setup detector coordinates and angles
+			setupDetector_multislice(pars);
 
-		// setup detector coordinates and angles
-		setupDetector_multislice(pars);
+			// compile the annular bins, custom detectors and DPC sums into one sparse map
+			Array2D<PRISMATIC_FLOAT_PRECISION> alpha = pars.q1 * pars.lambda;
+			pars.detMap = buildDetectorMap(pars.alphaInd, pars.Ndet, alpha, pars.qTheta,
+										   pars.qxa, pars.qya, pars.meta.detectors, pars.meta.saveDPC_CoM);
+
+			if(pars.meta.reusePlan) plan.store("Multislice geometry", geometryKey, copyGeometry_multislice, pars);
+		}
 
 		// create initial probes
-		setupProbes_multislice(pars);
+		SimulationPlan::Key probeKey;
+		probeKey << geometryKey << pars.meta.aberrations;
+		if(!pars.meta.reusePlan or !plan.restore("Multislice probe", probeKey.str(), copyProbe_multislice, pars))
+		{
+			setupProbes_multislice(pars);
+			if(pars.meta.reusePlan) plan.store("Multislice probe", probeKey.str(), copyProbe_multislice, pars);
+		}
+		else if(pars.meta.saveProbe && pars.fpFlag == 0)
+		{
+			setupProbeOutput(pars);
+			saveProbe(pars);
+		}
 
 		// create transmission array
 		createTransmission(pars);
@@ -821,8 +818,13 @@ namespace Prismatic{
         pars.progressbar->signalOutputUpdate(0, pars.numProbes);
 #endif
 
-		// create the output
+		// create the output, staging 4D frames for a single writer thread
+		if (pars.meta.save4DOutput) startDatacubeWriter(pars);
 		buildMultisliceOutput(pars);
+		if (pars.meta.save4DOutput) finishDatacubeWriter(pars);
+
+		// the probes waiting for their 4D blocks are complete once the writer is finished
+		if (pars.checkpoint) pars.checkpoint->endStage();
 	}
 
 }
@@ -313,8 +313,7 @@ namespace Prismatic{
 		// now launch CPU work
 		std::cout<<"Also do CPU work: "<<pars.meta.alsoDoCPUWork<<std::endl;
 		if (pars.meta.alsoDoCPUWork){
-			PRISMATIC_FFTW_INIT_THREADS();
-			PRISMATIC_FFTW_PLAN_WITH_NTHREADS(pars.meta.numThreads);vector<thread> workers_CPU;
+			initFFTWThreads(pars.meta.numThreads);vector<thread> workers_CPU;
 			workers_CPU.reserve(pars.meta.numThreads); // prevents multiple reallocations
 
 			// If the batch size is too big, the work won't be spread over the threads, which will usually hurt more than the benefit
@@ -387,7 +386,6 @@ namespace Prismatic{
 			}
 			cout << "Waiting on CPU threads..." << endl;
 			for (auto& t:workers_CPU)t.join();
-			PRISMATIC_FFTW_CLEANUP_THREADS();
 		}
 		// synchronize threads
 		cout << "Waiting on GPU threads..." << endl;
@@ -479,8 +477,7 @@ namespace Prismatic{
 
 		// now launch CPU work
 		if (pars.meta.alsoDoCPUWork){
-			PRISMATIC_FFTW_INIT_THREADS();
-			PRISMATIC_FFTW_PLAN_WITH_NTHREADS(pars.meta.numThreads);vector<thread> workers_CPU;
+			initFFTWThreads(pars.meta.numThreads);vector<thread> workers_CPU;
 			workers_CPU.reserve(pars.meta.numThreads); // prevents multiple reallocations
 			for (auto t = 0; t < pars.meta.numThreads; ++t) {
 				cout << "Launching CPU worker #" << t << endl;
@@ -549,7 +546,6 @@ namespace Prismatic{
 			}
 			cout << "Waiting on GPU threads..." << endl;
 			for (auto& t:workers_CPU)t.join();
-			PRISMATIC_FFTW_CLEANUP_THREADS();
 		}
 		// synchronize threads
 		cout << "Waiting on GPU threads..." << endl;
@@ -23,6 +23,9 @@
 #include "fileIO.h"
 #include "Multislice_entry.h"
 #include "aberration.h"
+#include "PotentialPipeline.h"
+#include "FPConvergence.h"
+#include "Checkpoint.h"
 
 // #ifdef PRISMATIC_BUILDING_GUI
 // #include <QMutex>
@@ -35,26 +38,22 @@ namespace Prismatic
 	
 void Multislice_entry(Metadata<PRISMATIC_FLOAT_PRECISION> &meta)
 {
-	Parameters<PRISMATIC_FLOAT_PRECISION> pars;
-	try
-	{ // read atomic coordinates
-		pars = Parameters<PRISMATIC_FLOAT_PRECISION>(meta);
-	}
-	catch (...)
-	{
-		std::cout << "Terminating" << std::endl;
-		exit(1);
-	}
+	// read atomic coordinates; a failure reaches the caller, which ends the program or only the job it serves
+	Parameters<PRISMATIC_FLOAT_PRECISION> pars(meta);
 
     Multislice_entry_pars(pars);
 }
 
 void Multislice_entry_pars(Parameters<PRISMATIC_FLOAT_PRECISION> &pars){
 
-	pars.outputFile = H5::H5File(pars.meta.filenameOutput.c_str(), H5F_ACC_TRUNC);
-
-	setupOutputFile(pars);
-	pars.outputFile.close();
+	//an interrupted run continues in its output file once it completed a frozen phonon
+	if(useCheckpoint(pars)) pars.checkpoint = std::make_shared<Checkpoint>(pars);
+	if(!pars.checkpoint || !pars.checkpoint->continuesOutput())
+	{
+		pars.outputFile = H5::H5File(pars.meta.filenameOutput.c_str(), H5F_ACC_TRUNC);
+		setupOutputFile(pars);
+		pars.outputFile.close();
+	}
 	
 	pars.meta.importSMatrix = false; //incase it is accidentally set
 	if(pars.meta.importPotential) configureImportFP(pars);
@@ -71,11 +70,9 @@ void Multislice_entry_pars(Parameters<PRISMATIC_FLOAT_PRECISION> &pars){
 		{
 			std::string currentName = pars.meta.seriesTags[i];
 			pars.currentTag = currentName;
-			pars.meta.probeDefocus = pars.meta.seriesVals[0][i]; //TODO: later, if expanding sim series past defocus, need to pull current val more generally
+			updateSeriesParams(pars, i); //the attributes of the saved outputs carry the series values
 			
-			readRealDataSet_inOrder(pars.net_output, "prismatic_scratch.h5", "scratch/"+currentName);
-			if(pars.meta.saveDPC_CoM)
-				readRealDataSet_inOrder(pars.net_DPC_CoM, "prismatic_scratch.h5", "scratch/"+currentName+"_DPC");
+			readScratchData(pars);
 			//average data by fp
 			for (auto &i : pars.net_output)
 				i /= pars.meta.numFP;
@@ -93,10 +90,42 @@ void Multislice_entry_pars(Parameters<PRISMATIC_FLOAT_PRECISION> &pars){
 	else
   {
 		pars.meta.aberrations = updateAberrations(pars.meta.aberrations, pars.meta.probeDefocus, pars.meta.C3, pars.meta.C5, pars.lambda);
-		for(auto i = 0; i < pars.meta.numFP; i++)
+		size_t numGroups = getConcurrentFP(pars);
+		if(numGroups > 1)
+		{
+			Multislice_runFP(pars, 0);
+			runConcurrentFP(pars, numGroups, [](Parameters<PRISMATIC_FLOAT_PRECISION> &fpPars) {
+				fpPars.scale = 1.0;
+				PRISM01_calcPotential(fpPars);
+				Multislice_calcOutput(fpPars);
+			});
+		}
+		else
 		{
-			Multislice_runFP(pars, i);
-		}	
+			size_t pipelineThreads = getPipelineThreads(pars);
+			if(pipelineThreads > 0) pars.potentialPipeline = std::make_shared<PotentialPipeline>(pipelineThreads);
+			std::shared_ptr<FPConvergence> convergence;
+			if(useTargetFPError(pars)) convergence = std::make_shared<FPConvergence>(pars.meta);
+			size_t firstFP = 0;
+			if(pars.checkpoint)
+			{
+				pars.checkpoint->restoreNet(pars);
+				firstFP = pars.checkpoint->getCompletedFP();
+			}
+			for(auto i = firstFP; i < pars.meta.numFP; i++)
+			{
+				Multislice_runFP(pars, i);
+
+				//numFP is the upper bound once a target error is set
+				if(convergence)
+				{
+					convergence->add(pars);
+					if(convergence->converged()) break;
+				}
+			}
+			pars.potentialPipeline.reset();
+			if(convergence) convergence->finish(pars);
+		}
 
 		//average data by fp
 		for (auto &i : pars.net_output)
@@ -114,10 +143,17 @@ void Multislice_entry_pars(Parameters<PRISMATIC_FLOAT_PRECISION> &pars){
 	pars.outputFile = H5::H5File(pars.meta.filenameOutput.c_str(), H5F_ACC_RDWR);
 	
 	//perhaps have this check against the keys
-	if(pars.meta.simSeries) CCseriesSG(pars.outputFile);
+	if(pars.meta.simSeries and pars.meta.seriesKeys[0] == "probeDefocus") CCseriesSG(pars.outputFile);
 
 	writeMetadata(pars);
 	pars.outputFile.close();
+
+	//the run is complete, so there is nothing left to resume
+	if(pars.checkpoint)
+	{
+		pars.checkpoint->remove();
+		pars.checkpoint.reset();
+	}
 	if (pars.meta.simSeries) removeScratchFile(pars);
 
 #ifdef PRISMATIC_ENABLE_GPU
@@ -139,6 +175,10 @@ void Multislice_runFP(Parameters<PRISMATIC_FLOAT_PRECISION> &pars, size_t fpNum)
 	pars.fpFlag = fpNum;
 	pars.scale = 1.0;
 
+	//take the potential the pipeline computed during the previous frozen phonon
+	if(pars.potentialPipeline) pars.potentialPipeline->finish(pars, fpNum);
+	if(pars.checkpoint) pars.checkpoint->beginFP(pars, fpNum);
+
 	// compute projected potentials
 	if(!pars.potentialReady){
 		if(pars.meta.importPotential)
@@ -160,10 +200,20 @@ void Multislice_runFP(Parameters<PRISMATIC_FLOAT_PRECISION> &pars, size_t fpNum)
 #ifdef PRISMATIC_BUILDING_GUI
     pars.parent_thread->passPotentialToParent(pars.pot);
 #endif
+	if(pars.checkpoint) pars.checkpoint->recordPotential(pars);
+
+	//compute the next potential on a few threads while the rest run this frozen phonon
+	size_t numThreads = pars.meta.numThreads;
+	if(pars.potentialPipeline && fpNum + 1 < pars.meta.numFP)
+	{
+		pars.potentialPipeline->start(pars, fpNum + 1);
+		pars.meta.numThreads = std::max((size_t)1, numThreads - pars.potentialPipeline->getNumThreads());
+	}
 
 	//update original object as pars is recreated later
 	Multislice_calcOutput(pars);
 	pars.outputFile.close();
+	pars.meta.numThreads = numThreads;
 
 	if(fpNum >= 1)
 	{
@@ -175,6 +225,7 @@ void Multislice_runFP(Parameters<PRISMATIC_FLOAT_PRECISION> &pars, size_t fpNum)
 		pars.net_output = pars.output;
 		if (pars.meta.saveDPC_CoM) pars.net_DPC_CoM = pars.DPC_CoM;
 	}
+	if(pars.checkpoint) pars.checkpoint->finishFP(pars, fpNum);
 	
 
 };
@@ -27,6 +27,7 @@
 #include "WorkDispatcher.h"
 #include "utility.h"
 #include "fileIO.h"
+#include "DatasetReader.h"
 #include "fftw3.h"
 #include <complex>
 
@@ -67,7 +68,7 @@ void fetch_potentials3D(Array4D<std::complex<PRISMATIC_FLOAT_PRECISION>> &potent
 					  const Array1D<PRISMATIC_FLOAT_PRECISION> &zr)
 {
 	Array3D<PRISMATIC_FLOAT_PRECISION> cur_pot;
-	PRISMATIC_FFTW_INIT_THREADS();
+	initFFTWThreads();
 	for (auto l = 0; l < potentials.get_diml(); l++)
 	{
 		Array3D<PRISMATIC_FLOAT_PRECISION> cur_pot = kirklandPotential3D(atomic_species[l], xr, yr, zr);
@@ -96,7 +97,6 @@ void fetch_potentials3D(Array4D<std::complex<PRISMATIC_FLOAT_PRECISION>> &potent
 			PRISMATIC_FFTW_DESTROY_PLAN(plan_forward);
 		}
 	}
-	PRISMATIC_FFTW_CLEANUP_THREADS();
 }
 
 vector<size_t> get_unique_atomic_species(Parameters<PRISMATIC_FLOAT_PRECISION> &pars)
@@ -418,7 +418,7 @@ void generateProjectedPotentials3D(Parameters<PRISMATIC_FLOAT_PRECISION> &pars,
 	WorkDispatcher dispatcher(0, pars.atoms.size());
 	const size_t print_frequency = std::max((size_t)1, pars.atoms.size() / 10);
 
-	PRISMATIC_FFTW_INIT_THREADS();
+	initFFTWThreads();
 	std::cout << "Base random seed = " << pars.meta.randomSeed << std::endl;
 	for (long t = 0; t < numWorkers; t++)
 	{
@@ -555,7 +555,6 @@ void generateProjectedPotentials3D(Parameters<PRISMATIC_FLOAT_PRECISION> &pars,
 	for (auto &t : workers)
 		t.join();
 
-	PRISMATIC_FFTW_CLEANUP_THREADS();
 };
 
 void PRISM01_calcPotential(Parameters<PRISMATIC_FLOAT_PRECISION> &pars)
@@ -626,28 +625,29 @@ void PRISM01_calcPotential(Parameters<PRISMATIC_FLOAT_PRECISION> &pars)
 void PRISM01_importPotential(Parameters<PRISMATIC_FLOAT_PRECISION> &pars)
 {
 	std::cout << "Setting up PRISM01 auxilary variables according to " << pars.meta.importFile << " metadata." << std::endl;
-	//scope out imported tmp_pot as soon as possible
+	//stream the potential in slabs along its first axis, reordering each while the next one is read
 	{
-		Array3D<PRISMATIC_FLOAT_PRECISION> tmp_pot;
-		if(pars.meta.importPath.size() > 0)
-		{
-			readRealDataSet_inOrder(tmp_pot, pars.meta.importFile, pars.meta.importPath);
-		}
-		else //read default path
-		{
-			std::string groupPath = "4DSTEM_simulation/data/realslices/ppotential_fp" + getDigitString(pars.fpFlag) + "/data";
-			readRealDataSet_inOrder(tmp_pot, pars.meta.importFile, groupPath);
-		}
+		std::string dataPath = (pars.meta.importPath.size() > 0) ? pars.meta.importPath
+							 : "4DSTEM_simulation/data/realslices/ppotential_fp" + getDigitString(pars.fpFlag) + "/data";
+		DatasetReader<PRISMATIC_FLOAT_PRECISION> reader(pars.meta.importFile, dataPath, pars.meta.importCache);
+		const std::vector<hsize_t> &dims = reader.getDims();
+		size_t slabLength = reader.getSlabLength();
 
 		//initailize array and get data in right order
-		pars.pot = zeros_ND<3, PRISMATIC_FLOAT_PRECISION>({{tmp_pot.get_dimi(), tmp_pot.get_dimj(), tmp_pot.get_dimk()}});
-		for(auto i = 0; i < tmp_pot.get_dimi(); i++)
+		pars.pot = zeros_ND<3, PRISMATIC_FLOAT_PRECISION>({{dims[2], dims[1], dims[0]}});
+		for(auto k0 = 0; k0 < dims[0]; k0 += slabLength)
 		{
-			for(auto j = 0; j < tmp_pot.get_dimj(); j++)
+			size_t num = std::min(slabLength, (size_t) dims[0] - k0);
+			reader.prefetch(k0 + num, std::min(slabLength, (size_t) dims[0] - k0 - num));
+			std::shared_ptr<const std::vector<PRISMATIC_FLOAT_PRECISION>> slab = reader.getSlab(k0, num);
+			for(auto i = 0; i < dims[2]; i++)
 			{
-				for(auto k = 0; k < tmp_pot.get_dimk(); k++)
+				for(auto j = 0; j < dims[1]; j++)
 				{
-					pars.pot.at(i,j,k) = tmp_pot.at(k,j,i);
+					for(auto k = 0; k < num; k++)
+					{
+						pars.pot.at(i,j,k0+k) = (*slab)[(k*dims[1] + j)*dims[2] + i];
+					}
 				}
 			}
 		}
@@ -717,8 +717,7 @@ void fourierResampling(Parameters<PRISMATIC_FLOAT_PRECISION> &pars)
 	Array2D<complex<PRISMATIC_FLOAT_PRECISION>> bpot = zeros_ND<2,complex<PRISMATIC_FLOAT_PRECISION>>({{(size_t)Nj,(size_t) Ni}});
 	
 	//create FFT plans 
-	PRISMATIC_FFTW_INIT_THREADS();
-	PRISMATIC_FFTW_PLAN_WITH_NTHREADS(pars.meta.numThreads);
+	initFFTWThreads(pars.meta.numThreads);
 	
 	unique_lock<mutex> gatekeeper(fftw_plan_lock);
 	PRISMATIC_FFTW_PLAN plan_forward = PRISMATIC_FFTW_PLAN_DFT_2D(fstore.get_dimj(), fstore.get_dimi(),
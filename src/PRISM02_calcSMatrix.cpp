@@ -18,12 +18,18 @@
 #include <thread>
 #include "fftw3.h"
 #include <mutex>
+#include <condition_variable>
 #include "ArrayND.h"
 #include <complex>
+#include <algorithm>
 #include "utility.h"
 #include "configure.h"
 #include "WorkDispatcher.h"
 #include "fileIO.h"
+#include "DatasetReader.h"
+#include "SimulationPlan.h"
+#include "Checkpoint.h"
+#include "MPIComm.h"
 #ifdef PRISMATIC_BUILDING_GUI
 #include "prism_progressbar.h"
 #endif
@@ -35,6 +41,37 @@ using namespace std;
 const PRISMATIC_FLOAT_PRECISION pi = acos(-1);
 const std::complex<PRISMATIC_FLOAT_PRECISION> i(0, 1);
 
+namespace
+{
+// holds each thread of a fixed team until the whole team has arrived, and can be passed again right away
+class TeamBarrier
+{
+public:
+	explicit TeamBarrier(const size_t _size) : size(_size), arrived(0), generation(0){};
+
+	void wait()
+	{
+		std::unique_lock<std::mutex> lock(m);
+		const size_t current = generation;
+		if (++arrived == size)
+		{
+			arrived = 0;
+			++generation;
+			passed.notify_all();
+			return;
+		}
+		passed.wait(lock, [&]() { return generation != current; });
+	};
+
+private:
+	const size_t size;
+	size_t arrived;
+	size_t generation;
+	std::mutex m;
+	std::condition_variable passed;
+};
+} // namespace
+
 void setupCoordinates(Parameters<PRISMATIC_FLOAT_PRECISION> &pars)
 {
 
@@ -494,6 +531,20 @@ void fill_Scompact_CPUOnly(Parameters<PRISMATIC_FLOAT_PRECISION> &pars)
 			j = exp(i * pars.sigma * (*p++));
 	}
 
+	// beams of an interrupted run are restored from its checkpoint
+	std::vector<bool> beamsDone(pars.numberBeams, false);
+	if (pars.checkpoint)
+		beamsDone = pars.checkpoint->beginStage(Checkpoint::Stage::Beams, pars);
+#ifdef PRISMATIC_ENABLE_MPI
+	// beams of the other ranks are skipped here and gathered once all ranks are done
+	if (pars.distributeBeams)
+	{
+		std::pair<size_t, size_t> rankBeams = getRankBeams(pars);
+		for (auto b = 0; b < pars.numberBeams; b++)
+			beamsDone[b] = b < rankBeams.first || b >= rankBeams.second;
+	}
+#endif //PRISMATIC_ENABLE_MPI
+
 	// prepare to launch the calculation
 	vector<thread> workers;
 	workers.reserve(pars.meta.numThreads);												  // prevents multiple reallocations
@@ -502,12 +553,11 @@ void fill_Scompact_CPUOnly(Parameters<PRISMATIC_FLOAT_PRECISION> &pars)
 	pars.meta.batchSizeCPU = min(pars.meta.batchSizeTargetCPU, max((size_t)1, pars.numberBeams / pars.meta.numThreads));
 
 	// initialize FFTW threads
-	PRISMATIC_FFTW_INIT_THREADS();
-	PRISMATIC_FFTW_PLAN_WITH_NTHREADS(pars.meta.numThreads);
+	initFFTWThreads(pars.meta.numThreads);
 	for (auto t = 0; t < pars.meta.numThreads; ++t)
 	{
 		cout << "Launching thread #" << t << " to compute beams\n";
-		workers.push_back(thread([&pars, &dispatcher, &PRISMATIC_PRINT_FREQUENCY_BEAMS]() {
+		workers.push_back(thread([&pars, &dispatcher, &PRISMATIC_PRINT_FREQUENCY_BEAMS, &beamsDone]() {
 			// allocate array for psi just once per thread
 			//				Array2D<complex<PRISMATIC_FLOAT_PRECISION> > psi = zeros_ND<2, complex<PRISMATIC_FLOAT_PRECISION> >(
 			//						{{pars.imageSize[0], pars.imageSize[1]}});
@@ -567,12 +617,27 @@ void fill_Scompact_CPUOnly(Parameters<PRISMATIC_FLOAT_PRECISION> &pars)
 							cout << "Computing Plane Wave #" << currentBeam << "/" << pars.numberBeams << endl;
 						}
 
-						// re-zero psi each iteration
-						memset((void *)&psi_stack[0], 0,
-							   psi_stack.size() * sizeof(complex<PRISMATIC_FLOAT_PRECISION>));
-						//							propagatePlaneWave_CPU(pars, currentBeam, psi, plan_forward, plan_inverse, fftw_plan_lock);
-						propagatePlaneWave_CPU_batch(pars, currentBeam, stopBeam, psi_stack, plan_forward,
-													 plan_inverse, fftw_plan_lock);
+						// propagate the runs of beams the checkpoint does not hold yet
+						for (size_t workStart = currentBeam; workStart < stopBeam;)
+						{
+							size_t workStop = workStart;
+							while (workStop < stopBeam && !beamsDone[workStop])
+								++workStop;
+							if (workStop > workStart)
+							{
+								// re-zero psi each iteration
+								memset((void *)&psi_stack[0], 0,
+									   psi_stack.size() * sizeof(complex<PRISMATIC_FLOAT_PRECISION>));
+								//							propagatePlaneWave_CPU(pars, currentBeam, psi, plan_forward, plan_inverse, fftw_plan_lock);
+								propagatePlaneWave_CPU_batch(pars, workStart, workStop, psi_stack, plan_forward,
+															 plan_inverse, fftw_plan_lock);
+								if (pars.checkpoint)
+									pars.checkpoint->complete(workStart, workStop);
+							}
+							workStart = workStop;
+							while (workStart < stopBeam && beamsDone[workStart])
+								++workStart;
+						}
 #ifdef PRISMATIC_BUILDING_GUI
 						pars.progressbar->signalScompactUpdate(currentBeam, pars.numberBeams);
 #endif
@@ -591,7 +656,12 @@ void fill_Scompact_CPUOnly(Parameters<PRISMATIC_FLOAT_PRECISION> &pars)
 	cout << "Waiting for threads...\n";
 	for (auto &t : workers)
 		t.join();
-	PRISMATIC_FFTW_CLEANUP_THREADS();
+	if (pars.checkpoint)
+		pars.checkpoint->endStage();
+#ifdef PRISMATIC_ENABLE_MPI
+	if (pars.distributeBeams)
+		gatherBeams(pars);
+#endif //PRISMATIC_ENABLE_MPI
 #ifdef PRISMATIC_BUILDING_GUI
 	pars.progressbar->setProgress(100);
 	pars.progressbar->signalCalcStatusMessage(QString("Plane Wave ") +
@@ -630,8 +700,7 @@ void refocus(Parameters<PRISMATIC_FLOAT_PRECISION> &pars)
 				{{pars.Scompact.get_dimj(), pars.Scompact.get_dimi()}});
 
 	//create FFT plans
-	PRISMATIC_FFTW_INIT_THREADS();
-	PRISMATIC_FFTW_PLAN_WITH_NTHREADS(pars.meta.numThreads);
+	initFFTWThreads(pars.meta.numThreads);
 	
 	unique_lock<mutex> gatekeeper(fftw_plan_lock);
 	PRISMATIC_FFTW_PLAN plan_forward = PRISMATIC_FFTW_PLAN_DFT_2D(beamHold.get_dimj(), beamHold.get_dimi(),
@@ -692,8 +761,7 @@ void apply_aberrations(Parameters<PRISMATIC_FLOAT_PRECISION> &pars)
 				{{pars.Scompact.get_dimj(), pars.Scompact.get_dimi()}});
 
 	//create FFT plans
-	PRISMATIC_FFTW_INIT_THREADS();
-	PRISMATIC_FFTW_PLAN_WITH_NTHREADS(pars.meta.numThreads);
+	initFFTWThreads(pars.meta.numThreads);
 	
 	unique_lock<mutex> gatekeeper(fftw_plan_lock);
 	PRISMATIC_FFTW_PLAN plan_forward = PRISMATIC_FFTW_PLAN_DFT_2D(beamHold.get_dimj(), beamHold.get_dimi(),
@@ -735,27 +803,176 @@ void apply_aberrations(Parameters<PRISMATIC_FLOAT_PRECISION> &pars)
 
 }
 
-void PRISM02_calcSMatrix(Parameters<PRISMATIC_FLOAT_PRECISION> &pars)
+void compressSMatrix(Parameters<PRISMATIC_FLOAT_PRECISION> &pars)
 {
-	// propagate plane waves to construct compact S-matrix
-
-	cout << "Entering PRISM02_calcSMatrix" << endl;
+	// replaces the compact S-matrix, viewed as a (beams x pixels) matrix, with an orthonormal basis of
+	// its row space and a (beams x basis) coefficient matrix. The basis is grown with a pivoted modified
+	// Gram-Schmidt (rank-revealing QR) and truncated once every beam's residual falls below
+	// sMatrixRankTol relative to the largest beam norm. Refocusing and aberrations act identically on each
+	// plane, so they can be applied to the basis directly afterwards.
+
+#ifdef PRISMATIC_ENABLE_GPU
+	if (pars.meta.numGPUs > 0)
+	{
+		cout << "S-matrix compression is only supported by CPU workers, keeping full compact S-matrix" << endl;
+		return;
+	}
+#endif //PRISMATIC_ENABLE_GPU
 
-	// setup some coordinates
-	setupCoordinates(pars);
+	const size_t numBeams = pars.Scompact.get_dimk();
+	const size_t planeSize = pars.Scompact.get_dimj() * pars.Scompact.get_dimi();
+	const size_t numThreads = max((size_t)1, min((size_t)pars.meta.numThreads, numBeams));
+	complex<PRISMATIC_FLOAT_PRECISION> *S = &pars.Scompact[0];
 
-	// setup the beams and their indices
-	if(pars.meta.algorithm == Algorithm::PRISM)
+	// squared norm of each beam's residual
+	vector<PRISMATIC_FLOAT_PRECISION> norms(numBeams, 0);
+	for (auto a = 0; a < numBeams; ++a)
 	{
-		setupBeams(pars);
+		for (auto p = 0; p < planeSize; ++p)
+			norms[a] += std::norm(S[a * planeSize + p]);
 	}
-	else if(pars.meta.algorithm == Algorithm::HRTEM)
+	const PRISMATIC_FLOAT_PRECISION maxNorm = *max_element(norms.begin(), norms.end());
+	const PRISMATIC_FLOAT_PRECISION threshold = maxNorm * pars.meta.sMatrixRankTol * pars.meta.sMatrixRankTol;
+
+	vector<complex<PRISMATIC_FLOAT_PRECISION>> basis;
+	vector<complex<PRISMATIC_FLOAT_PRECISION>> coeffs; // stored [basis][beam] while growing
+	vector<bool> used(numBeams, false);
+	size_t rank = 0;
+	bool finished = false;
+
+	// one team of threads grows the whole basis: thread 0 picks each pivot alone, then all of them deflate their beams
+	TeamBarrier barrier(numThreads);
+	auto grow = [&](const size_t t) {
+		while (true)
+		{
+			if (t == 0)
+			{
+				size_t pivot = 0;
+				PRISMATIC_FLOAT_PRECISION pivotNorm = -1;
+				for (auto a = 0; a < numBeams; ++a)
+				{
+					if (!used[a] && norms[a] > pivotNorm)
+					{
+						pivotNorm = norms[a];
+						pivot = a;
+					}
+				}
+				finished = rank == numBeams || pivotNorm <= threshold || pivotNorm <= 0;
+				if (!finished)
+				{
+					// normalize the pivot residual into the next basis vector
+					basis.resize((rank + 1) * planeSize);
+					complex<PRISMATIC_FLOAT_PRECISION> *u = &basis[rank * planeSize];
+					const PRISMATIC_FLOAT_PRECISION invNorm = 1 / sqrt(pivotNorm);
+					for (auto p = 0; p < planeSize; ++p)
+						u[p] = S[pivot * planeSize + p] * invNorm;
+					used[pivot] = true;
+					coeffs.resize((rank + 1) * numBeams);
+				}
+			}
+			barrier.wait();
+			if (finished) return;
+
+			// project every beam onto it and deflate the residuals
+			const complex<PRISMATIC_FLOAT_PRECISION> *u = &basis[rank * planeSize];
+			complex<PRISMATIC_FLOAT_PRECISION> *c = &coeffs[rank * numBeams];
+			for (auto a = t; a < numBeams; a += numThreads)
+			{
+				complex<PRISMATIC_FLOAT_PRECISION> *r = &S[a * planeSize];
+				complex<PRISMATIC_FLOAT_PRECISION> proj = 0;
+				for (auto p = 0; p < planeSize; ++p)
+					proj += conj(u[p]) * r[p];
+				PRISMATIC_FLOAT_PRECISION resid = 0;
+				for (auto p = 0; p < planeSize; ++p)
+				{
+					r[p] -= proj * u[p];
+					resid += std::norm(r[p]);
+				}
+				c[a] = proj;
+				norms[a] = resid;
+			}
+			barrier.wait();
+			if (t == 0) ++rank;
+		}
+	};
+	vector<thread> workers;
+	workers.reserve(numThreads - 1);
+	for (auto t = 1; t < numThreads; ++t)
+		workers.push_back(thread(grow, t));
+	grow(0);
+	for (auto &w : workers)
+		w.join();
+
+	cout << "Compressed S-matrix from " << numBeams << " beams to a rank " << rank << " basis" << endl;
+
+	pars.ScompactCoeffs = zeros_ND<2, complex<PRISMATIC_FLOAT_PRECISION>>({{numBeams, rank}});
+	for (auto r = 0; r < rank; ++r)
 	{
-		setupBeams_HRTEM(pars);
+		for (auto a = 0; a < numBeams; ++a)
+			pars.ScompactCoeffs.at(a, r) = coeffs[r * numBeams + a];
 	}
+	pars.Scompact = Array3D<complex<PRISMATIC_FLOAT_PRECISION>>(std::move(basis), {{rank, pars.Scompact.get_dimj(), pars.Scompact.get_dimi()}});
+	pars.sMatrixCompressed = true;
+}
 
-	// setup coordinates for nonzero values of compact S-matrix
-	setupSMatrixCoordinates(pars);
+std::string geometryKey_SMatrix(const Parameters<PRISMATIC_FLOAT_PRECISION> &pars)
+{
+	// everything the coordinate, beam and S-matrix index setup read
+	SimulationPlan::Key key;
+	key << pars.pot.get_dimj() << pars.pot.get_dimi() << pars.pixelSize
+		<< pars.meta.realspacePixelSize[0] << pars.meta.realspacePixelSize[1] << pars.lambda << pars.meta.sliceThickness
+		<< pars.tiledCellDim << pars.meta.aberrations << pars.meta.alphaBeamMax
+		<< pars.meta.interpolationFactorX << pars.meta.interpolationFactorY;
+	return key.str();
+}
+
+void copyGeometry_SMatrix(const Parameters<PRISMATIC_FLOAT_PRECISION> &from, Parameters<PRISMATIC_FLOAT_PRECISION> &to)
+{
+	to.imageSize = from.imageSize;
+	to.qxa = from.qxa;
+	to.qya = from.qya;
+	to.q2 = from.q2;
+	to.qMax = from.qMax;
+	to.qMask = from.qMask;
+	to.prop = from.prop;
+	to.propBack = from.propBack;
+	to.numberBeams = from.numberBeams;
+	to.beams = from.beams;
+	to.beamsIndex = from.beamsIndex;
+	to.qxInd = from.qxInd;
+	to.qyInd = from.qyInd;
+}
+
+void PRISM02_calcSMatrix(Parameters<PRISMATIC_FLOAT_PRECISION> &pars)
+{
+	// propagate plane waves to construct compact S-matrix
+
+	cout << "Entering PRISM02_calcSMatrix" << endl;
+
+	// the HRTEM tilt selection depends on more than the grid, so only the PRISM setup is planned
+	SimulationPlan &plan = SimulationPlan::getPlan();
+	bool usePlan = pars.meta.reusePlan && pars.meta.algorithm == Algorithm::PRISM;
+	std::string geometryKey = usePlan ? geometryKey_SMatrix(pars) : "";
+	if(!usePlan or !plan.restore("PRISM02 geometry", geometryKey, copyGeometry_SMatrix, pars))
+	{
+		// setup some coordinates
+		setupCoordinates(pars);
+
+		// setup the beams and their indices
+		if(pars.meta.algorithm == Algorithm::PRISM)
+		{
+			setupBeams(pars);
+		}
+		else if(pars.meta.algorithm == Algorithm::HRTEM)
+		{
+			setupBeams_HRTEM(pars);
+		}
+
+		// setup coordinates for nonzero values of compact S-matrix
+		setupSMatrixCoordinates(pars);
+
+		if(usePlan) plan.store("PRISM02 geometry", geometryKey, copyGeometry_SMatrix, pars);
+	}
 
 	cout << "Computing compact S matrix" << endl;
 
@@ -773,12 +990,15 @@ void PRISM02_calcSMatrix(Parameters<PRISMATIC_FLOAT_PRECISION> &pars)
 	//set defocus parameter
 	pars.sMatrix_defocus = pars.tiledCellDim[0];
 
+	// optionally reduce the beam dimension to a low-rank basis
+	if(pars.meta.compressSMatrix && pars.meta.algorithm == Algorithm::PRISM) compressSMatrix(pars);
+
 	if(pars.meta.saveSMatrix)
 	{
 		std::cout << "Writing scattering matrix to output file." << std::endl;
 		setupSMatrixOutput(pars, pars.fpFlag);
 		H5::Group smatrix_group = pars.outputFile.openGroup("4DSTEM_simulation/data/realslices/smatrix_fp" + getDigitString(pars.fpFlag));
-		hsize_t mdims[3] = {pars.Scompact.get_dimi(), pars.Scompact.get_dimj(), pars.numberBeams};
+		hsize_t mdims[3] = {pars.Scompact.get_dimi(), pars.Scompact.get_dimj(), pars.Scompact.get_dimk()};
 
 		Array3D<std::complex<PRISMATIC_FLOAT_PRECISION>> output_buffer = zeros_ND<3, std::complex<PRISMATIC_FLOAT_PRECISION>>({{pars.Scompact.get_dimi(), pars.Scompact.get_dimj(), pars.Scompact.get_dimk()}});
 
@@ -793,38 +1013,64 @@ void PRISM02_calcSMatrix(Parameters<PRISMATIC_FLOAT_PRECISION> &pars)
 			}
 		}		
 		writeComplexDataSet_inOrder(smatrix_group, "data", &output_buffer[0], mdims, 3);
+
+		if(pars.sMatrixCompressed)
+		{
+			hsize_t cdims[2] = {pars.ScompactCoeffs.get_dimj(), pars.ScompactCoeffs.get_dimi()};
+			writeComplexDataSet_inOrder(smatrix_group, "coefficients", &pars.ScompactCoeffs[0], cdims, 2);
+		}
 	}
 }
 
 void PRISM02_importSMatrix(Parameters<PRISMATIC_FLOAT_PRECISION> &pars)
 {
 	std::cout << "Setting up auxilary variables according to " << pars.meta.importFile << " metadata." << std::endl;
-	//scope out imported smatrix as soon as possible
+	//stream the smatrix in slabs along its first axis, reordering each while the next one is read
 	{
-		Array3D<std::complex<PRISMATIC_FLOAT_PRECISION>> tmp_sm;
-		if(pars.meta.importPath.size() > 0)
-		{
-			readComplexDataSet_inOrder(tmp_sm, pars.meta.importFile, pars.meta.importPath);
-		}
-		else //read default path
-		{
-			std::string groupPath = "4DSTEM_simulation/data/realslices/smatrix_fp" + getDigitString(pars.fpFlag) + "/data";
-			readComplexDataSet_inOrder(tmp_sm, pars.meta.importFile, groupPath);
-		}
+		std::string dataPath = (pars.meta.importPath.size() > 0) ? pars.meta.importPath
+							 : "4DSTEM_simulation/data/realslices/smatrix_fp" + getDigitString(pars.fpFlag) + "/data";
+		DatasetReader<std::complex<PRISMATIC_FLOAT_PRECISION>> reader(pars.meta.importFile, dataPath, pars.meta.importCache);
+		const std::vector<hsize_t> &dims = reader.getDims();
+		size_t slabLength = reader.getSlabLength();
 
 		//initailize array and get data in right order
-		pars.Scompact = zeros_ND<3, std::complex<PRISMATIC_FLOAT_PRECISION>>({{tmp_sm.get_dimi(), tmp_sm.get_dimj(), tmp_sm.get_dimk()}});
-		for(auto i = 0; i < tmp_sm.get_dimi(); i++)
+		pars.Scompact = zeros_ND<3, std::complex<PRISMATIC_FLOAT_PRECISION>>({{dims[2], dims[1], dims[0]}});
+		for(auto k0 = 0; k0 < dims[0]; k0 += slabLength)
 		{
-			for(auto j = 0; j < tmp_sm.get_dimj(); j++)
+			size_t num = std::min(slabLength, (size_t) dims[0] - k0);
+			reader.prefetch(k0 + num, std::min(slabLength, (size_t) dims[0] - k0 - num));
+			std::shared_ptr<const std::vector<std::complex<PRISMATIC_FLOAT_PRECISION>>> slab = reader.getSlab(k0, num);
+			for(auto i = 0; i < dims[2]; i++)
 			{
-				for(auto k = 0; k < tmp_sm.get_dimk(); k++)
+				for(auto j = 0; j < dims[1]; j++)
 				{
-					pars.Scompact.at(i,j,k) = tmp_sm.at(k,j,i);
+					for(auto k = 0; k < num; k++)
+					{
+						pars.Scompact.at(i,j,k0+k) = (*slab)[(k*dims[1] + j)*dims[2] + i];
+					}
 				}
 			}
 		}
 	}
+
+	//compressed s-matrices carry their beam coefficients next to the basis
+	{
+		std::string dataPath = (pars.meta.importPath.size() > 0) ? pars.meta.importPath
+							 : "4DSTEM_simulation/data/realslices/smatrix_fp" + getDigitString(pars.fpFlag) + "/data";
+		std::string coeffPath = dataPath.substr(0, dataPath.find_last_of('/') + 1) + "coefficients";
+		H5::H5File input = H5::H5File(pars.meta.importFile.c_str(), H5F_ACC_RDONLY);
+		bool compressed = input.nameExists(coeffPath.c_str());
+		input.close();
+		if(compressed)
+		{
+#ifdef PRISMATIC_ENABLE_GPU
+			if(pars.meta.numGPUs > 0) throw std::runtime_error("Compressed S-matrices can only be imported by CPU workers.\n");
+#endif //PRISMATIC_ENABLE_GPU
+			readComplexDataSet_inOrder(pars.ScompactCoeffs, pars.meta.importFile, coeffPath);
+			pars.sMatrixCompressed = true;
+			std::cout << "Imported S-matrix is compressed to a rank " << pars.Scompact.get_dimk() << " basis" << std::endl;
+		}
+	}
 	
 	//acquire necessary metadata to create auxillary variables
 	std::string groupPath = "4DSTEM_simulation/metadata/metadata_0/original/simulation_parameters";
@@ -905,7 +1151,7 @@ void PRISM02_importSMatrix(Parameters<PRISMATIC_FLOAT_PRECISION> &pars)
 		std::cout << "Writing scattering matrix to output file." << std::endl;
 		setupSMatrixOutput(pars, pars.fpFlag);
 		H5::Group smatrix_group = pars.outputFile.openGroup("4DSTEM_simulation/data/realslices/smatrix_fp" + getDigitString(pars.fpFlag));
-		hsize_t mdims[3] = {pars.Scompact.get_dimi(), pars.Scompact.get_dimj(), pars.numberBeams};
+		hsize_t mdims[3] = {pars.Scompact.get_dimi(), pars.Scompact.get_dimj(), pars.Scompact.get_dimk()};
 
 		Array3D<std::complex<PRISMATIC_FLOAT_PRECISION>> output_buffer = zeros_ND<3, std::complex<PRISMATIC_FLOAT_PRECISION>>({{pars.Scompact.get_dimi(), pars.Scompact.get_dimj(), pars.Scompact.get_dimk()}});
 
@@ -920,6 +1166,12 @@ void PRISM02_importSMatrix(Parameters<PRISMATIC_FLOAT_PRECISION> &pars)
 			}
 		}		
 		writeComplexDataSet_inOrder(smatrix_group, "data", &output_buffer[0], mdims, 3);
+
+		if(pars.sMatrixCompressed)
+		{
+			hsize_t cdims[2] = {pars.ScompactCoeffs.get_dimj(), pars.ScompactCoeffs.get_dimi()};
+			writeComplexDataSet_inOrder(smatrix_group, "coefficients", &pars.ScompactCoeffs[0], cdims, 2);
+		}
 	}
 
 }
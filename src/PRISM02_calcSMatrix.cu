@@ -466,8 +466,7 @@ namespace Prismatic {
 			pars.meta.batchSizeCPU = min(pars.meta.batchSizeTargetCPU, max((size_t)1, pars.numberBeams / pars.meta.numThreads));
 
 			// startup FFTW threads
-			PRISMATIC_FFTW_INIT_THREADS();
-			PRISMATIC_FFTW_PLAN_WITH_NTHREADS(pars.meta.numThreads);
+			initFFTWThreads(pars.meta.numThreads);
 			for (auto t = 0; t < pars.meta.numThreads; ++t) {
 				cout << "Launching thread #" << t << " to compute beams\n";
 				workers_CPU.push_back(thread([&pars, &dispatcher, &PRISMATIC_PRINT_FREQUENCY_BEAMS]() {
@@ -543,7 +542,6 @@ namespace Prismatic {
 				}));
 			}
 			for (auto &t:workers_CPU)t.join();
-			PRISMATIC_FFTW_CLEANUP_THREADS();
 		}
 		// synchronize workers
 		for (auto &t:workers_GPU)t.join();
@@ -658,8 +656,7 @@ namespace Prismatic {
 			pars.meta.batchSizeCPU = min(pars.meta.batchSizeTargetCPU, max((size_t)1, pars.numberBeams / pars.meta.numThreads));
 
 			// startup FFTW threads
-			PRISMATIC_FFTW_INIT_THREADS();
-			PRISMATIC_FFTW_PLAN_WITH_NTHREADS(pars.meta.numThreads);
+			initFFTWThreads(pars.meta.numThreads);
 			for (auto t = 0; t < pars.meta.numThreads; ++t) {
 				cout << "Launching thread #" << t << " to compute beams\n";
 				workers_CPU.push_back(thread([&pars, &fftw_plan_lock, &dispatcher, &PRISMATIC_PRINT_FREQUENCY_BEAMS]() {
@@ -732,7 +729,6 @@ namespace Prismatic {
 				}));
 			}
 			for (auto &t:workers_CPU)t.join();
-			PRISMATIC_FFTW_CLEANUP_THREADS();
 		}
 		for (auto &t:workers_GPU)t.join();
 	}
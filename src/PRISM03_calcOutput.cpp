@@ -21,11 +21,15 @@
 #include <mutex>
 #include <numeric>
 #include <vector>
+#include <map>
+#include <chrono>
 #include "fftw3.h"
 #include "utility.h"
 #include "WorkDispatcher.h"
 #include "ArrayND.h"
 #include "fileIO.h"
+#include "SimulationPlan.h"
+#include "Checkpoint.h"
 
 #ifdef PRISMATIC_BUILDING_GUI
 #include "prism_progressbar.h"
@@ -64,45 +68,11 @@ void setupCoordinates_2(Parameters<PRISMATIC_FLOAT_PRECISION> &pars)
 {
 	std::vector<PRISMATIC_FLOAT_PRECISION> xp_d;
 	std::vector<PRISMATIC_FLOAT_PRECISION> yp_d;
+	getProbePositions(pars, xp_d, yp_d);
 
-	if(pars.meta.arbitraryProbes)
-	{
-		xp_d = pars.meta.probes_x;
-		yp_d = pars.meta.probes_y;
-		pars.numXprobes = xp_d.size();
-		pars.numYprobes = 1;
-		pars.numProbes = xp_d.size();
-	}
-	else
-	{
-		Array1D<PRISMATIC_FLOAT_PRECISION> xR = zeros_ND<1, PRISMATIC_FLOAT_PRECISION>({{2}});
-		xR[0] = pars.scanWindowXMin * pars.tiledCellDim[2];
-		xR[1] = pars.scanWindowXMax * pars.tiledCellDim[2];
-		Array1D<PRISMATIC_FLOAT_PRECISION> yR = zeros_ND<1, PRISMATIC_FLOAT_PRECISION>({{2}});
-		yR[0] = pars.scanWindowYMin * pars.tiledCellDim[1];
-		yR[1] = pars.scanWindowYMax * pars.tiledCellDim[1];
-
-		PRISMATIC_FLOAT_PRECISION probeStepX;
-		PRISMATIC_FLOAT_PRECISION probeStepY;
-		if (pars.meta.nyquistSampling)
-		{
-			int numX = nyquistProbes(pars, 2); //x is dim 2
-			int numY = nyquistProbes(pars, 1); //y is dim 1
-			probeStepX = pars.tiledCellDim[2] / numX;
-			probeStepY = pars.tiledCellDim[1] / numY;
-		}
-		else
-		{
-			probeStepX = pars.meta.probeStepX;
-			probeStepY = pars.meta.probeStepY;
-		}
-
-		xp_d = vecFromRange(xR[0], probeStepX, xR[1]);
-		yp_d = vecFromRange(yR[0], probeStepY, yR[1]);
-		pars.numXprobes = xp_d.size();
-		pars.numYprobes = yp_d.size();
-		pars.numProbes = xp_d.size()*yp_d.size();
-	}
+	pars.numXprobes = xp_d.size();
+	pars.numYprobes = pars.meta.arbitraryProbes ? 1 : yp_d.size();
+	pars.numProbes = pars.numXprobes * pars.numYprobes;
 
 	Array1D<PRISMATIC_FLOAT_PRECISION> xp(xp_d, {{xp_d.size()}});
 	Array1D<PRISMATIC_FLOAT_PRECISION> yp(yp_d, {{yp_d.size()}});
@@ -167,7 +137,7 @@ void createStack_integrate(Parameters<PRISMATIC_FLOAT_PRECISION> &pars)
 {
 	// create output of a size corresponding to 3D mode (integration)
 	pars.numLayers = 1;
-	pars.output = zeros_ND<4, PRISMATIC_FLOAT_PRECISION>({{1, pars.numYprobes, pars.numXprobes, pars.Ndet}});
+	pars.output = zeros_ND<4, PRISMATIC_FLOAT_PRECISION>({{1, pars.numYprobes, pars.numXprobes, pars.Ndet + pars.meta.detectors.size()}});
 	if (pars.meta.saveDPC_CoM)
 		pars.DPC_CoM = zeros_ND<4, PRISMATIC_FLOAT_PRECISION>({{1, pars.numYprobes, pars.numXprobes, 2}});
 	
@@ -216,69 +186,357 @@ void setupFourierCoordinates(Parameters<PRISMATIC_FLOAT_PRECISION> &pars)
 	pars.q2 = zeros_ND<2, PRISMATIC_FLOAT_PRECISION>({{pars.imageSizeReduce[0], pars.imageSizeReduce[1]}});
 }
 
-std::pair<Array2D<std::complex<PRISMATIC_FLOAT_PRECISION>>, Array2D<std::complex<PRISMATIC_FLOAT_PRECISION>>>
-getSinglePRISMProbe_CPU(Parameters<PRISMATIC_FLOAT_PRECISION> &pars, const PRISMATIC_FLOAT_PRECISION xp, const PRISMATIC_FLOAT_PRECISION yp)
+void getProbeWindow(Parameters<PRISMATIC_FLOAT_PRECISION> &pars,
+					const PRISMATIC_FLOAT_PRECISION xp,
+					const PRISMATIC_FLOAT_PRECISION yp,
+					Array1D<PRISMATIC_FLOAT_PRECISION> &x,
+					Array1D<PRISMATIC_FLOAT_PRECISION> &y)
 {
-
-	// compute a single probe (for comparison with multislice in the GUI)
-
-	Array2D<std::complex<PRISMATIC_FLOAT_PRECISION>> realspace_probe;
-	Array2D<std::complex<PRISMATIC_FLOAT_PRECISION>> kspace_probe;
-
-	Array2D<std::complex<PRISMATIC_FLOAT_PRECISION>> psi = Prismatic::zeros_ND<2, std::complex<PRISMATIC_FLOAT_PRECISION>>(
-		{{pars.imageSizeReduce[0], pars.imageSizeReduce[1]}});
-	unique_lock<mutex> gatekeeper(fftw_plan_lock);
-	PRISMATIC_FFTW_PLAN plan = PRISMATIC_FFTW_PLAN_DFT_2D(psi.get_dimj(), psi.get_dimi(),
-														  reinterpret_cast<PRISMATIC_FFTW_COMPLEX *>(&psi[0]),
-														  reinterpret_cast<PRISMATIC_FFTW_COMPLEX *>(&psi[0]),
-														  FFTW_FORWARD, FFTW_ESTIMATE);
-	gatekeeper.unlock();
-	const static std::complex<PRISMATIC_FLOAT_PRECISION> i(0, 1);
-	const static PRISMATIC_FLOAT_PRECISION pi = std::acos(-1);
-
-	// setup some coordinates
+	// wrapped indices of the S-matrix window that a probe centered at (xp, yp) reads from
 	PRISMATIC_FLOAT_PRECISION x0 = xp / pars.pixelSizeOutput[1];
 	PRISMATIC_FLOAT_PRECISION y0 = yp / pars.pixelSizeOutput[0];
 
-	Array1D<PRISMATIC_FLOAT_PRECISION> x = pars.xVec + round(x0);
+	if (pars.ScompactHalo[0] > 0)
+	{
+		// with a periodic halo only the window origin needs wrapping; the rest of the window follows contiguously
+		long x_start = ((long)round(x0) + (long)pars.xVec[0]) % (long)pars.imageSizeOutput[1];
+		long y_start = ((long)round(y0) + (long)pars.yVec[0]) % (long)pars.imageSizeOutput[0];
+		if (x_start < 0) x_start += pars.imageSizeOutput[1];
+		if (y_start < 0) y_start += pars.imageSizeOutput[0];
+		x = pars.xVec - pars.xVec[0] + (PRISMATIC_FLOAT_PRECISION)x_start;
+		y = pars.yVec - pars.yVec[0] + (PRISMATIC_FLOAT_PRECISION)y_start;
+		return;
+	}
+
+	x = pars.xVec + round(x0);
 	// the second call to fmod here is to make sure the result is positive
 	transform(x.begin(), x.end(), x.begin(), [&pars](PRISMATIC_FLOAT_PRECISION &a) {
 		return fmod((PRISMATIC_FLOAT_PRECISION)pars.imageSizeOutput[1] +
 						fmod(a, (PRISMATIC_FLOAT_PRECISION)pars.imageSizeOutput[1]),
 					(PRISMATIC_FLOAT_PRECISION)pars.imageSizeOutput[1]);
 	});
-	Array1D<PRISMATIC_FLOAT_PRECISION> y = pars.yVec + round(y0);
+
+	y = pars.yVec + round(y0);
 	transform(y.begin(), y.end(), y.begin(), [&pars](PRISMATIC_FLOAT_PRECISION &a) {
 		return fmod((PRISMATIC_FLOAT_PRECISION)pars.imageSizeOutput[0] +
 						fmod(a, (PRISMATIC_FLOAT_PRECISION)pars.imageSizeOutput[0]),
 					(PRISMATIC_FLOAT_PRECISION)pars.imageSizeOutput[0]);
 	});
-	Array2D<PRISMATIC_FLOAT_PRECISION> intOutput = Prismatic::zeros_ND<2, PRISMATIC_FLOAT_PRECISION>(
-		{{pars.imageSizeReduce[0], pars.imageSizeReduce[1]}});
+}
+
+size_t getNumSMatrixPlanes(Parameters<PRISMATIC_FLOAT_PRECISION> &pars)
+{
+	// planes of Scompact summed over per probe: one per beam, or one per basis vector if compressed
+	return pars.sMatrixCompressed ? pars.ScompactCoeffs.get_dimi() : pars.beamsIndex.size();
+}
+
+void getProbeWeights_CPU(Parameters<PRISMATIC_FLOAT_PRECISION> &pars,
+						 const PRISMATIC_FLOAT_PRECISION xp,
+						 const PRISMATIC_FLOAT_PRECISION yp,
+						 std::complex<PRISMATIC_FLOAT_PRECISION> *weights)
+{
+	getProbeWeights_CPU(pars, pars.psiProbeInit, pars.xTiltShift, pars.yTiltShift, xp, yp, weights);
+}
 
-	memset(&psi[0], 0, sizeof(std::complex<PRISMATIC_FLOAT_PRECISION>) * psi.size());
+void getProbeWeights_CPU(Parameters<PRISMATIC_FLOAT_PRECISION> &pars,
+						 const Array2D<std::complex<PRISMATIC_FLOAT_PRECISION>> &psiProbeInit,
+						 const PRISMATIC_FLOAT_PRECISION xTiltShift,
+						 const PRISMATIC_FLOAT_PRECISION yTiltShift,
+						 const PRISMATIC_FLOAT_PRECISION xp,
+						 const PRISMATIC_FLOAT_PRECISION yp,
+						 std::complex<PRISMATIC_FLOAT_PRECISION> *weights)
+{
+	// complex weight of each S-matrix plane for the initial probe psiProbeInit centered at (xp, yp). When Scompact
+	// holds a low-rank basis, the per-beam weights are folded through ScompactCoeffs so the sum runs over the rank instead
+	const size_t numSPlanes = getNumSMatrixPlanes(pars);
+	std::fill_n(weights, numSPlanes, std::complex<PRISMATIC_FLOAT_PRECISION>(0, 0));
 	for (auto a4 = 0; a4 < pars.beamsIndex.size(); ++a4)
 	{
 		PRISMATIC_FLOAT_PRECISION yB = pars.xyBeams.at(a4, 0);
 		PRISMATIC_FLOAT_PRECISION xB = pars.xyBeams.at(a4, 1);
 
-		if (abs(pars.psiProbeInit.at(yB, xB)) > 0)
+		if (abs(psiProbeInit.at(yB, xB)) > 0)
 		{
 			PRISMATIC_FLOAT_PRECISION q0_0 = pars.qxaReduce.at(yB, xB);
 			PRISMATIC_FLOAT_PRECISION q0_1 = pars.qyaReduce.at(yB, xB);
 			std::complex<PRISMATIC_FLOAT_PRECISION> phaseShift = exp(
-				-2 * pi * i * (q0_0 * (xp + pars.xTiltShift) + q0_1 * (yp + pars.yTiltShift)));
-			const std::complex<PRISMATIC_FLOAT_PRECISION> tmp_const = pars.psiProbeInit.at(yB, xB) * phaseShift;
-			auto psi_ptr = psi.begin();
+				-2 * pi * i * (q0_0 * (xp + xTiltShift) + q0_1 * (yp + yTiltShift)));
+			const std::complex<PRISMATIC_FLOAT_PRECISION> tmp_const = psiProbeInit.at(yB, xB) * phaseShift;
+			if (pars.sMatrixCompressed)
+			{
+				const std::complex<PRISMATIC_FLOAT_PRECISION> *c = &pars.ScompactCoeffs.at(a4, 0);
+				for (auto r = 0; r < numSPlanes; ++r)
+					weights[r] += tmp_const * c[r];
+			}
+			else
+			{
+				weights[a4] = tmp_const;
+			}
+		}
+	}
+}
+
+void synthesizeProbe_CPU(Parameters<PRISMATIC_FLOAT_PRECISION> &pars,
+						 const std::complex<PRISMATIC_FLOAT_PRECISION> *weights,
+						 const Array1D<PRISMATIC_FLOAT_PRECISION> &x,
+						 const Array1D<PRISMATIC_FLOAT_PRECISION> &y,
+						 std::complex<PRISMATIC_FLOAT_PRECISION> *psi)
+{
+	// accumulate the weighted S-matrix window into the row-major y.size() x x.size() wave psi
+	const size_t numSPlanes = getNumSMatrixPlanes(pars);
+	if (pars.ScompactHalo[0] > 0)
+	{
+		// the window is a contiguous block starting at (y[0], x[0]), so rows are read by pointer arithmetic
+		if (pars.sMatrixPixelMajor)
+		{
+			const size_t pixelStride = pars.Scompact.get_dimi();
 			for (auto j = 0; j < y.size(); ++j)
 			{
+				const std::complex<PRISMATIC_FLOAT_PRECISION> *row = &pars.Scompact.at(y[0] + j, x[0], 0);
+				std::complex<PRISMATIC_FLOAT_PRECISION> *psi_ptr = &psi[j * x.size()];
 				for (auto i = 0; i < x.size(); ++i)
 				{
-					*psi_ptr++ += (tmp_const * pars.Scompact.at(a4, y[j], x[i]));
+					psi_ptr[i] += complexDot_CPU(weights, row + i * pixelStride, numSPlanes);
+				}
+			}
+		}
+		else
+		{
+			for (auto a4 = 0; a4 < numSPlanes; ++a4)
+			{
+				const std::complex<PRISMATIC_FLOAT_PRECISION> tmp_const = weights[a4];
+				if (tmp_const == std::complex<PRISMATIC_FLOAT_PRECISION>(0, 0)) continue;
+				for (auto j = 0; j < y.size(); ++j)
+				{
+					const std::complex<PRISMATIC_FLOAT_PRECISION> *row = &pars.Scompact.at(a4, y[0] + j, x[0]);
+					std::complex<PRISMATIC_FLOAT_PRECISION> *psi_ptr = &psi[j * x.size()];
+					for (auto i = 0; i < x.size(); ++i)
+					{
+						psi_ptr[i] += tmp_const * row[i];
+					}
 				}
 			}
 		}
+		return;
+	}
+	if (pars.sMatrixPixelMajor)
+	{
+		for (auto j = 0; j < y.size(); ++j)
+		{
+			for (auto i = 0; i < x.size(); ++i)
+			{
+				psi[j * x.size() + i] += complexDot_CPU(weights, &pars.Scompact.at(y[j], x[i], 0), numSPlanes);
+			}
+		}
+		return;
 	}
+	for (auto a4 = 0; a4 < numSPlanes; ++a4)
+	{
+		const std::complex<PRISMATIC_FLOAT_PRECISION> tmp_const = weights[a4];
+		if (tmp_const == std::complex<PRISMATIC_FLOAT_PRECISION>(0, 0)) continue;
+		for (auto j = 0; j < y.size(); ++j)
+		{
+			for (auto i = 0; i < x.size(); ++i)
+			{
+				psi[j * x.size() + i] += (tmp_const * pars.Scompact.at(a4, y[j], x[i]));
+			}
+		}
+	}
+}
+
+std::complex<PRISMATIC_FLOAT_PRECISION> complexDot_CPU(const std::complex<PRISMATIC_FLOAT_PRECISION> *a,
+													   const std::complex<PRISMATIC_FLOAT_PRECISION> *b,
+													   const size_t N)
+{
+	// sum of a[n] * b[n], written on the real and imaginary parts so the loop is a plain unit-stride reduction
+	const PRISMATIC_FLOAT_PRECISION *a_r = reinterpret_cast<const PRISMATIC_FLOAT_PRECISION *>(a);
+	const PRISMATIC_FLOAT_PRECISION *b_r = reinterpret_cast<const PRISMATIC_FLOAT_PRECISION *>(b);
+	PRISMATIC_FLOAT_PRECISION re = 0;
+	PRISMATIC_FLOAT_PRECISION im = 0;
+	for (size_t n = 0; n < 2 * N; n += 2)
+	{
+		re += a_r[n] * b_r[n] - a_r[n + 1] * b_r[n + 1];
+		im += a_r[n] * b_r[n + 1] + a_r[n + 1] * b_r[n];
+	}
+	return std::complex<PRISMATIC_FLOAT_PRECISION>(re, im);
+}
+
+void complexGemm_CPU(const std::complex<PRISMATIC_FLOAT_PRECISION> *A,
+					 const std::complex<PRISMATIC_FLOAT_PRECISION> *B,
+					 std::complex<PRISMATIC_FLOAT_PRECISION> *C,
+					 const size_t M, const size_t N, const size_t K)
+{
+	// row-major C[M x N] = A[M x K] * B[K x N], blocked so that a tile of B stays in cache while it is reused
+	// for every row of A
+	const size_t blockN = 256;
+	const size_t blockK = 32;
+	std::fill_n(C, M * N, std::complex<PRISMATIC_FLOAT_PRECISION>(0, 0));
+	for (size_t n0 = 0; n0 < N; n0 += blockN)
+	{
+		const size_t n1 = min(N, n0 + blockN);
+		for (size_t k0 = 0; k0 < K; k0 += blockK)
+		{
+			const size_t k1 = min(K, k0 + blockK);
+			for (size_t m = 0; m < M; ++m)
+			{
+				std::complex<PRISMATIC_FLOAT_PRECISION> *c = &C[m * N];
+				for (size_t k = k0; k < k1; ++k)
+				{
+					const std::complex<PRISMATIC_FLOAT_PRECISION> a = A[m * K + k];
+					const std::complex<PRISMATIC_FLOAT_PRECISION> *b = &B[k * N];
+					for (size_t n = n0; n < n1; ++n)
+						c[n] += a * b[n];
+				}
+			}
+		}
+	}
+}
+
+void setSMatrixLayout_CPU(Parameters<PRISMATIC_FLOAT_PRECISION> &pars, const bool pixelMajor)
+{
+	// transpose Scompact between [plane][y][x] and [y][x][plane]. In the pixel-major layout the plane axis is
+	// padded to a multiple of 8 so that every pixel's plane vector starts on a SIMD-friendly boundary
+	if (pars.sMatrixPixelMajor == pixelMajor) return;
+
+	Array3D<std::complex<PRISMATIC_FLOAT_PRECISION>> transposed;
+	if (pixelMajor)
+	{
+		const size_t numPlanes = pars.Scompact.get_dimk();
+		const size_t paddedPlanes = ((numPlanes + 7) / 8) * 8;
+		transposed = zeros_ND<3, std::complex<PRISMATIC_FLOAT_PRECISION>>(
+			{{pars.Scompact.get_dimj(), pars.Scompact.get_dimi(), paddedPlanes}});
+		for (auto k = 0; k < numPlanes; ++k)
+		{
+			for (auto y = 0; y < pars.Scompact.get_dimj(); ++y)
+			{
+				for (auto x = 0; x < pars.Scompact.get_dimi(); ++x)
+				{
+					transposed.at(y, x, k) = pars.Scompact.at(k, y, x);
+				}
+			}
+		}
+		pars.ScompactPlanes = numPlanes;
+	}
+	else
+	{
+		transposed = zeros_ND<3, std::complex<PRISMATIC_FLOAT_PRECISION>>(
+			{{pars.ScompactPlanes, pars.Scompact.get_dimk(), pars.Scompact.get_dimj()}});
+		for (auto y = 0; y < pars.Scompact.get_dimk(); ++y)
+		{
+			for (auto x = 0; x < pars.Scompact.get_dimj(); ++x)
+			{
+				for (auto k = 0; k < pars.ScompactPlanes; ++k)
+				{
+					transposed.at(k, y, x) = pars.Scompact.at(y, x, k);
+				}
+			}
+		}
+	}
+	pars.Scompact = std::move(transposed);
+	pars.sMatrixPixelMajor = pixelMajor;
+}
+
+bool preferPixelMajor_CPU(const size_t numPlanes, const size_t activePlanes, const size_t windowPixels)
+{
+	// values read per window pixel: beam-major reads only the activePlanes a probe weights, but also reads and writes
+	// the output window once per plane when the window is too large to stay in cache between planes; pixel-major
+	// reads every padded plane in one dot product and writes each output value once
+	const size_t paddedPlanes = ((numPlanes + 7) / 8) * 8;
+	const size_t cachedWindowBytes = 256 * 1024;
+	const size_t beamMajorReads = (windowPixels * sizeof(std::complex<PRISMATIC_FLOAT_PRECISION>) > cachedWindowBytes) ? 3 * activePlanes : activePlanes;
+	return paddedPlanes < beamMajorReads;
+}
+
+void chooseSMatrixLayout_CPU(Parameters<PRISMATIC_FLOAT_PRECISION> &pars)
+{
+	// put Scompact in the layout requested by the user, or pick one from the probe window size and the number of
+	// S-matrix planes a probe weights, which are the same for every probe
+	if (pars.meta.sMatrixLayout != SMatrixLayout::Auto)
+	{
+		setSMatrixLayout_CPU(pars, pars.meta.sMatrixLayout == SMatrixLayout::PixelMajor);
+		return;
+	}
+
+	// a compressed basis plane is weighted by every beam; an uncompressed beam only inside the probe aperture
+	const size_t numSPlanes = getNumSMatrixPlanes(pars);
+	size_t activePlanes = numSPlanes;
+	if (!pars.sMatrixCompressed)
+	{
+		activePlanes = 0;
+		for (auto a4 = 0; a4 < pars.beamsIndex.size(); ++a4)
+		{
+			if (abs(pars.psiProbeInit.at(pars.xyBeams.at(a4, 0), pars.xyBeams.at(a4, 1))) > 0) ++activePlanes;
+		}
+	}
+	setSMatrixLayout_CPU(pars, preferPixelMajor_CPU(numSPlanes, activePlanes, pars.imageSizeReduce[0] * pars.imageSizeReduce[1]));
+	cout << "Using " << (pars.sMatrixPixelMajor ? "pixel-major" : "beam-major") << " S-matrix layout for probe synthesis\n";
+}
+
+void setSMatrixHalo_CPU(Parameters<PRISMATIC_FLOAT_PRECISION> &pars, const bool halo)
+{
+	// extend Scompact periodically by one probe window along y and x, or crop such a halo back off. With the
+	// halo in place every probe window is a contiguous sub-block of Scompact in either layout
+	if ((pars.ScompactHalo[0] > 0) == halo) return;
+
+	// dimensions as {plane, y, x} regardless of the memory order
+	const bool pixelMajor = pars.sMatrixPixelMajor;
+	const size_t numPlanes = pixelMajor ? pars.Scompact.get_dimi() : pars.Scompact.get_dimk();
+	const size_t Ny_in = pixelMajor ? pars.Scompact.get_dimk() : pars.Scompact.get_dimj();
+	const size_t Nx_in = pixelMajor ? pars.Scompact.get_dimj() : pars.Scompact.get_dimi();
+	const size_t Ny = halo ? Ny_in + pars.yVec.size() : Ny_in - pars.ScompactHalo[0];
+	const size_t Nx = halo ? Nx_in + pars.xVec.size() : Nx_in - pars.ScompactHalo[1];
+
+	Array3D<std::complex<PRISMATIC_FLOAT_PRECISION>> resized = pixelMajor ? zeros_ND<3, std::complex<PRISMATIC_FLOAT_PRECISION>>({{Ny, Nx, numPlanes}})
+																			: zeros_ND<3, std::complex<PRISMATIC_FLOAT_PRECISION>>({{numPlanes, Ny, Nx}});
+	for (auto y = 0; y < Ny; ++y)
+	{
+		for (auto x = 0; x < Nx; ++x)
+		{
+			// reading modulo the input size wraps into the halo when padding and is the identity when cropping
+			if (pixelMajor)
+			{
+				const std::complex<PRISMATIC_FLOAT_PRECISION> *src = &pars.Scompact.at(y % Ny_in, x % Nx_in, 0);
+				copy(src, src + numPlanes, &resized.at(y, x, 0));
+			}
+			else
+			{
+				for (auto k = 0; k < numPlanes; ++k)
+					resized.at(k, y, x) = pars.Scompact.at(k, y % Ny_in, x % Nx_in);
+			}
+		}
+	}
+	pars.Scompact = std::move(resized);
+	pars.ScompactHalo = halo ? std::array<size_t, 2>{{pars.yVec.size(), pars.xVec.size()}} : std::array<size_t, 2>{{0, 0}};
+}
+
+std::pair<Array2D<std::complex<PRISMATIC_FLOAT_PRECISION>>, Array2D<std::complex<PRISMATIC_FLOAT_PRECISION>>>
+getSinglePRISMProbe_CPU(Parameters<PRISMATIC_FLOAT_PRECISION> &pars, const PRISMATIC_FLOAT_PRECISION xp, const PRISMATIC_FLOAT_PRECISION yp)
+{
+
+	// compute a single probe (for comparison with multislice in the GUI)
+
+	Array2D<std::complex<PRISMATIC_FLOAT_PRECISION>> realspace_probe;
+	Array2D<std::complex<PRISMATIC_FLOAT_PRECISION>> kspace_probe;
+
+	Array2D<std::complex<PRISMATIC_FLOAT_PRECISION>> psi = Prismatic::zeros_ND<2, std::complex<PRISMATIC_FLOAT_PRECISION>>(
+		{{pars.imageSizeReduce[0], pars.imageSizeReduce[1]}});
+	unique_lock<mutex> gatekeeper(fftw_plan_lock);
+	PRISMATIC_FFTW_PLAN plan = PRISMATIC_FFTW_PLAN_DFT_2D(psi.get_dimj(), psi.get_dimi(),
+														  reinterpret_cast<PRISMATIC_FFTW_COMPLEX *>(&psi[0]),
+														  reinterpret_cast<PRISMATIC_FFTW_COMPLEX *>(&psi[0]),
+														  FFTW_FORWARD, FFTW_ESTIMATE);
+	gatekeeper.unlock();
+
+	// setup some coordinates
+	Array1D<PRISMATIC_FLOAT_PRECISION> x, y;
+	getProbeWindow(pars, xp, yp, x, y);
+
+	std::vector<std::complex<PRISMATIC_FLOAT_PRECISION>> weights(getNumSMatrixPlanes(pars));
+	getProbeWeights_CPU(pars, xp, yp, &weights[0]);
+
+	std::fill_n(&psi[0], psi.size(), std::complex<PRISMATIC_FLOAT_PRECISION>(0, 0));
+	synthesizeProbe_CPU(pars, &weights[0], x, y, &psi[0]);
+
 	realspace_probe = psi;
 	PRISMATIC_FFTW_EXECUTE(plan);
 	kspace_probe = psi;
@@ -298,49 +556,103 @@ void buildPRISMOutput_CPUOnly(Parameters<PRISMATIC_FLOAT_PRECISION> &pars)
 	// If that is not the case
 	// this may need to be adapted
 
+	// put the S-matrix in the memory order the workers will read it in
+	chooseSMatrixLayout_CPU(pars);
+	if (pars.meta.sMatrixHalo) setSMatrixHalo_CPU(pars, true);
+
 	// initialize FFTW threads
-	PRISMATIC_FFTW_INIT_THREADS();
-	PRISMATIC_FFTW_PLAN_WITH_NTHREADS(pars.meta.numThreads);
+	initFFTWThreads(pars.meta.numThreads);
 	vector<thread> workers;
 	workers.reserve(pars.meta.numThreads);																  // prevents multiple reallocations
 	const size_t PRISMATIC_PRINT_FREQUENCY_PROBES = max((size_t)1, pars.numProbes / 10); // for printing status
+
+	// If the batch size is too big, the work won't be spread over the threads, which will usually hurt more than the benefit
+	// of batch FFT
+	pars.meta.batchSizeCPU = min(pars.meta.batchSizeTargetCPU, max((size_t)1, pars.numProbes / pars.meta.numThreads));
+
+	// probes are handed out a scan row at a time (or less, to keep threads busy) so that neighbours sharing
+	// an S-matrix window end up in the same work unit
+	const size_t probesPerWork = max(pars.meta.batchSizeCPU, min(pars.numXprobes, pars.numProbes / pars.meta.numThreads));
+
+	// every probe of a series pass is synthesized and transformed once per series member
+	const size_t wavesPerProbe = max((size_t)1, pars.seriesMembers.size());
+
+	// probes of an interrupted run are restored from its checkpoint
+	std::vector<bool> probesDone(pars.numProbes, false);
+	if (pars.checkpoint)
+		probesDone = pars.checkpoint->beginStage(Checkpoint::Stage::Probes, pars);
+
 	WorkDispatcher dispatcher(0, pars.numProbes);
 	for (auto t = 0; t < pars.meta.numThreads; ++t)
 	{
 		cout << "Launching CPU worker thread #" << t << " to compute partial PRISM result\n";
-		workers.push_back(thread([&pars, &dispatcher, &PRISMATIC_PRINT_FREQUENCY_PROBES]() {
-			size_t Nstart, Nstop, ay, ax;
+		workers.push_back(thread([&pars, &dispatcher, &PRISMATIC_PRINT_FREQUENCY_PROBES, &probesPerWork, &wavesPerProbe, &probesDone]() {
+			size_t Nstart, Nstop;
 			Nstart = Nstop = 0;
-			if (dispatcher.getWork(Nstart, Nstop))
+			if (dispatcher.getWork(Nstart, Nstop, probesPerWork))
 			{ // synchronously get work assignment
-				Array2D<std::complex<PRISMATIC_FLOAT_PRECISION>> psi = Prismatic::zeros_ND<2, std::complex<PRISMATIC_FLOAT_PRECISION>>(
-					{{pars.imageSizeReduce[0], pars.imageSizeReduce[1]}});
+
+				// Allocate memory for the synthesized probes. These are 2D arrays, but as they will be operated on
+				// as a batch FFT they are all stacked together into one linearized array
+				Array1D<std::complex<PRISMATIC_FLOAT_PRECISION>> psi_stack = Prismatic::zeros_ND<1, std::complex<PRISMATIC_FLOAT_PRECISION>>(
+					{{pars.imageSizeReduce[0] * pars.imageSizeReduce[1] * pars.meta.batchSizeCPU * wavesPerProbe}});
+
+				// setup batch FFTW parameters
+				const int rank = 2;
+				int n[] = {(int)pars.imageSizeReduce[0], (int)pars.imageSizeReduce[1]};
+				const int howmany = pars.meta.batchSizeCPU * wavesPerProbe;
+				int idist = n[0] * n[1];
+				int odist = n[0] * n[1];
+				int istride = 1;
+				int ostride = 1;
+				int *inembed = n;
+				int *onembed = n;
 
 				unique_lock<mutex> gatekeeper(fftw_plan_lock);
-				PRISMATIC_FFTW_PLAN plan = PRISMATIC_FFTW_PLAN_DFT_2D(psi.get_dimj(), psi.get_dimi(),
-																	  reinterpret_cast<PRISMATIC_FFTW_COMPLEX *>(&psi[0]),
-																	  reinterpret_cast<PRISMATIC_FFTW_COMPLEX *>(&psi[0]),
-																	  FFTW_FORWARD, FFTW_MEASURE);
+				PRISMATIC_FFTW_PLAN plan = PRISMATIC_FFTW_PLAN_DFT_BATCH(rank, n, howmany,
+																		 reinterpret_cast<PRISMATIC_FFTW_COMPLEX *>(&psi_stack[0]), inembed,
+																		 istride, idist,
+																		 reinterpret_cast<PRISMATIC_FFTW_COMPLEX *>(&psi_stack[0]), onembed,
+																		 ostride, odist,
+																		 FFTW_FORWARD, FFTW_MEASURE);
 				gatekeeper.unlock();
 
 				// main work loop
 				do
 				{
-					while (Nstart < Nstop)
+					// order probes by the S-matrix window they read, so that probes sharing a window are adjacent
+					// within a batch and can be synthesized together
+					std::map<std::pair<long, long>, std::vector<size_t>> windowGroups;
+					for (auto n = Nstart; n < Nstop; ++n)
 					{
-						if (Nstart % PRISMATIC_PRINT_FREQUENCY_PROBES == 0 | Nstart == 100)
+						if (!probesDone[n])
+							windowGroups[getProbeWindowKey(pars, n)].push_back(n);
+					}
+					std::vector<size_t> orderedProbes;
+					orderedProbes.reserve(Nstop - Nstart);
+					for (auto &group : windowGroups)
+						orderedProbes.insert(orderedProbes.end(), group.second.begin(), group.second.end());
+
+					for (auto b = 0; b < orderedProbes.size(); b += pars.meta.batchSizeCPU)
+					{
+						std::vector<size_t> batch(orderedProbes.begin() + b,
+												  orderedProbes.begin() + min(orderedProbes.size(), b + pars.meta.batchSizeCPU));
+						for (auto n : batch)
 						{
-							cout << "Computing Probe Position #" << Nstart << "/" << pars.numProbes << endl;
+							if (n % PRISMATIC_PRINT_FREQUENCY_PROBES == 0 | n == 100)
+							{
+								cout << "Computing Probe Position #" << n << "/" << pars.numProbes << endl;
+							}
 						}
-						ay = (pars.meta.arbitraryProbes) ? Nstart : Nstart / pars.numXprobes;
-						ax = (pars.meta.arbitraryProbes) ? Nstart : Nstart % pars.numXprobes;
-						buildSignal_CPU(pars, ay, ax, plan, psi);
+						buildSignal_CPU_batch(pars, batch, plan, psi_stack);
 #ifdef PRISMATIC_BUILDING_GUI
-						pars.progressbar->signalOutputUpdate(Nstart, pars.numProbes);
+						pars.progressbar->signalOutputUpdate(batch.back(), pars.numProbes);
 #endif
-						++Nstart;
 					}
-				} while (dispatcher.getWork(Nstart, Nstop));
+					if (pars.checkpoint)
+						pars.checkpoint->complete(Nstart, Nstop);
+					Nstart = Nstop;
+				} while (dispatcher.getWork(Nstart, Nstop, probesPerWork));
 				gatekeeper.lock();
 				PRISMATIC_FFTW_DESTROY_PLAN(plan);
 				gatekeeper.unlock();
@@ -351,7 +663,10 @@ void buildPRISMOutput_CPUOnly(Parameters<PRISMATIC_FLOAT_PRECISION> &pars)
 	cout << "Waiting for threads...\n";
 	for (auto &t : workers)
 		t.join();
-	PRISMATIC_FFTW_CLEANUP_THREADS();
+
+	// refocusing, series and S-matrix output all expect the beam-major layout without a halo
+	setSMatrixHalo_CPU(pars, false);
+	setSMatrixLayout_CPU(pars, false);
 }
 
 void buildSignal_CPU(Parameters<PRISMATIC_FLOAT_PRECISION> &pars,
@@ -362,103 +677,277 @@ void buildSignal_CPU(Parameters<PRISMATIC_FLOAT_PRECISION> &pars,
 {
 	// build the output for a single probe position using CPU resources
 
-	const static std::complex<PRISMATIC_FLOAT_PRECISION> i(0, 1);
-	const static PRISMATIC_FLOAT_PRECISION pi = std::acos(-1);
-
 	// setup some coordinates
-	PRISMATIC_FLOAT_PRECISION x0 = pars.xp[ax] / pars.pixelSizeOutput[1];
-	PRISMATIC_FLOAT_PRECISION y0 = pars.yp[ay] / pars.pixelSizeOutput[0];
-	Array1D<PRISMATIC_FLOAT_PRECISION> x = pars.xVec + round(x0);
+	Array1D<PRISMATIC_FLOAT_PRECISION> x, y;
+	getProbeWindow(pars, pars.xp[ax], pars.yp[ay], x, y);
 
-	// the second call to fmod here is to make sure the result is positive
-	transform(x.begin(), x.end(), x.begin(), [&pars](PRISMATIC_FLOAT_PRECISION &a) {
-		return fmod((PRISMATIC_FLOAT_PRECISION)pars.imageSizeOutput[1] +
-						fmod(a, (PRISMATIC_FLOAT_PRECISION)pars.imageSizeOutput[1]),
-					(PRISMATIC_FLOAT_PRECISION)pars.imageSizeOutput[1]);
-	});
+	std::vector<std::complex<PRISMATIC_FLOAT_PRECISION>> weights(getNumSMatrixPlanes(pars));
+	getProbeWeights_CPU(pars, pars.xp[ax], pars.yp[ay], &weights[0]);
 
-	Array1D<PRISMATIC_FLOAT_PRECISION> y = pars.yVec + round(y0);
-	transform(y.begin(), y.end(), y.begin(), [&pars](PRISMATIC_FLOAT_PRECISION &a) {
-		return fmod((PRISMATIC_FLOAT_PRECISION)pars.imageSizeOutput[0] +
-						fmod(a, (PRISMATIC_FLOAT_PRECISION)pars.imageSizeOutput[0]),
-					(PRISMATIC_FLOAT_PRECISION)pars.imageSizeOutput[0]);
-	});
+	std::fill_n(&psi[0], psi.size(), std::complex<PRISMATIC_FLOAT_PRECISION>(0, 0));
+	synthesizeProbe_CPU(pars, &weights[0], x, y, &psi[0]);
 
-	Array2D<PRISMATIC_FLOAT_PRECISION> intOutput = Prismatic::zeros_ND<2, PRISMATIC_FLOAT_PRECISION>(
-		{{pars.imageSizeReduce[0], pars.imageSizeReduce[1]}});
+	PRISMATIC_FFTW_EXECUTE(plan);
 
-	memset(&psi[0], 0, sizeof(std::complex<PRISMATIC_FLOAT_PRECISION>) * psi.size());
+	formatPRISMOutput_CPU(pars, ay, ax, &psi[0]);
+}
 
-	for (auto a4 = 0; a4 < pars.beamsIndex.size(); ++a4)
+void buildSignal_CPU_batch(Parameters<PRISMATIC_FLOAT_PRECISION> &pars,
+						   const std::vector<size_t> &probes,
+						   PRISMATIC_FFTW_PLAN &plan,
+						   Array1D<std::complex<PRISMATIC_FLOAT_PRECISION>> &psi_stack)
+{
+	// build the output for a batch of probe positions. Each probe is synthesized into its slot of psi_stack,
+	// the whole stack is transformed with one batched FFT, and then each slot is reduced into the outputs.
+	// Runs of probes sharing an S-matrix window are synthesized together
+
+	if (!pars.seriesMembers.empty())
 	{
-		PRISMATIC_FLOAT_PRECISION yB = pars.xyBeams.at(a4, 0);
-		PRISMATIC_FLOAT_PRECISION xB = pars.xyBeams.at(a4, 1);
+		buildSeriesSignal_CPU_batch(pars, probes, plan, psi_stack);
+		return;
+	}
 
-		if (abs(pars.psiProbeInit.at(yB, xB)) > 0)
+	const size_t numPixels = pars.imageSizeReduce[0] * pars.imageSizeReduce[1];
+	std::vector<std::complex<PRISMATIC_FLOAT_PRECISION>> weights(getNumSMatrixPlanes(pars));
+	Array1D<PRISMATIC_FLOAT_PRECISION> x, y;
+	size_t ay, ax;
+
+	size_t start = 0;
+	while (start < probes.size())
+	{
+		size_t stop = start + 1;
+		while (stop < probes.size() && getProbeWindowKey(pars, probes[stop]) == getProbeWindowKey(pars, probes[start]))
+			++stop;
+
+		if (stop - start == 1)
 		{
-			PRISMATIC_FLOAT_PRECISION q0_0 = pars.qxaReduce.at(yB, xB);
-			PRISMATIC_FLOAT_PRECISION q0_1 = pars.qyaReduce.at(yB, xB);
-			std::complex<PRISMATIC_FLOAT_PRECISION> phaseShift = exp(
-				-2 * pi * i * (q0_0 * (pars.xp[ax] + pars.xTiltShift) + q0_1 * (pars.yp[ay] + pars.yTiltShift)));
+			ay = (pars.meta.arbitraryProbes) ? probes[start] : probes[start] / pars.numXprobes;
+			ax = (pars.meta.arbitraryProbes) ? probes[start] : probes[start] % pars.numXprobes;
+			getProbeWindow(pars, pars.xp[ax], pars.yp[ay], x, y);
+			getProbeWeights_CPU(pars, pars.xp[ax], pars.yp[ay], &weights[0]);
+			std::fill_n(&psi_stack[start * numPixels], numPixels, std::complex<PRISMATIC_FLOAT_PRECISION>(0, 0));
+			synthesizeProbe_CPU(pars, &weights[0], x, y, &psi_stack[start * numPixels]);
+		}
+		else
+		{
+			std::vector<size_t> group(probes.begin() + start, probes.begin() + stop);
+			synthesizeProbeGroup_CPU(pars, group, &psi_stack[start * numPixels]);
+		}
+		start = stop;
+	}
 
-			const std::complex<PRISMATIC_FLOAT_PRECISION> tmp_const = pars.psiProbeInit.at(yB, xB) * phaseShift;
-			for (auto j = 0; j < y.size(); ++j)
+	PRISMATIC_FFTW_EXECUTE(plan); // batch FFT
+
+	for (auto batch_idx = 0; batch_idx < probes.size(); ++batch_idx)
+	{
+		ay = (pars.meta.arbitraryProbes) ? probes[batch_idx] : probes[batch_idx] / pars.numXprobes;
+		ax = (pars.meta.arbitraryProbes) ? probes[batch_idx] : probes[batch_idx] % pars.numXprobes;
+		formatPRISMOutput_CPU(pars, ay, ax, &psi_stack[batch_idx * numPixels]);
+	}
+}
+
+void buildSeriesSignal_CPU_batch(Parameters<PRISMATIC_FLOAT_PRECISION> &pars,
+								 const std::vector<size_t> &probes,
+								 PRISMATIC_FFTW_PLAN &plan,
+								 Array1D<std::complex<PRISMATIC_FLOAT_PRECISION>> &psi_stack)
+{
+	// build the outputs of every series member for a batch of probe positions. Slot p * numMembers + m of psi_stack
+	// holds member m of probe p, and each S-matrix window is read once for all probes sharing it and all members
+
+	const size_t numPixels = pars.imageSizeReduce[0] * pars.imageSizeReduce[1];
+	const size_t numSPlanes = getNumSMatrixPlanes(pars);
+	const size_t numMembers = pars.seriesMembers.size();
+	std::vector<std::complex<PRISMATIC_FLOAT_PRECISION>> weights;
+	Array1D<PRISMATIC_FLOAT_PRECISION> x, y;
+	size_t ay, ax;
+
+	size_t start = 0;
+	while (start < probes.size())
+	{
+		size_t stop = start + 1;
+		while (stop < probes.size() && getProbeWindowKey(pars, probes[stop]) == getProbeWindowKey(pars, probes[start]))
+			++stop;
+
+		weights.resize((stop - start) * numMembers * numSPlanes);
+		for (auto p = start; p < stop; ++p)
+		{
+			ay = (pars.meta.arbitraryProbes) ? probes[p] : probes[p] / pars.numXprobes;
+			ax = (pars.meta.arbitraryProbes) ? probes[p] : probes[p] % pars.numXprobes;
+			if (p == start) getProbeWindow(pars, pars.xp[ax], pars.yp[ay], x, y);
+			for (auto m = 0; m < numMembers; ++m)
 			{
-				for (auto i = 0; i < x.size(); ++i)
-				{
-					psi.at(j, i) += (tmp_const * pars.Scompact.at(a4, y[j], x[i]));
-				}
+				const seriesMember<PRISMATIC_FLOAT_PRECISION> &member = pars.seriesMembers[m];
+				getProbeWeights_CPU(pars, member.psiProbeInit, member.xTiltShift, member.yTiltShift,
+									pars.xp[ax], pars.yp[ay], &weights[((p - start) * numMembers + m) * numSPlanes]);
 			}
 		}
+		synthesizeWindow_CPU(pars, &weights[0], (stop - start) * numMembers, x, y, &psi_stack[start * numMembers * numPixels]);
+		start = stop;
 	}
 
-	PRISMATIC_FFTW_EXECUTE(plan);
+	PRISMATIC_FFTW_EXECUTE(plan); // batch FFT
 
-	for (auto jj = 0; jj < intOutput.get_dimj(); ++jj)
+	for (auto batch_idx = 0; batch_idx < probes.size(); ++batch_idx)
 	{
-		for (auto ii = 0; ii < intOutput.get_dimi(); ++ii)
+		ay = (pars.meta.arbitraryProbes) ? probes[batch_idx] : probes[batch_idx] / pars.numXprobes;
+		ax = (pars.meta.arbitraryProbes) ? probes[batch_idx] : probes[batch_idx] % pars.numXprobes;
+		for (auto m = 0; m < numMembers; ++m)
 		{
-			intOutput.at(jj, ii) += pow(abs(psi.at(jj, ii)), 2) * pars.scale;
+			seriesMember<PRISMATIC_FLOAT_PRECISION> &member = pars.seriesMembers[m];
+			formatPRISMOutput_CPU(pars, ay, ax, &psi_stack[(batch_idx * numMembers + m) * numPixels],
+								  member.detMap, member.output, member.DPC_CoM, member.tag);
 		}
 	}
+}
 
-	size_t write_ay = (pars.meta.arbitraryProbes) ? 0 : ay;
-	if (pars.meta.saveDPC_CoM)
+std::pair<long, long> getProbeWindowKey(Parameters<PRISMATIC_FLOAT_PRECISION> &pars, const size_t n)
+{
+	// rounded window center of probe n; probes with equal keys read the same S-matrix window
+	const size_t ay = (pars.meta.arbitraryProbes) ? n : n / pars.numXprobes;
+	const size_t ax = (pars.meta.arbitraryProbes) ? n : n % pars.numXprobes;
+	return std::make_pair((long)round(pars.yp[ay] / pars.pixelSizeOutput[0]),
+						  (long)round(pars.xp[ax] / pars.pixelSizeOutput[1]));
+}
+
+void synthesizeProbeGroup_CPU(Parameters<PRISMATIC_FLOAT_PRECISION> &pars,
+							  const std::vector<size_t> &probes,
+							  std::complex<PRISMATIC_FLOAT_PRECISION> *psi_group)
+{
+	// synthesize several probe positions that share one S-matrix window into consecutive slots of psi_group
+
+	const size_t numSPlanes = getNumSMatrixPlanes(pars);
+	const size_t numGroupProbes = probes.size();
+	auto getIndices = [&pars](const size_t n, size_t &ay, size_t &ax) {
+		ay = (pars.meta.arbitraryProbes) ? n : n / pars.numXprobes;
+		ax = (pars.meta.arbitraryProbes) ? n : n % pars.numXprobes;
+	};
+
+	size_t ay, ax;
+	getIndices(probes[0], ay, ax);
+	Array1D<PRISMATIC_FLOAT_PRECISION> x, y;
+	getProbeWindow(pars, pars.xp[ax], pars.yp[ay], x, y);
+
+	std::vector<std::complex<PRISMATIC_FLOAT_PRECISION>> weights(numGroupProbes * numSPlanes);
+	for (auto p = 0; p < numGroupProbes; ++p)
+	{
+		getIndices(probes[p], ay, ax);
+		getProbeWeights_CPU(pars, pars.xp[ax], pars.yp[ay], &weights[p * numSPlanes]);
+	}
+
+	synthesizeWindow_CPU(pars, &weights[0], numGroupProbes, x, y, psi_group);
+}
+
+void synthesizeWindow_CPU(Parameters<PRISMATIC_FLOAT_PRECISION> &pars,
+						  const std::complex<PRISMATIC_FLOAT_PRECISION> *weights,
+						  const size_t numWaves,
+						  const Array1D<PRISMATIC_FLOAT_PRECISION> &x,
+						  const Array1D<PRISMATIC_FLOAT_PRECISION> &y,
+						  std::complex<PRISMATIC_FLOAT_PRECISION> *psi_group)
+{
+	// form numWaves waves from one S-matrix window into consecutive slots of psi_group, the plane weights of wave p
+	// being row p of weights. The window is gathered once and all waves are formed together as
+	// weights[waves x planes] * window[planes x pixels]. In the pixel-major layout the window rows are already
+	// contiguous and are read in place
+
+	const size_t numSPlanes = getNumSMatrixPlanes(pars);
+	const size_t numPixels = pars.imageSizeReduce[0] * pars.imageSizeReduce[1];
+
+	if (pars.sMatrixPixelMajor)
 	{
-		//calculate center of mass; qxa, qya are the fourier coordinates, should have 0 components at boundaries
-		for (long y = 0; y < intOutput.get_dimj(); ++y)
+		// the planes of each window pixel are contiguous, so every output is a dot product against that row
+		const bool contiguousWindow = pars.ScompactHalo[0] > 0;
+		for (auto j = 0; j < y.size(); ++j)
 		{
-			for (long x = 0; x < intOutput.get_dimi(); ++x)
+			for (auto i = 0; i < x.size(); ++i)
 			{
-				pars.DPC_CoM.at(0, write_ay, ax, 0) += pars.qxaReduce.at(y, x) * intOutput.at(y, x);
-				pars.DPC_CoM.at(0, write_ay, ax, 1) += pars.qyaReduce.at(y, x) * intOutput.at(y, x);
+				const std::complex<PRISMATIC_FLOAT_PRECISION> *row = contiguousWindow ? &pars.Scompact.at(y[0] + j, x[0] + i, 0)
+																					 : &pars.Scompact.at(y[j], x[i], 0);
+				for (auto p = 0; p < numWaves; ++p)
+				{
+					psi_group[p * numPixels + j * x.size() + i] = complexDot_CPU(&weights[p * numSPlanes], row, numSPlanes);
+				}
 			}
 		}
-		//divide by sum of intensity
-		PRISMATIC_FLOAT_PRECISION intensitySum = 0;
-		for (auto iter = intOutput.begin(); iter != intOutput.end(); ++iter)
+	}
+	else
+	{
+		// only planes with a nonzero weight for some wave need to be gathered
+		std::vector<size_t> activePlanes;
+		for (auto a4 = 0; a4 < numSPlanes; ++a4)
 		{
-			intensitySum += *iter;
+			for (auto p = 0; p < numWaves; ++p)
+			{
+				if (weights[p * numSPlanes + a4] != std::complex<PRISMATIC_FLOAT_PRECISION>(0, 0))
+				{
+					activePlanes.push_back(a4);
+					break;
+				}
+			}
 		}
-		pars.DPC_CoM.at(0, write_ay, ax, 0) /= intensitySum;
-		pars.DPC_CoM.at(0, write_ay, ax, 1) /= intensitySum;
-	}
+		const size_t numActive = activePlanes.size();
 
-	//         update output -- ax,ay are unique per thread so this write is thread-safe without a lock
-	auto idx = pars.alphaInd.begin();
-	for (auto counts = intOutput.begin(); counts != intOutput.end(); ++counts)
-	{
-		if (*idx <= pars.Ndet)
+		std::vector<std::complex<PRISMATIC_FLOAT_PRECISION>> activeWeights(numWaves * numActive);
+		for (auto p = 0; p < numWaves; ++p)
 		{
-			pars.output.at(0, write_ay, ax, (*idx) - 1) += *counts;
+			for (auto k = 0; k < numActive; ++k)
+				activeWeights[p * numActive + k] = weights[p * numSPlanes + activePlanes[k]];
 		}
-		++idx;
-	};
+
+		std::vector<std::complex<PRISMATIC_FLOAT_PRECISION>> window(numActive * numPixels);
+		for (auto k = 0; k < numActive; ++k)
+		{
+			auto w_ptr = &window[k * numPixels];
+			for (auto j = 0; j < y.size(); ++j)
+			{
+				if (pars.ScompactHalo[0] > 0)
+				{
+					const std::complex<PRISMATIC_FLOAT_PRECISION> *row = &pars.Scompact.at(activePlanes[k], y[0] + j, x[0]);
+					w_ptr = copy(row, row + x.size(), w_ptr);
+					continue;
+				}
+				for (auto i = 0; i < x.size(); ++i)
+				{
+					*w_ptr++ = pars.Scompact.at(activePlanes[k], y[j], x[i]);
+				}
+			}
+		}
+
+		complexGemm_CPU(&activeWeights[0], &window[0], psi_group, numWaves, numPixels, numActive);
+	}
+}
+
+void formatPRISMOutput_CPU(Parameters<PRISMATIC_FLOAT_PRECISION> &pars,
+						   const size_t &ay,
+						   const size_t &ax,
+						   const std::complex<PRISMATIC_FLOAT_PRECISION> *psi)
+{
+	formatPRISMOutput_CPU(pars, ay, ax, psi, pars.detMap, pars.output, pars.DPC_CoM, pars.currentTag);
+}
+
+void formatPRISMOutput_CPU(Parameters<PRISMATIC_FLOAT_PRECISION> &pars,
+						   const size_t &ay,
+						   const size_t &ax,
+						   const std::complex<PRISMATIC_FLOAT_PRECISION> *psi,
+						   const detectorMap &detMap,
+						   Array4D<PRISMATIC_FLOAT_PRECISION> &output,
+						   Array4D<PRISMATIC_FLOAT_PRECISION> &DPC_CoM,
+						   const std::string &tag)
+{
+	// reduce the diffracted probe psi, stored row-major with the dimensions of imageSizeReduce, into the
+	// detector, DPC and 4D outputs of the series member tagged tag
+
+	//         integrate every detector bin and the DPC sums in one pass over the sparse detector map
+	//         ax,ay are unique per thread so these writes are thread-safe without a lock
+	size_t write_ay = (pars.meta.arbitraryProbes) ? 0 : ay;
+	std::vector<PRISMATIC_FLOAT_PRECISION> binValues(detMap.numBins());
+	integrateDetectors(detMap, psi, pars.scale, &binValues[0]);
+	storeDetectorBins(detMap, &binValues[0], &output.at(0, write_ay, ax, 0),
+					  pars.meta.saveDPC_CoM ? &DPC_CoM.at(0, write_ay, ax, 0) : nullptr);
 
 	//save 4D output if applicable
 	if (pars.meta.save4DOutput)
 	{
-		std::string nameString ="4DSTEM_simulation/data/datacubes/CBED_array_depth" + getDigitString(0)+pars.currentTag;
+		std::string nameString ="4DSTEM_simulation/data/datacubes/CBED_array_depth" + getDigitString(0)+tag;
 
 
 		PRISMATIC_FLOAT_PRECISION numFP = pars.meta.numFP;
@@ -466,17 +955,20 @@ void buildSignal_CPU(Parameters<PRISMATIC_FLOAT_PRECISION> &pars,
 		if(pars.meta.saveComplexOutputWave)
 		{
 			nameString += "_fp" + getDigitString(pars.meta.fpNum);
+			Array2D<std::complex<PRISMATIC_FLOAT_PRECISION>> psi_arr = Prismatic::zeros_ND<2, std::complex<PRISMATIC_FLOAT_PRECISION>>(
+				{{pars.imageSizeReduce[0], pars.imageSizeReduce[1]}});
+			copy(psi, psi + psi_arr.size(), &psi_arr[0]);
 			Array2D<std::complex<PRISMATIC_FLOAT_PRECISION>> finalOutput;
 			if(pars.meta.crop4DOutput)
 			{
-				finalOutput = cropOutput(psi, pars);
+				finalOutput = cropOutput(psi_arr, pars);
 				finalOutput *= sqrt(pars.scale);
 				hsize_t mdims[4] = {1, 1, finalOutput.get_dimj(), finalOutput.get_dimi()};
 				writeDatacube4D(pars, &finalOutput[0], &pars.cbed_buffer_c[0], mdims, offset, numFP, nameString.c_str());
 			}
 			else
 			{
-				finalOutput = fftshift2_flip(psi);
+				finalOutput = fftshift2_flip(psi_arr);
 				finalOutput *= sqrt(pars.scale);
 				hsize_t mdims[4] = {1, 1, finalOutput.get_dimj(), finalOutput.get_dimi()};
 				writeDatacube4D(pars, &finalOutput[0], &pars.cbed_buffer_c[0], mdims, offset, numFP, nameString.c_str());
@@ -484,6 +976,11 @@ void buildSignal_CPU(Parameters<PRISMATIC_FLOAT_PRECISION> &pars,
 		}
 		else
 		{
+			Array2D<PRISMATIC_FLOAT_PRECISION> intOutput = Prismatic::zeros_ND<2, PRISMATIC_FLOAT_PRECISION>(
+				{{pars.imageSizeReduce[0], pars.imageSizeReduce[1]}});
+			for (auto i = 0; i < intOutput.size(); ++i)
+				intOutput[i] = pow(abs(psi[i]), 2) * pars.scale;
+
 			if(pars.meta.crop4DOutput)
 			{
 				Array2D<PRISMATIC_FLOAT_PRECISION> croppedOutput = cropOutput(intOutput, pars);
@@ -546,6 +1043,11 @@ void transformIndices(Parameters<PRISMATIC_FLOAT_PRECISION> &pars)
 	transform(pars.alphaInd.begin(), pars.alphaInd.end(),
 			  alphaMask.begin(),
 			  [&pars](const PRISMATIC_FLOAT_PRECISION &a) { return (a < pars.Ndet) ? 1 : 0; });
+
+	// compile the annular bins, custom detectors and DPC sums into one sparse map; DPC uses the unshifted coordinates
+	Array2D<PRISMATIC_FLOAT_PRECISION> alpha = pars.q1 * pars.lambda;
+	pars.detMap = buildDetectorMap(pars.alphaInd, pars.Ndet, alpha, pars.qTheta,
+								   pars.qxaReduce, pars.qyaReduce, pars.meta.detectors, pars.meta.saveDPC_CoM);
 }
 
 void initializeProbes(Parameters<PRISMATIC_FLOAT_PRECISION> &pars)
@@ -614,38 +1116,148 @@ void initializeProbes(Parameters<PRISMATIC_FLOAT_PRECISION> &pars)
 	}
 }
 
+std::string geometryKey_2(const Parameters<PRISMATIC_FLOAT_PRECISION> &pars)
+{
+	// everything setupCoordinates_2 through transformIndices read
+	SimulationPlan::Key key;
+	key << pars.meta.arbitraryProbes << pars.meta.probes_x << pars.meta.probes_y
+		<< pars.scanWindowXMin << pars.scanWindowXMax << pars.scanWindowYMin << pars.scanWindowYMax
+		<< pars.tiledCellDim << pars.meta.nyquistSampling << pars.meta.probeSemiangle << pars.meta.probeStepX << pars.meta.probeStepY
+		<< pars.qMax << pars.lambda << pars.meta.detectorAngleStep << pars.imageSizeOutput
+		<< pars.meta.interpolationFactorX << pars.meta.interpolationFactorY << pars.beamsOutput << pars.beamsIndex.size()
+		<< pars.qxaOutput << pars.qyaOutput << pars.meta.probeXtilt << pars.meta.probeYtilt
+		<< pars.meta.detectors << pars.meta.saveDPC_CoM << pars.meta.scanTiles << pars.meta.scanTile;
+	return key.str();
+}
+
+void copyGeometry_2(const Parameters<PRISMATIC_FLOAT_PRECISION> &from, Parameters<PRISMATIC_FLOAT_PRECISION> &to)
+{
+	to.numXprobes = from.numXprobes;
+	to.numYprobes = from.numYprobes;
+	to.numProbes = from.numProbes;
+	to.xp = from.xp;
+	to.yp = from.yp;
+	to.alphaMax = from.alphaMax;
+	to.detectorAngles = from.detectorAngles;
+	to.xVec = from.xVec;
+	to.yVec = from.yVec;
+	to.Ndet = from.Ndet;
+	to.imageSizeReduce = from.imageSizeReduce;
+	to.xyBeams = from.xyBeams;
+	to.qxaReduce = from.qxaReduce;
+	to.qyaReduce = from.qyaReduce;
+	to.qx = from.qx;
+	to.qy = from.qy;
+	to.q1 = from.q1;
+	to.q2 = from.q2;
+	to.dq = from.dq;
+	to.scale = from.scale;
+	to.qTheta = from.qTheta;
+	to.alphaInd = from.alphaInd;
+	to.detMap = from.detMap;
+}
+
+void copyProbe_2(const Parameters<PRISMATIC_FLOAT_PRECISION> &from, Parameters<PRISMATIC_FLOAT_PRECISION> &to)
+{
+	to.psiProbeInit = from.psiProbeInit;
+}
+
+void setupPRISMOutput(Parameters<PRISMATIC_FLOAT_PRECISION> &pars)
+{
+	// take the coordinates, detector and probe from the plan when their settings did not change
+	SimulationPlan &plan = SimulationPlan::getPlan();
+	std::string geometryKey = geometryKey_2(pars);
+	if(!pars.meta.reusePlan or !plan.restore("PRISM03 geometry", geometryKey, copyGeometry_2, pars))
+	{
+		// setup necessary coordinates
+		setupCoordinates_2(pars);
+		
+		// setup angles of detector and image sizes
+		setupDetector(pars);
+
+		// setup coordinates and indices for the beams
+		setupBeams_2(pars);
+		
+		// setup Fourier coordinates for the S-matrix
+		setupFourierCoordinates(pars);
+
+		// perform some necessary setup transformations of the data
+		transformIndices(pars);
+
+		if(pars.meta.reusePlan) plan.store("PRISM03 geometry", geometryKey, copyGeometry_2, pars);
+	}
+
+	// initialize the output to the correct size for the output mode
+	createStack_integrate(pars);
+
+	// initialize/compute the probes
+	SimulationPlan::Key probeKey;
+	probeKey << geometryKey << pars.meta.aberrations;
+	if(!pars.meta.reusePlan or !plan.restore("PRISM03 probe", probeKey.str(), copyProbe_2, pars))
+	{
+		initializeProbes(pars);
+		if(pars.meta.reusePlan) plan.store("PRISM03 probe", probeKey.str(), copyProbe_2, pars);
+	}
+	else if(pars.meta.saveProbe && pars.fpFlag == 0)
+	{
+		setupProbeOutput(pars);
+		saveProbe(pars);
+	}
+}
+
 void PRISM03_calcOutput(Parameters<PRISMATIC_FLOAT_PRECISION> &pars)
 {
 	// compute final image
 
 	cout << "Entering PRISM03_calcOutput" << endl;
-	// setup necessary coordinates
-	setupCoordinates_2(pars);
-	
-	// setup angles of detector and image sizes
-	setupDetector(pars);
+	setupPRISMOutput(pars);
 
-	// setup coordinates and indices for the beams
-	setupBeams_2(pars);
-	
-	// setup Fourier coordinates for the S-matrix
-	setupFourierCoordinates(pars);
+#ifdef PRISMATIC_BUILDING_GUI
+	pars.progressbar->signalDescriptionMessage("Computing final output (PRISM)");
+	pars.progressbar->signalOutputUpdate(0, pars.numProbes);
+#endif
 
-	// initialize the output to the correct size for the output mode
-	createStack_integrate(pars);
+	// compute the final PRISM output, staging 4D frames for a single writer thread
+	if (pars.meta.save4DOutput) startDatacubeWriter(pars);
+	buildPRISMOutput(pars);
+	if (pars.meta.save4DOutput) finishDatacubeWriter(pars);
 
-	// perform some necessary setup transformations of the data
-	transformIndices(pars);
+	// the probes waiting for their 4D blocks are complete once the writer is finished
+	if (pars.checkpoint) pars.checkpoint->endStage();
+}
 
-	// initialize/compute the probes
-	initializeProbes(pars);
+void PRISM03_calcSeries(Parameters<PRISMATIC_FLOAT_PRECISION> &pars)
+{
+	// compute the outputs of every series member in one pass over the probes, so that each S-matrix window is
+	// read once per probe instead of once per member
+
+	cout << "Entering PRISM03_calcSeries" << endl;
+	pars.seriesMembers.clear();
+	for (auto i = 0; i < pars.meta.seriesVals[0].size(); i++)
+	{
+		std::cout << "------------------- Series member " << i << " -------------------" << std::endl;
+		updateSeriesParams(pars, i);
+		pars.meta.aberrations = updateAberrations(pars.meta.aberrations, pars.meta.probeDefocus, pars.meta.C3, pars.meta.C5, pars.lambda);
+		setupPRISMOutput(pars);
+
+		seriesMember<PRISMATIC_FLOAT_PRECISION> member;
+		member.tag = pars.currentTag;
+		member.psiProbeInit = pars.psiProbeInit;
+		member.detMap = pars.detMap;
+		member.xTiltShift = pars.xTiltShift;
+		member.yTiltShift = pars.yTiltShift;
+		member.output = std::move(pars.output);
+		member.DPC_CoM = std::move(pars.DPC_CoM);
+		pars.seriesMembers.push_back(std::move(member));
+	}
 
 #ifdef PRISMATIC_BUILDING_GUI
 	pars.progressbar->signalDescriptionMessage("Computing final output (PRISM)");
 	pars.progressbar->signalOutputUpdate(0, pars.numProbes);
 #endif
 
-	// compute the final PRISM output
+	if (pars.meta.save4DOutput) startDatacubeWriter(pars);
 	buildPRISMOutput(pars);
+	if (pars.meta.save4DOutput) finishDatacubeWriter(pars);
 }
 } // namespace Prismatic
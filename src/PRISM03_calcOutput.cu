@@ -443,8 +443,7 @@ namespace Prismatic {
 
 		// Now launch CPU work
 		if (pars.meta.alsoDoCPUWork) {
-			PRISMATIC_FFTW_INIT_THREADS();
-			PRISMATIC_FFTW_PLAN_WITH_NTHREADS(pars.meta.numThreads);
+			initFFTWThreads(pars.meta.numThreads);
 			vector <thread> workers_CPU;
 			workers_CPU.reserve(pars.meta.numThreads); // prevents multiple reallocations
 			for (auto t = 0; t < pars.meta.numThreads; ++t) {
@@ -495,7 +494,6 @@ namespace Prismatic {
 			}
 			cout << "Waiting for CPU threads...\n";
 			for (auto &t:workers_CPU)t.join();
-			PRISMATIC_FFTW_CLEANUP_THREADS();
 		}
 
 		// synchronize
@@ -594,8 +592,7 @@ namespace Prismatic {
 
 		// Now launch CPU work
 		if (pars.meta.alsoDoCPUWork) {
-			PRISMATIC_FFTW_INIT_THREADS();
-			PRISMATIC_FFTW_PLAN_WITH_NTHREADS(pars.meta.numThreads);
+			initFFTWThreads(pars.meta.numThreads);
 			vector<thread> workers_CPU;
 			workers_CPU.reserve(pars.meta.numThreads); // prevents multiple reallocations
 			for (auto t = 0; t < pars.meta.numThreads; ++t) {
@@ -646,7 +643,6 @@ namespace Prismatic {
 			}
 			cout << "Waiting for CPU threads...\n";
 			for (auto& t:workers_CPU)t.join();
-			PRISMATIC_FFTW_CLEANUP_THREADS();
 		}
 
 		// synchronize
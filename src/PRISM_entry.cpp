@@ -26,30 +26,34 @@
 #include "utility.h"
 #include "fileIO.h"
 #include "aberration.h"
+#include "PotentialPipeline.h"
+#include "FPConvergence.h"
+#include "Checkpoint.h"
 
 namespace Prismatic
 {
 using namespace std;
 void PRISM_entry(Metadata<PRISMATIC_FLOAT_PRECISION> &meta)
 {
-	Parameters<PRISMATIC_FLOAT_PRECISION> pars;
-	try
-	{ // read atomic coordinates
-		pars = Parameters<PRISMATIC_FLOAT_PRECISION>(meta);
-	}
-	catch (...)
-	{
-		std::cout << "Terminating" << std::endl;
-		exit(1);
-	}
+	// read atomic coordinates; a failure reaches the caller, which ends the program or only the job it serves
+	Parameters<PRISMATIC_FLOAT_PRECISION> pars(meta);
 
     PRISM_entry_pars(pars);
 }
 
 void PRISM_entry_pars(Parameters<PRISMATIC_FLOAT_PRECISION> &pars)
 {
-	pars.outputFile = H5::H5File(pars.meta.filenameOutput.c_str(), H5F_ACC_TRUNC);
-	setupOutputFile(pars);
+	//an interrupted run continues in its output file once it completed a frozen phonon
+	if(useCheckpoint(pars)) pars.checkpoint = std::make_shared<Checkpoint>(pars);
+	if(pars.checkpoint && pars.checkpoint->continuesOutput())
+	{
+		pars.outputFile = H5::H5File(pars.meta.filenameOutput.c_str(), H5F_ACC_RDWR);
+	}
+	else
+	{
+		pars.outputFile = H5::H5File(pars.meta.filenameOutput.c_str(), H5F_ACC_TRUNC);
+		setupOutputFile(pars);
+	}
 
 	if(pars.meta.importPotential or pars.meta.importSMatrix) configureImportFP(pars);
 
@@ -64,11 +68,9 @@ void PRISM_entry_pars(Parameters<PRISMATIC_FLOAT_PRECISION> &pars)
 		{
 			std::string currentName = pars.meta.seriesTags[i];
 			pars.currentTag = currentName;
-			pars.meta.probeDefocus = pars.meta.seriesVals[0][i]; //TODO: later, if expanding sim series past defocus, need to pull current val more generally
+			updateSeriesParams(pars, i); //the attributes of the saved outputs carry the series values
 
-			readRealDataSet_inOrder(pars.net_output, "prismatic_scratch.h5", "scratch/"+currentName);
-			if(pars.meta.saveDPC_CoM)
-				readRealDataSet_inOrder(pars.net_DPC_CoM, "prismatic_scratch.h5", "scratch/"+currentName+"_DPC");
+			readScratchData(pars);
 			//average data by fp
 			for (auto &i : pars.net_output)
 				i /= pars.meta.numFP;
@@ -85,9 +87,42 @@ void PRISM_entry_pars(Parameters<PRISMATIC_FLOAT_PRECISION> &pars)
 	else
 	{
 		pars.meta.aberrations = updateAberrations(pars.meta.aberrations, pars.meta.probeDefocus, pars.meta.C3, pars.meta.C5, pars.lambda);
-		for(auto i = 0; i < pars.meta.numFP; i++)
+		size_t numGroups = getConcurrentFP(pars);
+		if(numGroups > 1)
+		{
+			PRISM_runFP(pars, 0);
+			runConcurrentFP(pars, numGroups, [](Parameters<PRISMATIC_FLOAT_PRECISION> &fpPars) {
+				PRISM01_calcPotential(fpPars);
+				PRISM02_calcSMatrix(fpPars);
+				if(fpPars.meta.matrixRefocus) refocus(fpPars);
+				PRISM03_calcOutput(fpPars);
+			});
+		}
+		else
 		{
-			PRISM_runFP(pars, i);
+			size_t pipelineThreads = getPipelineThreads(pars);
+			if(pipelineThreads > 0) pars.potentialPipeline = std::make_shared<PotentialPipeline>(pipelineThreads);
+			std::shared_ptr<FPConvergence> convergence;
+			if(useTargetFPError(pars)) convergence = std::make_shared<FPConvergence>(pars.meta);
+			size_t firstFP = 0;
+			if(pars.checkpoint)
+			{
+				pars.checkpoint->restoreNet(pars);
+				firstFP = pars.checkpoint->getCompletedFP();
+			}
+			for(auto i = firstFP; i < pars.meta.numFP; i++)
+			{
+				PRISM_runFP(pars, i);
+
+				//numFP is the upper bound once a target error is set
+				if(convergence)
+				{
+					convergence->add(pars);
+					if(convergence->converged()) break;
+				}
+			}
+			pars.potentialPipeline.reset();
+			if(convergence) convergence->finish(pars);
 		}
 
 		std::cout << "All frozen phonon configurations complete. Writing data to output file." << std::endl;
@@ -107,11 +142,18 @@ void PRISM_entry_pars(Parameters<PRISMATIC_FLOAT_PRECISION> &pars)
 	pars.outputFile = H5::H5File(pars.meta.filenameOutput.c_str(), H5F_ACC_RDWR);
 	
 	//perhaps have this check against the keys
-	if(pars.meta.simSeries) CCseriesSG(pars.outputFile);
+	if(pars.meta.simSeries and pars.meta.seriesKeys[0] == "probeDefocus") CCseriesSG(pars.outputFile);
 
 	writeMetadata(pars);
 	pars.outputFile.close();
 
+	//the run is complete, so there is nothing left to resume
+	if(pars.checkpoint)
+	{
+		pars.checkpoint->remove();
+		pars.checkpoint.reset();
+	}
+
 	if (pars.meta.simSeries) removeScratchFile(pars);
 
 #ifdef PRISMATIC_ENABLE_GPU
@@ -131,6 +173,10 @@ void PRISM_runFP(Parameters<PRISMATIC_FLOAT_PRECISION> &pars, size_t fpNum)
 	pars.outputFile = H5::H5File(pars.meta.filenameOutput.c_str(), H5F_ACC_RDWR);
 	pars.fpFlag = fpNum;
 
+	//take the potential the pipeline computed during the previous frozen phonon
+	if(pars.potentialPipeline) pars.potentialPipeline->finish(pars, fpNum);
+	if(pars.checkpoint) pars.checkpoint->beginFP(pars, fpNum);
+
 	if(pars.meta.importSMatrix)
 	{
 		std::cout << "Skipping PRISM01. Using precalculated scattering matrix from: "  << pars.meta.importFile << std::endl;
@@ -154,6 +200,15 @@ void PRISM_runFP(Parameters<PRISMATIC_FLOAT_PRECISION> &pars, size_t fpNum)
 #ifdef PRISMATIC_BUILDING_GUI
     pars.parent_thread->passPotentialToParent(pars.pot);
 #endif
+	if(pars.checkpoint) pars.checkpoint->recordPotential(pars);
+
+	//compute the next potential on a few threads while the rest run this frozen phonon
+	size_t numThreads = pars.meta.numThreads;
+	if(pars.potentialPipeline && fpNum + 1 < pars.meta.numFP)
+	{
+		pars.potentialPipeline->start(pars, fpNum + 1);
+		pars.meta.numThreads = std::max((size_t)1, numThreads - pars.potentialPipeline->getNumThreads());
+	}
 
 	// compute compact S-matrix
 	if(pars.meta.importSMatrix)
@@ -173,6 +228,7 @@ void PRISM_runFP(Parameters<PRISMATIC_FLOAT_PRECISION> &pars, size_t fpNum)
 
 	PRISM03_calcOutput(pars);
 	pars.outputFile.close();
+	pars.meta.numThreads = numThreads;
 
 	if(fpNum >= 1)
 	{
@@ -184,6 +240,7 @@ void PRISM_runFP(Parameters<PRISMATIC_FLOAT_PRECISION> &pars, size_t fpNum)
 		pars.net_output = pars.output;
 		if (pars.meta.saveDPC_CoM) pars.net_DPC_CoM = pars.DPC_CoM;
 	}
+	if(pars.checkpoint) pars.checkpoint->finishFP(pars, fpNum);
 	
 };
 
@@ -231,6 +288,24 @@ void PRISM_series_runFP(Parameters<PRISMATIC_FLOAT_PRECISION> &pars, size_t fpNu
 		PRISM02_calcSMatrix(pars);
 	}
 
+	if(useSeriesPass(pars))
+	{
+		//every member reads the S-matrix in the same pass, then their outputs are summed one at a time
+		PRISM03_calcSeries(pars);
+		for(auto i = 0; i < pars.seriesMembers.size(); i++)
+		{
+			pars.currentTag = pars.seriesMembers[i].tag;
+			pars.output = std::move(pars.seriesMembers[i].output);
+			if(pars.meta.saveDPC_CoM) pars.DPC_CoM = std::move(pars.seriesMembers[i].DPC_CoM);
+
+			if(i == 0 and fpNum == 0) createScratchFile(pars);
+			updateScratchData(pars);
+		}
+		pars.seriesMembers.clear();
+		pars.outputFile.close();
+		return;
+	}
+
 	for(auto i = 0; i < pars.meta.seriesVals[0].size(); i++)
 	{
 		std::cout << "------------------- Series iter " << i << " -------------------" << std::endl;
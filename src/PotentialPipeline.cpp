@@ -0,0 +1,83 @@
+// Copyright Alan (AJ) Pryor, Jr. 2017
+// Transcribed from MATLAB code by Colin Ophus
+// Prismatic is distributed under the GNU General Public License (GPL)
+// If you use Prismatic, we kindly ask that you cite the following papers:
+
+// 1. Ophus, C.: A fast image simulation algorithm for scanning
+//    transmission electron microscopy. Advanced Structural and
+//    Chemical Imaging 3(1), 13 (2017)
+
+// 2. Pryor, Jr., A., Ophus, C., and Miao, J.: A Streaming Multi-GPU
+//    Implementation of Image Simulation Algorithms for Scanning
+//	  Transmission Electron Microscopy. arXiv:1706.08563 (2017)
+
+#include "PotentialPipeline.h"
+#include "PRISM01_calcPotential.h"
+#include <iostream>
+#include <stdlib.h>
+
+namespace Prismatic
+{
+PotentialPipeline::PotentialPipeline(const size_t _numThreads) : numThreads(_numThreads),
+																 stagedFP(0){};
+
+PotentialPipeline::~PotentialPipeline()
+{
+	if (worker.joinable())
+		worker.join();
+};
+
+void PotentialPipeline::start(const Parameters<PRISMATIC_FLOAT_PRECISION> &pars, const size_t fpNum)
+{
+	if (worker.joinable())
+		worker.join();
+
+	// PRISM01 reads only the settings, the atoms and the grid; the seed is drawn here, before the worker calls srand
+	stage.meta = pars.meta;
+	stage.meta.numThreads = numThreads;
+	stage.meta.randomSeed = rand() % 100000;
+	stage.meta.fpNum = fpNum;
+	stage.meta.savePotentialSlices = false;
+	stage.atoms = pars.atoms;
+	stage.pixelSize = pars.pixelSize;
+	stage.imageSize = pars.imageSize;
+	stage.tiledCellDim = pars.tiledCellDim;
+	stage.numSlices = pars.numSlices;
+	stage.dzPot = pars.dzPot;
+	stage.fpFlag = fpNum;
+	stagedFP = fpNum;
+	error = nullptr;
+
+	std::cout << "Computing the potential of frozen phonon #" << fpNum << " on " << numThreads << " threads in the background" << std::endl;
+	worker = std::thread([this]() {
+		try
+		{
+			PRISM01_calcPotential(stage);
+		}
+		catch (...)
+		{
+			error = std::current_exception();
+		}
+	});
+};
+
+bool PotentialPipeline::finish(Parameters<PRISMATIC_FLOAT_PRECISION> &pars, const size_t fpNum)
+{
+	if (!worker.joinable() || stagedFP != fpNum)
+		return false;
+
+	worker.join();
+	if (error)
+		std::rethrow_exception(error);
+
+	// moving in the staged potential releases the one of the previous frozen phonon
+	pars.pot = std::move(stage.pot);
+	stage.pot = Array3D<PRISMATIC_FLOAT_PRECISION>();
+	pars.numPlanes = stage.numPlanes;
+	pars.numSlices = stage.numSlices;
+	pars.dzPot = stage.dzPot;
+	pars.meta.randomSeed = stage.meta.randomSeed;
+	pars.potentialReady = true;
+	return true;
+};
+} // namespace Prismatic
@@ -0,0 +1,126 @@
+// Copyright Alan (AJ) Pryor, Jr. 2017
+// Transcribed from MATLAB code by Colin Ophus
+// Prismatic is distributed under the GNU General Public License (GPL)
+// If you use Prismatic, we kindly ask that you cite the following papers:
+
+// 1. Ophus, C.: A fast image simulation algorithm for scanning
+//    transmission electron microscopy. Advanced Structural and
+//    Chemical Imaging 3(1), 13 (2017)
+
+// 2. Pryor, Jr., A., Ophus, C., and Miao, J.: A Streaming Multi-GPU
+//    Implementation of Image Simulation Algorithms for Scanning
+//	  Transmission Electron Microscopy. arXiv:1706.08563 (2017)
+
+#include "RawDatacube.h"
+#include <cstring>
+#include <sstream>
+#include <stdexcept>
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#endif //_WIN32
+
+namespace Prismatic
+{
+RawDatacube::RawDatacube(const std::string &_filename,
+						 const std::vector<size_t> &_shape,
+						 const bool _complex) : filename(_filename),
+												shape(_shape),
+												complex(_complex),
+												mapping(NULL)
+{
+	// npy header: magic, version 1.0, little endian header length, then a python dict padded to a multiple of 64
+	std::stringstream dict;
+	dict << "{'descr': '" << getDescr() << "', 'fortran_order': False, 'shape': (";
+	for (auto i = 0; i < shape.size(); ++i)
+		dict << shape[i] << ", ";
+	dict << "), }";
+	std::string header = dict.str();
+	header.append(64 - (10 + header.size() + 1) % 64, ' ');
+	header += '\n';
+	std::string preamble("\x93NUMPY\x01\x00", 8);
+	preamble += (char)(header.size() & 0xff);
+	preamble += (char)(header.size() >> 8);
+	header = preamble + header;
+	headerBytes = header.size();
+
+	fileBytes = (complex ? 2 : 1) * sizeof(PRISMATIC_FLOAT_PRECISION);
+	for (auto i = 0; i < shape.size(); ++i)
+		fileBytes *= shape[i];
+	fileBytes += headerBytes;
+
+	// the file is sized up front, so the mapping starts out zero filled
+#ifdef _WIN32
+	fileHandle = CreateFileA(filename.c_str(), GENERIC_READ | GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (fileHandle == INVALID_HANDLE_VALUE)
+		throw std::runtime_error("Unable to create raw 4D output file " + filename + "\n");
+	LARGE_INTEGER size;
+	size.QuadPart = fileBytes;
+	mapHandle = CreateFileMappingA(fileHandle, NULL, PAGE_READWRITE, size.HighPart, size.LowPart, NULL);
+	if (mapHandle != NULL)
+		mapping = (char *)MapViewOfFile(mapHandle, FILE_MAP_ALL_ACCESS, 0, 0, fileBytes);
+	if (mapping == NULL)
+	{
+		if (mapHandle != NULL)
+			CloseHandle(mapHandle);
+		CloseHandle(fileHandle);
+		throw std::runtime_error("Unable to map raw 4D output file " + filename + "\n");
+	}
+#else
+	fileDescriptor = open(filename.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+	if (fileDescriptor < 0)
+		throw std::runtime_error("Unable to create raw 4D output file " + filename + "\n");
+	if (ftruncate(fileDescriptor, fileBytes) != 0)
+	{
+		close(fileDescriptor);
+		throw std::runtime_error("Unable to allocate raw 4D output file " + filename + "\n");
+	}
+	void *map = mmap(NULL, fileBytes, PROT_READ | PROT_WRITE, MAP_SHARED, fileDescriptor, 0);
+	if (map == MAP_FAILED)
+	{
+		close(fileDescriptor);
+		throw std::runtime_error("Unable to map raw 4D output file " + filename + "\n");
+	}
+	mapping = (char *)map;
+#endif //_WIN32
+	std::memcpy(mapping, header.data(), headerBytes);
+};
+
+RawDatacube::~RawDatacube()
+{
+#ifdef _WIN32
+	UnmapViewOfFile(mapping);
+	CloseHandle(mapHandle);
+	CloseHandle(fileHandle);
+#else
+	munmap(mapping, fileBytes);
+	close(fileDescriptor);
+#endif //_WIN32
+};
+
+PRISMATIC_FLOAT_PRECISION *RawDatacube::getFrame(const size_t ax, const size_t ay)
+{
+	size_t frameSize = (complex ? 2 : 1) * shape[2] * shape[3];
+	return reinterpret_cast<PRISMATIC_FLOAT_PRECISION *>(mapping + headerBytes) + (ax * shape[1] + ay) * frameSize;
+};
+
+std::string RawDatacube::getDescr() const
+{
+	std::stringstream descr;
+	descr << (complex ? "<c" : "<f") << (complex ? 2 : 1) * sizeof(PRISMATIC_FLOAT_PRECISION);
+	return descr.str();
+};
+
+void RawDatacube::flush()
+{
+#ifdef _WIN32
+	FlushViewOfFile(mapping, fileBytes);
+	FlushFileBuffers(fileHandle);
+#else
+	msync(mapping, fileBytes, MS_SYNC);
+#endif //_WIN32
+};
+} // namespace Prismatic
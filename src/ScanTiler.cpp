@@ -0,0 +1,415 @@
+// Copyright Alan (AJ) Pryor, Jr. 2017
+// Transcribed from MATLAB code by Colin Ophus
+// Prismatic is distributed under the GNU General Public License (GPL)
+// If you use Prismatic, we kindly ask that you cite the following papers:
+
+// 1. Ophus, C.: A fast image simulation algorithm for scanning
+//    transmission electron microscopy. Advanced Structural and
+//    Chemical Imaging 3(1), 13 (2017)
+
+// 2. Pryor, Jr., A., Ophus, C., and Miao, J.: A Streaming Multi-GPU
+//    Implementation of Image Simulation Algorithms for Scanning
+//	  Transmission Electron Microscopy. arXiv:1706.08563 (2017)
+
+#include "ScanTiler.h"
+#include "PRISM01_calcPotential.h"
+#include "PRISM02_calcSMatrix.h"
+#include "configure.h"
+#include "fileIO.h"
+#include "utility.h"
+#include "MPIComm.h"
+#include <algorithm>
+#include <iostream>
+#include <cstdio>
+#include <stdlib.h>
+#include <stdexcept>
+#ifndef _WIN32
+#include <unistd.h>
+#include <sys/wait.h>
+#endif //_WIN32
+
+namespace Prismatic
+{
+namespace
+{
+//tile slabs are copied through a buffer of about this size
+const size_t mergeBufferBytes = 64 * 1024 * 1024;
+
+void copyAttributes(const H5::H5Object &from, H5::H5Object &to)
+{
+	for (auto i = 0; i < from.getNumAttrs(); i++)
+	{
+		H5::Attribute attr = from.openAttribute((unsigned int)i);
+		H5::DataType type = attr.getDataType();
+		H5::DataSpace space = attr.getSpace();
+		std::vector<char> buffer(std::max((size_t)attr.getInMemDataSize(), (size_t)1));
+		attr.read(type, &buffer[0]);
+		H5::Attribute copy = to.createAttribute(attr.getName(), type, space);
+		copy.write(type, &buffer[0]);
+	}
+};
+
+bool isScanDependent(const std::string &group, const std::string &name)
+{
+	if (group == "datacubes") return true;
+	if (group != "realslices") return false;
+	const std::string prefixes[] = {"virtual_detector_depth", "annular_detector_depth", "custom_detector_depth", "DPC_CoM_depth"};
+	for (auto &p : prefixes)
+		if (name.compare(0, p.size(), p) == 0) return true;
+	return false;
+};
+} // namespace
+
+ScanTiler::ScanTiler(const Metadata<PRISMATIC_FLOAT_PRECISION> &_meta, const bool _mpiRanks) : meta(_meta),
+																								mpiRanks(_mpiRanks),
+																								rank(0)
+{
+	//the launcher reads the atoms once to count the positions it tiles
+	meta.scanTile = -1;
+	Parameters<PRISMATIC_FLOAT_PRECISION> pars(meta);
+	std::vector<PRISMATIC_FLOAT_PRECISION> xp_d, yp_d;
+	getProbePositions(pars, xp_d, yp_d);
+	size_t numPositions = meta.arbitraryProbes ? xp_d.size() : yp_d.size();
+	size_t numWorkers = meta.scanTiles;
+#ifdef PRISMATIC_ENABLE_MPI
+	if (mpiRanks)
+	{
+		numWorkers = getMPISize();
+		rank = getMPIRank();
+	}
+#endif //PRISMATIC_ENABLE_MPI
+	numTiles = std::max((size_t)1, std::min(numWorkers, numPositions));
+	numFP = meta.numFP;
+
+	//workers import what the user imports; otherwise they share the potentials or S-matrices of the launcher
+	sharedFile = meta.filenameOutput + ".shared";
+	useSharedFile = !(meta.importSMatrix || (meta.algorithm == Algorithm::Multislice && meta.importPotential));
+};
+
+void ScanTiler::run()
+{
+	if (numTiles < 2)
+	{
+		std::cout << "The scan has fewer positions than tiles, running in one process" << std::endl;
+		if (rank == 0) execute_plan(meta);
+		return;
+	}
+
+#ifdef PRISMATIC_ENABLE_MPI
+	if (mpiRanks)
+	{
+		std::cout << "Splitting the scan among " << numTiles << " MPI ranks" << std::endl;
+		try
+		{
+			if (useSharedFile) writeSharedFile();
+			barrier();
+			if (rank < numTiles)
+			{
+				Metadata<PRISMATIC_FLOAT_PRECISION> tileMeta = getTileMeta(rank);
+				execute_plan(tileMeta);
+			}
+			barrier();
+			if (rank == 0)
+			{
+				merge();
+				removeTemporaryFiles();
+			}
+			barrier();
+		}
+		catch (std::exception &e)
+		{
+			abortRanks(e.what());
+		}
+		return;
+	}
+#endif //PRISMATIC_ENABLE_MPI
+
+	std::cout << "Splitting the scan among " << numTiles << " worker processes" << std::endl;
+	try
+	{
+		if (useSharedFile) writeSharedFile();
+		runWorkers();
+		merge();
+	}
+	catch (...)
+	{
+		removeTemporaryFiles();
+		throw;
+	}
+	removeTemporaryFiles();
+};
+
+void ScanTiler::writeSharedFile()
+{
+	//rank 0 computes the potentials and writes the file; with PRISM every rank computes a share of the beams
+	const bool root = rank == 0;
+	if (!root && meta.algorithm != Algorithm::PRISM) return;
+
+	Metadata<PRISMATIC_FLOAT_PRECISION> sharedMeta = meta;
+	sharedMeta.filenameOutput = sharedFile;
+	sharedMeta.savePotentialSlices = meta.savePotentialSlices || meta.algorithm == Algorithm::Multislice;
+	sharedMeta.saveSMatrix = meta.algorithm == Algorithm::PRISM;
+	sharedMeta.compressSMatrix = false;
+	sharedMeta.save2DOutput = false;
+	sharedMeta.save3DOutput = false;
+	sharedMeta.save4DOutput = false;
+	if (!root)
+	{
+		sharedMeta.savePotentialSlices = false;
+		sharedMeta.saveSMatrix = false;
+	}
+
+	Parameters<PRISMATIC_FLOAT_PRECISION> pars(sharedMeta);
+	pars.distributeBeams = mpiRanks;
+	if (root)
+	{
+		pars.outputFile = H5::H5File(sharedFile.c_str(), H5F_ACC_TRUNC);
+		setupOutputFile(pars);
+	}
+	if (pars.meta.importPotential) configureImportFP(pars);
+
+	std::cout << "Computing the shared " << (meta.algorithm == Algorithm::PRISM ? "S-matrices" : "potentials")
+			  << " of " << pars.meta.numFP << " frozen phonons" << std::endl;
+	for (auto fp = 0; fp < pars.meta.numFP; fp++)
+	{
+		pars.meta.randomSeed = rand() % 100000;
+		pars.meta.fpNum = fp;
+		pars.fpFlag = fp;
+		if (pars.meta.importPotential)
+		{
+			PRISM01_importPotential(pars);
+		}
+		else
+		{
+			if (root) PRISM01_calcPotential(pars);
+#ifdef PRISMATIC_ENABLE_MPI
+			//only with PRISM do the other ranks stay in this loop to compute their beams
+			if (mpiRanks && meta.algorithm == Algorithm::PRISM) broadcastPotential(pars);
+#endif //PRISMATIC_ENABLE_MPI
+		}
+		if (pars.meta.algorithm == Algorithm::PRISM) PRISM02_calcSMatrix(pars);
+	}
+	numFP = pars.meta.numFP;
+
+	if (root)
+	{
+		writeMetadata(pars);
+		pars.outputFile.close();
+	}
+};
+
+void ScanTiler::runWorkers()
+{
+#ifndef _WIN32
+	std::vector<pid_t> workers;
+	for (auto k = 0; k < numTiles; k++)
+	{
+		//local workers share the cores of this machine
+		Metadata<PRISMATIC_FLOAT_PRECISION> tileMeta = getTileMeta(k);
+		tileMeta.numThreads = std::max((size_t)1, meta.numThreads / numTiles);
+
+		//buffered output would otherwise be printed by the launcher and every worker
+		std::cout.flush();
+		fflush(stdout);
+		pid_t pid = fork();
+		if (pid == 0)
+		{
+			int status = 0;
+			try
+			{
+				execute_plan(tileMeta);
+			}
+			catch (std::exception &e)
+			{
+				std::cout << "Scan tile " << k << " failed: " << e.what() << std::endl;
+				status = 1;
+			}
+			catch (...)
+			{
+				status = 1;
+			}
+			std::cout.flush();
+			_exit(status);
+		}
+		if (pid < 0)
+		{
+			for (auto &w : workers) waitpid(w, nullptr, 0);
+			throw std::runtime_error("Unable to start the worker process of scan tile " + std::to_string(k));
+		}
+		workers.push_back(pid);
+	}
+
+	std::string failed;
+	for (auto k = 0; k < workers.size(); k++)
+	{
+		int status;
+		if (waitpid(workers[k], &status, 0) < 0 || !WIFEXITED(status) || WEXITSTATUS(status) != 0)
+			failed += " " + std::to_string(k);
+	}
+	if (!failed.empty()) throw std::runtime_error("The worker processes of scan tiles" + failed + " failed");
+#else
+	throw std::runtime_error("Scan tiles are not supported on Windows");
+#endif //_WIN32
+};
+
+Metadata<PRISMATIC_FLOAT_PRECISION> ScanTiler::getTileMeta(const size_t tile) const
+{
+	Metadata<PRISMATIC_FLOAT_PRECISION> tileMeta = meta;
+	tileMeta.scanTile = tile;
+	tileMeta.scanTiles = numTiles;
+	tileMeta.filenameOutput = getTileFile(tile);
+	tileMeta.savePotentialSlices = false;
+	tileMeta.saveSMatrix = false;
+	if (useSharedFile)
+	{
+		tileMeta.importPotential = meta.algorithm == Algorithm::Multislice;
+		tileMeta.importSMatrix = meta.algorithm == Algorithm::PRISM;
+		tileMeta.importFile = sharedFile;
+		tileMeta.numFP = numFP;
+		tileMeta.userSpecifiedNumFP = true;
+	}
+	return tileMeta;
+};
+
+void ScanTiler::merge()
+{
+	std::cout << "Merging the outputs of " << numTiles << " scan tiles into " << meta.filenameOutput << std::endl;
+	std::vector<H5::H5File> tiles;
+	for (auto k = 0; k < numTiles; k++)
+		tiles.push_back(H5::H5File(getTileFile(k).c_str(), H5F_ACC_RDONLY));
+
+	Parameters<PRISMATIC_FLOAT_PRECISION> pars(meta);
+	pars.meta.numFP = numFP;
+	pars.outputFile = H5::H5File(meta.filenameOutput.c_str(), H5F_ACC_TRUNC);
+	setupOutputFile(pars);
+
+	const std::string dataGroups[] = {"datacubes", "counted_datacubes", "diffractionslices", "realslices",
+									  "pointlists", "pointlistarrays", "supergroups"};
+	for (auto &g : dataGroups)
+	{
+		std::string groupPath = "4DSTEM_simulation/data/" + g;
+		H5::Group source = tiles[0].openGroup(groupPath.c_str());
+		H5::Group target = pars.outputFile.openGroup(groupPath.c_str());
+		for (auto i = 0; i < source.getNumObjs(); i++)
+		{
+			std::string name = source.getObjnameByIdx(i);
+			if (isScanDependent(g, name))
+			{
+				H5::Group merged = target.createGroup(name.c_str());
+				mergeGroup(tiles, merged, groupPath + "/" + name);
+			}
+			else
+			{
+				//outputs that do not depend on the scan, like the probes, are the same in every tile
+				H5Ocopy(source.getId(), name.c_str(), target.getId(), name.c_str(), H5P_DEFAULT, H5P_DEFAULT);
+			}
+		}
+	}
+
+	//the potentials and S-matrices the user asked for were saved once, in the shared file
+	if (useSharedFile && (meta.savePotentialSlices || meta.saveSMatrix))
+	{
+		H5::H5File shared(sharedFile.c_str(), H5F_ACC_RDONLY);
+		H5::Group source = shared.openGroup("4DSTEM_simulation/data/realslices");
+		H5::Group target = pars.outputFile.openGroup("4DSTEM_simulation/data/realslices");
+		for (auto i = 0; i < source.getNumObjs(); i++)
+		{
+			std::string name = source.getObjnameByIdx(i);
+			if ((meta.savePotentialSlices && name.compare(0, 13, "ppotential_fp") == 0) ||
+				(meta.saveSMatrix && name.compare(0, 10, "smatrix_fp") == 0))
+				H5Ocopy(source.getId(), name.c_str(), target.getId(), name.c_str(), H5P_DEFAULT, H5P_DEFAULT);
+		}
+	}
+
+	writeMetadata(pars);
+	pars.outputFile.close();
+};
+
+void ScanTiler::mergeGroup(std::vector<H5::H5File> &tiles, H5::Group &target, const std::string &path)
+{
+	//grid scans are tiled along the second axis (scan rows), probe lists along the first
+	H5::Group first = tiles[0].openGroup(path.c_str());
+	copyAttributes(first, target);
+	for (auto i = 0; i < first.getNumObjs(); i++)
+	{
+		std::string name = first.getObjnameByIdx(i);
+		if (name == "data")
+			concatenate(tiles, target, path, name, meta.arbitraryProbes ? 0 : 1);
+		else if (name == "dim2" || (meta.arbitraryProbes && name == "dim1"))
+			concatenate(tiles, target, path, name, 0);
+		else
+			H5Ocopy(first.getId(), name.c_str(), target.getId(), name.c_str(), H5P_DEFAULT, H5P_DEFAULT);
+	}
+};
+
+void ScanTiler::concatenate(std::vector<H5::H5File> &tiles, H5::Group &target, const std::string &path,
+							const std::string &name, const int axis)
+{
+	std::vector<H5::DataSet> sources;
+	for (auto &t : tiles)
+		sources.push_back(t.openGroup(path.c_str()).openDataSet(name.c_str()));
+
+	H5::DataType type = sources[0].getDataType();
+	const int rank = sources[0].getSpace().getSimpleExtentNdims();
+	std::vector<hsize_t> dims(rank);
+	sources[0].getSpace().getSimpleExtentDims(&dims[0]);
+	dims[axis] = 0;
+	for (auto &s : sources)
+	{
+		std::vector<hsize_t> tileDims(rank);
+		s.getSpace().getSimpleExtentDims(&tileDims[0]);
+		dims[axis] += tileDims[axis];
+	}
+
+	H5::DataSpace mspace(rank, &dims[0]);
+	H5::DataSet merged = target.createDataSet(name.c_str(), type, mspace, sources[0].getCreatePlist());
+	copyAttributes(sources[0], merged);
+
+	//copy each tile in slabs along the first axis so only part of a datacube is held in memory
+	hsize_t position = 0;
+	for (auto &s : sources)
+	{
+		H5::DataSpace sspace = s.getSpace();
+		std::vector<hsize_t> tileDims(rank);
+		sspace.getSimpleExtentDims(&tileDims[0]);
+		size_t rowBytes = type.getSize();
+		for (auto d = 1; d < rank; d++) rowBytes *= tileDims[d];
+		hsize_t step = std::max((size_t)1, mergeBufferBytes / std::max(rowBytes, (size_t)1));
+		std::vector<char> buffer;
+
+		for (hsize_t x0 = 0; x0 < tileDims[0]; x0 += step)
+		{
+			std::vector<hsize_t> count = tileDims;
+			count[0] = std::min(step, tileDims[0] - x0);
+			std::vector<hsize_t> sourceOffset(rank, 0);
+			sourceOffset[0] = x0;
+			std::vector<hsize_t> targetOffset = sourceOffset;
+			targetOffset[axis] += position;
+
+			size_t bytes = rowBytes * count[0];
+			if (bytes == 0) continue;
+			buffer.resize(bytes);
+			H5::DataSpace bufferSpace(rank, &count[0]);
+			sspace.selectHyperslab(H5S_SELECT_SET, &count[0], &sourceOffset[0]);
+			s.read(&buffer[0], type, bufferSpace, sspace);
+
+			H5::DataSpace tspace = merged.getSpace();
+			tspace.selectHyperslab(H5S_SELECT_SET, &count[0], &targetOffset[0]);
+			merged.write(&buffer[0], type, bufferSpace, tspace);
+		}
+		position += tileDims[axis];
+	}
+};
+
+void ScanTiler::removeTemporaryFiles()
+{
+	for (auto k = 0; k < numTiles; k++)
+		std::remove(getTileFile(k).c_str());
+	if (useSharedFile) std::remove(sharedFile.c_str());
+};
+
+std::string ScanTiler::getTileFile(const size_t tile) const
+{
+	return meta.filenameOutput + ".tile" + getDigitString(tile);
+};
+} // namespace Prismatic
@@ -0,0 +1,79 @@
+// Copyright Alan (AJ) Pryor, Jr. 2017
+// Transcribed from MATLAB code by Colin Ophus
+// Prismatic is distributed under the GNU General Public License (GPL)
+// If you use Prismatic, we kindly ask that you cite the following papers:
+
+// 1. Ophus, C.: A fast image simulation algorithm for scanning
+//    transmission electron microscopy. Advanced Structural and
+//    Chemical Imaging 3(1), 13 (2017)
+
+// 2. Pryor, Jr., A., Ophus, C., and Miao, J.: A Streaming Multi-GPU
+//    Implementation of Image Simulation Algorithms for Scanning
+//	  Transmission Electron Microscopy. arXiv:1706.08563 (2017)
+
+#include "SimulationPlan.h"
+#include <limits>
+
+namespace Prismatic
+{
+SimulationPlan::Key::Key()
+{
+	// settings are compared exactly, so print them with enough digits to round trip
+	key.precision(std::numeric_limits<double>::max_digits10);
+};
+
+SimulationPlan::Key &SimulationPlan::Key::operator<<(const aberration &ab)
+{
+	key << ab.m << ',' << ab.n << ',' << ab.mag << ',' << ab.angle << ' ';
+	return *this;
+};
+
+SimulationPlan::Key &SimulationPlan::Key::operator<<(const detector &det)
+{
+	key << det.innerAngle << ',' << det.outerAngle << ',' << det.minPhi << ',' << det.maxPhi << ' ';
+	return *this;
+};
+
+void SimulationPlan::Key::addHash(const void *data, const size_t bytes)
+{
+	// 64 bit FNV-1a
+	uint64_t hash = 14695981039346656037ULL;
+	const unsigned char *c = static_cast<const unsigned char *>(data);
+	for (size_t i = 0; i < bytes; ++i)
+	{
+		hash ^= c[i];
+		hash *= 1099511628211ULL;
+	}
+	key << std::hex << hash << std::dec;
+};
+
+SimulationPlan &SimulationPlan::getPlan()
+{
+	static SimulationPlan plan;
+	return plan;
+};
+
+bool SimulationPlan::restore(const std::string &stage, const std::string &key, stateCopy copy, Parameters<PRISMATIC_FLOAT_PRECISION> &pars)
+{
+	std::lock_guard<std::mutex> gatekeeper(planLock);
+	auto entry = stages.find(stage);
+	if (entry == stages.end() || entry->second.first != key)
+		return false;
+	copy(entry->second.second, pars);
+	return true;
+};
+
+void SimulationPlan::store(const std::string &stage, const std::string &key, stateCopy copy, const Parameters<PRISMATIC_FLOAT_PRECISION> &pars)
+{
+	std::lock_guard<std::mutex> gatekeeper(planLock);
+	std::pair<std::string, Parameters<PRISMATIC_FLOAT_PRECISION> > &entry = stages[stage];
+	entry.first = key;
+	copy(pars, entry.second);
+};
+
+void SimulationPlan::clear()
+{
+	std::lock_guard<std::mutex> gatekeeper(planLock);
+	stages.clear();
+};
+} // namespace Prismatic
@@ -21,7 +21,9 @@
 #include <stdexcept>
 #include <iostream>
 #include "utility.h"
+#include "SimulationPlan.h"
 #include <vector>
+#include <cmath>
 
 namespace Prismatic
 {
@@ -108,28 +110,188 @@ Array2D<std::complex<PRISMATIC_FLOAT_PRECISION>> getChi(Array2D<PRISMATIC_FLOAT_
                                                         PRISMATIC_FLOAT_PRECISION &lambda, 
                                                         std::vector<aberration> &ab)
 {
+    return ChiEngine::getEngine().getChi(q, qTheta, lambda, ab);
+};
 
-    Array2D<std::complex<PRISMATIC_FLOAT_PRECISION>> chi = zeros_ND<2, std::complex<PRISMATIC_FLOAT_PRECISION>>({{q.get_dimj(), q.get_dimi()}});
+// memory the bases and chi of all grids may hold together; the grid in use is kept even when it alone is larger
+static const size_t maxHeldBytes = 256 * 1024 * 1024;
+
+ChiEngine &ChiEngine::getEngine()
+{
+    static ChiEngine engine;
+    return engine;
+};
+
+void ChiEngine::clear()
+{
+    std::lock_guard<std::mutex> gatekeeper(engineLock);
+    grids.clear();
+};
+
+size_t ChiEngine::getBytes(const gridState &grid)
+{
+    size_t values = grid.lambdaQ.size() + grid.theta.size() + grid.chi.size();
+    for(auto &r : grid.radial) values += r.size();
+    for(auto &c : grid.cosine) values += c.size();
+    for(auto &s : grid.sine) values += s.size();
+    return values * sizeof(PRISMATIC_FLOAT_PRECISION);
+};
+
+ChiEngine::termMap ChiEngine::getTerms(const std::vector<aberration> &ab)
+{
+    // aberrations sharing (m, n) add up, so they are merged into one term
     const PRISMATIC_FLOAT_PRECISION pi = acos(-1);
-    for(auto n = 0; n < ab.size(); n++)
+    termMap terms;
+    for(auto &a : ab)
+    {
+        PRISMATIC_FLOAT_PRECISION rad = a.angle * pi / 180.0;
+        std::pair<PRISMATIC_FLOAT_PRECISION, PRISMATIC_FLOAT_PRECISION> &c = terms[std::make_pair(a.m, a.n)];
+        c.first += a.mag * cos(a.n * rad);
+        c.second += a.mag * sin(a.n * rad);
+    }
+    return terms;
+};
+
+void ChiEngine::addTerm(gridState &grid, const int m, const int n, const PRISMATIC_FLOAT_PRECISION cx, const PRISMATIC_FLOAT_PRECISION cy)
+{
+    const size_t numPixels = grid.chi.size();
+    PRISMATIC_FLOAT_PRECISION *chi = &grid.chi[0];
+
+    if(m < 0)
     {
-        for(auto j = 0; j < chi.get_dimj(); j++)
+        // negative powers are not part of the basis set; evaluate them directly
+        for(auto k = 0; k < numPixels; k++)
         {
-            for(auto i = 0; i < chi.get_dimi(); i++)
+            PRISMATIC_FLOAT_PRECISION r = pow(grid.lambdaQ[k], m);
+            chi[k] += r * (cx * cos(n * grid.theta[k]) + cy * sin(n * grid.theta[k]));
+        }
+        return;
+    }
+
+    // extend the bases by recurrence up to the orders this term needs
+    while(grid.radial.size() <= m)
+    {
+        std::vector<PRISMATIC_FLOAT_PRECISION> next(numPixels, 1.0);
+        if(!grid.radial.empty())
+        {
+            const std::vector<PRISMATIC_FLOAT_PRECISION> &last = grid.radial.back();
+            for(auto k = 0; k < numPixels; k++) next[k] = last[k] * grid.lambdaQ[k];
+        }
+        grid.radial.push_back(std::move(next));
+    }
+
+    const size_t absN = std::abs(n);
+    while(grid.cosine.size() <= absN)
+    {
+        std::vector<PRISMATIC_FLOAT_PRECISION> nextCos(numPixels, 1.0);
+        std::vector<PRISMATIC_FLOAT_PRECISION> nextSin(numPixels, 0.0);
+        if(grid.cosine.size() == 1)
+        {
+            for(auto k = 0; k < numPixels; k++)
             {
-				PRISMATIC_FLOAT_PRECISION rad = ab[n].angle * pi / 180.0;
-                PRISMATIC_FLOAT_PRECISION cx = ab[n].mag * cos(ab[n].n*rad);
-                PRISMATIC_FLOAT_PRECISION cy = ab[n].mag * sin(ab[n].n*rad);
-                PRISMATIC_FLOAT_PRECISION tmp = chi.at(j,i).real();
-				tmp += cx*pow(lambda*q.at(j,i), ab[n].m)*cos(ab[n].n * qTheta.at(j,i));
-                tmp += cy*pow(lambda*q.at(j,i), ab[n].m)*sin(ab[n].n * qTheta.at(j,i));
-                chi.at(j,i).real(tmp);
+                nextCos[k] = cos(grid.theta[k]);
+                nextSin[k] = sin(grid.theta[k]);
             }
         }
+        else if(grid.cosine.size() > 1)
+        {
+            // cos((n+1)t) and sin((n+1)t) from the angle addition formulas
+            const std::vector<PRISMATIC_FLOAT_PRECISION> &c1 = grid.cosine[1];
+            const std::vector<PRISMATIC_FLOAT_PRECISION> &s1 = grid.sine[1];
+            const std::vector<PRISMATIC_FLOAT_PRECISION> &cn = grid.cosine.back();
+            const std::vector<PRISMATIC_FLOAT_PRECISION> &sn = grid.sine.back();
+            for(auto k = 0; k < numPixels; k++)
+            {
+                nextCos[k] = cn[k] * c1[k] - sn[k] * s1[k];
+                nextSin[k] = sn[k] * c1[k] + cn[k] * s1[k];
+            }
+        }
+        grid.cosine.push_back(std::move(nextCos));
+        grid.sine.push_back(std::move(nextSin));
     }
 
-    return chi;
+    // sin(-n*t) = -sin(n*t)
+    const PRISMATIC_FLOAT_PRECISION sy = (n < 0) ? -cy : cy;
+    const PRISMATIC_FLOAT_PRECISION *r = &grid.radial[m][0];
+    const PRISMATIC_FLOAT_PRECISION *c = &grid.cosine[absN][0];
+    const PRISMATIC_FLOAT_PRECISION *s = &grid.sine[absN][0];
+    for(auto k = 0; k < numPixels; k++)
+    {
+        chi[k] += r[k] * (cx * c[k] + sy * s[k]);
+    }
+};
 
+Array2D<std::complex<PRISMATIC_FLOAT_PRECISION>> ChiEngine::getChi(const Array2D<PRISMATIC_FLOAT_PRECISION> &q,
+                                                                   const Array2D<PRISMATIC_FLOAT_PRECISION> &qTheta,
+                                                                   const PRISMATIC_FLOAT_PRECISION lambda,
+                                                                   const std::vector<aberration> &ab)
+{
+    SimulationPlan::Key gridKey;
+    gridKey << q << qTheta;
+    const std::string key = gridKey.str();
+    const size_t numPixels = q.size();
+
+    std::lock_guard<std::mutex> gatekeeper(engineLock);
+    auto grid = grids.begin();
+    while(grid != grids.end() && (grid->key != key || grid->lambda != lambda)) ++grid;
+    if(grid == grids.end())
+    {
+        gridState state;
+        state.key = key;
+        state.lambda = lambda;
+        state.lambdaQ.resize(numPixels);
+        state.theta.assign(qTheta.begin(), qTheta.end());
+        for(auto k = 0; k < numPixels; k++) state.lambdaQ[k] = lambda * q[k];
+        state.chi.assign(numPixels, 0.0);
+        grids.push_front(std::move(state));
+    }
+    else if(grid != grids.begin())
+    {
+        grids.splice(grids.begin(), grids, grid);
+    }
+    gridState &state = grids.front();
+
+    // the change of every term between the chi held and the one asked for
+    termMap terms = getTerms(ab);
+    termMap delta;
+    for(auto &t : terms)
+    {
+        auto held = state.terms.find(t.first);
+        std::pair<PRISMATIC_FLOAT_PRECISION, PRISMATIC_FLOAT_PRECISION> d = t.second;
+        if(held != state.terms.end())
+        {
+            d.first -= held->second.first;
+            d.second -= held->second.second;
+        }
+        if(d.first != 0 || d.second != 0) delta[t.first] = d;
+    }
+    for(auto &t : state.terms)
+    {
+        if(terms.find(t.first) == terms.end())
+            delta[t.first] = std::make_pair(-t.second.first, -t.second.second);
+    }
+
+    // when most terms change, summing from zero is as cheap and does not carry rounding from earlier updates
+    if(delta.size() >= terms.size())
+    {
+        std::fill(state.chi.begin(), state.chi.end(), 0.0);
+        delta = terms;
+    }
+    for(auto &d : delta) addTerm(state, d.first.first, d.first.second, d.second.first, d.second.second);
+    state.terms = terms;
+
+    // the PRISM02 and PRISM03 grids alternate in a series, so older grids are kept while they fit in the budget
+    size_t heldBytes = 0;
+    for(auto &g : grids) heldBytes += getBytes(g);
+    while(grids.size() > 1 && heldBytes > maxHeldBytes)
+    {
+        heldBytes -= getBytes(grids.back());
+        grids.pop_back();
+    }
+
+    Array2D<std::complex<PRISMATIC_FLOAT_PRECISION>> chi = zeros_ND<2, std::complex<PRISMATIC_FLOAT_PRECISION>>({{q.get_dimj(), q.get_dimi()}});
+    for(auto k = 0; k < numPixels; k++) chi[k].real(state.chi[k]);
+    return chi;
 };
 
 std::vector<aberration> updateAberrations(std::vector<aberration> ab, 
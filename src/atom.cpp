@@ -20,10 +20,23 @@
 #include <fstream>
 #include <stdexcept>
 #include <iostream>
+#include <mutex>
 #include "kirkland_params.h"
 
 namespace Prismatic
 {
+namespace
+{
+// the atoms of the last file read, kept with the text they were parsed from so that repeated reads (scan tile
+// workers, served jobs) skip parsing the file while its contents are unchanged
+std::mutex atomCacheLock;
+std::string cachedAtomFile;
+std::string cachedAtomText;
+std::vector<atom> cachedAtoms;
+
+std::vector<atom> parseAtoms_xyz(std::istream &f, const std::string &filename);
+} // namespace
+
 std::string atomReadError(size_t line_num, const std::string str)
 {
 	std::string msg(" \n\nPrismatic: Error getting atomic species from");
@@ -88,10 +101,36 @@ void to_xyz(const std::vector<atom> atoms, const std::string filename, const std
 
 std::vector<atom> readAtoms_xyz(const std::string &filename)
 {
-	std::vector<atom> atoms;
+	// comparing the contents catches files rewritten within the resolution of their modification time
 	std::ifstream f(filename);
 	if (!f)
 		throw std::runtime_error("Unable to open file.\n");
+	std::stringstream contents;
+	contents << f.rdbuf();
+	std::string text = contents.str();
+	{
+		std::lock_guard<std::mutex> lock(atomCacheLock);
+		if (filename == cachedAtomFile && text == cachedAtomText)
+		{
+			std::cout << "using the " << cachedAtoms.size() << " atoms already read from " << filename << std::endl;
+			return cachedAtoms;
+		}
+	}
+
+	std::istringstream in(text);
+	std::vector<atom> atoms = parseAtoms_xyz(in, filename);
+	std::lock_guard<std::mutex> lock(atomCacheLock);
+	cachedAtomFile = filename;
+	cachedAtomText.swap(text);
+	cachedAtoms = atoms;
+	return atoms;
+}
+
+namespace
+{
+std::vector<atom> parseAtoms_xyz(std::istream &f, const std::string &filename)
+{
+	std::vector<atom> atoms;
 	std::string line;
 	std::string token;
 	size_t line_num = 2;
@@ -178,7 +217,8 @@ std::vector<atom> readAtoms_xyz(const std::string &filename)
 				  << std::endl;
 	}
 	return atoms;
-};
+}
+} // namespace
 
 std::array<double, 3> peekDims_xyz(const std::string &filename)
 {
@@ -198,6 +198,11 @@ void configure(Metadata<PRISMATIC_FLOAT_PRECISION> &meta)
 	formatOutput_CPU = formatOutput_CPU_integrate;
 #ifdef PRISMATIC_ENABLE_GPU
 	formatOutput_GPU = formatOutput_GPU_integrate;
+	if (meta.detectors.size() > 0 && meta.algorithm != Algorithm::HRTEM)
+	{
+		cout << "Custom detectors are only integrated by the CPU codes; rebuild without GPU support to use --detectors\n";
+		throw std::runtime_error("Custom detectors are not supported by the GPU codes");
+	}
 #endif
 	if (meta.algorithm == Algorithm::PRISM)
 	{
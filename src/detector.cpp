@@ -0,0 +1,200 @@
+// Copyright Alan (AJ) Pryor, Jr. 2017
+// Transcribed from MATLAB code by Colin Ophus
+// Prismatic is distributed under the GNU General Public License (GPL)
+// If you use Prismatic, we kindly ask that you cite the following papers:
+
+// 1. Ophus, C.: A fast image simulation algorithm for scanning
+//    transmission electron microscopy. Advanced Structural and
+//    Chemical Imaging 3(1), 13 (2017)
+
+// 2. Pryor, Jr., A., Ophus, C., and Miao, J.: A Streaming Multi-GPU
+//    Implementation of Image Simulation Algorithms for Scanning
+//	  Transmission Electron Microscopy. arXiv:1706.08563 (2017)
+
+#include "detector.h"
+#include <algorithm>
+#include <string>
+#include <cstring>
+#include <cmath>
+#include <sstream>
+#include <fstream>
+#include <stdexcept>
+#include <iostream>
+#include <vector>
+
+namespace Prismatic
+{
+
+std::string detectorReadError(size_t line_num, const std::string str)
+{
+	std::string msg(" \n\nPrismatic: Error getting detector from");
+	std::stringstream ssError;
+	msg += " line ";
+	ssError << line_num;
+	msg += ssError.str();
+	msg += ":\n ";
+	msg += str;
+	msg += " \n";
+	return msg;
+}
+
+std::vector<detector> readDetectors(const std::string &filename)
+{
+	// one detector per line after a comment line: inner, outer[, phiMin, phiMax] with the scattering angles in mrad
+	// and the azimuthal range in degrees. The list ends at the end of the file or at a line of at most 3 characters (e.g. -1)
+	std::vector<detector> detectors;
+	std::ifstream f(filename);
+	if (!f)
+		throw std::runtime_error("Unable to open file.\n");
+	std::string line;
+	size_t line_num = 1;
+	if (!std::getline(f, line))
+		throw std::runtime_error("Error reading comment line.\n");
+	const PRISMATIC_FLOAT_PRECISION pi = acos(-1);
+	while (std::getline(f, line))
+	{
+		++line_num;
+		size_t first = line.find_first_not_of(" \r\n\t");
+		if (first == std::string::npos)
+			continue;
+		line = line.substr(first, line.find_last_not_of(" \r\n\t") - first + 1);
+		if (line.size() <= 3)
+			break;
+
+		std::vector<PRISMATIC_FLOAT_PRECISION> vals;
+		std::stringstream ss;
+		ss << line;
+		PRISMATIC_FLOAT_PRECISION val;
+		while (ss >> val)
+		{
+			vals.push_back(val);
+			if (ss.peek() == ',')
+				ss.ignore();
+		}
+		if ((vals.size() != 2 && vals.size() != 4) || vals[1] <= vals[0] || vals[0] < 0)
+		{
+			throw std::domain_error(detectorReadError(line_num, line));
+		}
+		detector d{vals[0] / 1000, vals[1] / 1000, 0, 2 * pi};
+		if (vals.size() == 4)
+		{
+			d.minPhi = vals[2] * pi / 180;
+			d.maxPhi = vals[3] * pi / 180;
+		}
+		detectors.push_back(d);
+	}
+	if (detectors.size() == 0)
+	{
+		throw std::domain_error("Bad input data. No detectors were found in this file.\n");
+	}
+	std::cout << "extracted " << detectors.size() << " detectors from " << line_num << " lines in " << filename
+			  << std::endl;
+	return detectors;
+};
+
+bool inSegment(const detector &d, const PRISMATIC_FLOAT_PRECISION alpha, PRISMATIC_FLOAT_PRECISION phi)
+{
+	// azimuths are compared on [0, 2 pi); a segment whose end is below its start wraps through 0
+	const PRISMATIC_FLOAT_PRECISION two_pi = 2 * acos(-1);
+	if (alpha < d.innerAngle || alpha >= d.outerAngle)
+		return false;
+	if (d.maxPhi - d.minPhi >= two_pi)
+		return true;
+	PRISMATIC_FLOAT_PRECISION lo = fmod(fmod(d.minPhi, two_pi) + two_pi, two_pi);
+	PRISMATIC_FLOAT_PRECISION hi = fmod(fmod(d.maxPhi, two_pi) + two_pi, two_pi);
+	phi = fmod(fmod(phi, two_pi) + two_pi, two_pi);
+	return (lo <= hi) ? (phi >= lo && phi < hi) : (phi >= lo || phi < hi);
+};
+
+detectorMap buildDetectorMap(const Array2D<PRISMATIC_FLOAT_PRECISION> &alphaInd,
+							 const size_t Ndet,
+							 const Array2D<PRISMATIC_FLOAT_PRECISION> &alpha,
+							 const Array2D<PRISMATIC_FLOAT_PRECISION> &phi,
+							 const Array2D<PRISMATIC_FLOAT_PRECISION> &qx,
+							 const Array2D<PRISMATIC_FLOAT_PRECISION> &qy,
+							 const std::vector<detector> &detectors,
+							 const bool DPC)
+{
+	// compile the annular bins, user detectors and DPC sums into one sparse map over the diffraction pixels.
+	// Pixels are visited in memory order so every bin is accumulated in the same order as a dense pass would
+	detectorMap map;
+	map.numAnnular = Ndet;
+	map.numCustom = detectors.size();
+	map.DPC = DPC;
+	const size_t customStart = Ndet;
+	const size_t dpcStart = Ndet + detectors.size();
+
+	map.rowStart.push_back(0);
+	for (auto p = 0; p < alphaInd.size(); ++p)
+	{
+		const size_t numEntries = map.bins.size();
+		if (alphaInd[p] >= 1 && alphaInd[p] <= Ndet)
+		{
+			map.bins.push_back((size_t)alphaInd[p] - 1);
+			map.weights.push_back(1);
+		}
+		for (auto d = 0; d < detectors.size(); ++d)
+		{
+			if (inSegment(detectors[d], alpha[p], phi[p]))
+			{
+				map.bins.push_back(customStart + d);
+				map.weights.push_back(1);
+			}
+		}
+		if (DPC)
+		{
+			map.bins.push_back(dpcStart);
+			map.weights.push_back(qx[p]);
+			map.bins.push_back(dpcStart + 1);
+			map.weights.push_back(qy[p]);
+			map.bins.push_back(dpcStart + 2);
+			map.weights.push_back(1);
+		}
+		if (map.bins.size() > numEntries)
+		{
+			map.pixels.push_back(p);
+			map.rowStart.push_back(map.bins.size());
+		}
+	}
+	return map;
+};
+
+void integrateDetectors(const detectorMap &map,
+						const std::complex<PRISMATIC_FLOAT_PRECISION> *psi,
+						const PRISMATIC_FLOAT_PRECISION scale,
+						PRISMATIC_FLOAT_PRECISION *binValues)
+{
+	// single pass over the mapped pixels of psi, accumulating scale * |psi|^2 into every bin the pixel feeds
+	memset(binValues, 0, sizeof(PRISMATIC_FLOAT_PRECISION) * map.numBins());
+	const size_t *bin_ptr = map.bins.data();
+	const PRISMATIC_FLOAT_PRECISION *w_ptr = map.weights.data();
+	for (auto p = 0; p < map.pixels.size(); ++p)
+	{
+		const PRISMATIC_FLOAT_PRECISION intensity = std::norm(psi[map.pixels[p]]) * scale;
+		for (auto e = map.rowStart[p]; e < map.rowStart[p + 1]; ++e)
+		{
+			binValues[bin_ptr[e]] += w_ptr[e] * intensity;
+		}
+	}
+};
+
+void storeDetectorBins(const detectorMap &map,
+					   const PRISMATIC_FLOAT_PRECISION *binValues,
+					   PRISMATIC_FLOAT_PRECISION *output,
+					   PRISMATIC_FLOAT_PRECISION *DPC_CoM)
+{
+	// add the integrated bins to one probe's row of the output stack and, if requested, normalize the centre of mass
+	for (auto b = 0; b < map.numStored(); ++b)
+		output[b] += binValues[b];
+
+	if (map.DPC)
+	{
+		const PRISMATIC_FLOAT_PRECISION *dpc = binValues + map.numStored();
+		DPC_CoM[0] += dpc[0];
+		DPC_CoM[1] += dpc[1];
+		DPC_CoM[0] /= dpc[2];
+		DPC_CoM[1] /= dpc[2];
+	}
+};
+
+} // namespace Prismatic
@@ -16,15 +16,28 @@
 #include "configure.h"
 #include "parseInput.h"
 #include "utility.h"
+#include "JobServer.h"
+#ifdef PRISMATIC_ENABLE_MPI
+#include <mpi.h>
+#endif //PRISMATIC_ENABLE_MPI
 
 using namespace std;
 int main(int argc, const char **argv)
 {
+#ifdef PRISMATIC_ENABLE_MPI
+	// every rank parses the same options and runs its share of the simulation
+	MPI_Init(NULL, NULL);
+#endif //PRISMATIC_ENABLE_MPI
 	Prismatic::Metadata<PRISMATIC_FLOAT_PRECISION> meta;
 
 	// parse command line options
 	if (!Prismatic::parseInputs(meta, argc, &argv))
+	{
+#ifdef PRISMATIC_ENABLE_MPI
+		MPI_Finalize();
+#endif //PRISMATIC_ENABLE_MPI
 		return 1;
+	}
 
 	Prismatic::printHeader();
 
@@ -33,10 +46,27 @@ int main(int argc, const char **argv)
 	// print metadata
 	//	meta.toString();
 
-	// execute simulation
-	Prismatic::go(meta);
+	// execute simulation, or keep running the simulation jobs of a job source
+	try
+	{
+		if (!meta.serveSource.empty())
+			Prismatic::JobServer(meta).run();
+		else
+			Prismatic::go(meta);
+	}
+	catch (...)
+	{
+		std::cout << "Terminating" << std::endl;
+#ifdef PRISMATIC_ENABLE_MPI
+		MPI_Finalize();
+#endif //PRISMATIC_ENABLE_MPI
+		return 1;
+	}
 
 	//	Prismatic::printTime();
 
+#ifdef PRISMATIC_ENABLE_MPI
+	MPI_Finalize();
+#endif //PRISMATIC_ENABLE_MPI
 	return 0;
 }
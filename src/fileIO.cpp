@@ -3,6 +3,9 @@
 #include "fileIO.h"
 #include "utility.h"
 #include <mutex>
+#include <fstream>
+#include <iomanip>
+#include <limits>
 
 namespace Prismatic{
 
@@ -47,6 +50,10 @@ void setupOutputFile(Parameters<PRISMATIC_FLOAT_PRECISION> &pars)
 void setup4DOutput(Parameters<PRISMATIC_FLOAT_PRECISION> &pars)
 {
 	H5::Group datacubes = pars.outputFile.openGroup("4DSTEM_simulation/data/datacubes");
+	H5::Group countedDatacubes = pars.outputFile.openGroup("4DSTEM_simulation/data/counted_datacubes");
+
+	//electron counts are only sampled from intensities
+	bool counted = pars.meta.countedElectrons > 0 && !pars.meta.saveComplexOutputWave;
 
 	//shared properties
 	std::string base_name = "CBED_array_depth";
@@ -55,7 +62,7 @@ void setup4DOutput(Parameters<PRISMATIC_FLOAT_PRECISION> &pars)
 	data_dims[0] = {pars.numXprobes};
 	data_dims[1] = {pars.numYprobes};
 	hsize_t chunkDims[4];
-	chunkDims[0] = chunkDims[1] = {1};
+	for (auto i = 0; i < 4; i++) chunkDims[i] = pars.meta.chunk4D[i];
 	hsize_t rx_dim[1] = {pars.xp.size()};
 	hsize_t ry_dim[1] = {pars.yp.size()};
 	hsize_t qx_dim[1];
@@ -129,8 +136,6 @@ void setup4DOutput(Parameters<PRISMATIC_FLOAT_PRECISION> &pars)
 		qy_dim[0] = {qyInd_max};
 		qx = fftshift(pars.qx);
 		qy = fftshift(pars.qy);
-		chunkDims[2] = {qxInd_max};
-		chunkDims[3] = {qyInd_max};
 	}
 	else
 	{
@@ -140,44 +145,159 @@ void setup4DOutput(Parameters<PRISMATIC_FLOAT_PRECISION> &pars)
 		qy_dim[0] = {qyInd_max};
 		qx = pars.qx;
 		qy = pars.qy;
-		chunkDims[2] = {qxInd_max};
-		chunkDims[3] = {qyInd_max};
 	}
 
+	//rectangular window and binning of the detector pixels, applied to each pattern before it is queued for writing
+	const Array1D<PRISMATIC_FLOAT_PRECISION> *qLabels[2] = {&qx, &qy};
+	long qOffsets[2] = {offset_qx, offset_qy};
+	std::vector<PRISMATIC_FLOAT_PRECISION> binnedLabels[2];
+	pars.reduce4D = pars.meta.window4DOutput;
+	for (auto d = 0; d < 2; d++)
+	{
+		size_t start = 0;
+		size_t stop = data_dims[2 + d];
+		if (pars.meta.window4DOutput)
+		{
+			//the window runs from the first to the last pixel within the angular limits
+			size_t first = stop;
+			size_t last = 0;
+			for (auto i = 0; i < data_dims[2 + d]; i++)
+			{
+				PRISMATIC_FLOAT_PRECISION angle = qLabels[d]->at(qOffsets[d] + i) * pars.lambda;
+				if (angle >= pars.meta.window4D[2 * d] && angle <= pars.meta.window4D[2 * d + 1])
+				{
+					first = std::min(first, (size_t)i);
+					last = std::max(last, (size_t)i);
+				}
+			}
+			if (first > last) throw std::runtime_error("The 4D window contains no detector pixels.\n");
+			start = first;
+			stop = last + 1;
+		}
+
+		//binning intensities sums the pixels of each bin; complex waves are not binned, and partial bins are dropped
+		size_t bin = pars.meta.saveComplexOutputWave ? 1 : std::max((size_t)1, std::min(pars.meta.bin4D[d], stop - start));
+		pars.reduce4D = pars.reduce4D || (bin > 1);
+		pars.frame4DStart[d] = start;
+		pars.frame4DBin[d] = bin;
+		pars.frame4DDims[d] = (stop - start) / bin;
+
+		binnedLabels[d].resize(pars.frame4DDims[d]);
+		for (auto i = 0; i < pars.frame4DDims[d]; i++)
+		{
+			PRISMATIC_FLOAT_PRECISION sum = 0;
+			for (auto k = 0; k < bin; k++) sum += qLabels[d]->at(qOffsets[d] + start + i * bin + k);
+			binnedLabels[d][i] = sum / bin;
+		}
+		data_dims[2 + d] = pars.frame4DDims[d];
+	}
+	qx_dim[0] = data_dims[2];
+	qy_dim[0] = data_dims[3];
+
 	H5::CompType complex_type = H5::CompType(sizeof(complex_float_t));
 	const H5std_string re_str("r"); //using h5py default configuration
 	const H5std_string im_str("i");
 	complex_type.insertMember(re_str, 0, PFP_TYPE);
 	complex_type.insertMember(im_str, 4, PFP_TYPE);
 
+	//quantized intensities are stored as integer levels with a scale and offset per pattern
+	std::shared_ptr<FrameQuantizer> quantizer = getQuantizer(pars);
+	H5::DataType frameType = quantizer ? H5::DataType(quantizer->getFileType()) : H5::DataType(PFP_TYPE);
+	size_t elementBytes = DatacubeWriter::getElementBytes(pars.meta.saveComplexOutputWave ? 2 : 1, quantizer.get());
+
 	for (auto n = 0; n < pars.numLayers; n++)
 	{
 		//create slice group
 		std::string nth_name = base_name + getDigitString(n) + pars.currentTag;
 		if(pars.meta.saveComplexOutputWave) nth_name += "_fp" + getDigitString(pars.meta.fpNum);
-		H5::Group CBED_slice_n(datacubes.createGroup(nth_name.c_str()));
+		H5::Group CBED_slice_n(counted ? countedDatacubes.createGroup(nth_name.c_str()) : datacubes.createGroup(nth_name.c_str()));
 
 		//write attributes
 		writeScalarAttribute(CBED_slice_n, "emd_group_type", 1);
 		writeScalarAttribute(CBED_slice_n, "metadata", 0);
 		writeScalarAttribute(CBED_slice_n, "output_depth", pars.depths[n]);
 		
-		//setup data set chunking properties
-		H5::DSetCreatPropList plist;
-		plist.setChunk(4, chunkDims);
+		//setup data set chunking and filter properties
+		H5::DSetCreatPropList plist = getOutputPropList(pars, 4, data_dims, elementBytes, chunkDims);
 
-		//create dataset
-		H5::DataSpace mspace(4, data_dims); //rank is 4
-		H5::DataSet CBED_data;
-		if(pars.meta.saveComplexOutputWave)
+		//counted output collects sparse events in memory, saveSTEM writes them once all frozen phonons are sampled
+		if(counted)
+		{
+			pars.countedDatacubes["4DSTEM_simulation/data/datacubes/" + nth_name] = std::make_shared<CountedDatacube>("4DSTEM_simulation/data/counted_datacubes/" + nth_name, pars.numXprobes, pars.numYprobes);
+			writeScalarAttribute(CBED_slice_n, "electrons_per_probe", pars.meta.countedElectrons);
+		}
+		//raw output keeps the datacube in a memory-mapped .npy file next to the output file; the group only holds the dims
+		else if(pars.meta.raw4DOutput)
 		{
-			CBED_data = CBED_slice_n.createDataSet("data", complex_type, mspace, plist);
+			std::string rawName = getShardPrefix(pars) + "_" + nth_name + ".npy";
+			std::vector<size_t> shape = {data_dims[0], data_dims[1], data_dims[2], data_dims[3]};
+			pars.rawDatacubes["4DSTEM_simulation/data/datacubes/" + nth_name] = std::make_shared<RawDatacube>(rawName, shape, pars.meta.saveComplexOutputWave);
+			writeScalarAttribute(CBED_slice_n, "raw_file", rawName.substr(rawName.find_last_of('/') + 1));
+		}
+		//sharded output stitches the shard files of the 4D writer blocks into one virtual dataset
+		else if(pars.meta.shard4DOutput)
+		{
+			pars.shardProps = plist;
+			plist = H5::DSetCreatPropList();
+			size_t frameBytes = data_dims[2]*data_dims[3]*elementBytes;
+			size_t blockX, blockY;
+			DatacubeWriter::getBlockShape(pars.numXprobes, pars.numYprobes, frameBytes, blockX, blockY);
+
+			H5::DataSpace vds_mspace(4, data_dims);
+			size_t numBlocksX = (pars.numXprobes + blockX - 1) / blockX;
+			for(size_t by = 0; by < pars.numYprobes; by += blockY)
+			{
+				for(size_t bx = 0; bx < pars.numXprobes; bx += blockX)
+				{
+					hsize_t offset[4] = {bx, by, 0, 0};
+					hsize_t block_dims[4] = {std::min(blockX, pars.numXprobes - bx), std::min(blockY, pars.numYprobes - by), data_dims[2], data_dims[3]};
+					H5::DataSpace src_mspace(4, block_dims);
+					std::string shardName = DatacubeWriter::getShardName(getShardPrefix(pars), nth_name, (by / blockY) * numBlocksX + bx / blockX);
+					vds_mspace.selectHyperslab(H5S_SELECT_SET, block_dims, offset);
+					plist.setVirtual(vds_mspace, shardName.substr(shardName.find_last_of('/') + 1), "/data", src_mspace);
+					src_mspace.close();
+				}
+			}
+			vds_mspace.selectAll();
+			if(pars.meta.saveComplexOutputWave)
+			{
+				CBED_slice_n.createDataSet("data", complex_type, vds_mspace, plist);
+			}
+			else
+			{
+				CBED_slice_n.createDataSet("data", frameType, vds_mspace, plist);
+			}
+			vds_mspace.close();
 		}
 		else
 		{
-			CBED_data = CBED_slice_n.createDataSet("data", PFP_TYPE, mspace, plist);
+			//create dataset
+			H5::DataSpace mspace(4, data_dims); //rank is 4
+			H5::DataSet CBED_data;
+			if(pars.meta.saveComplexOutputWave)
+			{
+				CBED_data = CBED_slice_n.createDataSet("data", complex_type, mspace, plist);
+			}
+			else
+			{
+				CBED_data = CBED_slice_n.createDataSet("data", frameType, mspace, plist);
+			}
+			mspace.close();
+		}
+
+		if(quantizer)
+		{
+			hsize_t probe_dims[2] = {data_dims[0], data_dims[1]};
+			H5::DataSpace pspace(2, probe_dims);
+			H5::DSetCreatPropList pplist = getOutputPropList(pars, 2, probe_dims, sizeof(PRISMATIC_FLOAT_PRECISION));
+			CBED_slice_n.createDataSet("scale", PFP_TYPE, pspace, pplist);
+			PRISMATIC_FLOAT_PRECISION zeroOffset = quantizer->getZeroOffset();
+			pplist.setFillValue(PFP_TYPE, &zeroOffset);
+			CBED_slice_n.createDataSet("offset", PFP_TYPE, pspace, pplist);
+			pspace.close();
+			writeScalarAttribute(CBED_slice_n, "quantization", quantizer->isLogScale() ? "log" : "linear");
+			if(quantizer->isLogScale()) writeScalarAttribute(CBED_slice_n, "log_floor", FrameQuantizer::logFloor);
 		}
-		mspace.close();
 
 		//write dimensions
 		H5::DataSpace str_name_ds(H5S_SCALAR);
@@ -185,8 +305,8 @@ void setup4DOutput(Parameters<PRISMATIC_FLOAT_PRECISION> &pars)
 
 		writeRealDataSet_inOrder(CBED_slice_n, "dim1", &pars.xp[0], rx_dim, 1);
 		writeRealDataSet_inOrder(CBED_slice_n, "dim2", &pars.yp[0], ry_dim, 1);
-		writeRealDataSet_inOrder(CBED_slice_n, "dim3", &qx[offset_qx], qx_dim, 1);
-		writeRealDataSet_inOrder(CBED_slice_n, "dim4", &qy[offset_qy], qy_dim, 1);
+		writeRealDataSet_inOrder(CBED_slice_n, "dim3", &binnedLabels[0][0], qx_dim, 1);
+		writeRealDataSet_inOrder(CBED_slice_n, "dim4", &binnedLabels[1][0], qy_dim, 1);
 
 		//dimension attributes
 		H5::DataSet dim1 = CBED_slice_n.openDataSet("dim1");
@@ -244,9 +364,10 @@ void setupVDOutput(Parameters<PRISMATIC_FLOAT_PRECISION> &pars)
 
 		//create datasets
 		H5::DataSpace mspace(3, data_dims); //rank is 2 for each realslice
+		H5::DSetCreatPropList plist = getOutputPropList(pars, 3, data_dims, sizeof(PRISMATIC_FLOAT_PRECISION));
 
 		H5::DataSet VD_data;
-		VD_slice_n.createDataSet("data", PFP_TYPE, mspace);
+		VD_slice_n.createDataSet("data", PFP_TYPE, mspace, plist);
 
 		VD_data.close();
 		mspace.close();
@@ -278,6 +399,68 @@ void setupVDOutput(Parameters<PRISMATIC_FLOAT_PRECISION> &pars)
 	realslices.close();
 };
 
+void setupCustomDetectorOutput(Parameters<PRISMATIC_FLOAT_PRECISION> &pars)
+{
+	H5::Group realslices = pars.outputFile.openGroup("4DSTEM_simulation/data/realslices");
+
+	//shared properties
+	std::string base_name = "custom_detector_depth";
+	hsize_t data_dims[3];
+	data_dims[0] = {pars.numXprobes};
+	data_dims[1] = {pars.numYprobes};
+	data_dims[2] = {pars.meta.detectors.size()};
+
+	hsize_t rx_dim[1] = {pars.xp.size()};
+	hsize_t ry_dim[1] = {pars.yp.size()};
+	hsize_t det_dim[1] = {pars.meta.detectors.size()};
+	std::vector<PRISMATIC_FLOAT_PRECISION> detectorIndex(pars.meta.detectors.size());
+	for (auto d = 0; d < detectorIndex.size(); d++) detectorIndex[d] = d;
+
+	for (auto n = 0; n < pars.numLayers; n++)
+	{
+		//create slice group
+		std::string nth_name = base_name + getDigitString(n) + pars.currentTag;
+		H5::Group det_slice_n(realslices.createGroup(nth_name.c_str()));
+
+		//write attributes
+		writeScalarAttribute(det_slice_n, "emd_group_type", 1);
+		writeScalarAttribute(det_slice_n, "metadata", 0);
+		writeScalarAttribute(det_slice_n, "output_depth", pars.depths[n]);
+		if(pars.meta.simSeries) writeScalarAttribute(det_slice_n, "output_defocus", pars.meta.probeDefocus);
+
+		//create dataset
+		H5::DataSpace mspace(3, data_dims);
+		H5::DSetCreatPropList plist = getOutputPropList(pars, 3, data_dims, sizeof(PRISMATIC_FLOAT_PRECISION));
+		det_slice_n.createDataSet("data", PFP_TYPE, mspace, plist);
+		mspace.close();
+
+		//write dimensions
+		writeRealDataSet_inOrder(det_slice_n, "dim1", &pars.xp[0], rx_dim, 1);
+		writeRealDataSet_inOrder(det_slice_n, "dim2", &pars.yp[0], ry_dim, 1);
+		writeRealDataSet_inOrder(det_slice_n, "dim3", &detectorIndex[0], det_dim, 1);
+
+		//dimension attribute
+		H5::DataSet dim1 = det_slice_n.openDataSet("dim1");
+		H5::DataSet dim2 = det_slice_n.openDataSet("dim2");
+		H5::DataSet dim3 = det_slice_n.openDataSet("dim3");
+
+		writeScalarAttribute(dim1, "name", "R_x");
+		writeScalarAttribute(dim2, "name", "R_y");
+		writeScalarAttribute(dim3, "name", "detector_index");
+
+		writeScalarAttribute(dim1, "units", "[Å]");
+		writeScalarAttribute(dim2, "units", "[Å]");
+		writeScalarAttribute(dim3, "units", "[n_unitless]");
+
+		dim1.close();
+		dim2.close();
+		dim3.close();
+		det_slice_n.close();
+	}
+
+	realslices.close();
+};
+
 void setup2DOutput(Parameters<PRISMATIC_FLOAT_PRECISION> &pars)
 {
 	H5::Group realslices = pars.outputFile.openGroup("4DSTEM_simulation/data/realslices");
@@ -306,8 +489,9 @@ void setup2DOutput(Parameters<PRISMATIC_FLOAT_PRECISION> &pars)
 
 		//create dataset
 		H5::DataSpace mspace(2, data_dims); //rank is 2
+		H5::DSetCreatPropList plist = getOutputPropList(pars, 2, data_dims, sizeof(PRISMATIC_FLOAT_PRECISION));
 		H5::DataSet annular_data;
-		annular_data = annular_slice_n.createDataSet("data", PFP_TYPE, mspace);
+		annular_data = annular_slice_n.createDataSet("data", PFP_TYPE, mspace, plist);
 		mspace.close();
 
 		//write dimensions
@@ -362,7 +546,8 @@ void setupDPCOutput(Parameters<PRISMATIC_FLOAT_PRECISION> &pars)
 
 		//create dataset
 		H5::DataSpace mspace(3, data_dims); //rank is 3
-		H5::DataSet DPC_data = DPC_CoM_slice_n.createDataSet("data", PFP_TYPE, mspace);
+		H5::DSetCreatPropList plist = getOutputPropList(pars, 3, data_dims, sizeof(PRISMATIC_FLOAT_PRECISION));
+		H5::DataSet DPC_data = DPC_CoM_slice_n.createDataSet("data", PFP_TYPE, mspace, plist);
 		mspace.close();
 
 		//write dimensions
@@ -424,7 +609,8 @@ void setupSMatrixOutput(Parameters<PRISMATIC_FLOAT_PRECISION> &pars, const int F
 
 	//create datasets
 	H5::DataSpace mspace(3, data_dims); //rank is 2 for each realslice
-	H5::DataSet smatrix_data = smatrix_group.createDataSet("data", complex_type, mspace);
+	H5::DSetCreatPropList plist = getOutputPropList(pars, 3, data_dims, sizeof(complex_float_t));
+	H5::DataSet smatrix_data = smatrix_group.createDataSet("data", complex_type, mspace, plist);
 	smatrix_data.close();
 	mspace.close();
 
@@ -436,6 +622,13 @@ void setupSMatrixOutput(Parameters<PRISMATIC_FLOAT_PRECISION> &pars, const int F
 
 	std::vector<PRISMATIC_FLOAT_PRECISION> beamsIndex(pars.numberBeams); //convert to float
 	for(auto i = 0; i < pars.numberBeams; i++) beamsIndex.push_back(pars.beamsIndex[i]);
+	if(pars.sMatrixCompressed)
+	{
+		//third dimension indexes the low-rank basis instead of the beams
+		beams[0] = pars.Scompact.get_dimk();
+		beamsIndex.resize(beams[0]);
+		for(auto i = 0; i < beams[0]; i++) beamsIndex[i] = i;
+	}
 
 	writeRealDataSet_inOrder(smatrix_group, "dim1", &x_dim_data[0], x_size, 1);
 	writeRealDataSet_inOrder(smatrix_group, "dim2", &y_dim_data[0], y_size, 1);
@@ -448,7 +641,7 @@ void setupSMatrixOutput(Parameters<PRISMATIC_FLOAT_PRECISION> &pars, const int F
 
 	writeScalarAttribute(dim1, "name", "R_x");
 	writeScalarAttribute(dim2, "name", "R_y");
-	writeScalarAttribute(dim3, "name", "beam_number");
+	writeScalarAttribute(dim3, "name", pars.sMatrixCompressed ? "basis_number" : "beam_number");
 
 	writeScalarAttribute(dim1, "units", "[Å]");
 	writeScalarAttribute(dim2, "units", "[Å]");
@@ -490,11 +683,13 @@ void setupHRTEMOutput(Parameters<PRISMATIC_FLOAT_PRECISION> &pars)
 	H5::DataSet hrtem_data;
 	if(pars.meta.saveComplexOutputWave)
 	{
-		hrtem_data = hrtem_group.createDataSet("data", complex_type, mspace);
+		H5::DSetCreatPropList plist = getOutputPropList(pars, 3, data_dims, sizeof(complex_float_t));
+		hrtem_data = hrtem_group.createDataSet("data", complex_type, mspace, plist);
 	}
 	else
 	{
-		hrtem_data = hrtem_group.createDataSet("data", PFP_TYPE, mspace);
+		H5::DSetCreatPropList plist = getOutputPropList(pars, 3, data_dims, sizeof(PRISMATIC_FLOAT_PRECISION));
+		hrtem_data = hrtem_group.createDataSet("data", PFP_TYPE, mspace, plist);
 	}
 	
 	hrtem_data.close();
@@ -745,6 +940,70 @@ void setupProbeOutput(Parameters<PRISMATIC_FLOAT_PRECISION> &pars)
 	dslices.close();
 };
 
+H5::DSetCreatPropList getOutputPropList(Parameters<PRISMATIC_FLOAT_PRECISION> &pars,
+										const int rank,
+										const hsize_t *dims,
+										const size_t elementBytes,
+										const hsize_t *chunkDims)
+{
+	//largest chunk handed to the filters; bigger chunks are split along the leading (scan) axes first
+	static const size_t maxChunkBytes = 16 * 1024 * 1024;
+
+	H5::DSetCreatPropList plist;
+	if(chunkDims == NULL && pars.meta.outputFilter == OutputFilter::None) return plist;
+
+	std::vector<hsize_t> chunk(rank);
+	size_t chunkBytes = elementBytes;
+	for(auto i = 0; i < rank; i++)
+	{
+		//0 spans the whole axis, and chunks can not exceed a fixed size dataset
+		chunk[i] = (chunkDims == NULL || chunkDims[i] == 0) ? dims[i] : std::min(chunkDims[i], dims[i]);
+		chunk[i] = std::max(chunk[i], (hsize_t) 1);
+		chunkBytes *= chunk[i];
+	}
+	for(auto i = 0; i < rank && chunkBytes > maxChunkBytes; i++)
+	{
+		while(chunk[i] > 1 && chunkBytes > maxChunkBytes)
+		{
+			chunkBytes = chunkBytes / chunk[i] * ((chunk[i] + 1) / 2);
+			chunk[i] = (chunk[i] + 1) / 2;
+		}
+	}
+	plist.setChunk(rank, &chunk[0]);
+
+	if(pars.meta.outputFilter == OutputFilter::None) return plist;
+	if(pars.meta.outputShuffle) plist.setShuffle();
+
+	//lz4 and zstd come from the HDF5 filter plugins when they can be found on HDF5_PLUGIN_PATH
+	static const H5Z_filter_t lz4Filter = 32004;
+	static const H5Z_filter_t zstdFilter = 32015;
+	H5Z_filter_t pluginFilter = (pars.meta.outputFilter == OutputFilter::LZ4) ? lz4Filter : zstdFilter;
+	if(pars.meta.outputFilter != OutputFilter::Deflate && H5Zfilter_avail(pluginFilter) > 0)
+	{
+		if(pluginFilter == zstdFilter)
+		{
+			unsigned int level = pars.meta.outputFilterLevel;
+			plist.setFilter(zstdFilter, H5Z_FLAG_OPTIONAL, 1, &level);
+		}
+		else
+		{
+			plist.setFilter(lz4Filter, H5Z_FLAG_OPTIONAL, 0, NULL);
+		}
+	}
+	else
+	{
+		static bool warned = false;
+		if(pars.meta.outputFilter != OutputFilter::Deflate && !warned)
+		{
+			std::cout << "Warning: HDF5 filter plugin " << pluginFilter << " not found, compressing output with deflate instead" << std::endl;
+			warned = true;
+		}
+		int level = (pars.meta.outputFilter == OutputFilter::LZ4) ? 1 : pars.meta.outputFilterLevel;
+		plist.setDeflate(std::min(std::max(level, 0), 9));
+	}
+	return plist;
+};
+
 //these write functions will soon be deprecated
 void writeRealSlice(H5::DataSet dataset, const PRISMATIC_FLOAT_PRECISION *buffer, const hsize_t *mdims)
 {
@@ -861,7 +1120,8 @@ void savePotentialSlices(Parameters<PRISMATIC_FLOAT_PRECISION> &pars)
 		}
 	}
 	
-	writeRealDataSet_inOrder(ppotential, "data", &tmp[0], dataDims, 3);
+	H5::DSetCreatPropList plist = getOutputPropList(pars, 3, dataDims, sizeof(PRISMATIC_FLOAT_PRECISION));
+	writeRealDataSet_inOrder(ppotential, "data", &tmp[0], dataDims, 3, plist);
 
 	dim1.close();
 	dim2.close();
@@ -904,9 +1164,46 @@ void saveHRTEM(Parameters<PRISMATIC_FLOAT_PRECISION> &pars,
 	hrtem_group.close();
 }
 
+static void writeEventDataSet(Parameters<PRISMATIC_FLOAT_PRECISION> &pars,
+							  H5::Group &group,
+							  const std::string &name,
+							  const void *data,
+							  const hsize_t length,
+							  const H5::PredType &type)
+{
+	hsize_t dims[1] = {length};
+	H5::DataSpace mspace(1, dims);
+	H5::DSetCreatPropList plist = (length > 0) ? getOutputPropList(pars, 1, dims, type.getSize()) : H5::DSetCreatPropList();
+	H5::DataSet dataset = group.createDataSet(name.c_str(), type, mspace, plist);
+	if(length > 0) dataset.write(data, type);
+	dataset.close();
+	mspace.close();
+};
+
+void saveCounted4D(Parameters<PRISMATIC_FLOAT_PRECISION> &pars)
+{
+	//events are stored flat in scan order, frame_offsets[p] to frame_offsets[p+1] are the events of probe p = ax*Ry + ay
+	for(auto &cube : pars.countedDatacubes)
+	{
+		std::vector<uint64_t> offsets;
+		std::vector<uint32_t> indices;
+		std::vector<uint32_t> counts;
+		cube.second->getEvents(offsets, indices, counts);
+
+		H5::Group group = pars.outputFile.openGroup(cube.second->getGroupPath());
+		writeEventDataSet(pars, group, "frame_offsets", &offsets[0], offsets.size(), H5::PredType::NATIVE_UINT64);
+		writeEventDataSet(pars, group, "pixel_index", indices.size() ? &indices[0] : NULL, indices.size(), H5::PredType::NATIVE_UINT32);
+		writeEventDataSet(pars, group, "counts", counts.size() ? &counts[0] : NULL, counts.size(), H5::PredType::NATIVE_UINT32);
+		group.close();
+	}
+	pars.countedDatacubes.clear();
+};
+
 void saveSTEM(Parameters<PRISMATIC_FLOAT_PRECISION> &pars)
 {
 	pars.outputFile = H5::H5File(pars.meta.filenameOutput.c_str(), H5F_ACC_RDWR);
+	if (pars.countedDatacubes.size() > 0) saveCounted4D(pars);
+
 	if (pars.meta.save3DOutput)
 	{
 		setupVDOutput(pars);
@@ -920,8 +1217,8 @@ void saveSTEM(Parameters<PRISMATIC_FLOAT_PRECISION> &pars)
 			nameString = nameString + pars.currentTag;
 			H5::Group dataGroup = pars.outputFile.openGroup(nameString);
 			//manual restride is faster
-			Array3D<PRISMATIC_FLOAT_PRECISION> tmp_array = zeros_ND<3, PRISMATIC_FLOAT_PRECISION>({{pars.net_output.get_dimj(), pars.net_output.get_dimk(), pars.net_output.get_dimi()}});
-			for(auto ii = 0; ii < pars.net_output.get_dimi(); ii++) //over detector
+			Array3D<PRISMATIC_FLOAT_PRECISION> tmp_array = zeros_ND<3, PRISMATIC_FLOAT_PRECISION>({{pars.net_output.get_dimj(), pars.net_output.get_dimk(), pars.Ndet}});
+			for(auto ii = 0; ii < pars.Ndet; ii++) //over detector
 			{
 				for(auto jj = 0; jj < pars.net_output.get_dimj(); jj++) //over x
 				{
@@ -967,6 +1264,34 @@ void saveSTEM(Parameters<PRISMATIC_FLOAT_PRECISION> &pars)
 		}
 	}
 
+	if (pars.meta.detectors.size() > 0)
+	{
+		//custom detectors are stored in the output stack after the annular bins
+		setupCustomDetectorOutput(pars);
+		const size_t numCustom = pars.meta.detectors.size();
+		hsize_t mdims[3] = {pars.numXprobes, pars.numYprobes, numCustom};
+		for (auto j = 0; j < pars.numLayers; j++)
+		{
+			std::string nameString = "4DSTEM_simulation/data/realslices/custom_detector_depth" + getDigitString(j);
+			nameString += pars.currentTag;
+			H5::Group dataGroup = pars.outputFile.openGroup(nameString.c_str());
+
+			Array3D<PRISMATIC_FLOAT_PRECISION> tmp_array = zeros_ND<3, PRISMATIC_FLOAT_PRECISION>({{pars.net_output.get_dimj(), pars.net_output.get_dimk(), numCustom}});
+			for(auto ii = 0; ii < numCustom; ii++) //over detector
+			{
+				for(auto jj = 0; jj < pars.net_output.get_dimj(); jj++) //over x
+				{
+					for(auto kk = 0; kk < pars.net_output.get_dimk(); kk++) //over y
+					{
+						tmp_array.at(jj,kk,ii) = pars.net_output.at(j,kk,jj,pars.Ndet+ii);
+					}
+				}
+			}
+			writeRealDataSet_inOrder(dataGroup, "data", &tmp_array[0], mdims, 3);
+			dataGroup.close();
+		}
+	}
+
 	if (pars.meta.saveDPC_CoM)
 	{
 		setupDPCOutput(pars);
@@ -996,6 +1321,41 @@ void saveSTEM(Parameters<PRISMATIC_FLOAT_PRECISION> &pars)
 	pars.outputFile.close();
 };
 
+void rescale4DOutput(Parameters<PRISMATIC_FLOAT_PRECISION> &pars, const PRISMATIC_FLOAT_PRECISION factor)
+{
+	//datacubes are rescaled one probe row at a time so that only a slab is held in memory
+	H5::H5File file(pars.meta.filenameOutput.c_str(), H5F_ACC_RDWR);
+	H5::Group datacubes = file.openGroup("4DSTEM_simulation/data/datacubes");
+	for (auto i = 0; i < datacubes.getNumObjs(); i++)
+	{
+		std::string name = datacubes.getObjnameByIdx(i);
+		if (name.find("CBED_array_depth") != 0) continue;
+
+		H5::Group dataGroup = datacubes.openGroup(name);
+		H5::DataSet dataset = dataGroup.openDataSet("data");
+		H5::DataSpace fspace = dataset.getSpace();
+		hsize_t dims[4];
+		fspace.getSimpleExtentDims(dims);
+		hsize_t mdims[4] = {1, dims[1], dims[2], dims[3]};
+		H5::DataSpace mspace(4, mdims);
+		std::vector<PRISMATIC_FLOAT_PRECISION> slab(dims[1] * dims[2] * dims[3]);
+		for (hsize_t x = 0; x < dims[0]; x++)
+		{
+			hsize_t offset[4] = {x, 0, 0, 0};
+			fspace.selectHyperslab(H5S_SELECT_SET, mdims, offset);
+			dataset.read(&slab[0], PFP_TYPE, mspace, fspace);
+			for (auto &v : slab) v *= factor;
+			dataset.write(&slab[0], PFP_TYPE, mspace, fspace);
+		}
+		mspace.close();
+		fspace.close();
+		dataset.close();
+		dataGroup.close();
+	}
+	datacubes.close();
+	file.close();
+};
+
 void save_qArr(Parameters<PRISMATIC_FLOAT_PRECISION> &pars)
 {
 	//create group and write data all at once
@@ -1247,6 +1607,13 @@ void writeMetadata(Parameters<PRISMATIC_FLOAT_PRECISION> &pars)
 	writeScalarAttribute(sim_params, "fx", (int) pars.meta.interpolationFactorX);
 	writeScalarAttribute(sim_params, "fy", (int) pars.meta.interpolationFactorY);
 	writeScalarAttribute(sim_params, "F", (int) pars.meta.numFP);
+	writeScalarAttribute(sim_params, "cFP", (int) pars.meta.concurrentFP);
+	writeScalarAttribute(sim_params, "pp", (int) pars.meta.pipelineThreads);
+	writeScalarAttribute(sim_params, "rp", (int) pars.meta.reusePlan);
+	writeScalarAttribute(sim_params, "mfp", (int) pars.meta.minFP);
+	writeScalarAttribute(sim_params, "feo", (int) pars.meta.convergenceOutput);
+	writeScalarAttribute(sim_params, "cpi", (int) pars.meta.checkpointInterval);
+	writeScalarAttribute(sim_params, "stl", (int) pars.meta.scanTiles);
 	writeScalarAttribute(sim_params, "ns", (int) pars.meta.numSlices);
 	writeScalarAttribute(sim_params, "3DPZ", (int) pars.meta.zSampling);
 
@@ -1256,6 +1623,26 @@ void writeMetadata(Parameters<PRISMATIC_FLOAT_PRECISION> &pars)
 	writeScalarAttribute(sim_params, "3D", (int) pars.meta.save3DOutput);
 	writeScalarAttribute(sim_params, "4D", (int) pars.meta.save4DOutput);
 	writeScalarAttribute(sim_params, "4DC", (int) pars.meta.crop4DOutput);
+	writeScalarAttribute(sim_params, "4DS", (int) pars.meta.shard4DOutput);
+	writeScalarAttribute(sim_params, "4DR", (int) pars.meta.raw4DOutput);
+	writeScalarAttribute(sim_params, "4DE", pars.meta.countedElectrons);
+	writeScalarAttribute(sim_params, "tfe", pars.meta.targetFPError);
+	writeScalarAttribute(sim_params, "4DP", (int) pars.meta.precision4D);
+	writeScalarAttribute(sim_params, "4DL", (int) pars.meta.logQuantize4D);
+	int binBuffer[2] = {(int)pars.meta.bin4D[0], (int)pars.meta.bin4D[1]};
+	hsize_t binDims[1] = {2};
+	H5::DataSpace bin_dataspace(1, binDims);
+	H5::Attribute bin_attr = sim_params.createAttribute("4DB", H5::PredType::NATIVE_INT, bin_dataspace);
+	bin_attr.write(H5::PredType::NATIVE_INT, binBuffer);
+	if (pars.meta.window4DOutput)
+	{
+		hsize_t windowDims[1] = {4};
+		H5::DataSpace window_dataspace(1, windowDims);
+		H5::Attribute window_attr = sim_params.createAttribute("4DW", PFP_TYPE, window_dataspace);
+		PRISMATIC_FLOAT_PRECISION windowBuffer[4];
+		for (auto i = 0; i < 4; i++) windowBuffer[i] = pars.meta.window4D[i] * 1000;
+		window_attr.write(PFP_TYPE, windowBuffer);
+	}
 	writeScalarAttribute(sim_params, "DPC", (int) pars.meta.saveDPC_CoM);
 	writeScalarAttribute(sim_params, "ps", (int) pars.meta.savePotentialSlices);
 	writeScalarAttribute(sim_params, "sm", (int) pars.meta.saveSMatrix);
@@ -1266,6 +1653,9 @@ void writeMetadata(Parameters<PRISMATIC_FLOAT_PRECISION> &pars)
 	writeScalarAttribute(sim_params, "ism", (int) pars.meta.importSMatrix);
 	writeScalarAttribute(sim_params, "probe", (int) pars.meta.saveProbe);
 	writeScalarAttribute(sim_params, "mrf", (int) pars.meta.matrixRefocus);
+	writeScalarAttribute(sim_params, "csm", (int) pars.meta.compressSMatrix);
+	writeScalarAttribute(sim_params, "sml", (int) pars.meta.sMatrixLayout);
+	writeScalarAttribute(sim_params, "smh", (int) pars.meta.sMatrixHalo);
 	writeScalarAttribute(sim_params, "abs", (int) pars.meta.arbitraryAberrations);
 	writeScalarAttribute(sim_params, "C", (int) pars.meta.alsoDoCPUWork);
 
@@ -1294,6 +1684,7 @@ void writeMetadata(Parameters<PRISMATIC_FLOAT_PRECISION> &pars)
 	writeScalarAttribute(sim_params, "ty", pars.meta.probeYtilt * 1000);
 	writeScalarAttribute(sim_params, "rs", pars.meta.randomSeed);
 	writeScalarAttribute(sim_params, "4DA", pars.meta.crop4Damax * 1000);
+	writeScalarAttribute(sim_params, "csmt", pars.meta.sMatrixRankTol);
 
 	writeScalarAttribute(sim_params, "lambda", pars.lambda);
 	writeScalarAttribute(sim_params, "eff_pixel_size_x", pars.pixelSize[1]* (PRISMATIC_FLOAT_PRECISION) 2.0);
@@ -1408,8 +1799,19 @@ void writeMetadata(Parameters<PRISMATIC_FLOAT_PRECISION> &pars)
 		ab_attr.write(ab_type, &pars.meta.aberrations[0]);
 	}
 
+	//custom detectors, stored as rows of inner, outer, min phi, max phi in radians
+	writeScalarAttribute(sim_params, "ndet_custom", (int) pars.meta.detectors.size());
+	if(pars.meta.detectors.size() > 0)
+	{
+		hsize_t dim[2] = {pars.meta.detectors.size(), 4};
+		H5::DataSpace mspace(2,dim);
+		H5::Attribute det_attr = sim_params.createAttribute("custom_det", PFP_TYPE, mspace);
+		det_attr.write(PFP_TYPE, &pars.meta.detectors[0]);
+	}
+
 	//series vals
 	writeScalarAttribute(sim_params, "simseries", (int) pars.meta.simSeries);
+	writeScalarAttribute(sim_params, "ssp", (int) pars.meta.seriesSinglePass);
 	if(pars.meta.simSeries)
 	{
 		//series vals will be NxM vector of vectors
@@ -1432,6 +1834,8 @@ void writeMetadata(Parameters<PRISMATIC_FLOAT_PRECISION> &pars)
 
 
 	metadata.close();
+
+	if(pars.rawDatacubes.size() > 0) writeRawSidecar(pars);
 };
 
 Array2D<PRISMATIC_FLOAT_PRECISION> readDataSet2D(const std::string &filename, const std::string &dataPath)
@@ -1740,7 +2144,8 @@ void writeRealDataSet_inOrder(H5::Group group,
 						const std::string &dsetname,
 						const PRISMATIC_FLOAT_PRECISION *buffer,
 						const hsize_t *mdims,
-						const size_t &rank)
+						const size_t &rank,
+						const H5::DSetCreatPropList &plist)
 {
 	//create dataset and write
 	H5::DataSpace mspace(rank, mdims);
@@ -1752,7 +2157,7 @@ void writeRealDataSet_inOrder(H5::Group group,
 	}
 	else
 	{
-		real_dset = group.createDataSet(dsetname.c_str(), PFP_TYPE, mspace);
+		real_dset = group.createDataSet(dsetname.c_str(), PFP_TYPE, mspace, plist);
 	}		
 	
 	H5::DataSpace fspace = real_dset.getSpace();
@@ -2203,18 +2608,188 @@ hsize_t* restrideElements_subset(std::vector<size_t> &dims, std::vector<size_t>
 	return coords;	
 };
 
+std::shared_ptr<FrameQuantizer> getQuantizer(Parameters<PRISMATIC_FLOAT_PRECISION> &pars)
+{
+	//complex waves, electron counts and raw datacubes keep their own element types
+	if(pars.meta.precision4D == OutputPrecision::Float || pars.meta.saveComplexOutputWave ||
+	   pars.meta.countedElectrons > 0 || pars.meta.raw4DOutput) return nullptr;
+	return std::make_shared<FrameQuantizer>(pars.meta.precision4D == OutputPrecision::UInt8 ? 8 : 16, pars.meta.logQuantize4D);
+};
+
+std::string getShardPrefix(Parameters<PRISMATIC_FLOAT_PRECISION> &pars)
+{
+	//shard files sit next to the output file and share its name
+	std::string prefix = pars.meta.filenameOutput;
+	size_t ext = prefix.find_last_of('.');
+	if(ext != std::string::npos && ext > prefix.find_last_of('/') + 1) prefix = prefix.substr(0, ext);
+	return prefix;
+};
+
+static std::string jsonString(const std::string &str)
+{
+	std::stringstream out;
+	out << '"';
+	for (auto c : str.substr(0, str.find('\0')))
+	{
+		if (c == '"' || c == '\\') out << '\\' << c;
+		else if ((unsigned char) c < 0x20) out << "\\u" << std::hex << std::setw(4) << std::setfill('0') << (int) c << std::dec;
+		else out << c;
+	}
+	out << '"';
+	return out.str();
+};
+
+static void writeJsonValues(std::ostream &out, const std::vector<double> &values, const bool scalar)
+{
+	if (!scalar) out << '[';
+	for (auto i = 0; i < values.size(); i++)
+	{
+		if (i > 0) out << ", ";
+		if (std::isfinite(values[i])) out << values[i];
+		else out << "null";
+	}
+	if (!scalar) out << ']';
+};
+
+static void writeJsonAttribute(std::ostream &out, H5::Attribute &attr)
+{
+	//numbers and strings are written as they are, compound attributes as one list per member
+	H5::DataSpace space = attr.getSpace();
+	size_t numValues = space.getSimpleExtentNpoints();
+	bool scalar = space.getSimpleExtentNdims() == 0;
+	H5T_class_t typeClass = attr.getTypeClass();
+	if (typeClass == H5T_STRING)
+	{
+		std::string str;
+		attr.read(attr.getStrType(), str);
+		out << jsonString(str);
+	}
+	else if (typeClass == H5T_INTEGER || typeClass == H5T_FLOAT)
+	{
+		std::vector<double> values(numValues);
+		attr.read(H5::PredType::NATIVE_DOUBLE, &values[0]);
+		writeJsonValues(out, values, scalar);
+	}
+	else if (typeClass == H5T_COMPOUND)
+	{
+		H5::CompType fileType = attr.getCompType();
+		out << '{';
+		for (auto m = 0; m < fileType.getNmembers(); m++)
+		{
+			H5::CompType memberType(sizeof(double));
+			memberType.insertMember(fileType.getMemberName(m), 0, H5::PredType::NATIVE_DOUBLE);
+			std::vector<double> values(numValues);
+			attr.read(memberType, &values[0]);
+			out << (m > 0 ? ", " : "") << jsonString(fileType.getMemberName(m)) << ": ";
+			writeJsonValues(out, values, scalar);
+		}
+		out << '}';
+	}
+	else
+	{
+		out << "null";
+	}
+};
+
+void writeRawSidecar(Parameters<PRISMATIC_FLOAT_PRECISION> &pars)
+{
+	//the sidecar lists the raw datacubes and repeats the simulation parameters of the output file
+	std::string outputName = pars.meta.filenameOutput.substr(pars.meta.filenameOutput.find_last_of('/') + 1);
+	std::ofstream sidecar(getShardPrefix(pars) + ".json");
+	sidecar << std::setprecision(std::numeric_limits<double>::max_digits10);
+	sidecar << "{\n  \"format\": \"prismatic_raw4D\",\n  \"version\": 1,\n";
+	sidecar << "  \"output_file\": " << jsonString(outputName) << ",\n";
+	sidecar << "  \"datacubes\": [";
+	size_t n = 0;
+	for (auto &raw : pars.rawDatacubes)
+	{
+		raw.second->flush();
+		std::string rawFile = raw.second->getFilename();
+		const std::vector<size_t> &shape = raw.second->getShape();
+		sidecar << (n++ > 0 ? ",\n" : "\n") << "    {\"group\": " << jsonString(raw.first)
+				<< ", \"file\": " << jsonString(rawFile.substr(rawFile.find_last_of('/') + 1))
+				<< ", \"dtype\": " << jsonString(raw.second->getDescr())
+				<< ", \"shape\": [" << shape[0] << ", " << shape[1] << ", " << shape[2] << ", " << shape[3] << "]}";
+	}
+	sidecar << "\n  ],\n  \"simulation_parameters\": {";
+
+	H5::Group sim_params = pars.outputFile.openGroup("4DSTEM_simulation/metadata/metadata_0/original/simulation_parameters");
+	for (auto i = 0; i < sim_params.getNumAttrs(); i++)
+	{
+		H5::Attribute attr = sim_params.openAttribute((unsigned int) i);
+		sidecar << (i > 0 ? ",\n" : "\n") << "    " << jsonString(attr.getName()) << ": ";
+		writeJsonAttribute(sidecar, attr);
+		attr.close();
+	}
+	sim_params.close();
+	sidecar << "\n  }\n}\n";
+	sidecar.close();
+
+	//unmap the datacubes, the run is finished with them
+	pars.rawDatacubes.clear();
+};
+
+void startDatacubeWriter(Parameters<PRISMATIC_FLOAT_PRECISION> &pars)
+{
+	//raw datacubes are written in place by the workers
+	if(pars.meta.raw4DOutput) return;
+
+	//complex output waves get a fresh dataset per frozen phonon, intensities are summed into the first one
+	bool addToFile = (pars.fpFlag > 0) && !pars.meta.saveComplexOutputWave;
+	std::string shardPrefix = pars.meta.shard4DOutput ? getShardPrefix(pars) : "";
+	std::lock_guard<std::mutex> fileGatekeeper(DatacubeWriter::fileLock);
+	pars.cbedWriter = std::make_shared<DatacubeWriter>(pars.outputFile, pars.numXprobes, pars.numYprobes, addToFile, shardPrefix, pars.shardProps, getQuantizer(pars));
+};
+
+void finishDatacubeWriter(Parameters<PRISMATIC_FLOAT_PRECISION> &pars)
+{
+	for(auto &raw : pars.rawDatacubes) raw.second->flush();
+	if(!pars.cbedWriter) return;
+
+	std::shared_ptr<DatacubeWriter> writer = pars.cbedWriter;
+	pars.cbedWriter.reset();
+	writer->finish();
+
+	//the writer holds references to the output file
+	std::lock_guard<std::mutex> fileGatekeeper(DatacubeWriter::fileLock);
+	writer.reset();
+};
+
 void createScratchFile(Parameters<PRISMATIC_FLOAT_PRECISION> &pars)
 {
+	//series outputs are accumulated in memory when all of them fit the budget, otherwise in a scratch file
+	size_t seriesElems = pars.output.size();
+	if(pars.meta.saveDPC_CoM) seriesElems += pars.DPC_CoM.size();
+	seriesElems *= pars.meta.seriesTags.size();
+	pars.seriesInMemory = seriesElems*sizeof(PRISMATIC_FLOAT_PRECISION) <= pars.meta.seriesMemory;
+	if(pars.seriesInMemory)
+	{
+		std::cout << "Accumulating series outputs in memory" << std::endl;
+		for(auto i = 0; i < pars.meta.seriesTags.size(); i++)
+		{
+			pars.seriesOutput[pars.meta.seriesTags[i]] = zeros_ND<4, PRISMATIC_FLOAT_PRECISION>({{pars.output.get_diml(), pars.output.get_dimk(), pars.output.get_dimj(), pars.output.get_dimi()}});
+			if(pars.meta.saveDPC_CoM)
+				pars.seriesOutput[pars.meta.seriesTags[i]+"_DPC"] = zeros_ND<4, PRISMATIC_FLOAT_PRECISION>({{pars.DPC_CoM.get_diml(), pars.DPC_CoM.get_dimk(), pars.DPC_CoM.get_dimj(), pars.DPC_CoM.get_dimi()}});
+		}
+		return;
+	}
+
 	//TODO: decide home directory for windows
-	pars.scratchFile = H5::H5File("prismatic_scratch.h5", H5F_ACC_TRUNC);
+	pars.scratchFilename = pars.meta.scratchDirectory;
+	if(!pars.scratchFilename.empty() && pars.scratchFilename.back() != '/') pars.scratchFilename += "/";
+	pars.scratchFilename += "prismatic_scratch.h5";
+	std::cout << "Series outputs exceed the series memory budget, accumulating them in " << pars.scratchFilename << std::endl;
+	pars.scratchFile = H5::H5File(pars.scratchFilename.c_str(), H5F_ACC_TRUNC);
 	H5::Group scratchGroup = pars.scratchFile.createGroup("scratch");
 
-	//initialize datasets
+	//initialize datasets, chunked in bands of scan rows so that each update touches whole chunks
 	hsize_t mdims[4] = {pars.output.get_diml(), pars.output.get_dimk(), pars.output.get_dimj(), pars.output.get_dimi()};
 	H5::DataSpace mspace(4,mdims);
+	H5::DSetCreatPropList plist;
+	plist.setChunk(4, getScratchChunk(mdims).data());
 	for(auto i = 0; i < pars.meta.seriesTags.size(); i++)
 	{
-		scratchGroup.createDataSet(pars.meta.seriesTags[i].c_str(), PFP_TYPE, mspace);
+		scratchGroup.createDataSet(pars.meta.seriesTags[i].c_str(), PFP_TYPE, mspace, plist);
 			
 	}
 
@@ -2222,10 +2797,12 @@ void createScratchFile(Parameters<PRISMATIC_FLOAT_PRECISION> &pars)
 	{
 		hsize_t mdims_dpc[4] = {pars.DPC_CoM.get_diml(), pars.DPC_CoM.get_dimk(), pars.DPC_CoM.get_dimj(), pars.DPC_CoM.get_dimi()};
 		H5::DataSpace mspace_dpc(4,mdims_dpc);
+		H5::DSetCreatPropList plist_dpc;
+		plist_dpc.setChunk(4, getScratchChunk(mdims_dpc).data());
 		for(auto i = 0; i < pars.meta.seriesTags.size(); i++)
 		{
 			std::string current_name = pars.meta.seriesTags[i]+"_DPC";
-			scratchGroup.createDataSet(current_name.c_str(), PFP_TYPE, mspace_dpc);
+			scratchGroup.createDataSet(current_name.c_str(), PFP_TYPE, mspace_dpc, plist_dpc);
 				
 		}
 	}
@@ -2234,48 +2811,118 @@ void createScratchFile(Parameters<PRISMATIC_FLOAT_PRECISION> &pars)
 
 void removeScratchFile(Parameters<PRISMATIC_FLOAT_PRECISION> &pars)
 {
-	//TODO: make better decision about where scratch file is written
-	// and save name as a member of pars
+	if(pars.seriesInMemory)
+	{
+		pars.seriesOutput.clear();
+		return;
+	}
+
 	pars.scratchFile.close();
-	if( remove( "prismatic_scratch.h5" ) != 0 )
+	if( remove( pars.scratchFilename.c_str() ) != 0 )
         perror( "Error deleting scratch file" );
     else
         puts( "Scratch file successfully deleted" );
 };
 
+std::array<hsize_t, 4> getScratchChunk(const hsize_t *dims)
+{
+	//target size of one scratch chunk; a chunk always holds at least one scan row
+	static const size_t targetChunkBytes = 4 * 1024 * 1024;
+	size_t rowBytes = dims[2]*dims[3]*sizeof(PRISMATIC_FLOAT_PRECISION);
+	hsize_t rows = std::max((size_t) 1, std::min((size_t) dims[1], targetChunkBytes / std::max(rowBytes, (size_t) 1)));
+	return std::array<hsize_t, 4>{{1, rows, dims[2], dims[3]}};
+};
+
+void updateScratchDataSet(H5::DataSet &dataset, Array4D<PRISMATIC_FLOAT_PRECISION> &data, const bool addToStored)
+{
+	//add the new output one chunk at a time, so no more than a chunk of the stored sum is ever in memory
+	hsize_t dims[4] = {data.get_diml(), data.get_dimk(), data.get_dimj(), data.get_dimi()};
+	std::array<hsize_t, 4> chunk = getScratchChunk(dims);
+	H5::DataSpace fspace = dataset.getSpace();
+	std::vector<PRISMATIC_FLOAT_PRECISION> stored;
+	size_t rowSize = dims[2]*dims[3];
+	for(hsize_t l = 0; l < dims[0]; l++)
+	{
+		for(hsize_t k = 0; k < dims[1]; k += chunk[1])
+		{
+			hsize_t offset[4] = {l, k, 0, 0};
+			hsize_t count[4] = {1, std::min(chunk[1], dims[1] - k), dims[2], dims[3]};
+			fspace.selectHyperslab(H5S_SELECT_SET, count, offset);
+			PRISMATIC_FLOAT_PRECISION *block = &data[(l*dims[1] + k)*rowSize];
+			H5::DataSpace mspace(4, count);
+			if(addToStored)
+			{
+				stored.resize(count[1]*rowSize);
+				dataset.read(&stored[0], PFP_TYPE, mspace, fspace);
+				for(auto i = 0; i < stored.size(); i++) stored[i] += block[i];
+				dataset.write(&stored[0], PFP_TYPE, mspace, fspace);
+			}
+			else
+			{
+				dataset.write(block, PFP_TYPE, mspace, fspace);
+			}
+			mspace.close();
+		}
+	}
+	fspace.close();
+};
+
 void updateScratchData(Parameters<PRISMATIC_FLOAT_PRECISION> &pars)
 {
-	//for series simulations, need to update the 3D output array independently with a read-add-write process
-	Array4D<PRISMATIC_FLOAT_PRECISION> tmp_buffer(pars.output);
+	//for series simulations, need to update the 3D output array independently for each series value
 	std::string currentName = pars.currentTag;
+	if(pars.seriesInMemory)
+	{
+		Array4D<PRISMATIC_FLOAT_PRECISION> &sum = pars.seriesOutput[currentName];
+		for(auto i = 0; i < pars.output.size(); i++) sum[i] += pars.output[i];
+		if(pars.meta.saveDPC_CoM)
+		{
+			Array4D<PRISMATIC_FLOAT_PRECISION> &dpc_sum = pars.seriesOutput[currentName+"_DPC"];
+			for(auto i = 0; i < pars.DPC_CoM.size(); i++) dpc_sum[i] += pars.DPC_CoM[i];
+		}
+		return;
+	}
 
-	std::cout << "Reading scratch dataset " << currentName << " from " <<  "prismatic_scratch.h5" << std::endl;
-	readRealDataSet_inOrder(tmp_buffer, "prismatic_scratch.h5", "scratch/"+currentName);
-	for(auto i = 0; i < pars.output.size(); i++) tmp_buffer[i] += pars.output[i];
-
+	//the first frozen phonon writes straight into the freshly created datasets
+	bool addToStored = pars.fpFlag > 0;
 	H5::Group scratch = pars.scratchFile.openGroup("scratch");
-	hsize_t mdims[4] = {pars.output.get_diml(), pars.output.get_dimk(), pars.output.get_dimj(), pars.output.get_dimi()};
-	std::cout << "Writing scratch dataset " << currentName << " to " <<  "prismatic_scratch.h5" << std::endl;
-	writeRealDataSet_inOrder(scratch, currentName, &tmp_buffer[0], mdims, 4);
+	std::cout << "Updating scratch dataset " << currentName << " in " << pars.scratchFilename << std::endl;
+	H5::DataSet dataset = scratch.openDataSet(currentName.c_str());
+	updateScratchDataSet(dataset, pars.output, addToStored);
+	dataset.close();
 
 	if(pars.meta.saveDPC_CoM)
 	{
-		Array4D<PRISMATIC_FLOAT_PRECISION> dpc_buffer(pars.DPC_CoM);
 		currentName += "_DPC";
-		std::cout << "Reading scratch dataset " << currentName << " from " <<  "prismatic_scratch.h5" << std::endl;
-		readRealDataSet_inOrder(dpc_buffer, "prismatic_scratch.h5", "scratch/"+currentName);
-		for(auto i = 0; i < pars.DPC_CoM.size(); i++) dpc_buffer[i] += pars.DPC_CoM[i];
-
-		H5::Group scratch = pars.scratchFile.openGroup("scratch");
-		hsize_t mdims_dpc[4] = {pars.DPC_CoM.get_diml(), pars.DPC_CoM.get_dimk(), pars.DPC_CoM.get_dimj(), pars.DPC_CoM.get_dimi()};
-
-		std::cout << "Writing scratch dataset " << currentName << " to " <<  "prismatic_scratch.h5" << std::endl;
+		std::cout << "Updating scratch dataset " << currentName << " in " << pars.scratchFilename << std::endl;
+		H5::DataSet dpc_dataset = scratch.openDataSet(currentName.c_str());
+		updateScratchDataSet(dpc_dataset, pars.DPC_CoM, addToStored);
+		dpc_dataset.close();
+	}
+	scratch.close();
 
-		writeRealDataSet_inOrder(scratch, currentName, &dpc_buffer[0], mdims_dpc, 4);
+};
 
+void readScratchData(Parameters<PRISMATIC_FLOAT_PRECISION> &pars)
+{
+	//moves the summed series output of the current tag into net_output and net_DPC_CoM
+	std::string currentName = pars.currentTag;
+	if(pars.seriesInMemory)
+	{
+		pars.net_output = std::move(pars.seriesOutput[currentName]);
+		pars.seriesOutput.erase(currentName);
+		if(pars.meta.saveDPC_CoM)
+		{
+			pars.net_DPC_CoM = std::move(pars.seriesOutput[currentName+"_DPC"]);
+			pars.seriesOutput.erase(currentName+"_DPC");
+		}
+		return;
 	}
-	scratch.close();
 
+	pars.scratchFile.flush(H5F_SCOPE_LOCAL);
+	readRealDataSet_inOrder(pars.net_output, pars.scratchFilename, "scratch/"+currentName);
+	if(pars.meta.saveDPC_CoM)
+		readRealDataSet_inOrder(pars.net_DPC_CoM, pars.scratchFilename, "scratch/"+currentName+"_DPC");
 };
 
 
@@ -23,16 +23,40 @@
 #include "params.h"
 #include "go.h"
 #include "parseInput.h"
+#include "ScanTiler.h"
+#include "utility.h"
+#include "MPIComm.h"
 
 namespace Prismatic
 {
 void go(Metadata<PRISMATIC_FLOAT_PRECISION> meta)
 {
+	// the aberration bases of this run's grids are of no use to the next job, however the run ends
+	struct ChiRelease
+	{
+		~ChiRelease() { ChiEngine::getEngine().clear(); }
+	} chiRelease;
+
 	// configure simulation behavior
 	Prismatic::configure(meta);
 
-	// execute simulation
-	Prismatic::execute_plan(meta);
+	// execute simulation, optionally split among MPI ranks or local worker processes
+#ifdef PRISMATIC_ENABLE_MPI
+	if (Prismatic::getMPISize() > 1)
+	{
+		if (Prismatic::useMPIRanks(meta))
+			Prismatic::ScanTiler(meta, true).run();
+		else if (Prismatic::getMPIRank() == 0)
+			Prismatic::execute_plan(meta);
+		if (Prismatic::getMPIRank() != 0)
+			return;
+	}
+	else
+#endif //PRISMATIC_ENABLE_MPI
+	if (Prismatic::useScanTiles(meta))
+		Prismatic::ScanTiler(meta).run();
+	else
+		Prismatic::execute_plan(meta);
 
 #ifdef _WIN32
 	char *appdata = getenv("APPDATA");
@@ -26,6 +26,7 @@
 #include "atom.h"
 #include "probe.h"
 #include "aberration.h"
+#include "detector.h"
 
 namespace Prismatic
 {
@@ -88,6 +89,16 @@ void printHelp()
               << "* --scan-window-yr (-wyr) min max : size of the window to scan the probe in Y (in Angstroms) (defaults to fractional coordiantes) "
               << ")\n"
               << "* --num-FP (-F) value : number of frozen phonon configurations to calculate (default: " << defaults.numFP << ")\n"
+              << "* --concurrent-FP (-cFP) value : number of frozen phonon configurations to calculate at once, each with an equal share of the CPU threads (default: " << defaults.concurrentFP << ")\n"
+              << "* --pipeline-potential (-pp) value : number of CPU threads computing the potential of the next frozen phonon configuration while the current one runs, 0 to compute the potentials in turn (default: " << defaults.pipelineThreads << ")\n"
+              << "* --target-FP-error (-tfe) value : stop computing frozen phonon configurations once the relative standard error of the averaged output falls below value, with --num-FP as the upper bound; 0 always computes --num-FP (default: " << defaults.targetFPError << ")\n"
+              << "* --min-FP (-mfp) value : number of frozen phonon configurations computed before --target-FP-error can stop the calculation (default: " << defaults.minFP << ")\n"
+              << "* --FP-error-output (-feo) type : output whose standard error is compared to --target-FP-error. Choices are 3D (the detector stack), 2D (the annular image of --save-2D-output) or DPC (default: 3D)\n"
+              << "* --checkpoint-interval (-cpi) value : seconds between checkpoints of the running frozen phonon configuration, kept next to the output file so that an interrupted run can continue with --resume; 0 for no checkpoints (default: " << defaults.checkpointInterval << ")\n"
+              << "* --resume (-res) bool : whether to continue an interrupted run from its checkpoint instead of starting over (default: False)\n"
+              << "* --scan-tiles (-stl) value : number of local worker processes the probe scan is split among. The potential or S-matrix is computed once and shared, and the outputs of the workers are merged into the output file (default: " << defaults.scanTiles << ")\n"
+              << "* --serve (-srv) source : keep running and compute the simulation jobs read from source, either stdin or the path of a UNIX socket to listen on. A job is one line holding a parameter file, a JSON object of options such as {\"input-file\": \"atoms.xyz\", \"output-file\": \"out.h5\"}, or command line options; the other options given with --serve are the defaults of every job, and a line reading quit stops the server. Serving from stdin, the replies are written to stdout and the simulation logs to stderr (default: Off)\n"
+              << "* --reuse-plan (-rp) bool : whether to reuse coordinates, masks, propagators and probes across frozen phonons, series steps and calls when their settings did not change (default: True)\n"
               << "* --thermal-effects (-te) bool : whether or not to include Debye-Waller factors (thermal effects) (default: True)\n"
               << "* --occupancy (-oc) bool : whether or not to consider occupancy values for likelihood of atoms existing at each site (default: True)\n"
               << "* --3Dpotential (-3DP) bool : whether or not to use 3D integration with subpixel shifting for calculating the atomic potentials (default: True)\n"
@@ -96,6 +107,18 @@ void printHelp()
               << "* --save-4D-output (-4D) bool=false : Also save the 4D output at the detector for each probe (4D output mode) (default: Off)\n"
               << "* --4D-crop (-4DC) bool=false : Crop the 4D output smaller than the anti-aliasing boundary (default: Off)\n"
               << "* --4D-amax (-4DA) value: If --4D-crop, the maximum angle to which the output is cropped (in mrad) (default: 100)\n"
+              << "* --4D-shard (-4DS) bool=false : Write the 4D output as shard files next to the output file, stitched into the usual datacubes by virtual datasets. Keep the shards with the output file (default: Off)\n"
+              << "* --4D-counted (-4DE) electrons : Store the 4D output as Poisson sampled electron counts for this many electrons per probe position, kept as sparse events in counted_datacubes. 0 keeps the dense intensities (default: 0)\n"
+              << "* --4D-precision (-4DP) float/uint16/uint8 : Element type of the 4D intensities. Integer types store levels q with a scale and offset per pattern, I = offset + scale*q, accurate to (max-min)/(2*(2^bits-1)) per pattern and frozen phonon (default: float)\n"
+              << "* --4D-log (-4DL) bool=false : With an integer --4D-precision, quantize ln(I + 1e-10) instead of I, giving a relative error of about scale/2 per frozen phonon (default: Off)\n"
+              << "* --4D-raw (-4DR) bool=false : Write the 4D output as memory-mapped .npy files next to the output file, described by a .json sidecar. An output filename ending in .npy selects this as well. pyprismatic.fileio.convertRaw4D restores the usual datacubes (default: Off)\n"
+              << "* --4D-bin (-4DB) bx by : Sum the 4D detector pixels in bins of bx by by pixels along Qx, Qy before writing, dropping partial bins. Complex output waves are not binned (default: 1 1)\n"
+              << "* --4D-window (-4DW) qxmin qxmax qymin qymax : Keep only the 4D detector pixels between these angles along Qx, Qy (in mrad), applied before binning (default: Off)\n"
+              << "* --4D-chunk (-4DK) rx ry qx qy : Chunk shape of the 4D output in probes and detector pixels. 0 spans the whole axis (default: 1 1 0 0)\n"
+              << "* --output-filter (-ocf) none/deflate/lz4/zstd : Compression filter for the datasets of the output file. lz4 and zstd use the HDF5 filter plugins on HDF5_PLUGIN_PATH and fall back to deflate when they are missing (default: none)\n"
+              << "* --output-filter-level (-ocl) level : Compression level of the deflate (0-9) or zstd filter (default: 4)\n"
+              << "* --output-shuffle (-osh) bool=true : Byte shuffle the data ahead of the compression filter (default: On)\n"
+              << "* --output-preset (-ocp) frame/row/tile/archive : Chunking and filter preset for py4DSTEM access patterns. frame is uncompressed single diffraction patterns, row is lz4 compressed scan rows, tile is lz4 compressed blocks of probes and detector pixels for virtual imaging, archive is zstd compressed scan rows\n"
               << "* --save-DPC-CoM (-DPC) bool=false : Also save the DPC Center of Mass calculation (default: Off)\n"
               << "* --save-probe (-probe) int : Also save the complex entrance probe. 0 to not save \"off\", 1 to save probe intensity, 2 to save complex probe (default: 0 )\n"
               << "* --save-potential-slices (-ps) bool=false : Also save the calculated potential slices (default: Off)\n"
@@ -106,16 +129,25 @@ void printHelp()
               << "* --import-smatrix (-ism) bool=false : Use precalculated scattering matrix from import HDF5 file -if and -idp (default: Off)]\n"
               << "* --import-file (-if) filename : File from where to import precalculated potential or smatrix(default: Off)]\n"
               << "* --import-data-path (-idp) string : Datapath from where precalcualted values are retrieved within HDF5 import file (default: none, uses Prismatic save path)\n"
+              << "* --import-cache (-ic) size : Megabytes of the import file cached while a potential or smatrix is streamed in (default: 256)\n"
               << "* --xtilt-tem (-xtt) min max step : plane wave tilt selection for HRTEM in x (in mrad) (default: " << defaults.minXtilt * 1000 << " " << defaults.maxXtilt * 1000 << " " << defaults.xTiltStep * 1000 << ")\n"
               << "* --ytilt-tem (-ytt) min max step : plane wave tilt selection for HRTEM in y (in mrad) (default: " << defaults.minYtilt * 1000 << " " << defaults.maxYtilt * 1000 << " " << defaults.yTiltStep * 1000 << ")\n"
               << "* --rtilt-tem (-rtt) min max : plane wave tilt selection for HRTEM in radial fashion (in mrad) (default: " << defaults.minRtilt * 1000 << " " << defaults.maxRtilt * 1000 << ")\n"
               << "* --tilt-offset-tem (-tot) xOffset yOffset : offset to select center tilt for HRTEM in (in mrad) (default: " << defaults.xTiltOffset * 1000 << " " << defaults.yTiltOffset * 1000 << ")\n"
               << "* --probe-pos (-pos) filename : filename containing list of arbitrary probe positions. If set, runs custom list of probe positions; data are returned in order of list. See www.prism-em.com/about for details \n"
+              << "* --detectors (-det) filename : filename containing list of custom virtual detectors, one per line as inner, outer (mrad)[, phi min, phi max (degrees)] after a comment line. Integrated intensities are saved alongside the annular bins (CPU only)\n"
               << "* --aberrations (-aber) filename : filename containing list of arbitrary aberrations. See www.prism-em.com/about for details \n"
               << "* --max-filesize size : Maximum output file size in gigabytes that Prismatic will be allowed to generate. Default is 2 Gigabytes. \n"
+              << "* --series-memory (-smem) size : Memory in gigabytes for summing the outputs of a simulation series. Larger series are summed in a scratch file instead (default: 4)\n"
+              << "* --scratch-dir (-scr) path : Directory of the scratch file used by simulation series that exceed --series-memory (default: working directory)\n"
               << "* --probe-defocus-sigma (-dfs) sigma: Run a simulation series over a range of 9 defocii, up to +- 2 sigma in steps 0.5 sigma (in angstroms).\n"
               << "* --probe-defocus-range (-dfr) min max step : Run a simulation series over a range of defocus values, from min to max in step size of step. All input units in Angstroms. \n"
-              << "* --matrix-refocus (-mrf) bool : Use matrix refocusing in PRISM simulation (default: Off).\n";
+              << "* --probe-series (-pser) key min max step : Run a simulation series over a probe parameter from min to max in step size of step. key is defocus, C3, C5 (in Angstroms), semiangle, xtilt or ytilt (in mrad). Repeat for several parameters varied together; all need the same number of values.\n"
+              << "* --series-single-pass (-ssp) bool : whether PRISM computes all members of a series in one pass over the S-matrix instead of one pass per member (default: True)\n"
+              << "* --matrix-refocus (-mrf) bool : Use matrix refocusing in PRISM simulation (default: Off).\n"
+              << "* --compress-smatrix (-csm) tolerance : Replace the compact S-matrix with a low-rank basis, truncated once the relative residual of every beam falls below tolerance. 0 disables compression (default: Off).\n"
+              << "* --smatrix-layout (-sml) auto/beam/pixel : Memory order of the compact S-matrix while CPU threads compute the PRISM output. pixel stores the beams of each pixel contiguously; auto picks the layout that reads less memory for the probe window size and the number of beams a probe weights (default: auto).\n"
+              << "* --smatrix-halo (-smh) bool : Pad the compact S-matrix periodically by one probe window while CPU threads compute the PRISM output, so windows are read without index wrapping. Costs extra memory (default: Off).\n";
 }
 
 // string white-space trimming utility functions courtesy of https://stackoverflow.com/questions/216823/whats-the-best-way-to-trim-stdstring
@@ -237,6 +269,26 @@ bool writeParamFile(Metadata<PRISMATIC_FLOAT_PRECISION> &meta,
     f << "--pixel-size-y:" << meta.realspacePixelSize[0] << '\n';
     f << "--potential-bound:" << meta.potBound << '\n';
     f << "--num-FP:" << meta.numFP << '\n';
+    f << "--concurrent-FP:" << meta.concurrentFP << '\n';
+    f << "--pipeline-potential:" << meta.pipelineThreads << '\n';
+    f << "--reuse-plan:" << meta.reusePlan << '\n';
+    f << "--target-FP-error:" << meta.targetFPError << '\n';
+    f << "--min-FP:" << meta.minFP << '\n';
+    if (meta.convergenceOutput == Prismatic::ConvergenceOutput::Annular2D)
+    {
+        f << "--FP-error-output:2D\n";
+    }
+    else if (meta.convergenceOutput == Prismatic::ConvergenceOutput::DPC_CoM)
+    {
+        f << "--FP-error-output:DPC\n";
+    }
+    else
+    {
+        f << "--FP-error-output:3D\n";
+    }
+    f << "--checkpoint-interval:" << meta.checkpointInterval << '\n';
+    f << "--resume:" << meta.resume << '\n';
+    f << "--scan-tiles:" << meta.scanTiles << '\n';
     f << "--slice-thickness:" << meta.sliceThickness << '\n';
     f << "--num-slices:" << meta.numSlices << '\n';
     f << "--zstart-slices:" << meta.zStart << '\n';
@@ -287,13 +339,69 @@ bool writeParamFile(Metadata<PRISMATIC_FLOAT_PRECISION> &meta,
     f << "--save-3D-output:" << meta.save3DOutput << "\n";
     f << "--save-4D-output:" << meta.save4DOutput << "\n";
     f << "--4D-crop:" << meta.crop4DOutput << "\n";
+    f << "--4D-shard:" << meta.shard4DOutput << "\n";
+    f << "--4D-raw:" << meta.raw4DOutput << "\n";
+    f << "--4D-counted:" << meta.countedElectrons << "\n";
+    if (meta.precision4D == Prismatic::OutputPrecision::UInt16)
+    {
+        f << "--4D-precision:uint16\n";
+    }
+    else if (meta.precision4D == Prismatic::OutputPrecision::UInt8)
+    {
+        f << "--4D-precision:uint8\n";
+    }
+    else
+    {
+        f << "--4D-precision:float\n";
+    }
+    f << "--4D-log:" << meta.logQuantize4D << "\n";
+    f << "--4D-bin:" << meta.bin4D[0] << ' ' << meta.bin4D[1] << "\n";
+    if (meta.window4DOutput) f << "--4D-window:" << meta.window4D[0] * 1000 << ' ' << meta.window4D[1] * 1000 << ' ' << meta.window4D[2] * 1000 << ' ' << meta.window4D[3] * 1000 << "\n";
+    f << "--4D-chunk:" << meta.chunk4D[0] << ' ' << meta.chunk4D[1] << ' ' << meta.chunk4D[2] << ' ' << meta.chunk4D[3] << "\n";
+    if (meta.outputFilter == Prismatic::OutputFilter::Deflate)
+    {
+        f << "--output-filter:deflate\n";
+    }
+    else if (meta.outputFilter == Prismatic::OutputFilter::LZ4)
+    {
+        f << "--output-filter:lz4\n";
+    }
+    else if (meta.outputFilter == Prismatic::OutputFilter::Zstd)
+    {
+        f << "--output-filter:zstd\n";
+    }
+    else
+    {
+        f << "--output-filter:none\n";
+    }
+    f << "--output-filter-level:" << meta.outputFilterLevel << "\n";
+    f << "--output-shuffle:" << meta.outputShuffle << "\n";
     f << "--save-DPC-CoM:" << meta.saveDPC_CoM << "\n";
     f << "--save-potential-slices:" << meta.savePotentialSlices << "\n";
     f << "--save-smatrix:" << meta.saveSMatrix << "\n";
     f << "--save-probe:" << int(meta.saveProbe) + int(meta.saveProbeComplex) << "\n"; // should be safe since saveProbeComplex can't be set independently
     f << "--import-potential:" << meta.importPotential << "\n";
     f << "--import-smatrix:" << meta.importSMatrix << "\n";
+    f << "--import-cache:" << meta.importCache / 1e6 << "\n";
     f << "--nyquist-sampling:"<< meta.nyquistSampling <<"\n";
+    f << "--compress-smatrix:" << (meta.compressSMatrix ? meta.sMatrixRankTol : 0) << "\n";
+    if (meta.sMatrixLayout == Prismatic::SMatrixLayout::Auto)
+    {
+        f << "--smatrix-layout:auto\n";
+    }
+    else if (meta.sMatrixLayout == Prismatic::SMatrixLayout::PixelMajor)
+    {
+        f << "--smatrix-layout:pixel\n";
+    }
+    else
+    {
+        f << "--smatrix-layout:beam\n";
+    }
+    f << "--smatrix-halo:" << meta.sMatrixHalo << "\n";
+    f << "--series-memory:" << meta.seriesMemory / 1e9 << "\n";
+    f << "--series-single-pass:" << meta.seriesSinglePass << "\n";
+    if (!meta.scratchDirectory.empty())
+        f << "--scratch-dir:" << meta.scratchDirectory << "\n";
 
 #ifdef PRISMATIC_ENABLE_GPU
     if (meta.alsoDoCPUWork)
@@ -661,6 +769,195 @@ bool parse_F(Metadata<PRISMATIC_FLOAT_PRECISION> &meta,
     return true;
 };
 
+bool parse_cFP(Metadata<PRISMATIC_FLOAT_PRECISION> &meta,
+               int &argc, const char ***argv)
+{
+    if (argc < 2)
+    {
+        cout << "No number of concurrent frozen phonon configurations provided for -cFP (syntax is -cFP #)\n";
+        return false;
+    }
+    if ((meta.concurrentFP = atoi((*argv)[1])) == 0)
+    {
+        cout << "Invalid value \"" << (*argv)[1] << "\" provided for number of concurrent frozen phonon configurations (syntax is -cFP #)\n";
+        return false;
+    }
+    argc -= 2;
+    argv[0] += 2;
+    return true;
+};
+
+bool parse_pp(Metadata<PRISMATIC_FLOAT_PRECISION> &meta,
+              int &argc, const char ***argv)
+{
+    if (argc < 2)
+    {
+        cout << "No number of threads provided for -pp (syntax is -pp #)\n";
+        return false;
+    }
+    int val = atoi((*argv)[1]);
+    if (val < 0)
+    {
+        cout << "Invalid value \"" << (*argv)[1] << "\" provided for number of potential pipeline threads (syntax is -pp #)\n";
+        return false;
+    }
+    meta.pipelineThreads = val;
+    argc -= 2;
+    argv[0] += 2;
+    return true;
+};
+
+bool parse_rp(Metadata<PRISMATIC_FLOAT_PRECISION> &meta,
+              int &argc, const char ***argv)
+{
+    if (argc < 2)
+    {
+        cout << "No value provided for -rp (syntax is -rp bool)\n";
+        return false;
+    }
+    meta.reusePlan = std::string((*argv)[1]) == "0" ? false : true;
+    argc -= 2;
+    argv[0] += 2;
+    return true;
+};
+
+bool parse_tfe(Metadata<PRISMATIC_FLOAT_PRECISION> &meta,
+               int &argc, const char ***argv)
+{
+    if (argc < 2)
+    {
+        cout << "No target error provided for -tfe (syntax is -tfe value)\n";
+        return false;
+    }
+    PRISMATIC_FLOAT_PRECISION val = atof((*argv)[1]);
+    if (val < 0)
+    {
+        cout << "Invalid value \"" << (*argv)[1] << "\" provided for the target frozen phonon error (syntax is -tfe value)\n";
+        return false;
+    }
+    meta.targetFPError = val;
+    argc -= 2;
+    argv[0] += 2;
+    return true;
+};
+
+bool parse_mfp(Metadata<PRISMATIC_FLOAT_PRECISION> &meta,
+               int &argc, const char ***argv)
+{
+    if (argc < 2)
+    {
+        cout << "No minimum number of frozen phonon configurations provided for -mfp (syntax is -mfp #)\n";
+        return false;
+    }
+    if ((meta.minFP = atoi((*argv)[1])) == 0)
+    {
+        cout << "Invalid value \"" << (*argv)[1] << "\" provided for minimum number of frozen phonon configurations (syntax is -mfp #)\n";
+        return false;
+    }
+    argc -= 2;
+    argv[0] += 2;
+    return true;
+};
+
+bool parse_feo(Metadata<PRISMATIC_FLOAT_PRECISION> &meta,
+               int &argc, const char ***argv)
+{
+    if (argc < 2)
+    {
+        cout << "No output provided for -feo (syntax is -feo type). Choices are 3D, 2D, or DPC\n";
+        return false;
+    }
+    std::string output = std::string((*argv)[1]);
+    if (output == "3D")
+    {
+        meta.convergenceOutput = Prismatic::ConvergenceOutput::Stack3D;
+    }
+    else if (output == "2D")
+    {
+        meta.convergenceOutput = Prismatic::ConvergenceOutput::Annular2D;
+    }
+    else if (output == "DPC")
+    {
+        meta.convergenceOutput = Prismatic::ConvergenceOutput::DPC_CoM;
+    }
+    else
+    {
+        cout << "Unrecognized frozen phonon error output \"" << (*argv)[1] << "\"\n";
+        return false;
+    }
+    argc -= 2;
+    argv[0] += 2;
+    return true;
+};
+
+bool parse_cpi(Metadata<PRISMATIC_FLOAT_PRECISION> &meta,
+               int &argc, const char ***argv)
+{
+    if (argc < 2)
+    {
+        cout << "No checkpoint interval provided for -cpi (syntax is -cpi seconds)\n";
+        return false;
+    }
+    int val = atoi((*argv)[1]);
+    if (val < 0)
+    {
+        cout << "Invalid value \"" << (*argv)[1] << "\" provided for the checkpoint interval (syntax is -cpi seconds)\n";
+        return false;
+    }
+    meta.checkpointInterval = val;
+    argc -= 2;
+    argv[0] += 2;
+    return true;
+};
+
+bool parse_res(Metadata<PRISMATIC_FLOAT_PRECISION> &meta,
+               int &argc, const char ***argv)
+{
+    if (argc < 2)
+    {
+        cout << "No value provided for -res (syntax is -res bool)\n";
+        return false;
+    }
+    meta.resume = std::string((*argv)[1]) == "0" ? false : true;
+    argc -= 2;
+    argv[0] += 2;
+    return true;
+};
+
+bool parse_stl(Metadata<PRISMATIC_FLOAT_PRECISION> &meta,
+               int &argc, const char ***argv)
+{
+    if (argc < 2)
+    {
+        cout << "No number of scan tiles provided for -stl (syntax is -stl value)\n";
+        return false;
+    }
+    int val = atoi((*argv)[1]);
+    if (val < 1)
+    {
+        cout << "Invalid value \"" << (*argv)[1] << "\" provided for the number of scan tiles (syntax is -stl value)\n";
+        return false;
+    }
+    meta.scanTiles = val;
+    argc -= 2;
+    argv[0] += 2;
+    return true;
+};
+
+bool parse_srv(Metadata<PRISMATIC_FLOAT_PRECISION> &meta,
+               int &argc, const char ***argv)
+{
+    if (argc < 2)
+    {
+        cout << "No job source provided for -srv (syntax is -srv stdin|socket_path)\n";
+        return false;
+    }
+    meta.serveSource = std::string((*argv)[1]);
+    argc -= 2;
+    argv[0] += 2;
+    return true;
+};
+
 bool parse_g(Metadata<PRISMATIC_FLOAT_PRECISION> &meta,
              int &argc, const char ***argv)
 {
@@ -805,6 +1102,13 @@ bool parse_o(Metadata<PRISMATIC_FLOAT_PRECISION> &meta,
         return false;
     }
     meta.filenameOutput = std::string((*argv)[1]);
+    //a .npy output keeps the 4D output in raw files, the remaining outputs and metadata go to an .h5 file of the same name
+    size_t ext = meta.filenameOutput.find_last_of('.');
+    if (ext != std::string::npos && meta.filenameOutput.substr(ext) == ".npy")
+    {
+        meta.raw4DOutput = true;
+        meta.filenameOutput = meta.filenameOutput.substr(0, ext) + ".h5";
+    }
     argc -= 2;
     argv[0] += 2;
     return true;
@@ -856,6 +1160,26 @@ bool parse_idp(Metadata<PRISMATIC_FLOAT_PRECISION> &meta,
     return true;
 };
 
+bool parse_ic(Metadata<PRISMATIC_FLOAT_PRECISION> &meta,
+              int &argc, const char ***argv)
+{
+    if (argc < 2)
+    {
+        cout << "No cache size provided for -ic (syntax is -ic size)\n";
+        return false;
+    }
+    PRISMATIC_FLOAT_PRECISION size = (PRISMATIC_FLOAT_PRECISION)atof((*argv)[1]);
+    if (size <= 0)
+    {
+        cout << "Invalid value \"" << (*argv)[1] << "\" provided for import cache (syntax is -ic size)\n";
+        return false;
+    }
+    meta.importCache = size * 1e6;
+    argc -= 2;
+    argv[0] += 2;
+    return true;
+};
+
 bool parse_p(Metadata<PRISMATIC_FLOAT_PRECISION> &meta,
              int &argc, const char ***argv)
 {
@@ -1362,6 +1686,277 @@ bool parse_4DC(Metadata<PRISMATIC_FLOAT_PRECISION> &meta,
     return true;
 };
 
+bool parse_4DP(Metadata<PRISMATIC_FLOAT_PRECISION> &meta,
+              int &argc, const char ***argv)
+{
+    if (argc < 2)
+    {
+        cout << "No type provided for -4DP (syntax is -4DP type). Choices are float, uint16, or uint8\n";
+        return false;
+    }
+    std::string precision = std::string((*argv)[1]);
+    if (precision == "float")
+    {
+        meta.precision4D = Prismatic::OutputPrecision::Float;
+    }
+    else if (precision == "uint16")
+    {
+        meta.precision4D = Prismatic::OutputPrecision::UInt16;
+    }
+    else if (precision == "uint8")
+    {
+        meta.precision4D = Prismatic::OutputPrecision::UInt8;
+    }
+    else
+    {
+        cout << "Unrecognized 4D precision \"" << (*argv)[1] << "\"\n";
+        return false;
+    }
+    argc -= 2;
+    argv[0] += 2;
+    return true;
+};
+
+bool parse_4DL(Metadata<PRISMATIC_FLOAT_PRECISION> &meta,
+              int &argc, const char ***argv)
+{
+    if (argc < 2)
+    {
+        cout << "No value provided for -4DL (syntax is -4DL bool)\n";
+        return false;
+    }
+    meta.logQuantize4D = std::string((*argv)[1]) == "0" ? false : true;
+    argc -= 2;
+    argv[0] += 2;
+    return true;
+};
+
+bool parse_4DB(Metadata<PRISMATIC_FLOAT_PRECISION> &meta,
+              int &argc, const char ***argv)
+{
+    if (argc < 3)
+    {
+        cout << "Not enough values provided for -4DB (syntax is -4DB bx by)\n";
+        return false;
+    }
+    for (auto i = 0; i < 2; i++)
+    {
+        int val = atoi((*argv)[i + 1]);
+        if (val < 1)
+        {
+            cout << "Invalid value \"" << (*argv)[i + 1] << "\" provided for -4DB (syntax is -4DB bx by)\n";
+            return false;
+        }
+        meta.bin4D[i] = val;
+    }
+    argc -= 3;
+    argv[0] += 3;
+    return true;
+};
+
+bool parse_4DW(Metadata<PRISMATIC_FLOAT_PRECISION> &meta,
+              int &argc, const char ***argv)
+{
+    if (argc < 5)
+    {
+        cout << "Not enough values provided for -4DW (syntax is -4DW qxmin qxmax qymin qymax)\n";
+        return false;
+    }
+    for (auto i = 0; i < 4; i++)
+        meta.window4D[i] = (PRISMATIC_FLOAT_PRECISION)atof((*argv)[i + 1]) / 1000;
+    if (meta.window4D[0] > meta.window4D[1] || meta.window4D[2] > meta.window4D[3])
+    {
+        cout << "Invalid limits provided for -4DW, the minimum angles must not exceed the maximum angles\n";
+        return false;
+    }
+    meta.window4DOutput = true;
+    argc -= 5;
+    argv[0] += 5;
+    return true;
+};
+
+bool parse_4DE(Metadata<PRISMATIC_FLOAT_PRECISION> &meta,
+              int &argc, const char ***argv)
+{
+    if (argc < 2)
+    {
+        cout << "No value provided for -4DE (syntax is -4DE electrons)\n";
+        return false;
+    }
+    if (((meta.countedElectrons = (PRISMATIC_FLOAT_PRECISION)atof((*argv)[1])) <= 0) & (std::string((*argv)[1]) != "0"))
+    {
+        cout << "Invalid value \"" << (*argv)[1] << "\" provided for -4DE (syntax is -4DE electrons)\n";
+        return false;
+    }
+    argc -= 2;
+    argv[0] += 2;
+    return true;
+};
+
+bool parse_4DR(Metadata<PRISMATIC_FLOAT_PRECISION> &meta,
+              int &argc, const char ***argv)
+{
+    if (argc < 2)
+    {
+        cout << "No value provided for -4DR (syntax is -4DR bool)\n";
+        return false;
+    }
+    meta.raw4DOutput = std::string((*argv)[1]) == "0" ? false : true;
+    argc -= 2;
+    argv[0] += 2;
+    return true;
+};
+
+bool parse_4DS(Metadata<PRISMATIC_FLOAT_PRECISION> &meta,
+              int &argc, const char ***argv)
+{
+    if (argc < 2)
+    {
+        cout << "No value provided for -4DS (syntax is -4DS bool)\n";
+        return false;
+    }
+    meta.shard4DOutput = std::string((*argv)[1]) == "0" ? false : true;
+    argc -= 2;
+    argv[0] += 2;
+    return true;
+};
+
+bool parse_4DK(Metadata<PRISMATIC_FLOAT_PRECISION> &meta,
+              int &argc, const char ***argv)
+{
+    if (argc < 5)
+    {
+        cout << "Insufficient arguments provided for -4DK (syntax is -4DK rx ry qx qy)\n";
+        return false;
+    }
+    for (auto i = 0; i < 4; i++)
+    {
+        int val = atoi((*argv)[i + 1]);
+        if (val < 0)
+        {
+            cout << "Invalid value \"" << (*argv)[i + 1] << "\" provided for -4DK (syntax is -4DK rx ry qx qy)\n";
+            return false;
+        }
+        meta.chunk4D[i] = val;
+    }
+    argc -= 5;
+    argv[0] += 5;
+    return true;
+};
+
+bool parse_ocf(Metadata<PRISMATIC_FLOAT_PRECISION> &meta,
+              int &argc, const char ***argv)
+{
+    if (argc < 2)
+    {
+        cout << "No filter provided for -ocf (syntax is -ocf filter). Choices are none, deflate, lz4, or zstd\n";
+        return false;
+    }
+    std::string filter = std::string((*argv)[1]);
+    if (filter == "none")
+    {
+        meta.outputFilter = Prismatic::OutputFilter::None;
+    }
+    else if (filter == "deflate")
+    {
+        meta.outputFilter = Prismatic::OutputFilter::Deflate;
+    }
+    else if (filter == "lz4")
+    {
+        meta.outputFilter = Prismatic::OutputFilter::LZ4;
+    }
+    else if (filter == "zstd")
+    {
+        meta.outputFilter = Prismatic::OutputFilter::Zstd;
+    }
+    else
+    {
+        cout << "Unrecognized output filter \"" << (*argv)[1] << "\"\n";
+        return false;
+    }
+    argc -= 2;
+    argv[0] += 2;
+    return true;
+};
+
+bool parse_ocl(Metadata<PRISMATIC_FLOAT_PRECISION> &meta,
+              int &argc, const char ***argv)
+{
+    if (argc < 2)
+    {
+        cout << "No value provided for -ocl (syntax is -ocl level)\n";
+        return false;
+    }
+    meta.outputFilterLevel = atoi((*argv)[1]);
+    if (meta.outputFilterLevel < 0)
+    {
+        cout << "Invalid value \"" << (*argv)[1] << "\" provided for -ocl (syntax is -ocl level)\n";
+        return false;
+    }
+    argc -= 2;
+    argv[0] += 2;
+    return true;
+};
+
+bool parse_osh(Metadata<PRISMATIC_FLOAT_PRECISION> &meta,
+              int &argc, const char ***argv)
+{
+    if (argc < 2)
+    {
+        cout << "No value provided for -osh (syntax is -osh bool)\n";
+        return false;
+    }
+    meta.outputShuffle = std::string((*argv)[1]) == "0" ? false : true;
+    argc -= 2;
+    argv[0] += 2;
+    return true;
+};
+
+bool parse_ocp(Metadata<PRISMATIC_FLOAT_PRECISION> &meta,
+              int &argc, const char ***argv)
+{
+    if (argc < 2)
+    {
+        cout << "No preset provided for -ocp (syntax is -ocp preset). Choices are frame, row, tile, or archive\n";
+        return false;
+    }
+    // row chunks match the scan-row blocks of the 4D writer, tiles serve virtual detectors that read a few
+    // detector pixels at every probe
+    std::string preset = std::string((*argv)[1]);
+    if (preset == "frame")
+    {
+        meta.chunk4D = std::vector<size_t>{1, 1, 0, 0};
+        meta.outputFilter = Prismatic::OutputFilter::None;
+    }
+    else if (preset == "row")
+    {
+        meta.chunk4D = std::vector<size_t>{0, 1, 0, 0};
+        meta.outputFilter = Prismatic::OutputFilter::LZ4;
+        meta.outputShuffle = true;
+    }
+    else if (preset == "tile")
+    {
+        meta.chunk4D = std::vector<size_t>{16, 16, 32, 32};
+        meta.outputFilter = Prismatic::OutputFilter::LZ4;
+        meta.outputShuffle = true;
+    }
+    else if (preset == "archive")
+    {
+        meta.chunk4D = std::vector<size_t>{0, 1, 0, 0};
+        meta.outputFilter = Prismatic::OutputFilter::Zstd;
+        meta.outputFilterLevel = 9;
+        meta.outputShuffle = true;
+    }
+    else
+    {
+        cout << "Unrecognized output preset \"" << (*argv)[1] << "\"\n";
+        return false;
+    }
+    argc -= 2;
+    argv[0] += 2;
+    return true;
+};
+
 bool parse_4DA(Metadata<PRISMATIC_FLOAT_PRECISION> &meta,
               int &argc, const char ***argv)
 {
@@ -1597,6 +2192,40 @@ bool parse_maxFile(Metadata<PRISMATIC_FLOAT_PRECISION> &meta,
     return true;
 };
 
+bool parse_smem(Metadata<PRISMATIC_FLOAT_PRECISION> &meta,
+              int &argc, const char ***argv)
+{
+    if (argc < 2)
+    {
+        cout << "No memory size provided for -smem (syntax is -smem size)\n";
+        return false;
+    }
+    PRISMATIC_FLOAT_PRECISION size = (PRISMATIC_FLOAT_PRECISION)atof((*argv)[1]);
+    if (size < 0)
+    {
+        cout << "Invalid value \"" << (*argv)[1] << "\" provided for series memory (syntax is -smem size)\n";
+        return false;
+    }
+    meta.seriesMemory = size * 1e9;
+    argc -= 2;
+    argv[0] += 2;
+    return true;
+};
+
+bool parse_scr(Metadata<PRISMATIC_FLOAT_PRECISION> &meta,
+              int &argc, const char ***argv)
+{
+    if (argc < 2)
+    {
+        cout << "No directory provided for -scr (syntax is -scr /path/)\n";
+        return false;
+    }
+    meta.scratchDirectory = std::string((*argv)[1]);
+    argc -= 2;
+    argv[0] += 2;
+    return true;
+};
+
 bool parse_dfs(Metadata<PRISMATIC_FLOAT_PRECISION> &meta,
               int &argc, const char ***argv)
 {
@@ -1646,6 +2275,66 @@ bool parse_dfr(Metadata<PRISMATIC_FLOAT_PRECISION> &meta,
     return true;
 };
 
+bool parse_pser(Metadata<PRISMATIC_FLOAT_PRECISION> &meta,
+               int &argc, const char ***argv)
+{
+    if (argc < 5)
+    {
+        cout << "Not enough values provided for --probe-series (syntax is -pser key min max step)\n";
+        return false;
+    }
+    //keys are stored under the names of their metadata fields, angles in radians
+    std::map<std::string, std::pair<std::string, PRISMATIC_FLOAT_PRECISION> > keys{{"defocus", {"probeDefocus", 1.0}},
+                                                                                   {"C3", {"C3", 1.0}},
+                                                                                   {"C5", {"C5", 1.0}},
+                                                                                   {"semiangle", {"probeSemiangle", 1e-3}},
+                                                                                   {"xtilt", {"probeXtilt", 1e-3}},
+                                                                                   {"ytilt", {"probeYtilt", 1e-3}}};
+    std::string key = std::string((*argv)[1]);
+    if (keys.count(key) == 0)
+    {
+        cout << "Unrecognized series parameter \"" << (*argv)[1] << "\". Choices are defocus, C3, C5, semiangle, xtilt, or ytilt\n";
+        return false;
+    }
+    PRISMATIC_FLOAT_PRECISION minval = (PRISMATIC_FLOAT_PRECISION)atof((*argv)[2]);
+    PRISMATIC_FLOAT_PRECISION maxval = (PRISMATIC_FLOAT_PRECISION)atof((*argv)[3]);
+    PRISMATIC_FLOAT_PRECISION step = (PRISMATIC_FLOAT_PRECISION)atof((*argv)[4]);
+    if (step <= 0 or maxval < minval)
+    {
+        cout << "Invalid range \"" << (*argv)[2] << " " << (*argv)[3] << " " << (*argv)[4] << "\" provided for --probe-series (syntax is -pser key min max step)\n";
+        return false;
+    }
+
+    std::vector<PRISMATIC_FLOAT_PRECISION> vals;
+    for (auto i = 0; minval + i * step <= maxval; i++)
+        vals.push_back((minval + i * step) * keys[key].second);
+    if (meta.seriesVals.size() > 0 and meta.seriesVals[0].size() != vals.size())
+    {
+        cout << "--probe-series for " << key << " has " << vals.size() << " values, but the series has " << meta.seriesVals[0].size() << "\n";
+        return false;
+    }
+    meta.seriesKeys.push_back(keys[key].first);
+    meta.seriesVals.push_back(vals);
+    meta.simSeries = true;
+    argc -= 5;
+    argv[0] += 5;
+    return true;
+};
+
+bool parse_ssp(Metadata<PRISMATIC_FLOAT_PRECISION> &meta,
+               int &argc, const char ***argv)
+{
+    if (argc < 2)
+    {
+        cout << "No value provided for -ssp (syntax is -ssp bool)\n";
+        return false;
+    }
+    meta.seriesSinglePass = std::string((*argv)[1]) == "0" ? false : true;
+    argc -= 2;
+    argv[0] += 2;
+    return true;
+};
+
 bool parse_3DPZ(Metadata<PRISMATIC_FLOAT_PRECISION> &meta,
               int &argc, const char ***argv)
 {
@@ -1678,6 +2367,72 @@ bool parse_mrf(Metadata<PRISMATIC_FLOAT_PRECISION> &meta,
     return true;
 };
 
+bool parse_csm(Metadata<PRISMATIC_FLOAT_PRECISION> &meta,
+              int &argc, const char ***argv)
+{
+    if (argc < 2)
+    {
+        cout << "No tolerance provided for -csm (syntax is -csm tolerance)\n";
+        return false;
+    }
+    PRISMATIC_FLOAT_PRECISION tol = (PRISMATIC_FLOAT_PRECISION)atof((*argv)[1]);
+    if (tol < 0 || tol >= 1)
+    {
+        cout << "Invalid value \"" << (*argv)[1] << "\" provided for S-matrix compression tolerance (syntax is -csm tolerance, with 0 <= tolerance < 1)\n";
+        return false;
+    }
+    meta.compressSMatrix = tol > 0;
+    if (meta.compressSMatrix) meta.sMatrixRankTol = tol;
+    argc -= 2;
+    argv[0] += 2;
+    return true;
+};
+
+bool parse_sml(Metadata<PRISMATIC_FLOAT_PRECISION> &meta,
+              int &argc, const char ***argv)
+{
+    if (argc < 2)
+    {
+        cout << "No layout provided for -sml (syntax is -sml layout). Choices are auto, beam, or pixel\n";
+        return false;
+    }
+    std::string layout = std::string((*argv)[1]);
+    if (layout == "auto")
+    {
+        meta.sMatrixLayout = Prismatic::SMatrixLayout::Auto;
+    }
+    else if (layout == "beam")
+    {
+        meta.sMatrixLayout = Prismatic::SMatrixLayout::BeamMajor;
+    }
+    else if (layout == "pixel")
+    {
+        meta.sMatrixLayout = Prismatic::SMatrixLayout::PixelMajor;
+    }
+    else
+    {
+        cout << "Unrecognized S-matrix layout \"" << (*argv)[1] << "\"\n";
+        return false;
+    }
+    argc -= 2;
+    argv[0] += 2;
+    return true;
+};
+
+bool parse_smh(Metadata<PRISMATIC_FLOAT_PRECISION> &meta,
+              int &argc, const char ***argv)
+{
+    if (argc < 2)
+    {
+        cout << "No value provided for -smh (syntax is -smh bool)\n";
+        return false;
+    }
+    meta.sMatrixHalo = std::string((*argv)[1]) == "0" ? false : true;
+    argc -= 2;
+    argv[0] += 2;
+    return true;
+};
+
 bool parse_aber(Metadata<PRISMATIC_FLOAT_PRECISION> &meta,
              int &argc, const char ***argv)
 {
@@ -1693,6 +2448,20 @@ bool parse_aber(Metadata<PRISMATIC_FLOAT_PRECISION> &meta,
     return true;
 };
 
+bool parse_det(Metadata<PRISMATIC_FLOAT_PRECISION> &meta,
+             int &argc, const char ***argv)
+{
+    if (argc < 2)
+    {
+        cout << "No filename provided for -det (syntax is -det filename)\n";
+        return false;
+    }
+    meta.detectors = readDetectors(std::string((*argv)[1]));
+    argc -= 2;
+    argv[0] += 2;
+    return true;
+};
+
 bool parse_com(Metadata<PRISMATIC_FLOAT_PRECISION> &meta,
               int &argc, const char ***argv)
 {
@@ -1784,6 +2553,16 @@ static std::map<std::string, parseFunction> parser{
     {"--scan-window-xr", parse_wxr}, {"-wxr", parse_wxr},
     {"--tile-uc", parse_t}, {"-t", parse_t},
     {"--num-FP", parse_F}, {"-F", parse_F},
+    {"--concurrent-FP", parse_cFP}, {"-cFP", parse_cFP},
+    {"--pipeline-potential", parse_pp}, {"-pp", parse_pp},
+    {"--target-FP-error", parse_tfe}, {"-tfe", parse_tfe},
+    {"--min-FP", parse_mfp}, {"-mfp", parse_mfp},
+    {"--FP-error-output", parse_feo}, {"-feo", parse_feo},
+    {"--checkpoint-interval", parse_cpi}, {"-cpi", parse_cpi},
+    {"--resume", parse_res}, {"-res", parse_res},
+    {"--scan-tiles", parse_stl}, {"-stl", parse_stl},
+    {"--serve", parse_srv}, {"-srv", parse_srv},
+    {"--reuse-plan", parse_rp}, {"-rp", parse_rp},
     {"--thermal-effects", parse_te}, {"-te", parse_te},
     {"--occupancy", parse_oc}, {"-oc", parse_oc},
     {"--3Dpotential", parse_3DP}, {"-3DP", parse_3DP},
@@ -1791,6 +2570,18 @@ static std::map<std::string, parseFunction> parser{
     {"--save-3D-output", parse_3D}, {"-3D", parse_3D},
     {"--save-4D-output", parse_4D}, {"-4D", parse_4D},
     {"--4D-crop", parse_4DC}, {"-4DC", parse_4DC},
+    {"--4D-shard", parse_4DS}, {"-4DS", parse_4DS},
+    {"--4D-raw", parse_4DR}, {"-4DR", parse_4DR},
+    {"--4D-counted", parse_4DE}, {"-4DE", parse_4DE},
+    {"--4D-precision", parse_4DP}, {"-4DP", parse_4DP},
+    {"--4D-log", parse_4DL}, {"-4DL", parse_4DL},
+    {"--4D-chunk", parse_4DK}, {"-4DK", parse_4DK},
+    {"--4D-bin", parse_4DB}, {"-4DB", parse_4DB},
+    {"--4D-window", parse_4DW}, {"-4DW", parse_4DW},
+    {"--output-filter", parse_ocf}, {"-ocf", parse_ocf},
+    {"--output-filter-level", parse_ocl}, {"-ocl", parse_ocl},
+    {"--output-shuffle", parse_osh}, {"-osh", parse_osh},
+    {"--output-preset", parse_ocp}, {"-ocp", parse_ocp},
     {"--4D-amax", parse_4DA}, {"-4DA", parse_4DA},
     {"--save-DPC-CoM", parse_dpc}, {"-DPC", parse_dpc},
     {"--save-potential-slices", parse_ps}, {"-ps", parse_ps},
@@ -1801,16 +2592,25 @@ static std::map<std::string, parseFunction> parser{
     {"--tilt-offset-tem", parse_tot}, {"-tot", parse_tot},
     {"--probe-pos", parse_pos}, {"-pos", parse_pos},
     {"--max-filesize", parse_maxFile},
+    {"--series-memory", parse_smem}, {"-smem", parse_smem},
+    {"--scratch-dir", parse_scr}, {"-scr", parse_scr},
     {"--probe-defocus-sigma", parse_dfs}, {"-dfs", parse_dfs},
     {"--probe-defocus-range", parse_dfr}, {"-dfr", parse_dfr},
+    {"--probe-series", parse_pser}, {"-pser", parse_pser},
+    {"--series-single-pass", parse_ssp}, {"-ssp", parse_ssp},
     {"--save-smatrix", parse_sm}, {"-sm", parse_sm},
     {"--3Dpotential-zsampling", parse_3DPZ}, {"-3DPZ", parse_3DPZ},
     {"--matrix-refocus", parse_mrf}, {"-mrf", parse_mrf},
+    {"--compress-smatrix", parse_csm}, {"-csm", parse_csm},
+    {"--smatrix-layout", parse_sml}, {"-sml", parse_sml},
+    {"--smatrix-halo", parse_smh}, {"-smh", parse_smh},
     {"--aberrations", parse_aber}, {"-aber", parse_aber},
+    {"--detectors", parse_det}, {"-det", parse_det},
     {"--save-complex", parse_com}, {"-com", parse_com},
     {"--save-probe", parse_probe}, {"-probe", parse_probe},
     {"--import-potential", parse_ips}, {"-ips", parse_ips},
-    {"--import-smatrix", parse_ism}, {"-ism", parse_ism}
+    {"--import-smatrix", parse_ism}, {"-ism", parse_ism},
+    {"--import-cache", parse_ic}, {"-ic", parse_ic}
     };
 bool parseInput(Metadata<PRISMATIC_FLOAT_PRECISION> &meta,
                 int &argc, const char ***argv)
@@ -25,6 +25,9 @@
 #endif
 #include <thread>
 #include <map>
+#include <algorithm>
+#include <exception>
+#include <iostream>
 
 namespace Prismatic
 {
@@ -108,12 +111,60 @@ PRISMATIC_FLOAT_PRECISION computeRfactor(Prismatic::Array2D<std::complex<PRISMAT
 	return diffs / accum;
 }
 
-int nyquistProbes(Prismatic::Parameters<PRISMATIC_FLOAT_PRECISION> pars, size_t dim)
+int nyquistProbes(const Prismatic::Parameters<PRISMATIC_FLOAT_PRECISION> &pars, size_t dim)
 {
 	int nProbes = ceil(4 * (pars.meta.probeSemiangle / pars.lambda) * pars.tiledCellDim[dim]);
 	return nProbes;
 }
 
+std::pair<size_t, size_t> getScanTileRange(const size_t numPositions, const size_t numTiles, const size_t tile)
+{
+	return std::make_pair(tile * numPositions / numTiles, (tile + 1) * numPositions / numTiles);
+}
+
+void getProbePositions(const Prismatic::Parameters<PRISMATIC_FLOAT_PRECISION> &pars,
+					   std::vector<PRISMATIC_FLOAT_PRECISION> &xp_d,
+					   std::vector<PRISMATIC_FLOAT_PRECISION> &yp_d)
+{
+	if(pars.meta.arbitraryProbes)
+	{
+		xp_d = pars.meta.probes_x;
+		yp_d = pars.meta.probes_y;
+	}
+	else
+	{
+		PRISMATIC_FLOAT_PRECISION xR[2] = {pars.scanWindowXMin * pars.tiledCellDim[2], pars.scanWindowXMax * pars.tiledCellDim[2]};
+		PRISMATIC_FLOAT_PRECISION yR[2] = {pars.scanWindowYMin * pars.tiledCellDim[1], pars.scanWindowYMax * pars.tiledCellDim[1]};
+
+		PRISMATIC_FLOAT_PRECISION probeStepX;
+		PRISMATIC_FLOAT_PRECISION probeStepY;
+		if (pars.meta.nyquistSampling)
+		{
+			int numX = nyquistProbes(pars, 2); //x is dim 2
+			int numY = nyquistProbes(pars, 1); //y is dim 1
+			probeStepX = pars.tiledCellDim[2] / numX;
+			probeStepY = pars.tiledCellDim[1] / numY;
+		}
+		else
+		{
+			probeStepX = pars.meta.probeStepX;
+			probeStepY = pars.meta.probeStepY;
+		}
+
+		xp_d = vecFromRange(xR[0], probeStepX, xR[1]);
+		yp_d = vecFromRange(yR[0], probeStepY, yR[1]);
+	}
+
+	//a scan tile worker keeps a band of scan rows, or a range of the probe list for arbitrary probes
+	if(pars.meta.scanTile >= 0)
+	{
+		std::pair<size_t, size_t> range = getScanTileRange(yp_d.size(), pars.meta.scanTiles, pars.meta.scanTile);
+		if(pars.meta.arbitraryProbes)
+			xp_d = std::vector<PRISMATIC_FLOAT_PRECISION>(xp_d.begin() + range.first, xp_d.begin() + range.second);
+		yp_d = std::vector<PRISMATIC_FLOAT_PRECISION>(yp_d.begin() + range.first, yp_d.begin() + range.second);
+	}
+}
+
 std::string remove_extension(const std::string &filename)
 {
 	size_t lastdot = filename.find_last_of(".");
@@ -171,14 +222,277 @@ int testExist(const std::string &filename)
 void updateSeriesParams(Parameters<PRISMATIC_FLOAT_PRECISION> &pars, size_t iter)
 {
 
-    //right now this assumes only CC series
-	std::map<std::string, PRISMATIC_FLOAT_PRECISION*> valMap{{"probeDefocus", &pars.meta.probeDefocus}};
+	//series run over the probe side parameters; aberrations are updated from C1, C3 and C5 by the caller
+	std::map<std::string, PRISMATIC_FLOAT_PRECISION*> valMap{{"probeDefocus", &pars.meta.probeDefocus},
+															 {"C3", &pars.meta.C3},
+															 {"C5", &pars.meta.C5},
+															 {"probeSemiangle", &pars.meta.probeSemiangle},
+															 {"probeXtilt", &pars.meta.probeXtilt},
+															 {"probeYtilt", &pars.meta.probeYtilt}};
     pars.currentTag = pars.meta.seriesTags[iter];
 	for(auto i = 0; i < pars.meta.seriesKeys.size(); i++)
 	{
 		PRISMATIC_FLOAT_PRECISION* val_ptr = valMap[pars.meta.seriesKeys[i]];
 		*val_ptr = pars.meta.seriesVals[i][iter];
 	}
+	pars.xTiltShift = -pars.zTotal * tan(pars.meta.probeXtilt);
+	pars.yTiltShift = -pars.zTotal * tan(pars.meta.probeYtilt);
+};
+
+bool useSeriesPass(Parameters<PRISMATIC_FLOAT_PRECISION> &pars)
+{
+	if(!pars.meta.seriesSinglePass) return false;
+
+	//all members have to share the S-matrix and the probe positions
+	std::string reason;
+	if(pars.meta.matrixRefocus) reason = "matrix refocusing";
+	else if(pars.meta.nyquistSampling and std::find(pars.meta.seriesKeys.begin(), pars.meta.seriesKeys.end(), "probeSemiangle") != pars.meta.seriesKeys.end())
+		reason = "a semiangle series with Nyquist sampled probes";
+#ifdef PRISMATIC_ENABLE_GPU
+	else if(pars.meta.numGPUs > 0) reason = "GPU calculations";
+#endif //PRISMATIC_ENABLE_GPU
+	if(!reason.empty())
+	{
+		std::cout << "Single pass series are not supported with " << reason << ", computing the series members in turn" << std::endl;
+		return false;
+	}
+	return true;
+};
+
+void initFFTWThreads(const size_t numThreads)
+{
+	//FFTW threads are never cleaned up: that destroys the plans of stages running at the same time in other frozen
+	//phonon groups or the potential pipeline, and discards the wisdom gathered so far
+	extern std::mutex fftw_plan_lock;
+	static std::once_flag fftwThreads;
+	std::call_once(fftwThreads, []() { PRISMATIC_FFTW_INIT_THREADS(); });
+	if(numThreads > 0)
+	{
+		std::lock_guard<std::mutex> gatekeeper(fftw_plan_lock);
+		PRISMATIC_FFTW_PLAN_WITH_NTHREADS(numThreads);
+	}
+};
+
+size_t getConcurrentFP(Parameters<PRISMATIC_FLOAT_PRECISION> &pars)
+{
+	//the first frozen phonon sets up the output file, so at most numFP - 1 run at once, each with at least one thread
+	size_t numGroups = std::min(pars.meta.concurrentFP, pars.meta.numThreads);
+	numGroups = std::min(numGroups, pars.meta.numFP - 1);
+	if(numGroups < 2) return 1;
+
+	//frozen phonons of these outputs write their own datasets or share memory that is not locked
+	std::string reason;
+	if(pars.meta.simSeries) reason = "simulation series";
+	else if(pars.meta.saveComplexOutputWave) reason = "complex output waves";
+	else if(pars.meta.savePotentialSlices) reason = "saved potential slices";
+	else if(pars.meta.saveSMatrix) reason = "saved S-matrices";
+	else if(pars.meta.importPotential or pars.meta.importSMatrix) reason = "imported potentials or S-matrices";
+	else if(pars.meta.raw4DOutput) reason = "raw 4D output";
+	else if(pars.meta.countedElectrons > 0) reason = "electron counted 4D output";
+	else if(pars.meta.targetFPError > 0) reason = "a target frozen phonon error";
+	else if(pars.meta.checkpointInterval > 0) reason = "checkpoints";
+#ifdef PRISMATIC_ENABLE_GPU
+	else if(pars.meta.numGPUs > 0) reason = "GPU calculations";
+#endif //PRISMATIC_ENABLE_GPU
+#ifdef PRISMATIC_BUILDING_GUI
+	reason = "the GUI";
+#endif //PRISMATIC_BUILDING_GUI
+	if(!reason.empty())
+	{
+		std::cout << "Concurrent frozen phonons are not supported with " << reason << ", computing them one at a time" << std::endl;
+		return 1;
+	}
+	return numGroups;
+};
+
+size_t getPipelineThreads(Parameters<PRISMATIC_FLOAT_PRECISION> &pars)
+{
+	if(pars.meta.pipelineThreads == 0 or pars.meta.numFP < 2) return 0;
+
+	//the staged potential is computed, never read from a file, and is not saved
+	std::string reason;
+	if(pars.meta.importPotential or pars.meta.importSMatrix) reason = "imported potentials or S-matrices";
+	else if(pars.meta.savePotentialSlices) reason = "saved potential slices";
+	else if(pars.meta.numThreads < 2) reason = "a single thread";
+#ifdef PRISMATIC_BUILDING_GUI
+	reason = "the GUI";
+#endif //PRISMATIC_BUILDING_GUI
+	if(!reason.empty())
+	{
+		std::cout << "The potential pipeline is not supported with " << reason << ", computing the potentials in turn" << std::endl;
+		return 0;
+	}
+	return std::min(pars.meta.pipelineThreads, pars.meta.numThreads - 1);
+};
+
+bool useTargetFPError(Parameters<PRISMATIC_FLOAT_PRECISION> &pars)
+{
+	if(pars.meta.targetFPError <= 0 or pars.meta.numFP < 2) return false;
+
+	//stopping early rescales the 4D datacubes in place, which only plain float datasets of the output file allow
+	std::string reason;
+	if(pars.meta.saveComplexOutputWave) reason = "complex output waves";
+	else if(pars.meta.save4DOutput and pars.meta.shard4DOutput) reason = "sharded 4D output";
+	else if(pars.meta.save4DOutput and pars.meta.raw4DOutput) reason = "raw 4D output";
+	else if(pars.meta.save4DOutput and pars.meta.countedElectrons > 0) reason = "electron counted 4D output";
+	else if(pars.meta.save4DOutput and pars.meta.precision4D != OutputPrecision::Float) reason = "quantized 4D output";
+	else if(pars.meta.convergenceOutput == ConvergenceOutput::Annular2D and !pars.meta.save2DOutput) reason = "a 2D error output without 2D output";
+	else if(pars.meta.convergenceOutput == ConvergenceOutput::DPC_CoM and !pars.meta.saveDPC_CoM) reason = "a DPC error output without DPC output";
+	else if(pars.meta.checkpointInterval > 0) reason = "checkpoints";
+	if(!reason.empty())
+	{
+		std::cout << "A target frozen phonon error is not supported with " << reason << ", computing all " << pars.meta.numFP << " frozen phonons" << std::endl;
+		return false;
+	}
+	return true;
+};
+
+bool useCheckpoint(Parameters<PRISMATIC_FLOAT_PRECISION> &pars)
+{
+	if(pars.meta.checkpointInterval == 0) return false;
+
+	//a resumed frozen phonon rewrites the blocks of plain 4D datacubes in the output file from the journal
+	std::string reason;
+	if(pars.meta.simSeries) reason = "simulation series";
+	else if(pars.meta.saveComplexOutputWave) reason = "complex output waves";
+	else if(pars.meta.savePotentialSlices) reason = "saved potential slices";
+	else if(pars.meta.saveSMatrix) reason = "saved S-matrices";
+	else if(pars.meta.save4DOutput and pars.meta.shard4DOutput) reason = "sharded 4D output";
+	else if(pars.meta.save4DOutput and pars.meta.raw4DOutput) reason = "raw 4D output";
+	else if(pars.meta.save4DOutput and pars.meta.countedElectrons > 0) reason = "electron counted 4D output";
+	else if(pars.meta.save4DOutput and pars.meta.precision4D != OutputPrecision::Float) reason = "quantized 4D output";
+#ifdef PRISMATIC_ENABLE_GPU
+	else if(pars.meta.numGPUs > 0) reason = "GPU calculations";
+#endif //PRISMATIC_ENABLE_GPU
+#ifdef PRISMATIC_BUILDING_GUI
+	reason = "the GUI";
+#endif //PRISMATIC_BUILDING_GUI
+	if(!reason.empty())
+	{
+		std::cout << "Checkpoints are not supported with " << reason << ", running without them" << std::endl;
+		return false;
+	}
+	return true;
+};
+
+std::string getScanTileFallback(Metadata<PRISMATIC_FLOAT_PRECISION> &meta)
+{
+	//the merge concatenates plain datasets along the scan
+	std::string reason;
+	if(meta.algorithm == Algorithm::HRTEM) reason = "HRTEM simulations";
+	else if(meta.simSeries) reason = "simulation series";
+	else if(meta.targetFPError > 0) reason = "a target FP error";
+	else if(meta.checkpointInterval > 0) reason = "checkpoints";
+	else if(meta.save4DOutput and meta.shard4DOutput) reason = "sharded 4D output";
+	else if(meta.save4DOutput and meta.raw4DOutput) reason = "raw 4D output";
+	else if(meta.save4DOutput and meta.countedElectrons > 0) reason = "electron counted 4D output";
+	else if(meta.save4DOutput and meta.precision4D != OutputPrecision::Float) reason = "quantized 4D output";
+#ifdef PRISMATIC_ENABLE_GPU
+	else if(meta.numGPUs > 0) reason = "GPU calculations";
+#endif //PRISMATIC_ENABLE_GPU
+#ifdef PRISMATIC_BUILDING_GUI
+	reason = "the GUI";
+#endif //PRISMATIC_BUILDING_GUI
+	return reason;
+};
+
+bool useScanTiles(Metadata<PRISMATIC_FLOAT_PRECISION> &meta)
+{
+	//workers are tiles themselves
+	if(meta.scanTiles < 2 || meta.scanTile >= 0) return false;
+
+	std::string reason = getScanTileFallback(meta);
+#ifdef _WIN32
+	reason = "Windows";
+#endif //_WIN32
+	if(!reason.empty())
+	{
+		std::cout << "Scan tiles are not supported with " << reason << ", running in one process" << std::endl;
+		return false;
+	}
+	return true;
+};
+
+#ifdef PRISMATIC_ENABLE_MPI
+bool useMPIRanks(Metadata<PRISMATIC_FLOAT_PRECISION> &meta)
+{
+	//ranks use the scan tile workflow with one tile per rank, so they share its limits but not the one on fork
+	std::string reason = getScanTileFallback(meta);
+	if(!reason.empty())
+	{
+		std::cout << "MPI ranks are not supported with " << reason << ", running on rank 0" << std::endl;
+		return false;
+	}
+	return true;
+};
+#endif //PRISMATIC_ENABLE_MPI
+
+void runConcurrentFP(Parameters<PRISMATIC_FLOAT_PRECISION> &pars,
+					 const size_t numGroups,
+					 const std::function<void(Parameters<PRISMATIC_FLOAT_PRECISION> &)> &calcFP)
+{
+	//frozen phonons 1 to numFP - 1 are dealt round robin to the groups, seeds are drawn here so the groups do not share rand()
+	std::vector<size_t> seeds(pars.meta.numFP, 0);
+	for(auto fp = 1; fp < pars.meta.numFP; fp++) seeds[fp] = rand() % 100000;
+
+	//every group computes its own potential and S-matrix, so the ones of the first frozen phonon are not copied
+	pars.pot = Array3D<PRISMATIC_FLOAT_PRECISION>();
+	pars.transmission = Array3D<std::complex<PRISMATIC_FLOAT_PRECISION> >();
+	pars.Scompact = Array3D<std::complex<PRISMATIC_FLOAT_PRECISION> >();
+
+	//groups share the open output file; their 4D writers serialize on DatacubeWriter::fileLock
+	pars.outputFile = H5::H5File(pars.meta.filenameOutput.c_str(), H5F_ACC_RDWR);
+	std::vector<Parameters<PRISMATIC_FLOAT_PRECISION> > groupPars(numGroups, pars);
+	std::vector<std::exception_ptr> errors(numGroups);
+	std::vector<std::thread> groups;
+	groups.reserve(numGroups);
+	std::cout << "Computing " << pars.meta.numFP - 1 << " frozen phonons in " << numGroups << " groups of "
+			  << std::max((size_t)1, pars.meta.numThreads / numGroups) << " threads" << std::endl;
+	for(auto g = 0; g < numGroups; g++)
+	{
+		//equal shares keep the FFTW thread count the same in every group
+		groupPars[g].meta.numThreads = std::max((size_t)1, pars.meta.numThreads / numGroups);
+		groups.push_back(std::thread([&, g]() {
+			Parameters<PRISMATIC_FLOAT_PRECISION> &fpPars = groupPars[g];
+			try
+			{
+				for(auto fp = g + 1; fp < pars.meta.numFP; fp += numGroups)
+				{
+					fpPars.meta.randomSeed = seeds[fp];
+					fpPars.meta.fpNum = fp;
+					fpPars.fpFlag = fp;
+					fpPars.potentialReady = false;
+					std::cout << "Frozen Phonon #" << fp << " (group " << g << ")" << std::endl;
+					calcFP(fpPars);
+
+					if(fp == g + 1)
+					{
+						fpPars.net_output = fpPars.output;
+						if (fpPars.meta.saveDPC_CoM) fpPars.net_DPC_CoM = fpPars.DPC_CoM;
+					}
+					else
+					{
+						fpPars.net_output += fpPars.output;
+						if (fpPars.meta.saveDPC_CoM) fpPars.net_DPC_CoM += fpPars.DPC_CoM;
+					}
+				}
+			}
+			catch(...)
+			{
+				errors[g] = std::current_exception();
+			}
+		}));
+	}
+	for(auto &t : groups) t.join();
+
+	for(auto g = 0; g < numGroups; g++)
+	{
+		if(errors[g]) std::rethrow_exception(errors[g]);
+		pars.net_output += groupPars[g].net_output;
+		if (pars.meta.saveDPC_CoM) pars.net_DPC_CoM += groupPars[g].net_DPC_CoM;
+	}
+	groupPars.clear();
+	pars.outputFile.close();
 };
 
 } // namespace Prismatic
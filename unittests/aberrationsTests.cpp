@@ -299,6 +299,57 @@ BOOST_AUTO_TEST_CASE(abb1)
     writeRealDataSet(group, "qtheta", &qTheta[0], mdims, 2, order);
 };
 
+BOOST_AUTO_TEST_CASE(incrementalChi)
+{
+    //a defocus series updates chi term by term, which should match summing every term directly
+    std::string fname = "../unittests/pfiles/abb1";
+    std::vector<aberration> abberations = readAberrations(fname);
+
+    size_t imsize = 128;
+    PRISMATIC_FLOAT_PRECISION pixelSize = 0.25;
+    Array1D<PRISMATIC_FLOAT_PRECISION> qx = makeFourierCoords(imsize, pixelSize);
+    Array1D<PRISMATIC_FLOAT_PRECISION> qy = makeFourierCoords(imsize, pixelSize);
+
+    std::pair< Array2D<PRISMATIC_FLOAT_PRECISION>, Array2D<PRISMATIC_FLOAT_PRECISION> > mesh = meshgrid(qy,qx);
+    Array2D<PRISMATIC_FLOAT_PRECISION> qya = mesh.first;
+    Array2D<PRISMATIC_FLOAT_PRECISION> qxa = mesh.second;
+    Array2D<PRISMATIC_FLOAT_PRECISION> q1(qya);
+    std::transform(qxa.begin(), qxa.end(),
+                qya.begin(), q1.begin(), [](const PRISMATIC_FLOAT_PRECISION& a, const PRISMATIC_FLOAT_PRECISION& b){
+                return sqrt(a*a + b*b);
+            });
+    Array2D<PRISMATIC_FLOAT_PRECISION> qTheta(q1);
+    std::transform(qxa.begin(), qxa.end(),
+                   qya.begin(), qTheta.begin(), [](const PRISMATIC_FLOAT_PRECISION& a, const PRISMATIC_FLOAT_PRECISION& b){
+                    return atan2(b,a);
+                });
+
+    PRISMATIC_FLOAT_PRECISION lambda = 0.0417571;
+    PRISMATIC_FLOAT_PRECISION pi = acos(-1);
+    PRISMATIC_FLOAT_PRECISION tol = 0.0001;
+    for(auto step = 0; step < 5; step++)
+    {
+        abberations = updateAberrations(abberations, -20.0 + 10.0*step, 1000.0, NAN, lambda);
+        Array2D<std::complex<PRISMATIC_FLOAT_PRECISION>> chi = getChi(q1, qTheta, lambda, abberations);
+
+        PRISMATIC_FLOAT_PRECISION errSum = 0.0;
+        PRISMATIC_FLOAT_PRECISION refSum = 0.0;
+        for(auto k = 0; k < chi.size(); k++)
+        {
+            if(q1[k] > 1.0) continue;
+            PRISMATIC_FLOAT_PRECISION ref = 0.0;
+            for(auto &a : abberations)
+            {
+                PRISMATIC_FLOAT_PRECISION rad = a.angle * pi / 180.0;
+                ref += a.mag*pow(lambda*q1[k], a.m)*(cos(a.n*rad)*cos(a.n*qTheta[k]) + sin(a.n*rad)*sin(a.n*qTheta[k]));
+            }
+            errSum += std::abs(chi[k].real() - ref);
+            refSum += std::abs(ref);
+        }
+        BOOST_TEST(errSum / refSum < tol);
+    }
+};
+
 BOOST_AUTO_TEST_SUITE_END();
 
 }
\ No newline at end of file
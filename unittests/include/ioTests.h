@@ -39,6 +39,20 @@ PRISMATIC_FLOAT_PRECISION compareValues(ArrayND<N, T> &ref, ArrayND<N, T> &test)
     return errorSum/ref.size();
 };
 
+template <size_t N, class T>
+PRISMATIC_FLOAT_PRECISION compareRelative(ArrayND<N, T> &ref, ArrayND<N, T> &test)
+{
+    //returns total error relative to the total reference, for outputs of thermal runs that only agree statistically
+    PRISMATIC_FLOAT_PRECISION errorSum = 0.0;
+    PRISMATIC_FLOAT_PRECISION refSum = 0.0;
+    for(auto i = 0; i < ref.size(); i++)
+    {
+        errorSum += std::abs(ref[i]-test[i]);
+        refSum += std::abs(ref[i]);
+    }
+    return errorSum/refSum;
+};
+
 template <size_t N, class T>
 ArrayND<N-1, T> subspace(ArrayND<N, T> &orig,  const size_t &index)
 {
@@ -9,8 +9,18 @@
 #include <stdio.h>
 #include <random>
 #include "fileIO.h"
+#include "DatasetReader.h"
+#include "JobServer.h"
+#include "DatacubeWriter.h"
 #include "H5Cpp.h"
 #include <thread>
+#include <fstream>
+#include <sstream>
+#include <functional>
+#include <cstdint>
+#include <unistd.h>
+#include <signal.h>
+#include <sys/wait.h>
 
 namespace Prismatic{
 
@@ -102,6 +112,113 @@ void intFunc(int x, int y)
     std::cout << x+y << std::endl;
 };
 
+bool checkpointMidFP(const std::string &state)
+{
+    //whether a checkpoint records a completed frozen phonon, the saved potential of the next one and some of its probes
+    std::ifstream f(state);
+    std::string line, word;
+    size_t completedFP = 0;
+    bool potentialSaved = false;
+    size_t stageRanges[2] = {0, 0};
+    std::getline(f, line);
+    std::getline(f, line);
+    f >> word >> completedFP;
+    std::getline(f, line);
+    f >> word >> potentialSaved;
+    std::getline(f, line);
+    std::getline(f, line);
+    for (auto &ranges : stageRanges)
+    {
+        size_t units, unitFloats;
+        f >> word >> units >> unitFloats >> ranges;
+        std::getline(f, line);
+    }
+    return f && completedFP > 0 && potentialSaved && stageRanges[1] > 0;
+};
+
+void setEdgeProbes(Metadata<PRISMATIC_FLOAT_PRECISION> &meta)
+{
+    //arbitrary probes on both sides of the cell edges, whose S-matrix windows wrap around the cell, mixed with
+    //interior probes close enough together to share a window
+    const PRISMATIC_FLOAT_PRECISION cellX = meta.tileX*5.43;
+    const PRISMATIC_FLOAT_PRECISION cellY = meta.tileY*5.43;
+    std::vector<PRISMATIC_FLOAT_PRECISION> fx = {0.0, 0.004, 0.02, 0.49, 0.5, 0.51, 0.98, 0.996};
+    std::vector<PRISMATIC_FLOAT_PRECISION> fy = {0.002, 0.5, 0.99};
+    meta.probes_x = {};
+    meta.probes_y = {};
+    for(auto i = 0; i < fx.size(); i++)
+    {
+        for(auto j = 0; j < fy.size(); j++)
+        {
+            meta.probes_x.push_back(fx[i]*cellX);
+            meta.probes_y.push_back(fy[j]*cellY);
+        }
+    }
+    meta.arbitraryProbes = true;
+};
+
+void runProbeSynthesis(Metadata<PRISMATIC_FLOAT_PRECISION> meta, const std::string &stem,
+                       const std::function<void(Metadata<PRISMATIC_FLOAT_PRECISION> &)> &setPath)
+{
+    //run the scalar PRISM output path (one probe per batch, beam-major S-matrix, no halo) and the path chosen by setPath,
+    //once on a scan grid over the whole cell and once on arbitrary probes around the cell edges
+    meta.algorithm = Algorithm::PRISM;
+    meta.potential3D = false;
+    meta.savePotentialSlices = false;
+    meta.numThreads = 2;
+    for(auto edges : {false, true})
+    {
+        if(edges) setEdgeProbes(meta);
+        std::string prefix = "../unittests/outputs/" + stem + (edges ? "_edges" : "_grid");
+
+        Metadata<PRISMATIC_FLOAT_PRECISION> ref = meta;
+        ref.batchSizeTargetCPU = 1;
+        ref.sMatrixLayout = SMatrixLayout::BeamMajor;
+        ref.sMatrixHalo = false;
+        ref.filenameOutput = prefix + "_ref.h5";
+        go(ref);
+        std::cout << "\n--------------------------------------------\n";
+
+        Metadata<PRISMATIC_FLOAT_PRECISION> test = meta;
+        setPath(test);
+        test.filenameOutput = prefix + ".h5";
+        go(test);
+        std::cout << "\n--------------------------------------------\n";
+    }
+};
+
+void compareProbeSynthesis(const std::string &stem)
+{
+    //the output paths only reorder the sums over beams, so the 2D, 3D and 4D outputs agree to float precision
+    std::string dataPath2D = "4DSTEM_simulation/data/realslices/annular_detector_depth0000/data";
+    std::string dataPath3D = "4DSTEM_simulation/data/realslices/virtual_detector_depth0000/data";
+    std::string dataPath4D = "4DSTEM_simulation/data/datacubes/CBED_array_depth0000/data";
+    PRISMATIC_FLOAT_PRECISION tol = 0.0001;
+    for(auto edges : {false, true})
+    {
+        std::string prefix = "../unittests/outputs/" + stem + (edges ? "_edges" : "_grid");
+        std::string refFile = prefix + "_ref.h5";
+        std::string testFile = prefix + ".h5";
+
+        Array2D<PRISMATIC_FLOAT_PRECISION> refAnnular = readDataSet2D(refFile, dataPath2D);
+        Array3D<PRISMATIC_FLOAT_PRECISION> refVD = readDataSet3D(refFile, dataPath3D);
+        Array4D<PRISMATIC_FLOAT_PRECISION> refCBED = readDataSet4D(refFile, dataPath4D);
+        Array2D<PRISMATIC_FLOAT_PRECISION> testAnnular = readDataSet2D(testFile, dataPath2D);
+        Array3D<PRISMATIC_FLOAT_PRECISION> testVD = readDataSet3D(testFile, dataPath3D);
+        Array4D<PRISMATIC_FLOAT_PRECISION> testCBED = readDataSet4D(testFile, dataPath4D);
+
+        BOOST_TEST(compareSize(refAnnular, testAnnular));
+        BOOST_TEST(compareSize(refVD, testVD));
+        BOOST_TEST(compareSize(refCBED, testCBED));
+        BOOST_TEST(compareRelative(refAnnular, testAnnular) < tol);
+        BOOST_TEST(compareRelative(refVD, testVD) < tol);
+        BOOST_TEST(compareRelative(refCBED, testCBED) < tol);
+
+        removeFile(refFile);
+        removeFile(testFile);
+    }
+};
+
 herr_t CBED_process(void *elem, hid_t type_id, unsigned ndim, const hsize_t *point, void *operator_data)
 {
     try
@@ -1043,6 +1160,107 @@ BOOST_AUTO_TEST_CASE(complexIO)
     removeFile(fname);
 }
 
+BOOST_AUTO_TEST_CASE(datacubeWriter)
+{
+    //frames pushed from several threads should land in their hyperslabs, and a second pass should add to the first
+    int seed = 20202;
+    std::default_random_engine de(seed);
+    size_t numX = 5; size_t numY = 3; size_t Qy = 4; size_t Qx = 6;
+    PRISMATIC_FLOAT_PRECISION numFP = 2;
+
+    Array4D<PRISMATIC_FLOAT_PRECISION> frames = zeros_ND<4,PRISMATIC_FLOAT_PRECISION>({{numX,numY,Qy,Qx}});
+    assignRandomValues(frames, de);
+
+    std::string fname = "../unittests/outputs/testFile.h5";
+    H5::H5File testFile = H5::H5File(fname.c_str(), H5F_ACC_TRUNC);
+    H5::Group testGroup(testFile.createGroup("/cube"));
+    hsize_t data_dims[4] = {numX, numY, Qy, Qx};
+    H5::DataSpace mspace(4, data_dims);
+    H5::DataSet cube = testGroup.createDataSet("data", PFP_TYPE, mspace);
+    cube.close();
+    mspace.close();
+    testGroup.close();
+
+    for(auto pass = 0; pass < 2; pass++)
+    {
+        DatacubeWriter writer(testFile, numX, numY, pass > 0);
+        std::vector<std::thread> workers;
+        for(auto t = 0; t < 3; t++)
+        {
+            workers.push_back(std::thread([&, t]() {
+                for(auto n = t; n < numX*numY; n += 3)
+                {
+                    hsize_t mdims[4] = {1, 1, Qy, Qx};
+                    hsize_t offset[4] = {n % numX, n / numX, 0, 0};
+                    writer.push("/cube", &frames.at(n % numX, n / numX, 0, 0), mdims, offset, 1, numFP);
+                }
+            }));
+        }
+        for(auto &w : workers) w.join();
+        writer.finish();
+    }
+    testFile.close();
+
+    Array4D<PRISMATIC_FLOAT_PRECISION> readBack;
+    readRealDataSet_inOrder(readBack, fname, "cube/data");
+
+    PRISMATIC_FLOAT_PRECISION tol = 0.0001;
+    BOOST_TEST(compareSize(frames, readBack));
+    BOOST_TEST(compareValues(frames, readBack) < tol);
+
+    removeFile(fname);
+}
+
+BOOST_AUTO_TEST_CASE(datasetReader)
+{
+    //slabs, prefetched slabs, and tiles handed out by the reader should match the dataset read in full
+    int seed = 30303;
+    std::default_random_engine de(seed);
+    size_t N0 = 7; size_t N1 = 5; size_t N2 = 4;
+
+    Array3D<PRISMATIC_FLOAT_PRECISION> data = zeros_ND<3,PRISMATIC_FLOAT_PRECISION>({{N0,N1,N2}});
+    assignRandomValues(data, de);
+
+    std::string fname = "../unittests/outputs/testFile.h5";
+    H5::H5File testFile = H5::H5File(fname.c_str(), H5F_ACC_TRUNC);
+    H5::Group testGroup(testFile.createGroup("/data"));
+    hsize_t mdims[3] = {N0, N1, N2};
+    writeRealDataSet_inOrder(testGroup, "data", &data[0], mdims, 3);
+    testGroup.close();
+    testFile.close();
+
+    PRISMATIC_FLOAT_PRECISION errSum = 0.0;
+    {
+        //cache of two entries forces slabs out of the cache while they are being read
+        DatasetReader<PRISMATIC_FLOAT_PRECISION> reader(fname, "data/data", 2*N1*N2*sizeof(PRISMATIC_FLOAT_PRECISION));
+        BOOST_TEST(reader.getDims()[0] == N0);
+        BOOST_TEST(reader.getDims()[2] == N2);
+
+        for(auto k0 = 0; k0 < N0; k0 += 2)
+        {
+            size_t num = std::min((size_t) 2, N0 - k0);
+            reader.prefetch(k0 + num, std::min((size_t) 2, N0 - k0 - num));
+            std::shared_ptr<const std::vector<PRISMATIC_FLOAT_PRECISION>> slab = reader.getSlab(k0, num);
+            BOOST_TEST(slab->size() == num*N1*N2);
+            for(auto i = 0; i < slab->size(); i++) errSum += std::abs((*slab)[i] - data[k0*N1*N2 + i]);
+        }
+
+        hsize_t offset[3] = {2, 1, 1};
+        hsize_t count[3] = {3, 2, 2};
+        std::vector<PRISMATIC_FLOAT_PRECISION> tile(12);
+        reader.read(offset, count, &tile[0]);
+        for(auto k = 0; k < 3; k++)
+            for(auto j = 0; j < 2; j++)
+                for(auto i = 0; i < 2; i++)
+                    errSum += std::abs(tile[(k*2 + j)*2 + i] - data.at(k+2, j+1, i+1));
+    }
+
+    PRISMATIC_FLOAT_PRECISION tol = 0.0001;
+    BOOST_TEST(errSum < tol);
+
+    removeFile(fname);
+}
+
 BOOST_AUTO_TEST_CASE(dataGroupCount)
 {
     //create a test file
@@ -1390,6 +1608,1252 @@ BOOST_FIXTURE_TEST_CASE(complexOutputWave_M, basicSim)
     removeFile(amplitudeFile);
 }
 
+BOOST_FIXTURE_TEST_CASE(shardedOutput_P, basicSim)
+{
+    //sharded 4D output read through the virtual datacube should match the single-file datacube
+    meta.potential3D = false;
+    meta.algorithm = Algorithm::PRISM;
+    meta.filenameOutput = "../unittests/outputs/shardedOutput_ref.h5";
+    meta.savePotentialSlices = false;
+    meta.numFP = 2;
+
+    divertOutput(pos, fd, logPath);
+    std::cout << "\n####### BEGIN TEST CASE: shardedOutput_P #######\n";
+
+    go(meta);
+
+    std::cout << "\n--------------------------------------------\n";
+
+    meta.filenameOutput = "../unittests/outputs/shardedOutput.h5";
+    meta.shard4DOutput = true;
+    go(meta);
+    std::cout << "######## END TEST CASE: shardedOutput_P ########\n";
+
+    revertOutput(fd, pos);
+
+    std::string refFile = "../unittests/outputs/shardedOutput_ref.h5";
+    std::string testFile = "../unittests/outputs/shardedOutput.h5";
+    std::string dataPath4D = "4DSTEM_simulation/data/datacubes/CBED_array_depth0000/data";
+
+    std::vector<size_t> order_4D = {2,3,0,1};
+    Array4D<PRISMATIC_FLOAT_PRECISION> refCBED;
+    Array4D<PRISMATIC_FLOAT_PRECISION> testCBED;
+    readRealDataSet(refCBED, refFile, dataPath4D, order_4D);
+    readRealDataSet(testCBED, testFile, dataPath4D, order_4D);
+
+    PRISMATIC_FLOAT_PRECISION tol = 0.0001;
+    BOOST_TEST(compareSize(refCBED, testCBED));
+    BOOST_TEST(compareValues(refCBED, testCBED) < tol);
+
+    removeFile(refFile);
+    removeFile(testFile);
+    removeFile("../unittests/outputs/shardedOutput_CBED_array_depth0000_shard000000.h5");
+}
+
+BOOST_FIXTURE_TEST_CASE(shardedQuantizedOutput_P, basicSim)
+{
+    //quantized shards read through the virtual datacube should match the single-file quantized datacube when the cube
+    //spans several blocks sized by the integer levels rather than by floats
+    meta.potential3D = false;
+    meta.algorithm = Algorithm::PRISM;
+    meta.filenameOutput = "../unittests/outputs/shardedQuantizedOutput_ref.h5";
+    meta.savePotentialSlices = false;
+    meta.numFP = 2;
+    meta.precision4D = OutputPrecision::UInt16;
+
+    divertOutput(pos, fd, logPath);
+    std::cout << "\n### BEGIN TEST CASE: shardedQuantizedOutput_P ###\n";
+
+    go(meta);
+    revertOutput(fd, pos);
+
+    std::string refFile = "../unittests/outputs/shardedQuantizedOutput_ref.h5";
+    std::string testFile = "../unittests/outputs/shardedQuantizedOutput.h5";
+    std::string dataPath4D = "4DSTEM_simulation/data/datacubes/CBED_array_depth0000/data";
+
+    //blocks of two scan rows of uint16 levels, which would be a single row of floats
+    H5::H5File refOutput(refFile.c_str(), H5F_ACC_RDONLY);
+    H5::DataSet refCube = refOutput.openDataSet(dataPath4D.c_str());
+    hsize_t dims[4];
+    refCube.getSpace().getSimpleExtentDims(dims);
+    std::vector<uint16_t> refLevels(dims[0]*dims[1]*dims[2]*dims[3]);
+    refCube.read(&refLevels[0], H5::PredType::NATIVE_UINT16);
+    refCube.close();
+    refOutput.close();
+    size_t defaultBlockBytes = DatacubeWriter::targetBlockBytes;
+    DatacubeWriter::targetBlockBytes = 2*dims[0]*dims[2]*dims[3]*sizeof(uint16_t);
+
+    divertOutput(pos, fd, logPath);
+    std::cout << "\n--------------------------------------------\n";
+    meta.filenameOutput = testFile;
+    meta.shard4DOutput = true;
+    go(meta);
+    std::cout << "#### END TEST CASE: shardedQuantizedOutput_P ####\n";
+    revertOutput(fd, pos);
+    DatacubeWriter::targetBlockBytes = defaultBlockBytes;
+
+    H5::H5File output(testFile.c_str(), H5F_ACC_RDONLY);
+    H5::DataSet cube = output.openDataSet(dataPath4D.c_str());
+    hsize_t testDims[4];
+    cube.getSpace().getSimpleExtentDims(testDims);
+    std::vector<uint16_t> levels(refLevels.size());
+    cube.read(&levels[0], H5::PredType::NATIVE_UINT16);
+    cube.close();
+    output.close();
+
+    BOOST_TEST(std::equal(dims, dims + 4, testDims));
+    BOOST_TEST((levels == refLevels));
+
+    //one shard per band of two rows
+    size_t numShards = (dims[1] + 1) / 2;
+    BOOST_TEST(numShards > 1);
+    removeFile(refFile);
+    removeFile(testFile);
+    for (auto i = 0; i < numShards; i++)
+        removeFile(DatacubeWriter::getShardName("../unittests/outputs/shardedQuantizedOutput", "CBED_array_depth0000", i));
+}
+
+BOOST_FIXTURE_TEST_CASE(compressedOutput_M, basicSim)
+{
+    //row chunks with shuffle and deflate should read back the same datacube as the uncompressed default
+    meta.potential3D = false;
+    meta.algorithm = Algorithm::Multislice;
+    meta.filenameOutput = "../unittests/outputs/compressedOutput_ref.h5";
+    meta.savePotentialSlices = false;
+    meta.numFP = 2;
+
+    divertOutput(pos, fd, logPath);
+    std::cout << "\n###### BEGIN TEST CASE: compressedOutput_M ######\n";
+
+    go(meta);
+
+    std::cout << "\n--------------------------------------------\n";
+
+    meta.filenameOutput = "../unittests/outputs/compressedOutput.h5";
+    meta.chunk4D = std::vector<size_t>{0, 1, 0, 0};
+    meta.outputFilter = OutputFilter::Deflate;
+    meta.outputFilterLevel = 4;
+    go(meta);
+    std::cout << "####### END TEST CASE: compressedOutput_M #######\n";
+
+    revertOutput(fd, pos);
+
+    std::string refFile = "../unittests/outputs/compressedOutput_ref.h5";
+    std::string testFile = "../unittests/outputs/compressedOutput.h5";
+    std::string dataPath4D = "4DSTEM_simulation/data/datacubes/CBED_array_depth0000/data";
+    std::string dataPath3D = "4DSTEM_simulation/data/realslices/virtual_detector_depth0000/data";
+
+    std::vector<size_t> order_4D = {2,3,0,1};
+    Array4D<PRISMATIC_FLOAT_PRECISION> refCBED;
+    Array4D<PRISMATIC_FLOAT_PRECISION> testCBED;
+    readRealDataSet(refCBED, refFile, dataPath4D, order_4D);
+    readRealDataSet(testCBED, testFile, dataPath4D, order_4D);
+
+    Array3D<PRISMATIC_FLOAT_PRECISION> refVD = readDataSet3D(refFile, dataPath3D);
+    Array3D<PRISMATIC_FLOAT_PRECISION> testVD = readDataSet3D(testFile, dataPath3D);
+
+    PRISMATIC_FLOAT_PRECISION tol = 0.0001;
+    BOOST_TEST(compareSize(refCBED, testCBED));
+    BOOST_TEST(compareValues(refCBED, testCBED) < tol);
+    BOOST_TEST(compareValues(refVD, testVD) < tol);
+
+    //the datacube should carry the shuffle and deflate filters
+    H5::H5File output(testFile.c_str(), H5F_ACC_RDONLY);
+    H5::DataSet cube = output.openDataSet(dataPath4D.c_str());
+    BOOST_TEST(cube.getCreatePlist().getNfilters() == 2);
+    cube.close();
+    output.close();
+
+    removeFile(refFile);
+    removeFile(testFile);
+}
+
+BOOST_FIXTURE_TEST_CASE(rawOutput_M, basicSim)
+{
+    //the memory-mapped .npy datacube should hold the same values as the HDF5 datacube
+    meta.potential3D = false;
+    meta.algorithm = Algorithm::Multislice;
+    meta.filenameOutput = "../unittests/outputs/rawOutput_ref.h5";
+    meta.savePotentialSlices = false;
+    meta.numFP = 2;
+
+    divertOutput(pos, fd, logPath);
+    std::cout << "\n######### BEGIN TEST CASE: rawOutput_M #########\n";
+
+    go(meta);
+
+    std::cout << "\n--------------------------------------------\n";
+
+    meta.filenameOutput = "../unittests/outputs/rawOutput.h5";
+    meta.raw4DOutput = true;
+    go(meta);
+    std::cout << "########## END TEST CASE: rawOutput_M ##########\n";
+
+    revertOutput(fd, pos);
+
+    std::string refFile = "../unittests/outputs/rawOutput_ref.h5";
+    std::string testFile = "../unittests/outputs/rawOutput.h5";
+    std::string rawFile = "../unittests/outputs/rawOutput_CBED_array_depth0000.npy";
+    std::string sidecarFile = "../unittests/outputs/rawOutput.json";
+    std::string dataPath4D = "4DSTEM_simulation/data/datacubes/CBED_array_depth0000/data";
+
+    Array4D<PRISMATIC_FLOAT_PRECISION> refCBED;
+    readRealDataSet_inOrder(refCBED, refFile, dataPath4D);
+
+    //npy v1.0: 8 byte magic and version, 2 byte header length, then the header dict
+    std::ifstream raw(rawFile, std::ios::binary);
+    char preamble[10];
+    raw.read(preamble, 10);
+    size_t headerLength = (unsigned char) preamble[8] + 256 * (unsigned char) preamble[9];
+    std::string header(headerLength, ' ');
+    raw.read(&header[0], headerLength);
+    BOOST_TEST((10 + headerLength) % 64 == 0);
+    BOOST_TEST(header.find("'fortran_order': False") != std::string::npos);
+
+    std::vector<PRISMATIC_FLOAT_PRECISION> testCBED(refCBED.size());
+    raw.read(reinterpret_cast<char *>(&testCBED[0]), testCBED.size() * sizeof(PRISMATIC_FLOAT_PRECISION));
+    BOOST_TEST(raw.gcount() == testCBED.size() * sizeof(PRISMATIC_FLOAT_PRECISION));
+    raw.close();
+
+    PRISMATIC_FLOAT_PRECISION errSum = 0.0;
+    for (auto i = 0; i < refCBED.size(); i++) errSum += std::abs(refCBED[i] - testCBED[i]);
+    PRISMATIC_FLOAT_PRECISION tol = 0.0001;
+    BOOST_TEST(errSum < tol);
+
+    //the HDF5 file keeps only the dims of the datacube, the sidecar points to the raw file
+    H5::H5File output(testFile.c_str(), H5F_ACC_RDONLY);
+    BOOST_TEST(!output.nameExists(dataPath4D.c_str()));
+    output.close();
+
+    std::ifstream sidecar(sidecarFile);
+    std::string description((std::istreambuf_iterator<char>(sidecar)), std::istreambuf_iterator<char>());
+    sidecar.close();
+    BOOST_TEST(description.find("\"file\": \"rawOutput_CBED_array_depth0000.npy\"") != std::string::npos);
+    BOOST_TEST(description.find("\"simulation_parameters\"") != std::string::npos);
+
+    removeFile(refFile);
+    removeFile(testFile);
+    removeFile(rawFile);
+    removeFile(sidecarFile);
+}
+
+BOOST_FIXTURE_TEST_CASE(countedOutput_M, basicSim)
+{
+    //the sampled counts should total the dose times the dense intensity, within Poisson noise
+    meta.potential3D = false;
+    meta.algorithm = Algorithm::Multislice;
+    meta.filenameOutput = "../unittests/outputs/countedOutput_ref.h5";
+    meta.savePotentialSlices = false;
+    meta.numFP = 2;
+
+    divertOutput(pos, fd, logPath);
+    std::cout << "\n####### BEGIN TEST CASE: countedOutput_M #######\n";
+
+    go(meta);
+
+    std::cout << "\n--------------------------------------------\n";
+
+    meta.filenameOutput = "../unittests/outputs/countedOutput.h5";
+    meta.countedElectrons = 1000;
+    go(meta);
+    std::cout << "######## END TEST CASE: countedOutput_M ########\n";
+
+    revertOutput(fd, pos);
+
+    std::string refFile = "../unittests/outputs/countedOutput_ref.h5";
+    std::string testFile = "../unittests/outputs/countedOutput.h5";
+    std::string dataPath4D = "4DSTEM_simulation/data/datacubes/CBED_array_depth0000/data";
+    std::string countedPath = "4DSTEM_simulation/data/counted_datacubes/CBED_array_depth0000/";
+
+    Array4D<PRISMATIC_FLOAT_PRECISION> refCBED;
+    readRealDataSet_inOrder(refCBED, refFile, dataPath4D);
+    PRISMATIC_FLOAT_PRECISION expected = 0.0;
+    for (auto i = 0; i < refCBED.size(); i++) expected += refCBED[i] * meta.countedElectrons;
+
+    H5::H5File output(testFile.c_str(), H5F_ACC_RDONLY);
+    BOOST_TEST(!output.nameExists("4DSTEM_simulation/data/datacubes/CBED_array_depth0000"));
+
+    H5::DataSet offsetData = output.openDataSet((countedPath + "frame_offsets").c_str());
+    std::vector<uint64_t> offsets(offsetData.getSpace().getSimpleExtentNpoints());
+    offsetData.read(&offsets[0], H5::PredType::NATIVE_UINT64);
+    BOOST_TEST(offsets.size() == refCBED.get_diml() * refCBED.get_dimk() + 1);
+
+    H5::DataSet indexData = output.openDataSet((countedPath + "pixel_index").c_str());
+    H5::DataSet countData = output.openDataSet((countedPath + "counts").c_str());
+    std::vector<uint32_t> indices(offsets.back());
+    std::vector<uint32_t> counts(offsets.back());
+    BOOST_TEST(indices.size() > 0);
+    indexData.read(&indices[0], H5::PredType::NATIVE_UINT32);
+    countData.read(&counts[0], H5::PredType::NATIVE_UINT32);
+    output.close();
+
+    size_t frameSize = refCBED.get_dimj() * refCBED.get_dimi();
+    PRISMATIC_FLOAT_PRECISION total = 0.0;
+    bool inFrame = true;
+    for (auto e = 0; e < counts.size(); e++)
+    {
+        total += counts[e];
+        inFrame = inFrame && (indices[e] < frameSize);
+    }
+    BOOST_TEST(inFrame);
+    BOOST_TEST(std::abs(total - expected) < 5 * std::sqrt(expected));
+
+    removeFile(refFile);
+    removeFile(testFile);
+}
+
+BOOST_FIXTURE_TEST_CASE(quantizedOutput_P, basicSim)
+{
+    //uint16 patterns decoded with their scale and offset should stay within the documented bound of the float datacube
+    meta.potential3D = false;
+    meta.algorithm = Algorithm::PRISM;
+    meta.filenameOutput = "../unittests/outputs/quantizedOutput_ref.h5";
+    meta.savePotentialSlices = false;
+    meta.numFP = 2;
+
+    divertOutput(pos, fd, logPath);
+    std::cout << "\n###### BEGIN TEST CASE: quantizedOutput_P ######\n";
+
+    go(meta);
+
+    std::cout << "\n--------------------------------------------\n";
+
+    meta.filenameOutput = "../unittests/outputs/quantizedOutput.h5";
+    meta.precision4D = OutputPrecision::UInt16;
+    go(meta);
+    std::cout << "####### END TEST CASE: quantizedOutput_P #######\n";
+
+    revertOutput(fd, pos);
+
+    std::string refFile = "../unittests/outputs/quantizedOutput_ref.h5";
+    std::string testFile = "../unittests/outputs/quantizedOutput.h5";
+    std::string groupPath = "4DSTEM_simulation/data/datacubes/CBED_array_depth0000/";
+
+    Array4D<PRISMATIC_FLOAT_PRECISION> refCBED;
+    readRealDataSet_inOrder(refCBED, refFile, groupPath + "data");
+
+    H5::H5File output(testFile.c_str(), H5F_ACC_RDONLY);
+    H5::DataSet cube = output.openDataSet((groupPath + "data").c_str());
+    BOOST_TEST(cube.getDataType().getSize() == 2);
+    std::vector<uint16_t> levels(refCBED.size());
+    cube.read(&levels[0], H5::PredType::NATIVE_UINT16);
+    size_t numFrames = refCBED.get_diml() * refCBED.get_dimk();
+    std::vector<PRISMATIC_FLOAT_PRECISION> scales(numFrames);
+    std::vector<PRISMATIC_FLOAT_PRECISION> offsets(numFrames);
+    output.openDataSet((groupPath + "scale").c_str()).read(&scales[0], PFP_TYPE);
+    output.openDataSet((groupPath + "offset").c_str()).read(&offsets[0], PFP_TYPE);
+    output.close();
+
+    size_t frameSize = refCBED.get_dimj() * refCBED.get_dimi();
+    bool withinBound = true;
+    for (auto f = 0; f < numFrames; f++)
+    {
+        for (auto i = 0; i < frameSize; i++)
+        {
+            PRISMATIC_FLOAT_PRECISION decoded = offsets[f] + scales[f] * levels[f * frameSize + i];
+            PRISMATIC_FLOAT_PRECISION bound = meta.numFP * scales[f] / 2 + 1e-6 * refCBED[f * frameSize + i];
+            withinBound = withinBound && std::abs(decoded - refCBED[f * frameSize + i]) <= bound;
+        }
+    }
+    BOOST_TEST(withinBound);
+
+    removeFile(refFile);
+    removeFile(testFile);
+}
+
+BOOST_FIXTURE_TEST_CASE(binnedOutput_M, basicSim)
+{
+    //binning during the simulation should match 2x2 sums over the full datacube
+    meta.potential3D = false;
+    meta.algorithm = Algorithm::Multislice;
+    meta.filenameOutput = "../unittests/outputs/binnedOutput_ref.h5";
+    meta.savePotentialSlices = false;
+    meta.numFP = 1;
+
+    divertOutput(pos, fd, logPath);
+    std::cout << "\n######## BEGIN TEST CASE: binnedOutput_M ########\n";
+
+    go(meta);
+
+    std::cout << "\n--------------------------------------------\n";
+
+    meta.filenameOutput = "../unittests/outputs/binnedOutput.h5";
+    meta.bin4D = std::vector<size_t>{2, 2};
+    go(meta);
+    std::cout << "######### END TEST CASE: binnedOutput_M #########\n";
+
+    revertOutput(fd, pos);
+
+    std::string refFile = "../unittests/outputs/binnedOutput_ref.h5";
+    std::string testFile = "../unittests/outputs/binnedOutput.h5";
+    std::string dataPath4D = "4DSTEM_simulation/data/datacubes/CBED_array_depth0000/data";
+
+    Array4D<PRISMATIC_FLOAT_PRECISION> refCBED;
+    Array4D<PRISMATIC_FLOAT_PRECISION> testCBED;
+    readRealDataSet_inOrder(refCBED, refFile, dataPath4D);
+    readRealDataSet_inOrder(testCBED, testFile, dataPath4D);
+
+    BOOST_TEST(testCBED.get_diml() == refCBED.get_diml());
+    BOOST_TEST(testCBED.get_dimk() == refCBED.get_dimk());
+    BOOST_TEST(testCBED.get_dimj() == refCBED.get_dimj() / 2);
+    BOOST_TEST(testCBED.get_dimi() == refCBED.get_dimi() / 2);
+
+    PRISMATIC_FLOAT_PRECISION errSum = 0.0;
+    for (auto l = 0; l < testCBED.get_diml(); l++)
+    {
+        for (auto k = 0; k < testCBED.get_dimk(); k++)
+        {
+            for (auto j = 0; j < testCBED.get_dimj(); j++)
+            {
+                for (auto i = 0; i < testCBED.get_dimi(); i++)
+                {
+                    PRISMATIC_FLOAT_PRECISION binned = refCBED.at(l, k, 2 * j, 2 * i) + refCBED.at(l, k, 2 * j + 1, 2 * i) +
+                                                       refCBED.at(l, k, 2 * j, 2 * i + 1) + refCBED.at(l, k, 2 * j + 1, 2 * i + 1);
+                    errSum += std::abs(binned - testCBED.at(l, k, j, i));
+                }
+            }
+        }
+    }
+    PRISMATIC_FLOAT_PRECISION tol = 0.0001;
+    BOOST_TEST(errSum < tol);
+
+    removeFile(refFile);
+    removeFile(testFile);
+}
+
+BOOST_FIXTURE_TEST_CASE(concurrentFP_M, basicSim)
+{
+    //without thermal motion all frozen phonons are equal, so running them concurrently should not change the output
+    meta.potential3D = false;
+    meta.algorithm = Algorithm::Multislice;
+    meta.filenameOutput = "../unittests/outputs/concurrentFP_ref.h5";
+    meta.savePotentialSlices = false;
+    meta.includeThermalEffects = false;
+    meta.includeOccupancy = false;
+    meta.numThreads = 4;
+    meta.numFP = 5;
+
+    divertOutput(pos, fd, logPath);
+    std::cout << "\n######## BEGIN TEST CASE: concurrentFP_M ########\n";
+
+    go(meta);
+
+    std::cout << "\n--------------------------------------------\n";
+
+    meta.filenameOutput = "../unittests/outputs/concurrentFP.h5";
+    meta.concurrentFP = 2;
+    go(meta);
+    std::cout << "######### END TEST CASE: concurrentFP_M #########\n";
+
+    revertOutput(fd, pos);
+
+    std::string refFile = "../unittests/outputs/concurrentFP_ref.h5";
+    std::string testFile = "../unittests/outputs/concurrentFP.h5";
+    std::string dataPath3D = "4DSTEM_simulation/data/realslices/virtual_detector_depth0000/data";
+    std::string dataPath4D = "4DSTEM_simulation/data/datacubes/CBED_array_depth0000/data";
+
+    Array3D<PRISMATIC_FLOAT_PRECISION> refVD = readDataSet3D(refFile, dataPath3D);
+    Array3D<PRISMATIC_FLOAT_PRECISION> testVD = readDataSet3D(testFile, dataPath3D);
+    Array4D<PRISMATIC_FLOAT_PRECISION> refCBED;
+    Array4D<PRISMATIC_FLOAT_PRECISION> testCBED;
+    readRealDataSet_inOrder(refCBED, refFile, dataPath4D);
+    readRealDataSet_inOrder(testCBED, testFile, dataPath4D);
+
+    PRISMATIC_FLOAT_PRECISION tol = 0.0001;
+    BOOST_TEST(compareSize(refVD, testVD));
+    BOOST_TEST(compareValues(refVD, testVD) < tol);
+
+    BOOST_TEST(refCBED.size() == testCBED.size());
+    PRISMATIC_FLOAT_PRECISION errSum = 0.0;
+    for (auto i = 0; i < refCBED.size(); i++) errSum += std::abs(refCBED[i] - testCBED[i]);
+    BOOST_TEST(errSum < tol);
+
+    removeFile(refFile);
+    removeFile(testFile);
+}
+
+BOOST_FIXTURE_TEST_CASE(concurrentFP_thermal_M, basicSim)
+{
+    //with thermal motion and 3D potentials the groups draw their own displacements and run FFTs at the same time,
+    //so the averages of a concurrent and a sequential run only agree statistically
+    meta.algorithm = Algorithm::Multislice;
+    meta.filenameOutput = "../unittests/outputs/concurrentFP_thermal_ref.h5";
+    meta.savePotentialSlices = false;
+    meta.save4DOutput = false;
+    meta.includeThermalEffects = true;
+    meta.numThreads = 4;
+    meta.numFP = 4;
+
+    divertOutput(pos, fd, logPath);
+    std::cout << "\n######## BEGIN TEST CASE: concurrentFP_thermal_M ########\n";
+
+    go(meta);
+
+    std::cout << "\n--------------------------------------------\n";
+
+    meta.filenameOutput = "../unittests/outputs/concurrentFP_thermal.h5";
+    meta.concurrentFP = 3;
+    go(meta);
+    std::cout << "######### END TEST CASE: concurrentFP_thermal_M #########\n";
+
+    revertOutput(fd, pos);
+
+    std::string refFile = "../unittests/outputs/concurrentFP_thermal_ref.h5";
+    std::string testFile = "../unittests/outputs/concurrentFP_thermal.h5";
+    std::string dataPath3D = "4DSTEM_simulation/data/realslices/virtual_detector_depth0000/data";
+
+    Array3D<PRISMATIC_FLOAT_PRECISION> refVD = readDataSet3D(refFile, dataPath3D);
+    Array3D<PRISMATIC_FLOAT_PRECISION> testVD = readDataSet3D(testFile, dataPath3D);
+
+    PRISMATIC_FLOAT_PRECISION tol = 0.1;
+    BOOST_TEST(compareSize(refVD, testVD));
+    BOOST_TEST(compareRelative(refVD, testVD) < tol);
+
+    removeFile(refFile);
+    removeFile(testFile);
+}
+
+BOOST_FIXTURE_TEST_CASE(pipelinePotential_P, basicSim)
+{
+    //without thermal motion all potentials are equal, so computing them ahead should not change the output
+    meta.potential3D = false;
+    meta.filenameOutput = "../unittests/outputs/pipelinePotential_ref.h5";
+    meta.savePotentialSlices = false;
+    meta.includeThermalEffects = false;
+    meta.includeOccupancy = false;
+    meta.numThreads = 4;
+    meta.numFP = 3;
+
+    divertOutput(pos, fd, logPath);
+    std::cout << "\n##### BEGIN TEST CASE: pipelinePotential_P #####\n";
+
+    go(meta);
+
+    std::cout << "\n--------------------------------------------\n";
+
+    meta.filenameOutput = "../unittests/outputs/pipelinePotential.h5";
+    meta.pipelineThreads = 1;
+    go(meta);
+    std::cout << "###### END TEST CASE: pipelinePotential_P ######\n";
+
+    revertOutput(fd, pos);
+
+    std::string refFile = "../unittests/outputs/pipelinePotential_ref.h5";
+    std::string testFile = "../unittests/outputs/pipelinePotential.h5";
+    std::string dataPath3D = "4DSTEM_simulation/data/realslices/virtual_detector_depth0000/data";
+    std::string dataPath4D = "4DSTEM_simulation/data/datacubes/CBED_array_depth0000/data";
+
+    Array3D<PRISMATIC_FLOAT_PRECISION> refVD = readDataSet3D(refFile, dataPath3D);
+    Array3D<PRISMATIC_FLOAT_PRECISION> testVD = readDataSet3D(testFile, dataPath3D);
+    Array4D<PRISMATIC_FLOAT_PRECISION> refCBED;
+    Array4D<PRISMATIC_FLOAT_PRECISION> testCBED;
+    readRealDataSet_inOrder(refCBED, refFile, dataPath4D);
+    readRealDataSet_inOrder(testCBED, testFile, dataPath4D);
+
+    PRISMATIC_FLOAT_PRECISION tol = 0.0001;
+    BOOST_TEST(compareSize(refVD, testVD));
+    BOOST_TEST(compareValues(refVD, testVD) < tol);
+
+    BOOST_TEST(refCBED.size() == testCBED.size());
+    PRISMATIC_FLOAT_PRECISION errSum = 0.0;
+    for (auto i = 0; i < refCBED.size(); i++) errSum += std::abs(refCBED[i] - testCBED[i]);
+    BOOST_TEST(errSum < tol);
+
+    removeFile(refFile);
+    removeFile(testFile);
+}
+
+BOOST_FIXTURE_TEST_CASE(pipelinePotential_thermal_P, basicSim)
+{
+    //with thermal motion every potential is drawn anew while the previous frozen phonon runs its 3D FFTs,
+    //so the pipelined and the plain run only agree statistically
+    meta.numThreads = 4;
+    meta.numFP = 4;
+    meta.filenameOutput = "../unittests/outputs/pipelinePotential_thermal_ref.h5";
+    meta.savePotentialSlices = false;
+    meta.save4DOutput = false;
+    meta.includeThermalEffects = true;
+
+    divertOutput(pos, fd, logPath);
+    std::cout << "\n##### BEGIN TEST CASE: pipelinePotential_thermal_P #####\n";
+
+    go(meta);
+
+    std::cout << "\n--------------------------------------------\n";
+
+    meta.filenameOutput = "../unittests/outputs/pipelinePotential_thermal.h5";
+    meta.pipelineThreads = 1;
+    go(meta);
+    std::cout << "###### END TEST CASE: pipelinePotential_thermal_P ######\n";
+
+    revertOutput(fd, pos);
+
+    std::string refFile = "../unittests/outputs/pipelinePotential_thermal_ref.h5";
+    std::string testFile = "../unittests/outputs/pipelinePotential_thermal.h5";
+    std::string dataPath3D = "4DSTEM_simulation/data/realslices/virtual_detector_depth0000/data";
+
+    Array3D<PRISMATIC_FLOAT_PRECISION> refVD = readDataSet3D(refFile, dataPath3D);
+    Array3D<PRISMATIC_FLOAT_PRECISION> testVD = readDataSet3D(testFile, dataPath3D);
+
+    PRISMATIC_FLOAT_PRECISION tol = 0.1;
+    BOOST_TEST(compareSize(refVD, testVD));
+    BOOST_TEST(compareRelative(refVD, testVD) < tol);
+
+    removeFile(refFile);
+    removeFile(testFile);
+}
+
+BOOST_FIXTURE_TEST_CASE(reusePlan_M, basicSim)
+{
+    //the second planned run takes all of its setup from the plan of the first, so all three outputs should agree
+    meta.potential3D = false;
+    meta.algorithm = Algorithm::Multislice;
+    meta.filenameOutput = "../unittests/outputs/reusePlan_ref.h5";
+    meta.savePotentialSlices = false;
+    meta.includeThermalEffects = false;
+    meta.includeOccupancy = false;
+    meta.numFP = 2;
+    meta.reusePlan = false;
+
+    divertOutput(pos, fd, logPath);
+    std::cout << "\n##### BEGIN TEST CASE: reusePlan_M #####\n";
+
+    go(meta);
+
+    std::cout << "\n--------------------------------------------\n";
+
+    meta.filenameOutput = "../unittests/outputs/reusePlan.h5";
+    meta.reusePlan = true;
+    go(meta);
+    go(meta);
+    std::cout << "###### END TEST CASE: reusePlan_M ######\n";
+
+    revertOutput(fd, pos);
+
+    std::string refFile = "../unittests/outputs/reusePlan_ref.h5";
+    std::string testFile = "../unittests/outputs/reusePlan.h5";
+    std::string dataPath3D = "4DSTEM_simulation/data/realslices/virtual_detector_depth0000/data";
+    std::string dataPath4D = "4DSTEM_simulation/data/datacubes/CBED_array_depth0000/data";
+
+    Array3D<PRISMATIC_FLOAT_PRECISION> refVD = readDataSet3D(refFile, dataPath3D);
+    Array3D<PRISMATIC_FLOAT_PRECISION> testVD = readDataSet3D(testFile, dataPath3D);
+    Array4D<PRISMATIC_FLOAT_PRECISION> refCBED;
+    Array4D<PRISMATIC_FLOAT_PRECISION> testCBED;
+    readRealDataSet_inOrder(refCBED, refFile, dataPath4D);
+    readRealDataSet_inOrder(testCBED, testFile, dataPath4D);
+
+    PRISMATIC_FLOAT_PRECISION tol = 0.0001;
+    BOOST_TEST(compareSize(refVD, testVD));
+    BOOST_TEST(compareValues(refVD, testVD) < tol);
+
+    BOOST_TEST(refCBED.size() == testCBED.size());
+    PRISMATIC_FLOAT_PRECISION errSum = 0.0;
+    for (auto i = 0; i < refCBED.size(); i++) errSum += std::abs(refCBED[i] - testCBED[i]);
+    BOOST_TEST(errSum < tol);
+
+    removeFile(refFile);
+    removeFile(testFile);
+}
+
+BOOST_FIXTURE_TEST_CASE(reusePlan_thermal_M, basicSim)
+{
+    //the plan only holds geometry derived state, so reusing it under thermal motion and 3D potentials should keep
+    //the averages in statistical agreement with an unplanned run
+    meta.algorithm = Algorithm::Multislice;
+    meta.numFP = 4;
+    meta.reusePlan = false;
+    meta.filenameOutput = "../unittests/outputs/reusePlan_thermal_ref.h5";
+    meta.savePotentialSlices = false;
+    meta.save4DOutput = false;
+    meta.includeThermalEffects = true;
+
+    divertOutput(pos, fd, logPath);
+    std::cout << "\n##### BEGIN TEST CASE: reusePlan_thermal_M #####\n";
+
+    go(meta);
+
+    std::cout << "\n--------------------------------------------\n";
+
+    meta.filenameOutput = "../unittests/outputs/reusePlan_thermal.h5";
+    meta.reusePlan = true;
+    go(meta);
+    go(meta);
+    std::cout << "###### END TEST CASE: reusePlan_thermal_M ######\n";
+
+    revertOutput(fd, pos);
+
+    std::string refFile = "../unittests/outputs/reusePlan_thermal_ref.h5";
+    std::string testFile = "../unittests/outputs/reusePlan_thermal.h5";
+    std::string dataPath3D = "4DSTEM_simulation/data/realslices/virtual_detector_depth0000/data";
+
+    Array3D<PRISMATIC_FLOAT_PRECISION> refVD = readDataSet3D(refFile, dataPath3D);
+    Array3D<PRISMATIC_FLOAT_PRECISION> testVD = readDataSet3D(testFile, dataPath3D);
+
+    PRISMATIC_FLOAT_PRECISION tol = 0.1;
+    BOOST_TEST(compareSize(refVD, testVD));
+    BOOST_TEST(compareRelative(refVD, testVD) < tol);
+
+    removeFile(refFile);
+    removeFile(testFile);
+}
+
+BOOST_FIXTURE_TEST_CASE(targetFPError_M, basicSim)
+{
+    //without thermal motion every frozen phonon is the same, so the error is zero and the run stops at the minimum
+    meta.potential3D = false;
+    meta.algorithm = Algorithm::Multislice;
+    meta.filenameOutput = "../unittests/outputs/targetFPError_ref.h5";
+    meta.savePotentialSlices = false;
+    meta.includeThermalEffects = false;
+    meta.includeOccupancy = false;
+    meta.numFP = 2;
+
+    divertOutput(pos, fd, logPath);
+    std::cout << "\n##### BEGIN TEST CASE: targetFPError_M #####\n";
+
+    go(meta);
+
+    std::cout << "\n--------------------------------------------\n";
+
+    meta.filenameOutput = "../unittests/outputs/targetFPError.h5";
+    meta.numFP = 6;
+    meta.minFP = 2;
+    meta.targetFPError = 0.01;
+    go(meta);
+    std::cout << "###### END TEST CASE: targetFPError_M ######\n";
+
+    revertOutput(fd, pos);
+
+    std::string refFile = "../unittests/outputs/targetFPError_ref.h5";
+    std::string testFile = "../unittests/outputs/targetFPError.h5";
+    std::string dataPath3D = "4DSTEM_simulation/data/realslices/virtual_detector_depth0000/data";
+    std::string dataPath4D = "4DSTEM_simulation/data/datacubes/CBED_array_depth0000/data";
+
+    Array3D<PRISMATIC_FLOAT_PRECISION> refVD = readDataSet3D(refFile, dataPath3D);
+    Array3D<PRISMATIC_FLOAT_PRECISION> testVD = readDataSet3D(testFile, dataPath3D);
+    Array4D<PRISMATIC_FLOAT_PRECISION> refCBED;
+    Array4D<PRISMATIC_FLOAT_PRECISION> testCBED;
+    readRealDataSet_inOrder(refCBED, refFile, dataPath4D);
+    readRealDataSet_inOrder(testCBED, testFile, dataPath4D);
+
+    //the 4D frames were written for six frozen phonons and rescaled to the two that ran
+    PRISMATIC_FLOAT_PRECISION tol = 0.0001;
+    BOOST_TEST(compareSize(refVD, testVD));
+    BOOST_TEST(compareValues(refVD, testVD) < tol);
+
+    BOOST_TEST(refCBED.size() == testCBED.size());
+    PRISMATIC_FLOAT_PRECISION errSum = 0.0;
+    for (auto i = 0; i < refCBED.size(); i++) errSum += std::abs(refCBED[i] - testCBED[i]);
+    BOOST_TEST(errSum < tol);
+
+    //the stored number of frozen phonons is the count that ran
+    int numFPRun = 0;
+    readAttribute(testFile, "4DSTEM_simulation/metadata/metadata_0/original/simulation_parameters", "F", numFPRun);
+    BOOST_TEST(numFPRun == 2);
+
+    removeFile(refFile);
+    removeFile(testFile);
+}
+
+BOOST_FIXTURE_TEST_CASE(targetFPError_thermal_M, basicSim)
+{
+    //with thermal motion the error falls as frozen phonons are added, so the run stops once it is small and
+    //its rescaled averages agree statistically with a run of fixed length
+    meta.algorithm = Algorithm::Multislice;
+    meta.numFP = 6;
+    meta.filenameOutput = "../unittests/outputs/targetFPError_thermal_ref.h5";
+    meta.savePotentialSlices = false;
+    meta.includeThermalEffects = true;
+
+    divertOutput(pos, fd, logPath);
+    std::cout << "\n##### BEGIN TEST CASE: targetFPError_thermal_M #####\n";
+
+    go(meta);
+
+    std::cout << "\n--------------------------------------------\n";
+
+    meta.filenameOutput = "../unittests/outputs/targetFPError_thermal.h5";
+    meta.numFP = 20;
+    meta.minFP = 2;
+    meta.targetFPError = 0.02;
+    go(meta);
+    std::cout << "###### END TEST CASE: targetFPError_thermal_M ######\n";
+
+    revertOutput(fd, pos);
+
+    std::string refFile = "../unittests/outputs/targetFPError_thermal_ref.h5";
+    std::string testFile = "../unittests/outputs/targetFPError_thermal.h5";
+    std::string dataPath3D = "4DSTEM_simulation/data/realslices/virtual_detector_depth0000/data";
+
+    Array3D<PRISMATIC_FLOAT_PRECISION> refVD = readDataSet3D(refFile, dataPath3D);
+    Array3D<PRISMATIC_FLOAT_PRECISION> testVD = readDataSet3D(testFile, dataPath3D);
+
+    PRISMATIC_FLOAT_PRECISION tol = 0.1;
+    BOOST_TEST(compareSize(refVD, testVD));
+    BOOST_TEST(compareRelative(refVD, testVD) < tol);
+
+    //the 4D frames written for at most twenty frozen phonons are rescaled to the ones that ran
+    std::string dataPath4D = "4DSTEM_simulation/data/datacubes/CBED_array_depth0000/data";
+    Array4D<PRISMATIC_FLOAT_PRECISION> refCBED;
+    Array4D<PRISMATIC_FLOAT_PRECISION> testCBED;
+    readRealDataSet_inOrder(refCBED, refFile, dataPath4D);
+    readRealDataSet_inOrder(testCBED, testFile, dataPath4D);
+    BOOST_TEST(refCBED.size() == testCBED.size());
+    BOOST_TEST(compareRelative(refCBED, testCBED) < tol);
+
+    //the run stopped before the twenty frozen phonons allowed, and not before the minimum
+    int numFPRun = 0;
+    readAttribute(testFile, "4DSTEM_simulation/metadata/metadata_0/original/simulation_parameters", "F", numFPRun);
+    BOOST_TEST(numFPRun >= 2);
+    BOOST_TEST(numFPRun < 20);
+
+    removeFile(refFile);
+    removeFile(testFile);
+}
+
+BOOST_FIXTURE_TEST_CASE(checkpoint_M, basicSim)
+{
+    //checkpoints only copy out finished work, so a run that writes them should not change the output
+    meta.algorithm = Algorithm::Multislice;
+    meta.potential3D = false;
+    meta.filenameOutput = "../unittests/outputs/checkpoint_ref.h5";
+    meta.savePotentialSlices = false;
+    meta.includeThermalEffects = false;
+    meta.includeOccupancy = false;
+    meta.numFP = 2;
+
+    divertOutput(pos, fd, logPath);
+    std::cout << "\n##### BEGIN TEST CASE: checkpoint_M #####\n";
+
+    go(meta);
+
+    std::cout << "\n--------------------------------------------\n";
+
+    //there is no checkpoint to resume from, so the run starts from the beginning
+    meta.filenameOutput = "../unittests/outputs/checkpoint.h5";
+    meta.checkpointInterval = 1;
+    meta.resume = true;
+    go(meta);
+    std::cout << "###### END TEST CASE: checkpoint_M ######\n";
+
+    revertOutput(fd, pos);
+
+    std::string refFile = "../unittests/outputs/checkpoint_ref.h5";
+    std::string testFile = "../unittests/outputs/checkpoint.h5";
+    std::string dataPath3D = "4DSTEM_simulation/data/realslices/virtual_detector_depth0000/data";
+    std::string dataPath4D = "4DSTEM_simulation/data/datacubes/CBED_array_depth0000/data";
+
+    Array3D<PRISMATIC_FLOAT_PRECISION> refVD = readDataSet3D(refFile, dataPath3D);
+    Array3D<PRISMATIC_FLOAT_PRECISION> testVD = readDataSet3D(testFile, dataPath3D);
+    Array4D<PRISMATIC_FLOAT_PRECISION> refCBED;
+    Array4D<PRISMATIC_FLOAT_PRECISION> testCBED;
+    readRealDataSet_inOrder(refCBED, refFile, dataPath4D);
+    readRealDataSet_inOrder(testCBED, testFile, dataPath4D);
+
+    PRISMATIC_FLOAT_PRECISION tol = 0.0001;
+    BOOST_TEST(compareSize(refVD, testVD));
+    BOOST_TEST(compareValues(refVD, testVD) < tol);
+
+    BOOST_TEST(refCBED.size() == testCBED.size());
+    PRISMATIC_FLOAT_PRECISION errSum = 0.0;
+    for (auto i = 0; i < refCBED.size(); i++) errSum += std::abs(refCBED[i] - testCBED[i]);
+    BOOST_TEST(errSum < tol);
+
+    //a complete run leaves no checkpoint behind
+    std::ifstream state(testFile + ".checkpoint");
+    BOOST_TEST(!state.good());
+
+    removeFile(refFile);
+    removeFile(testFile);
+}
+
+BOOST_FIXTURE_TEST_CASE(checkpointResume_M, basicSim)
+{
+    //a run killed while it computes the probes of a frozen phonon resumes with the sums of the completed ones, the
+    //potential, finished probes and journaled 4D blocks of the interrupted one, and ends like an uninterrupted run
+    meta.algorithm = Algorithm::Multislice;
+    meta.potential3D = false;
+    meta.filenameOutput = "../unittests/outputs/checkpointResume_ref.h5";
+    meta.savePotentialSlices = false;
+    meta.includeThermalEffects = false;
+    meta.includeOccupancy = false;
+    meta.numThreads = 1;
+    meta.numFP = 12;
+
+    divertOutput(pos, fd, logPath);
+    std::cout << "\n##### BEGIN TEST CASE: checkpointResume_M #####\n";
+
+    go(meta);
+
+    std::cout << "\n--------------------------------------------\n";
+
+    std::string refFile = "../unittests/outputs/checkpointResume_ref.h5";
+    std::string testFile = "../unittests/outputs/checkpointResume.h5";
+    std::string state = testFile + ".checkpoint";
+    meta.filenameOutput = testFile;
+    meta.checkpointInterval = 1;
+    meta.resume = true;
+
+    std::cout.flush();
+    fflush(stdout);
+    pid_t child = fork();
+    if (child == 0)
+    {
+        go(meta);
+        std::cout.flush();
+        _exit(0);
+    }
+
+    //the run is paused before its state is checked again, so it is killed at the point that was checked
+    bool interrupted = false;
+    for (auto i = 0; i < 60000 && !interrupted; i++)
+    {
+        if (waitpid(child, nullptr, WNOHANG) == child) break;
+        usleep(5000);
+        if (!checkpointMidFP(state)) continue;
+        kill(child, SIGSTOP);
+        interrupted = checkpointMidFP(state);
+        kill(child, interrupted ? SIGKILL : SIGCONT);
+    }
+    if (interrupted) waitpid(child, nullptr, 0);
+
+    //a torn entry at the end of the journal is dropped on resume
+    {
+        std::ofstream journal(state + ".journal", std::ios::binary | std::ios::app);
+        const uint64_t torn[2] = {0x50524953434b5054ULL, 7};
+        journal.write(reinterpret_cast<const char *>(torn), sizeof(torn));
+    }
+
+    go(meta);
+    std::cout << "###### END TEST CASE: checkpointResume_M ######\n";
+
+    revertOutput(fd, pos);
+
+    BOOST_TEST(interrupted);
+
+    std::string dataPath3D = "4DSTEM_simulation/data/realslices/virtual_detector_depth0000/data";
+    std::string dataPath4D = "4DSTEM_simulation/data/datacubes/CBED_array_depth0000/data";
+
+    Array3D<PRISMATIC_FLOAT_PRECISION> refVD = readDataSet3D(refFile, dataPath3D);
+    Array3D<PRISMATIC_FLOAT_PRECISION> testVD = readDataSet3D(testFile, dataPath3D);
+    Array4D<PRISMATIC_FLOAT_PRECISION> refCBED;
+    Array4D<PRISMATIC_FLOAT_PRECISION> testCBED;
+    readRealDataSet_inOrder(refCBED, refFile, dataPath4D);
+    readRealDataSet_inOrder(testCBED, testFile, dataPath4D);
+
+    PRISMATIC_FLOAT_PRECISION tol = 0.0001;
+    BOOST_TEST(compareSize(refVD, testVD));
+    BOOST_TEST(compareValues(refVD, testVD) < tol);
+
+    BOOST_TEST(refCBED.size() == testCBED.size());
+    PRISMATIC_FLOAT_PRECISION errSum = 0.0;
+    for (auto i = 0; i < refCBED.size(); i++) errSum += std::abs(refCBED[i] - testCBED[i]);
+    BOOST_TEST(errSum < tol);
+
+    //the resumed run completes and removes its checkpoint
+    std::ifstream leftover(state);
+    BOOST_TEST(!leftover.good());
+
+    removeFile(refFile);
+    removeFile(testFile);
+}
+
+BOOST_FIXTURE_TEST_CASE(scanTiles_M, basicSim)
+{
+    //workers import the shared potential and the merge reassembles the scan, so tiling should not change the output
+    meta.algorithm = Algorithm::Multislice;
+    meta.potential3D = false;
+    meta.filenameOutput = "../unittests/outputs/scanTiles_ref.h5";
+    meta.savePotentialSlices = false;
+    meta.includeThermalEffects = false;
+    meta.includeOccupancy = false;
+    meta.numFP = 2;
+
+    divertOutput(pos, fd, logPath);
+    std::cout << "\n##### BEGIN TEST CASE: scanTiles_M #####\n";
+
+    go(meta);
+
+    std::cout << "\n--------------------------------------------\n";
+
+    meta.filenameOutput = "../unittests/outputs/scanTiles.h5";
+    meta.scanTiles = 2;
+    go(meta);
+    std::cout << "###### END TEST CASE: scanTiles_M ######\n";
+
+    revertOutput(fd, pos);
+
+    std::string refFile = "../unittests/outputs/scanTiles_ref.h5";
+    std::string testFile = "../unittests/outputs/scanTiles.h5";
+    std::string dataPath3D = "4DSTEM_simulation/data/realslices/virtual_detector_depth0000/data";
+    std::string dataPath4D = "4DSTEM_simulation/data/datacubes/CBED_array_depth0000/data";
+
+    Array3D<PRISMATIC_FLOAT_PRECISION> refVD = readDataSet3D(refFile, dataPath3D);
+    Array3D<PRISMATIC_FLOAT_PRECISION> testVD = readDataSet3D(testFile, dataPath3D);
+    Array4D<PRISMATIC_FLOAT_PRECISION> refCBED;
+    Array4D<PRISMATIC_FLOAT_PRECISION> testCBED;
+    readRealDataSet_inOrder(refCBED, refFile, dataPath4D);
+    readRealDataSet_inOrder(testCBED, testFile, dataPath4D);
+
+    PRISMATIC_FLOAT_PRECISION tol = 0.0001;
+    BOOST_TEST(compareSize(refVD, testVD));
+    BOOST_TEST(compareValues(refVD, testVD) < tol);
+
+    BOOST_TEST(refCBED.size() == testCBED.size());
+    PRISMATIC_FLOAT_PRECISION errSum = 0.0;
+    for (auto i = 0; i < refCBED.size(); i++) errSum += std::abs(refCBED[i] - testCBED[i]);
+    BOOST_TEST(errSum < tol);
+
+    //the tile and shared files are removed after the merge
+    std::ifstream tile(testFile + ".tile0000");
+    std::ifstream shared(testFile + ".shared");
+    BOOST_TEST(!tile.good());
+    BOOST_TEST(!shared.good());
+
+    removeFile(refFile);
+    removeFile(testFile);
+}
+
+BOOST_FIXTURE_TEST_CASE(scanTiles_thermal_M, basicSim)
+{
+    //the tiles import the thermally displaced 3D potentials of the launcher, so the merged scan is one consistent set
+    //of frozen phonons that agrees statistically with a plain run
+    meta.algorithm = Algorithm::Multislice;
+    meta.numFP = 4;
+    meta.filenameOutput = "../unittests/outputs/scanTiles_thermal_ref.h5";
+    meta.savePotentialSlices = false;
+    meta.save4DOutput = false;
+    meta.includeThermalEffects = true;
+
+    divertOutput(pos, fd, logPath);
+    std::cout << "\n##### BEGIN TEST CASE: scanTiles_thermal_M #####\n";
+
+    go(meta);
+
+    std::cout << "\n--------------------------------------------\n";
+
+    meta.filenameOutput = "../unittests/outputs/scanTiles_thermal.h5";
+    meta.scanTiles = 2;
+    go(meta);
+    std::cout << "###### END TEST CASE: scanTiles_thermal_M ######\n";
+
+    revertOutput(fd, pos);
+
+    std::string refFile = "../unittests/outputs/scanTiles_thermal_ref.h5";
+    std::string testFile = "../unittests/outputs/scanTiles_thermal.h5";
+    std::string dataPath3D = "4DSTEM_simulation/data/realslices/virtual_detector_depth0000/data";
+
+    Array3D<PRISMATIC_FLOAT_PRECISION> refVD = readDataSet3D(refFile, dataPath3D);
+    Array3D<PRISMATIC_FLOAT_PRECISION> testVD = readDataSet3D(testFile, dataPath3D);
+
+    PRISMATIC_FLOAT_PRECISION tol = 0.1;
+    BOOST_TEST(compareSize(refVD, testVD));
+    BOOST_TEST(compareRelative(refVD, testVD) < tol);
+
+    removeFile(refFile);
+    removeFile(testFile);
+}
+
+BOOST_FIXTURE_TEST_CASE(serveJobs_M, basicSim)
+{
+    //served jobs start from the server options, so jobs given as options or JSON should match a plain run
+    meta.algorithm = Algorithm::Multislice;
+    meta.potential3D = false;
+    meta.filenameOutput = "../unittests/outputs/serveJobs_ref.h5";
+    meta.savePotentialSlices = false;
+    meta.includeThermalEffects = false;
+    meta.includeOccupancy = false;
+
+    divertOutput(pos, fd, logPath);
+    std::cout << "\n##### BEGIN TEST CASE: serveJobs_M #####\n";
+
+    go(meta);
+
+    std::cout << "\n--------------------------------------------\n";
+
+    std::istringstream jobs("-o ../unittests/outputs/serveJobs_0.h5\n"
+                            "{\"output-file\": \"../unittests/outputs/serveJobs_1.h5\"}\n"
+                            "quit\n"
+                            "-o ../unittests/outputs/serveJobs_2.h5\n");
+    std::streambuf *input = std::cin.rdbuf(jobs.rdbuf());
+    meta.serveSource = "stdin";
+    JobServer(meta).run();
+    std::cin.rdbuf(input);
+    std::cout << "###### END TEST CASE: serveJobs_M ######\n";
+
+    revertOutput(fd, pos);
+
+    std::string refFile = "../unittests/outputs/serveJobs_ref.h5";
+    std::string dataPath3D = "4DSTEM_simulation/data/realslices/virtual_detector_depth0000/data";
+    Array3D<PRISMATIC_FLOAT_PRECISION> refVD = readDataSet3D(refFile, dataPath3D);
+
+    PRISMATIC_FLOAT_PRECISION tol = 0.0001;
+    for (auto j = 0; j < 2; j++)
+    {
+        std::string testFile = "../unittests/outputs/serveJobs_" + std::to_string(j) + ".h5";
+        Array3D<PRISMATIC_FLOAT_PRECISION> testVD = readDataSet3D(testFile, dataPath3D);
+        BOOST_TEST(compareSize(refVD, testVD));
+        BOOST_TEST(compareValues(refVD, testVD) < tol);
+        removeFile(testFile);
+    }
+
+    //jobs after quit are not run
+    std::ifstream skipped("../unittests/outputs/serveJobs_2.h5");
+    BOOST_TEST(!skipped.good());
+
+    removeFile(refFile);
+}
+
+BOOST_FIXTURE_TEST_CASE(serveBadJob_M, basicSim)
+{
+    //a job whose atoms cannot be read fails alone, and the server goes on with the next job
+    meta.algorithm = Algorithm::Multislice;
+    meta.potential3D = false;
+    meta.filenameOutput = "../unittests/outputs/serveBadJob_ref.h5";
+    meta.savePotentialSlices = false;
+    meta.includeThermalEffects = false;
+    meta.includeOccupancy = false;
+
+    std::string badAtoms = "../unittests/outputs/serveBadJob.xyz";
+    std::ofstream bad(badAtoms);
+    bad << "atoms without a unit cell\nnot a cell\n";
+    bad.close();
+
+    divertOutput(pos, fd, logPath);
+    std::cout << "\n##### BEGIN TEST CASE: serveBadJob_M #####\n";
+
+    go(meta);
+
+    std::cout << "\n--------------------------------------------\n";
+
+    std::istringstream jobs("-i " + badAtoms + " -o ../unittests/outputs/serveBadJob_0.h5\n"
+                            "-o ../unittests/outputs/serveBadJob_1.h5\n");
+    std::stringstream replies;
+    std::streambuf *input = std::cin.rdbuf(jobs.rdbuf());
+    std::streambuf *output = std::cout.rdbuf(replies.rdbuf());
+    meta.serveSource = "stdin";
+    JobServer(meta).run();
+    std::cout.rdbuf(output);
+    std::cin.rdbuf(input);
+    std::cout << "###### END TEST CASE: serveBadJob_M ######\n";
+
+    revertOutput(fd, pos);
+
+    std::string refFile = "../unittests/outputs/serveBadJob_ref.h5";
+    std::string testFile = "../unittests/outputs/serveBadJob_1.h5";
+    std::string dataPath3D = "4DSTEM_simulation/data/realslices/virtual_detector_depth0000/data";
+
+    std::ifstream failed("../unittests/outputs/serveBadJob_0.h5");
+    BOOST_TEST(!failed.good());
+
+    //the simulations log to stderr, so stdout holds one reply per job and nothing else
+    std::string reply;
+    BOOST_TEST((std::getline(replies, reply) && reply.compare(0, 8, "error 0 ") == 0));
+    BOOST_TEST((std::getline(replies, reply) && reply.compare(0, 5, "ok 1 ") == 0));
+    BOOST_TEST(!std::getline(replies, reply));
+
+    Array3D<PRISMATIC_FLOAT_PRECISION> refVD = readDataSet3D(refFile, dataPath3D);
+    Array3D<PRISMATIC_FLOAT_PRECISION> testVD = readDataSet3D(testFile, dataPath3D);
+
+    PRISMATIC_FLOAT_PRECISION tol = 0.0001;
+    BOOST_TEST(compareSize(refVD, testVD));
+    BOOST_TEST(compareValues(refVD, testVD) < tol);
+
+    removeFile(refFile);
+    removeFile(testFile);
+    removeFile(badAtoms);
+}
+
+BOOST_FIXTURE_TEST_CASE(groupedSynthesis_P, basicSim)
+{
+    //probes sharing an S-matrix window are synthesized with one GEMM when they fall in the same batch; a scan step of
+    //half a reduced pixel puts several probes in each window
+    meta.probeStepX = 0.5;
+    meta.probeStepY = 0.5;
+    divertOutput(pos, fd, logPath);
+    std::cout << "\n##### BEGIN TEST CASE: groupedSynthesis_P #####\n";
+
+    runProbeSynthesis(meta, "groupedSynthesis", [](Metadata<PRISMATIC_FLOAT_PRECISION> &test) {
+        test.batchSizeTargetCPU = 16;
+        test.sMatrixLayout = SMatrixLayout::BeamMajor;
+    });
+
+    std::cout << "###### END TEST CASE: groupedSynthesis_P ######\n";
+    revertOutput(fd, pos);
+
+    compareProbeSynthesis("groupedSynthesis");
+}
+
+BOOST_FIXTURE_TEST_CASE(pixelMajorSynthesis_P, basicSim)
+{
+    //a pixel-major S-matrix is read both one probe at a time and by probe groups sharing a window
+    meta.probeStepX = 0.5;
+    meta.probeStepY = 0.5;
+    divertOutput(pos, fd, logPath);
+    std::cout << "\n##### BEGIN TEST CASE: pixelMajorSynthesis_P #####\n";
+
+    runProbeSynthesis(meta, "pixelMajorSynthesis", [](Metadata<PRISMATIC_FLOAT_PRECISION> &test) {
+        test.batchSizeTargetCPU = 1;
+        test.sMatrixLayout = SMatrixLayout::PixelMajor;
+    });
+    runProbeSynthesis(meta, "pixelMajorGrouped", [](Metadata<PRISMATIC_FLOAT_PRECISION> &test) {
+        test.batchSizeTargetCPU = 16;
+        test.sMatrixLayout = SMatrixLayout::PixelMajor;
+    });
+
+    std::cout << "###### END TEST CASE: pixelMajorSynthesis_P ######\n";
+    revertOutput(fd, pos);
+
+    compareProbeSynthesis("pixelMajorSynthesis");
+    compareProbeSynthesis("pixelMajorGrouped");
+}
+
+BOOST_FIXTURE_TEST_CASE(sMatrixHaloSynthesis_P, basicSim)
+{
+    //with a periodic halo, windows wrapping around the cell edge are read as one contiguous block in either layout
+    meta.probeStepX = 0.5;
+    meta.probeStepY = 0.5;
+    divertOutput(pos, fd, logPath);
+    std::cout << "\n##### BEGIN TEST CASE: sMatrixHaloSynthesis_P #####\n";
+
+    runProbeSynthesis(meta, "sMatrixHaloSynthesis", [](Metadata<PRISMATIC_FLOAT_PRECISION> &test) {
+        test.batchSizeTargetCPU = 1;
+        test.sMatrixLayout = SMatrixLayout::BeamMajor;
+        test.sMatrixHalo = true;
+    });
+    runProbeSynthesis(meta, "sMatrixHaloGrouped", [](Metadata<PRISMATIC_FLOAT_PRECISION> &test) {
+        test.batchSizeTargetCPU = 16;
+        test.sMatrixLayout = SMatrixLayout::PixelMajor;
+        test.sMatrixHalo = true;
+    });
+
+    std::cout << "###### END TEST CASE: sMatrixHaloSynthesis_P ######\n";
+    revertOutput(fd, pos);
+
+    compareProbeSynthesis("sMatrixHaloSynthesis");
+    compareProbeSynthesis("sMatrixHaloGrouped");
+}
+
+BOOST_FIXTURE_TEST_CASE(batchedSynthesis_P, basicSim)
+{
+    //with a scan step of one reduced pixel most probes read windows of their own, so batches are transformed together
+    //but synthesized one probe at a time
+    meta.probeStepX = 1;
+    meta.probeStepY = 1;
+    divertOutput(pos, fd, logPath);
+    std::cout << "\n##### BEGIN TEST CASE: batchedSynthesis_P #####\n";
+
+    runProbeSynthesis(meta, "batchedSynthesis", [](Metadata<PRISMATIC_FLOAT_PRECISION> &test) {
+        test.batchSizeTargetCPU = 16;
+        test.sMatrixLayout = SMatrixLayout::BeamMajor;
+    });
+
+    std::cout << "###### END TEST CASE: batchedSynthesis_P ######\n";
+    revertOutput(fd, pos);
+
+    compareProbeSynthesis("batchedSynthesis");
+}
+
 BOOST_FIXTURE_TEST_CASE(complexOutputWave_P, basicSim)
 {
     
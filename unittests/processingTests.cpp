@@ -7,6 +7,9 @@
 #include "utility.h"
 #include "fileIO.h"
 #include "pprocess.h"
+#include "PRISM02_calcSMatrix.h"
+#include "PRISM03_calcOutput.h"
+#include "detector.h"
 #include "ioTests.h"
 
 namespace Prismatic{
@@ -234,6 +237,197 @@ BOOST_AUTO_TEST_CASE(downsample)
     BOOST_TEST(smallArr.get_dimj() == Ty);
 }
 
+BOOST_AUTO_TEST_CASE(smatrixCompression)
+{
+    //build a compact S-matrix with a known rank and check that compression recovers it
+    int seed = 10101;
+    std::default_random_engine de(seed);
+    size_t numBeams = 20; size_t trueRank = 4;
+    size_t Ny = 16; size_t Nx = 12;
+
+    Array3D<std::complex<PRISMATIC_FLOAT_PRECISION>> planes = zeros_ND<3,std::complex<PRISMATIC_FLOAT_PRECISION>>({{trueRank,Ny,Nx}});
+    Array2D<std::complex<PRISMATIC_FLOAT_PRECISION>> mix = zeros_ND<2,std::complex<PRISMATIC_FLOAT_PRECISION>>({{numBeams,trueRank}});
+    assignRandomValues(planes, de);
+    assignRandomValues(mix, de);
+
+    Parameters<PRISMATIC_FLOAT_PRECISION> pars;
+    pars.meta.numThreads = 2;
+    pars.meta.sMatrixRankTol = 1e-4;
+    pars.Scompact = zeros_ND<3,std::complex<PRISMATIC_FLOAT_PRECISION>>({{numBeams,Ny,Nx}});
+    for(auto a = 0; a < numBeams; a++)
+    {
+        for(auto r = 0; r < trueRank; r++)
+        {
+            for(auto p = 0; p < Ny*Nx; p++) pars.Scompact[a*Ny*Nx+p] += mix.at(a,r)*planes[r*Ny*Nx+p];
+        }
+    }
+    Array3D<std::complex<PRISMATIC_FLOAT_PRECISION>> reference = pars.Scompact;
+
+    compressSMatrix(pars);
+    BOOST_TEST(pars.sMatrixCompressed);
+    BOOST_TEST(pars.Scompact.get_dimk() == trueRank);
+    BOOST_TEST(pars.ScompactCoeffs.get_dimj() == numBeams);
+
+    PRISMATIC_FLOAT_PRECISION err = 0;
+    PRISMATIC_FLOAT_PRECISION ref_norm = 0;
+    for(auto a = 0; a < numBeams; a++)
+    {
+        for(auto p = 0; p < Ny*Nx; p++)
+        {
+            std::complex<PRISMATIC_FLOAT_PRECISION> val = 0;
+            for(auto r = 0; r < pars.Scompact.get_dimk(); r++) val += pars.ScompactCoeffs.at(a,r)*pars.Scompact[r*Ny*Nx+p];
+            err += std::norm(val - reference[a*Ny*Nx+p]);
+            ref_norm += std::norm(reference[a*Ny*Nx+p]);
+        }
+    }
+    PRISMATIC_FLOAT_PRECISION tol = 1e-4;
+    BOOST_TEST(std::sqrt(err/ref_norm) < tol);
+}
+
+BOOST_AUTO_TEST_CASE(batchedProbeGemm)
+{
+    //blocked complex GEMM used for grouped probe synthesis should match a naive triple loop
+    int seed = 20202;
+    std::default_random_engine de(seed);
+    size_t M = 5; size_t N = 300; size_t K = 37; //sizes straddle the block edges
+
+    Array2D<std::complex<PRISMATIC_FLOAT_PRECISION>> A = zeros_ND<2,std::complex<PRISMATIC_FLOAT_PRECISION>>({{M,K}});
+    Array2D<std::complex<PRISMATIC_FLOAT_PRECISION>> B = zeros_ND<2,std::complex<PRISMATIC_FLOAT_PRECISION>>({{K,N}});
+    Array2D<std::complex<PRISMATIC_FLOAT_PRECISION>> C = zeros_ND<2,std::complex<PRISMATIC_FLOAT_PRECISION>>({{M,N}});
+    assignRandomValues(A, de);
+    assignRandomValues(B, de);
+
+    complexGemm_CPU(&A[0], &B[0], &C[0], M, N, K);
+
+    PRISMATIC_FLOAT_PRECISION err = 0;
+    for(auto m = 0; m < M; m++)
+    {
+        for(auto n = 0; n < N; n++)
+        {
+            std::complex<PRISMATIC_FLOAT_PRECISION> val = 0;
+            for(auto k = 0; k < K; k++) val += A.at(m,k)*B.at(k,n);
+            err = std::max(err, std::abs(val - C.at(m,n)));
+        }
+    }
+    PRISMATIC_FLOAT_PRECISION tol = 1e-4;
+    BOOST_TEST(err < tol);
+}
+
+BOOST_AUTO_TEST_CASE(smatrixLayout)
+{
+    //transposing the compact S-matrix to pixel-major and back should be lossless
+    int seed = 30303;
+    std::default_random_engine de(seed);
+    size_t numBeams = 13; size_t Ny = 10; size_t Nx = 6;
+
+    Parameters<PRISMATIC_FLOAT_PRECISION> pars;
+    pars.sMatrixPixelMajor = false;
+    pars.Scompact = zeros_ND<3,std::complex<PRISMATIC_FLOAT_PRECISION>>({{numBeams,Ny,Nx}});
+    assignRandomValues(pars.Scompact, de);
+    Array3D<std::complex<PRISMATIC_FLOAT_PRECISION>> reference = pars.Scompact;
+
+    setSMatrixLayout_CPU(pars, true);
+    BOOST_TEST(pars.sMatrixPixelMajor);
+    BOOST_TEST(pars.Scompact.get_dimi() % 8 == 0);
+    BOOST_TEST(pars.Scompact.at(3,4,5) == reference.at(5,3,4));
+
+    setSMatrixLayout_CPU(pars, false);
+    BOOST_TEST(!pars.sMatrixPixelMajor);
+    BOOST_TEST(pars.Scompact.get_dimk() == numBeams);
+    BOOST_TEST(compareSize(reference, pars.Scompact));
+    BOOST_TEST(compareValues(reference, pars.Scompact) == 0);
+}
+
+BOOST_AUTO_TEST_CASE(smatrixLayoutChoice)
+{
+    //pixel-major should only be picked once the output window no longer stays in cache between the planes of a
+    //beam-major sum, and not when it reads far more planes than a probe weights
+    size_t cachedWindow = 64*64; size_t largeWindow = 256*256;
+    BOOST_TEST(!preferPixelMajor_CPU(100, 60, cachedWindow));
+    BOOST_TEST(!preferPixelMajor_CPU(64, 64, cachedWindow));
+    BOOST_TEST(preferPixelMajor_CPU(100, 60, largeWindow));
+    BOOST_TEST(!preferPixelMajor_CPU(400, 60, largeWindow));
+}
+
+BOOST_AUTO_TEST_CASE(smatrixHalo)
+{
+    //periodic halo should repeat the S-matrix across the edges and crop back off exactly
+    int seed = 40404;
+    std::default_random_engine de(seed);
+    size_t numBeams = 5; size_t Ny = 8; size_t Nx = 10;
+
+    Parameters<PRISMATIC_FLOAT_PRECISION> pars;
+    pars.sMatrixPixelMajor = false;
+    pars.ScompactHalo = {0, 0};
+    pars.yVec = zeros_ND<1,PRISMATIC_FLOAT_PRECISION>({{4}});
+    pars.xVec = zeros_ND<1,PRISMATIC_FLOAT_PRECISION>({{6}});
+    pars.Scompact = zeros_ND<3,std::complex<PRISMATIC_FLOAT_PRECISION>>({{numBeams,Ny,Nx}});
+    assignRandomValues(pars.Scompact, de);
+    Array3D<std::complex<PRISMATIC_FLOAT_PRECISION>> reference = pars.Scompact;
+
+    setSMatrixHalo_CPU(pars, true);
+    BOOST_TEST(pars.Scompact.get_dimj() == Ny + 4);
+    BOOST_TEST(pars.Scompact.get_dimi() == Nx + 6);
+    BOOST_TEST(pars.Scompact.at(2,Ny+3,Nx+5) == reference.at(2,3,5));
+
+    setSMatrixHalo_CPU(pars, false);
+    BOOST_TEST(compareSize(reference, pars.Scompact));
+    BOOST_TEST(compareValues(reference, pars.Scompact) == 0);
+}
+
+BOOST_AUTO_TEST_CASE(sparseDetectorMap)
+{
+    //sparse detector map should reproduce the dense annular, segment, and DPC integrations
+    int seed = 50505;
+    std::default_random_engine de(seed);
+    size_t Ny = 6; size_t Nx = 8; size_t Ndet = 4;
+    PRISMATIC_FLOAT_PRECISION pi = acos(-1);
+
+    Array2D<std::complex<PRISMATIC_FLOAT_PRECISION>> psi = zeros_ND<2,std::complex<PRISMATIC_FLOAT_PRECISION>>({{Ny,Nx}});
+    assignRandomValues(psi, de);
+    Array2D<PRISMATIC_FLOAT_PRECISION> qx = zeros_ND<2,PRISMATIC_FLOAT_PRECISION>({{Ny,Nx}});
+    Array2D<PRISMATIC_FLOAT_PRECISION> qy = qx; Array2D<PRISMATIC_FLOAT_PRECISION> alpha = qx;
+    Array2D<PRISMATIC_FLOAT_PRECISION> phi = qx; Array2D<PRISMATIC_FLOAT_PRECISION> alphaInd = qx;
+    for(auto j = 0; j < Ny; j++)
+    {
+        for(auto i = 0; i < Nx; i++)
+        {
+            qx.at(j,i) = (PRISMATIC_FLOAT_PRECISION) i - 3.5;
+            qy.at(j,i) = (PRISMATIC_FLOAT_PRECISION) j - 2.5;
+            alpha.at(j,i) = sqrt(qx.at(j,i)*qx.at(j,i) + qy.at(j,i)*qy.at(j,i)) / 1000;
+            phi.at(j,i) = atan2(qy.at(j,i), qx.at(j,i));
+            alphaInd.at(j,i) = std::max((PRISMATIC_FLOAT_PRECISION) 1, std::round(alpha.at(j,i) * 1000));
+        }
+    }
+
+    std::vector<detector> detectors = {{0.001, 0.004, 0, 2*pi}, {0.001, 0.004, 0, pi}, {0.001, 0.004, pi, 2*pi}};
+    detectorMap map = buildDetectorMap(alphaInd, Ndet, alpha, phi, qx, qy, detectors, true);
+    BOOST_TEST(map.numBins() == Ndet + 3 + 3);
+
+    std::vector<PRISMATIC_FLOAT_PRECISION> binValues(map.numBins());
+    std::vector<PRISMATIC_FLOAT_PRECISION> output(map.numStored(), 0);
+    std::vector<PRISMATIC_FLOAT_PRECISION> DPC(2, 0);
+    integrateDetectors(map, &psi[0], 2, &binValues[0]);
+    storeDetectorBins(map, &binValues[0], &output[0], &DPC[0]);
+
+    std::vector<PRISMATIC_FLOAT_PRECISION> ref(Ndet, 0);
+    PRISMATIC_FLOAT_PRECISION ref_qx = 0, ref_qy = 0, total = 0, annulus = 0;
+    for(auto p = 0; p < psi.size(); p++)
+    {
+        PRISMATIC_FLOAT_PRECISION intensity = 2*std::norm(psi[p]);
+        if(alphaInd[p] <= Ndet) ref[alphaInd[p]-1] += intensity;
+        if(alpha[p] >= 0.001 && alpha[p] < 0.004) annulus += intensity;
+        ref_qx += qx[p]*intensity; ref_qy += qy[p]*intensity; total += intensity;
+    }
+
+    PRISMATIC_FLOAT_PRECISION tol = 0.0001;
+    for(auto b = 0; b < Ndet; b++) BOOST_TEST(std::abs(output[b] - ref[b]) < tol);
+    BOOST_TEST(std::abs(output[Ndet] - annulus) < tol);
+    BOOST_TEST(std::abs(output[Ndet+1] + output[Ndet+2] - annulus) < tol);
+    BOOST_TEST(std::abs(DPC[0] - ref_qx/total) < tol);
+    BOOST_TEST(std::abs(DPC[1] - ref_qy/total) < tol);
+}
+
 BOOST_AUTO_TEST_SUITE_END();
 
 } //namespace Prismatic
\ No newline at end of file
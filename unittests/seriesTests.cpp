@@ -61,6 +61,33 @@ void divertOutput(fpos_t &pos, int &fd, const std::string &file);
 void revertOutput(const int &fd, fpos_t &pos);
 void removeFile(const std::string &filepath);
 
+void compareSeriesOutput(const std::string &refFile, const std::string &refTag,
+                         const std::string &testFile, const std::string &testTag)
+{
+    //virtual detector, DPC and 4D output of one series member against another file's member
+    PRISMATIC_FLOAT_PRECISION tol = 0.0001;
+    std::string path_3D = "4DSTEM_simulation/data/realslices/virtual_detector_depth0000";
+    std::string path_DPC = "4DSTEM_simulation/data/realslices/DPC_CoM_depth0000";
+    std::string path_4D = "4DSTEM_simulation/data/datacubes/CBED_array_depth0000";
+    Array3D<PRISMATIC_FLOAT_PRECISION> refVD, testVD, refDPC, testDPC;
+    Array4D<PRISMATIC_FLOAT_PRECISION> refCBED, testCBED;
+    readRealDataSet_inOrder(refVD, refFile, path_3D + refTag + "/data");
+    readRealDataSet_inOrder(testVD, testFile, path_3D + testTag + "/data");
+    readRealDataSet_inOrder(refDPC, refFile, path_DPC + refTag + "/data");
+    readRealDataSet_inOrder(testDPC, testFile, path_DPC + testTag + "/data");
+    readRealDataSet_inOrder(refCBED, refFile, path_4D + refTag + "/data");
+    readRealDataSet_inOrder(testCBED, testFile, path_4D + testTag + "/data");
+
+    BOOST_TEST(compareSize(refVD, testVD));
+    BOOST_TEST(compareValues(refVD, testVD) < tol);
+    BOOST_TEST(compareValues(refDPC, testDPC) < tol);
+
+    BOOST_TEST(refCBED.size() == testCBED.size());
+    PRISMATIC_FLOAT_PRECISION errSum = 0.0;
+    for(auto j = 0; j < refCBED.size(); j++) errSum += std::abs(refCBED[j] - testCBED[j]);
+    BOOST_TEST(errSum < tol);
+};
+
 BOOST_GLOBAL_FIXTURE(logFile);
 
 BOOST_AUTO_TEST_SUITE(seriesTests);
@@ -218,6 +245,206 @@ BOOST_FIXTURE_TEST_CASE(CC_series_virtual, basicSim)
     removeFile(meta.filenameOutput);
 }
 
+BOOST_FIXTURE_TEST_CASE(series_scratchSpill, basicSim)
+{
+    //a series summed in the scratch file should match the same series summed in memory
+    meta.algorithm = Algorithm::Multislice;
+    meta.simSeries = true;
+    meta.seriesVals = {{-10.0, 0.0, 10.0}};
+    meta.seriesKeys = {"probeDefocus"};
+    meta.seriesTags = {"_df0000", "_df0001", "_df0002"};
+    meta.filenameOutput = "../unittests/outputs/series_memory.h5";
+    meta.save3DOutput = true;
+    meta.save2DOutput = false;
+    meta.save4DOutput = false;
+    meta.savePotentialSlices = false;
+    meta.saveDPC_CoM = true;
+    meta.probeStepX = 1;
+    meta.probeStepY = 1;
+    meta.numFP = 2;
+
+    divertOutput(pos, fd, logPath);
+    std::cout << "\n###### BEGIN TEST CASE: series_scratchSpill ######\n";
+    go(meta);
+
+    meta.filenameOutput = "../unittests/outputs/series_scratch.h5";
+    meta.seriesMemory = 0;
+    meta.scratchDirectory = "../unittests/outputs";
+    go(meta);
+    std::cout << "####### END TEST CASE: series_scratchSpill #######\n";
+    revertOutput(fd, pos);
+
+    std::string memoryFile = "../unittests/outputs/series_memory.h5";
+    std::string scratchFile = "../unittests/outputs/series_scratch.h5";
+    PRISMATIC_FLOAT_PRECISION tol = 0.0001;
+    for(auto i = 0; i < meta.seriesTags.size(); i++)
+    {
+        std::string path_3D = "4DSTEM_simulation/data/realslices/virtual_detector_depth0000" + meta.seriesTags[i] + "/data";
+        std::string path_DPC = "4DSTEM_simulation/data/realslices/DPC_CoM_depth0000" + meta.seriesTags[i] + "/data";
+        Array3D<PRISMATIC_FLOAT_PRECISION> refVD, testVD, refDPC, testDPC;
+        readRealDataSet_inOrder(refVD, memoryFile, path_3D);
+        readRealDataSet_inOrder(testVD, scratchFile, path_3D);
+        readRealDataSet_inOrder(refDPC, memoryFile, path_DPC);
+        readRealDataSet_inOrder(testDPC, scratchFile, path_DPC);
+
+        BOOST_TEST(compareSize(refVD, testVD));
+        BOOST_TEST(compareValues(refVD, testVD) < tol);
+        BOOST_TEST(compareValues(refDPC, testDPC) < tol);
+    }
+
+    //the scratch file is removed once the series is written out
+    FILE *scratch = fopen("../unittests/outputs/prismatic_scratch.h5", "r");
+    BOOST_TEST((scratch == NULL));
+    if(scratch) fclose(scratch);
+
+    removeFile(memoryFile);
+    removeFile(scratchFile);
+}
+
+BOOST_FIXTURE_TEST_CASE(seriesSinglePass_P, basicSim)
+{
+    //a series computed in one pass over the S-matrix should match one computed member by member
+    meta.algorithm = Algorithm::PRISM;
+    meta.simSeries = true;
+    meta.seriesVals = {{-10.0, 0.0, 10.0}, {0.0, 1000.0, 2000.0}};
+    meta.seriesKeys = {"probeDefocus", "C3"};
+    meta.seriesTags = {"_df0000", "_df0001", "_df0002"};
+    meta.filenameOutput = "../unittests/outputs/series_members.h5";
+    meta.save3DOutput = true;
+    meta.save2DOutput = false;
+    meta.save4DOutput = true;
+    meta.savePotentialSlices = false;
+    meta.saveDPC_CoM = true;
+    meta.probeStepX = 1;
+    meta.probeStepY = 1;
+    meta.numFP = 1;
+    meta.seriesSinglePass = false;
+
+    divertOutput(pos, fd, logPath);
+    std::cout << "\n###### BEGIN TEST CASE: seriesSinglePass_P ######\n";
+    go(meta);
+
+    meta.filenameOutput = "../unittests/outputs/series_singlePass.h5";
+    meta.seriesSinglePass = true;
+    go(meta);
+    std::cout << "####### END TEST CASE: seriesSinglePass_P #######\n";
+    revertOutput(fd, pos);
+
+    std::string refFile = "../unittests/outputs/series_members.h5";
+    std::string testFile = "../unittests/outputs/series_singlePass.h5";
+    for(auto i = 0; i < meta.seriesTags.size(); i++)
+        compareSeriesOutput(refFile, meta.seriesTags[i], testFile, meta.seriesTags[i]);
+
+    removeFile(refFile);
+    removeFile(testFile);
+}
+
+BOOST_FIXTURE_TEST_CASE(seriesSinglePass_semiangle_P, basicSim)
+{
+    //a semiangle series wider than the base aperture should match member by member and not be clipped by the beams
+    meta.algorithm = Algorithm::PRISM;
+    meta.simSeries = true;
+    meta.probeSemiangle = 20.0 / 1000;
+    meta.seriesVals = {{15.0 / 1000, 20.0 / 1000, 30.0 / 1000}};
+    meta.seriesKeys = {"probeSemiangle"};
+    meta.seriesTags = {"_sr0000", "_sr0001", "_sr0002"};
+    meta.filenameOutput = "../unittests/outputs/semiangleSeries_members.h5";
+    meta.save3DOutput = true;
+    meta.save2DOutput = false;
+    meta.save4DOutput = true;
+    meta.savePotentialSlices = false;
+    meta.saveDPC_CoM = true;
+    meta.probeStepX = 1;
+    meta.probeStepY = 1;
+    meta.numFP = 1;
+    meta.seriesSinglePass = false;
+
+    divertOutput(pos, fd, logPath);
+    std::cout << "\n## BEGIN TEST CASE: seriesSinglePass_semiangle_P ##\n";
+    go(meta);
+
+    meta.filenameOutput = "../unittests/outputs/semiangleSeries_singlePass.h5";
+    meta.seriesSinglePass = true;
+    go(meta);
+
+    //the widest member on its own
+    Metadata<PRISMATIC_FLOAT_PRECISION> single = meta;
+    single.simSeries = false;
+    single.seriesVals = {};
+    single.seriesKeys = {};
+    single.seriesTags = {};
+    single.probeSemiangle = 30.0 / 1000;
+    single.filenameOutput = "../unittests/outputs/semiangleSeries_single.h5";
+    go(single);
+    std::cout << "### END TEST CASE: seriesSinglePass_semiangle_P ###\n";
+    revertOutput(fd, pos);
+
+    std::string refFile = "../unittests/outputs/semiangleSeries_members.h5";
+    std::string testFile = "../unittests/outputs/semiangleSeries_singlePass.h5";
+    std::string singleFile = "../unittests/outputs/semiangleSeries_single.h5";
+    for(auto i = 0; i < meta.seriesTags.size(); i++)
+        compareSeriesOutput(refFile, meta.seriesTags[i], testFile, meta.seriesTags[i]);
+    compareSeriesOutput(singleFile, "", refFile, "_sr0002");
+    compareSeriesOutput(singleFile, "", testFile, "_sr0002");
+
+    removeFile(refFile);
+    removeFile(testFile);
+    removeFile(singleFile);
+}
+
+BOOST_FIXTURE_TEST_CASE(seriesSinglePass_tilt_P, basicSim)
+{
+    //a probe tilt series should match member by member and keep the tilted apertures inside the beams
+    meta.algorithm = Algorithm::PRISM;
+    meta.simSeries = true;
+    meta.seriesVals = {{0.0, 5.0 / 1000, 10.0 / 1000}, {0.0, -4.0 / 1000, 8.0 / 1000}};
+    meta.seriesKeys = {"probeXtilt", "probeYtilt"};
+    meta.seriesTags = {"_sr0000", "_sr0001", "_sr0002"};
+    meta.filenameOutput = "../unittests/outputs/tiltSeries_members.h5";
+    meta.save3DOutput = true;
+    meta.save2DOutput = false;
+    meta.save4DOutput = true;
+    meta.savePotentialSlices = false;
+    meta.saveDPC_CoM = true;
+    meta.probeStepX = 1;
+    meta.probeStepY = 1;
+    meta.numFP = 1;
+    meta.seriesSinglePass = false;
+
+    divertOutput(pos, fd, logPath);
+    std::cout << "\n##### BEGIN TEST CASE: seriesSinglePass_tilt_P #####\n";
+    go(meta);
+
+    meta.filenameOutput = "../unittests/outputs/tiltSeries_singlePass.h5";
+    meta.seriesSinglePass = true;
+    go(meta);
+
+    //the most tilted member on its own
+    Metadata<PRISMATIC_FLOAT_PRECISION> single = meta;
+    single.simSeries = false;
+    single.seriesVals = {};
+    single.seriesKeys = {};
+    single.seriesTags = {};
+    single.probeXtilt = 10.0 / 1000;
+    single.probeYtilt = 8.0 / 1000;
+    single.filenameOutput = "../unittests/outputs/tiltSeries_single.h5";
+    go(single);
+    std::cout << "###### END TEST CASE: seriesSinglePass_tilt_P ######\n";
+    revertOutput(fd, pos);
+
+    std::string refFile = "../unittests/outputs/tiltSeries_members.h5";
+    std::string testFile = "../unittests/outputs/tiltSeries_singlePass.h5";
+    std::string singleFile = "../unittests/outputs/tiltSeries_single.h5";
+    for(auto i = 0; i < meta.seriesTags.size(); i++)
+        compareSeriesOutput(refFile, meta.seriesTags[i], testFile, meta.seriesTags[i]);
+    compareSeriesOutput(singleFile, "", refFile, "_sr0002");
+    compareSeriesOutput(singleFile, "", testFile, "_sr0002");
+
+    removeFile(refFile);
+    removeFile(testFile);
+    removeFile(singleFile);
+}
+
 BOOST_AUTO_TEST_SUITE_END();
 
 } //namespace Prismatic
\ No newline at end of file